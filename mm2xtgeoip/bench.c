@@ -0,0 +1,1064 @@
+//nftw's flags
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <argp.h>
+
+#include "csv.h"
+#include "cidr.h"
+#include "libmm2xtgeoip.h"
+#include "libmm2xtgeoip_private.h"
+#include "bench.h"
+
+
+
+const char *argp_program_version = "mm2xtgeoip_bench 0.9";
+
+const char *argp_program_bug_address = "https://github.com/josedpedroso/mm2xtgeoip/issues";
+
+static char argp_doc[] = "mm2xtgeoip_bench -- measures the per-row functions of mm2xtgeoip on rows from GeoLite2 files\v"
+                         "Each function is run over the whole corpus once per repetition, after some warmup runs. "
+                         "The reported ns/op and cycles/op are medians over the repetitions. "
+                         "Cycles are counted with perf_event_open when the kernel and the CPU allow it. "
+                         "tokenize_csv modifies its line, so it's measured together with copying the line, "
+                         "which copy_line measures on its own. "
+                         "The convert_* benchmarks run whole conversions of the same rows, reading, parsing and writing included, "
+                         "into a temporary directory, so each of their ops is a row. "
+                         "convert_allowed converts them to xt_geoip with only a few countries allowed, as with -a in mm2xtgeoip, "
+                         "so that most rows are skipped. "
+                         "unpack_bundle unpacks the bundles written by convert_bundle, so each of its ops is a range. "
+                         "pack_tarball and unpack_tarball do the same with a gzipped tarball of the files written by convert_xt_geoip, "
+                         "using tar, as the usual way to ship them without bundles. "
+                         "Benchmarks that write files also report how many bytes they wrote. "
+                         "With -C (--cold), the files the convert_* and unpack_* benchmarks read are dropped from the page cache before each run, "
+                         "so they're read from the disk as in a conversion of freshly downloaded files.\n"
+                         "\n"
+                         "Return values:\n"
+                         "    0 - Success\n"
+                         "    1 - Unable to read the input or baseline files\n"
+                         "    2 - At least one benchmark regressed beyond the threshold\n"
+                         "Other - Unable to parse command-line arguments";
+
+static struct argp_option argp_options[] = {
+    {"country-file", 'c', "FILE", 0, "Use the specified CSV file as source for country data. "
+                                     "Default: " BENCH_DEFAULT_COUNTRY_FILE_NAME},
+    {"ipv4-file",    '4', "FILE", OPTION_ARG_OPTIONAL, "Take rows from the specified IPv4 range file. "
+                                                       "If you use this option without specifying a FILE, no IPv4 rows will be used. "
+                                                       "Default: " BENCH_DEFAULT_IPV4_RANGE_FILE_NAME},
+    {"ipv6-file",    '6', "FILE", OPTION_ARG_OPTIONAL, "Take rows from the specified IPv6 range file. "
+                                                       "If you use this option without specifying a FILE, no IPv6 rows will be used. "
+                                                       "Default: " BENCH_DEFAULT_IPV6_RANGE_FILE_NAME},
+    {"allow-countries", 'a', "COUNTRIES", 0, "Allow only the specified comma-separated country codes in convert_allowed. "
+                                             "As in mm2xtgeoip, the conversion fails if they have no rows in one of the range files. "
+                                             "Default: " BENCH_DEFAULT_ALLOWED_COUNTRIES},
+    {"rows",         'n', "N", 0, "Use the first N rows of the range files, split evenly between them. Default: 65536"},
+    {"warmup",       'w', "N", 0, "Run each benchmark N times before measuring it. Default: 2"},
+    {"repetitions",  'r', "N", 0, "Measure each benchmark N times. Default: 11"},
+    {"cold",         'C', 0, 0, "Drop the files read by the conversion benchmarks from the page cache before each run."},
+    {"json",         'j', 0, 0, "Write the results to stdout as JSON, which can be saved as a baseline for -b (--baseline)."},
+    {"baseline",     'b', "FILE", 0, "Compare the results to those in FILE, written with -j (--json), "
+                                     "using cycles/op when both have them and ns/op otherwise."},
+    {"threshold",    't', "PERCENT", 0, "With -b (--baseline), count a benchmark that is more than PERCENT slower as a regression. Default: 5"},
+    {0}
+};
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    BenchArguments *arguments = state->input;
+    char *end;
+    unsigned long value;
+    
+    switch (key) {
+        case 'c':
+            arguments->country_file = arg;
+            break;
+        
+        case '4':
+            arguments->ipv4_file = arg;
+            break;
+        
+        case '6':
+            arguments->ipv6_file = arg;
+            break;
+        
+        case 'a':
+            arguments->allowed_countries = arg;
+            break;
+        
+        case 'n':
+        case 'w':
+        case 'r':
+            errno = 0;
+            value = strtoul(arg, &end, 10);
+            if (errno || *end != '\0' || (key != 'w' && !value) || value > UINT_MAX ||
+                (key == 'r' && value > BENCH_MAX_REPETITIONS)) {
+                argp_error(state, "Invalid number: %s", arg);
+            }
+            
+            if (key == 'n') {
+                arguments->rows = value;
+            }
+            else if (key == 'w') {
+                arguments->warmup = value;
+            }
+            else {
+                arguments->repetitions = value;
+            }
+            break;
+        
+        case 'C':
+            arguments->cold = true;
+            break;
+        
+        case 'j':
+            arguments->json = true;
+            break;
+        
+        case 'b':
+            arguments->baseline_file = arg;
+            break;
+        
+        case 't':
+            errno = 0;
+            arguments->threshold = strtod(arg, &end);
+            if (errno || *end != '\0' || arguments->threshold < 0) {
+                argp_error(state, "Invalid threshold: %s", arg);
+            }
+            break;
+        
+        case ARGP_KEY_END:
+            if (arguments->ipv4_file == NULL && arguments->ipv6_file == NULL) {
+                argp_error(state, "At least one range file is needed.");
+            }
+            break;
+        
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    
+    return 0;
+}
+
+static struct argp argp_parser = {argp_options, parse_opt, 0, argp_doc};
+
+
+//reads the first rows of the range files and prepares the input of every benchmark
+//each row is decoded and looked up the way the library does it, so the corpus holds what the hot path sees
+//returns NULL on success or an error message
+char *read_corpus(BenchArguments *arguments, BenchCorpus *corpus) {
+    const char *REQUIRED_COLS[] = {
+        "network",
+        "geoname_id",
+        "registered_country_geoname_id",
+        "is_anonymous_proxy",
+        "is_satellite_provider"
+    };
+    char *file_names[] = {arguments->ipv4_file, arguments->ipv6_file};
+    uint16_t allowed_country_pos[GEOIP_MAX_COUNTRIES];
+    char *allowed_countries;
+    FILE *range_file;
+    char line[MAX_LINE];
+    char *tokens[MAX_COLS];
+    unsigned column_positions[MAX_COLS];
+    unsigned highest_column;
+    unsigned num_cols;
+    CsvField fields[MAX_COLS];
+    Country *country;
+    size_t rows_per_file;
+    size_t max_lines = arguments->rows;
+    size_t num_file_lines;
+    size_t i;
+    unsigned f;
+    
+    memset(corpus, 0, sizeof(BenchCorpus));
+    
+    corpus->ctx = geoip_new_context();
+    if (corpus->ctx == NULL) {
+        return "Error allocating buffers.";
+    }
+    
+    if (!geoip_read_country_file(corpus->ctx, arguments->country_file) || !geoip_add_virtual_countries(corpus->ctx)) {
+        return geoip_error(corpus->ctx);
+    }
+    
+    //convert_allowed has a context of its own, with only the allowed countries
+    corpus->allowed_ctx = geoip_new_context();
+    allowed_countries = strdup(arguments->allowed_countries);
+    if (corpus->allowed_ctx == NULL || allowed_countries == NULL) {
+        free(allowed_countries);
+        return "Error allocating buffers.";
+    }
+    
+    if (!geoip_read_country_file(corpus->allowed_ctx, arguments->country_file) || !geoip_add_virtual_countries(corpus->allowed_ctx)) {
+        free(allowed_countries);
+        return geoip_error(corpus->allowed_ctx);
+    }
+    
+    geoip_parse_country_code_list(allowed_countries, allowed_country_pos);
+    geoip_set_filtered_countries(corpus->allowed_ctx, allowed_country_pos, false);
+    free(allowed_countries);
+    
+    corpus->lines = calloc(max_lines, sizeof(char *));
+    corpus->networks = calloc(max_lines, sizeof(char *));
+    corpus->ranges = calloc(max_lines, sizeof(AddressRange));
+    corpus->geoname_ids = calloc(max_lines, sizeof(unsigned long));
+    corpus->proxies = calloc(max_lines, sizeof(bool));
+    corpus->sats = calloc(max_lines, sizeof(bool));
+    corpus->country_codes = calloc(max_lines, sizeof(char *));
+    if (corpus->lines == NULL || corpus->networks == NULL || corpus->ranges == NULL || corpus->geoname_ids == NULL ||
+        corpus->proxies == NULL || corpus->sats == NULL || corpus->country_codes == NULL) {
+        return "Error allocating buffers.";
+    }
+    
+    rows_per_file = file_names[0] != NULL && file_names[1] != NULL ? max_lines / 2 : max_lines;
+    
+    for (f = 0; f < 2; f++) {
+        if (file_names[f] == NULL) {
+            continue;
+        }
+        
+        range_file = fopen(file_names[f], "r");
+        if (range_file == NULL) {
+            return "Error opening range file.";
+        }
+        
+        //the header gives the columns of this file
+        //GeoLite2 IPv4 and IPv6 files have the same columns, so the plan of the last one serves both
+        if (fgets(line, MAX_LINE, range_file) == NULL || (corpus->headers[f] = strdup(line)) == NULL) {
+            fclose(range_file);
+            return "Error reading range file.";
+        }
+        
+        num_cols = tokenize_csv(line, tokens, MAX_COLS);
+        if (detect_columns(tokens, num_cols, REQUIRED_COLS, column_positions, BENCH_RANGE_COLUMNS, &highest_column) != BENCH_RANGE_COLUMNS ||
+            !compile_parse_plan(&corpus->plan, column_positions, BENCH_RANGE_COLUMNS, highest_column)) {
+            fclose(range_file);
+            return "Required columns not found in header.";
+        }
+        
+        for (num_file_lines = 0; num_file_lines < rows_per_file && corpus->num_lines < max_lines; num_file_lines++) {
+            if (fgets(line, MAX_LINE, range_file) == NULL) {
+                break;
+            }
+            
+            i = corpus->num_lines;
+            
+            if (decode_csv_fields(line, &corpus->plan, fields) < corpus->plan.num_columns) {
+                fclose(range_file);
+                return "Insufficient columns.";
+            }
+            
+            if (!csv_field_to_ulong(&fields[1], &corpus->geoname_ids[i])) {
+                csv_field_to_ulong(&fields[2], &corpus->geoname_ids[i]);
+            }
+            corpus->proxies[i] = csv_field_to_bool(&fields[3]);
+            corpus->sats[i] = csv_field_to_bool(&fields[4]);
+            
+            country = find_country(corpus->ctx, corpus->geoname_ids[i], corpus->proxies[i], corpus->sats[i]);
+            if (country == NULL) {
+                country = find_country(corpus->ctx, OTHER_GEONAME_ID, false, false);
+            }
+            corpus->country_codes[i] = country != NULL ? country->country_code : "O1";
+            
+            corpus->lines[i] = strdup(line);
+            corpus->networks[i] = strndup(fields[0].start, fields[0].len);
+            if (corpus->lines[i] == NULL || corpus->networks[i] == NULL) {
+                fclose(range_file);
+                return "Error allocating buffers.";
+            }
+            corpus->num_lines++;
+            
+            if (parse_cidr(corpus->networks[i], &corpus->ranges[corpus->num_ranges])) {
+                corpus->num_ranges++;
+            }
+        }
+        
+        corpus->num_file_lines[f] = num_file_lines;
+        fclose(range_file);
+    }
+    
+    if (!corpus->num_lines) {
+        return "No rows in range files.";
+    }
+    
+    //the lookup cache must start cold in every run
+    reset_country_cache(corpus->ctx);
+    
+    return write_corpus_files(corpus);
+}
+
+//writes the rows taken from each range file to a range file of their own in a new work directory,
+//which also gets a directory for the output of each format, for the conversion benchmarks
+//returns NULL on success or an error message
+char *write_corpus_files(BenchCorpus *corpus) {
+    FILE *range_file;
+    char output_dir[PATH_MAX];
+    size_t first = 0;
+    size_t i;
+    unsigned f;
+    int format;
+    
+    strcpy(corpus->work_dir, BENCH_WORK_DIR_TEMPLATE);
+    if (mkdtemp(corpus->work_dir) == NULL) {
+        corpus->work_dir[0] = '\0';
+        return "Error creating work directory.";
+    }
+    
+    for (format = 0; format < GEOIP_NUM_FORMATS; format++) {
+        if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, geoip_format_name(format)) >= PATH_MAX ||
+            mkdir(output_dir, 0755) != 0) {
+            return "Error creating output directory.";
+        }
+    }
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_UNPACK_DIR_NAME) >= PATH_MAX ||
+        mkdir(output_dir, 0755) != 0) {
+        return "Error creating output directory.";
+    }
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_ALLOWED_DIR_NAME) >= PATH_MAX ||
+        mkdir(output_dir, 0755) != 0) {
+        return "Error creating output directory.";
+    }
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_TARBALL_DIR_NAME) >= PATH_MAX ||
+        mkdir(output_dir, 0755) != 0) {
+        return "Error creating output directory.";
+    }
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_UNTAR_DIR_NAME) >= PATH_MAX ||
+        mkdir(output_dir, 0755) != 0) {
+        return "Error creating output directory.";
+    }
+    
+    for (f = 0; f < 2; f++) {
+        if (corpus->headers[f] == NULL) {
+            continue;
+        }
+        
+        if ((size_t)snprintf(corpus->range_files[f], PATH_MAX, "%s/%s", corpus->work_dir,
+                             f ? BENCH_IPV6_CORPUS_FILE_NAME : BENCH_IPV4_CORPUS_FILE_NAME) >= PATH_MAX) {
+            corpus->range_files[f][0] = '\0';
+            return "Error creating range file.";
+        }
+        
+        range_file = fopen(corpus->range_files[f], "w");
+        if (range_file == NULL) {
+            return "Error creating range file.";
+        }
+        
+        fputs(corpus->headers[f], range_file);
+        for (i = first; i < first + corpus->num_file_lines[f]; i++) {
+            fputs(corpus->lines[i], range_file);
+        }
+        first += corpus->num_file_lines[f];
+        
+        if (fclose(range_file) != 0) {
+            return "Error writing range file.";
+        }
+    }
+    
+    return NULL;
+}
+
+//total size of the files in a directory
+unsigned long long directory_size(char *directory) {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat file_stat;
+    char file_name[PATH_MAX];
+    unsigned long long size = 0;
+    
+    dir = opendir(directory);
+    if (dir == NULL) {
+        return 0;
+    }
+    
+    while ((entry = readdir(dir)) != NULL) {
+        if ((size_t)snprintf(file_name, PATH_MAX, "%s/%s", directory, entry->d_name) < PATH_MAX &&
+            stat(file_name, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+            size += file_stat.st_size;
+        }
+    }
+    
+    closedir(dir);
+    
+    return size;
+}
+
+//drops a file from the page cache, syncing it first since dirty pages can't be dropped
+//a file that can't be opened, like a bundle that wasn't written yet, is left alone
+void drop_file_cache(char *file_name) {
+    int fd;
+    
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+//drops the range files, the bundles and the tarball, which are all the conversion benchmarks read
+void drop_corpus_cache(BenchCorpus *corpus) {
+    char bundle_file[PATH_MAX];
+    char tarball_file[PATH_MAX];
+    unsigned f;
+    
+    if ((size_t)snprintf(tarball_file, PATH_MAX, "%s/%s/%s", corpus->work_dir, BENCH_TARBALL_DIR_NAME, BENCH_TARBALL_FILE_NAME) < PATH_MAX) {
+        drop_file_cache(tarball_file);
+    }
+    
+    for (f = 0; f < 2; f++) {
+        if (!corpus->range_files[f][0]) {
+            continue;
+        }
+        
+        drop_file_cache(corpus->range_files[f]);
+        
+        if ((size_t)snprintf(bundle_file, PATH_MAX, "%s/%s/%s%s", corpus->work_dir, geoip_format_name(GEOIP_FORMAT_BUNDLE),
+                             GEOIP_BUNDLE_FILE_NAME, f ? GEOIP_BUNDLE_IPV6_SUFFIX : GEOIP_BUNDLE_IPV4_SUFFIX) < PATH_MAX) {
+            drop_file_cache(bundle_file);
+        }
+    }
+}
+
+//runs tar with the given arguments, argv[0] being "tar"
+//returns false if it couldn't be run or failed
+bool run_tar(char *const *argv) {
+    pid_t pid;
+    int status;
+    
+    pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    
+    if (waitpid(pid, &status, 0) != pid) {
+        return false;
+    }
+    
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+void free_corpus(BenchCorpus *corpus) {
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        free(corpus->lines[i]);
+        free(corpus->networks[i]);
+    }
+    
+    free(corpus->lines);
+    free(corpus->networks);
+    free(corpus->ranges);
+    free(corpus->geoname_ids);
+    free(corpus->proxies);
+    free(corpus->sats);
+    free(corpus->country_codes);
+    free(corpus->headers[0]);
+    free(corpus->headers[1]);
+    
+    if (corpus->ctx != NULL) {
+        geoip_free_context(corpus->ctx);
+    }
+    
+    if (corpus->allowed_ctx != NULL) {
+        geoip_free_context(corpus->allowed_ctx);
+    }
+    
+    if (corpus->work_dir[0]) {
+        nftw(corpus->work_dir, remove_entry, BENCH_MAX_OPEN_DIRS, FTW_DEPTH | FTW_PHYS);
+    }
+}
+
+
+static unsigned long bench_copy_line(BenchCorpus *corpus, size_t *num_ops) {
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        strcpy(corpus->line_buf, corpus->lines[i]);
+        sum += corpus->line_buf[0];
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_tokenize_csv(BenchCorpus *corpus, size_t *num_ops) {
+    char *tokens[MAX_COLS];
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        strcpy(corpus->line_buf, corpus->lines[i]);
+        sum += tokenize_csv(corpus->line_buf, tokens, MAX_COLS);
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_decode_csv_fields(BenchCorpus *corpus, size_t *num_ops) {
+    CsvField fields[MAX_COLS];
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        sum += decode_csv_fields(corpus->lines[i], &corpus->plan, fields);
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+//headers are only detected once per file in a conversion, so this is the same header over and over
+static unsigned long bench_detect_columns(BenchCorpus *corpus, size_t *num_ops) {
+    const char *REQUIRED_COLS[] = {
+        "network",
+        "geoname_id",
+        "registered_country_geoname_id",
+        "is_anonymous_proxy",
+        "is_satellite_provider"
+    };
+    char *tokens[MAX_COLS];
+    unsigned column_positions[MAX_COLS];
+    unsigned highest_column;
+    unsigned num_cols;
+    unsigned long sum = 0;
+    size_t i;
+    
+    strcpy(corpus->line_buf, corpus->headers[0] != NULL ? corpus->headers[0] : corpus->headers[1]);
+    num_cols = tokenize_csv(corpus->line_buf, tokens, MAX_COLS);
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        sum += detect_columns(tokens, num_cols, REQUIRED_COLS, column_positions, BENCH_RANGE_COLUMNS, &highest_column);
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_parse_cidr(BenchCorpus *corpus, size_t *num_ops) {
+    AddressRange range;
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        if (parse_cidr(corpus->networks[i], &range)) {
+            sum += range.prefix_length;
+        }
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_ranges_contiguous(BenchCorpus *corpus, size_t *num_ops) {
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 1; i < corpus->num_ranges; i++) {
+        sum += ranges_contiguous(&corpus->ranges[i - 1], &corpus->ranges[i]);
+    }
+    
+    *num_ops = corpus->num_ranges ? corpus->num_ranges - 1 : 0;
+    return sum;
+}
+
+static unsigned long bench_inc_addr(BenchCorpus *corpus, size_t *num_ops) {
+    uint8_t addr[IPV6_BYTES];
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_ranges; i++) {
+        memcpy(addr, corpus->ranges[i].end, corpus->ranges[i].addr_bytes);
+        sum += inc_addr(addr, corpus->ranges[i].addr_family, 1) + addr[corpus->ranges[i].addr_bytes - 1];
+    }
+    
+    *num_ops = corpus->num_ranges;
+    return sum;
+}
+
+//rows come in file order, so the last-country cache hits as often as in a conversion
+//get_country is inlined into the library, so it's called through find_country, which adds a call to each op
+static unsigned long bench_get_country(BenchCorpus *corpus, size_t *num_ops) {
+    unsigned long sum = 0;
+    size_t i;
+    
+    reset_country_cache(corpus->ctx);
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        sum += find_country(corpus->ctx, corpus->geoname_ids[i], corpus->proxies[i], corpus->sats[i]) != NULL;
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_country_code_pos(BenchCorpus *corpus, size_t *num_ops) {
+    unsigned long sum = 0;
+    size_t i;
+    
+    for (i = 0; i < corpus->num_lines; i++) {
+        sum += country_code_pos(corpus->country_codes[i]);
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+//converts the rows of both range files into a directory of the work directory, as mm2xtgeoip does with one output
+//a conversion that fails sets the corpus's error message
+static unsigned long convert_corpus(BenchCorpus *corpus, GeoipContext *ctx, int format, char *dir_name, size_t *num_ops) {
+    char *output_dir = corpus->output_dir;
+    unsigned long sum = 0;
+    unsigned f;
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, dir_name) >= PATH_MAX) {
+        corpus->err_msg = "Path too long.";
+        *num_ops = corpus->num_lines;
+        return 0;
+    }
+    
+    for (f = 0; f < 2; f++) {
+        if (!corpus->range_files[f][0]) {
+            continue;
+        }
+        
+        sum += geoip_process_range_file(ctx, corpus->range_files[f], f ? AF_INET6 : AF_INET, output_dir, format);
+        if (geoip_error(ctx) != NULL) {
+            corpus->err_msg = geoip_error(ctx);
+        }
+    }
+    
+    *num_ops = corpus->num_lines;
+    return sum;
+}
+
+static unsigned long bench_convert_xt_geoip(BenchCorpus *corpus, size_t *num_ops) {
+    return convert_corpus(corpus, corpus->ctx, GEOIP_FORMAT_XTGEOIP, geoip_format_name(GEOIP_FORMAT_XTGEOIP), num_ops);
+}
+
+//ipset and lpm output split every range into prefixes and format them
+static unsigned long bench_convert_ipset(BenchCorpus *corpus, size_t *num_ops) {
+    return convert_corpus(corpus, corpus->ctx, GEOIP_FORMAT_IPSET, geoip_format_name(GEOIP_FORMAT_IPSET), num_ops);
+}
+
+static unsigned long bench_convert_lpm(BenchCorpus *corpus, size_t *num_ops) {
+    return convert_corpus(corpus, corpus->ctx, GEOIP_FORMAT_LPM, geoip_format_name(GEOIP_FORMAT_LPM), num_ops);
+}
+
+//rows of forbidden countries are skipped before they're decoded, which pays off when most countries are forbidden
+static unsigned long bench_convert_allowed(BenchCorpus *corpus, size_t *num_ops) {
+    return convert_corpus(corpus, corpus->allowed_ctx, GEOIP_FORMAT_XTGEOIP, BENCH_ALLOWED_DIR_NAME, num_ops);
+}
+
+//the bytes it writes compare with those of convert_xt_geoip, which writes the same ranges
+static unsigned long bench_convert_bundle(BenchCorpus *corpus, size_t *num_ops) {
+    return convert_corpus(corpus, corpus->ctx, GEOIP_FORMAT_BUNDLE, geoip_format_name(GEOIP_FORMAT_BUNDLE), num_ops);
+}
+
+//unpacks the bundles of convert_bundle, which runs first, into the xt_geoip files a conversion writes
+static unsigned long bench_unpack_bundle(BenchCorpus *corpus, size_t *num_ops) {
+    char bundle_file[PATH_MAX];
+    char *output_dir = corpus->output_dir;
+    unsigned long sum = 0;
+    unsigned f;
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_UNPACK_DIR_NAME) >= PATH_MAX) {
+        corpus->err_msg = "Path too long.";
+        *num_ops = 0;
+        return 0;
+    }
+    
+    for (f = 0; f < 2; f++) {
+        if (!corpus->range_files[f][0]) {
+            continue;
+        }
+        
+        if ((size_t)snprintf(bundle_file, PATH_MAX, "%s/%s/%s%s", corpus->work_dir, geoip_format_name(GEOIP_FORMAT_BUNDLE),
+                             GEOIP_BUNDLE_FILE_NAME, f ? GEOIP_BUNDLE_IPV6_SUFFIX : GEOIP_BUNDLE_IPV4_SUFFIX) >= PATH_MAX) {
+            corpus->err_msg = "Path too long.";
+            continue;
+        }
+        
+        sum += geoip_unpack_bundle(corpus->ctx, bundle_file, f ? AF_INET6 : AF_INET, output_dir);
+        if (geoip_error(corpus->ctx) != NULL) {
+            corpus->err_msg = geoip_error(corpus->ctx);
+        }
+    }
+    
+    corpus->num_bundle_ranges = sum;
+    *num_ops = sum;
+    return sum;
+}
+
+//packs the files of convert_xt_geoip into a tarball, whose bytes compare with those of convert_bundle
+//each op is one of the ranges unpack_bundle unpacks, so the two tarball benchmarks compare with it
+static unsigned long bench_pack_tarball(BenchCorpus *corpus, size_t *num_ops) {
+    char tarball_file[PATH_MAX];
+    char xt_geoip_dir[PATH_MAX];
+    char *output_dir = corpus->output_dir;
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_TARBALL_DIR_NAME) >= PATH_MAX ||
+        (size_t)snprintf(tarball_file, PATH_MAX, "%s/%s", output_dir, BENCH_TARBALL_FILE_NAME) >= PATH_MAX ||
+        (size_t)snprintf(xt_geoip_dir, PATH_MAX, "%s/%s", corpus->work_dir, geoip_format_name(GEOIP_FORMAT_XTGEOIP)) >= PATH_MAX) {
+        corpus->err_msg = "Path too long.";
+    } else if (!run_tar((char *[]){"tar", "-czf", tarball_file, "-C", xt_geoip_dir, ".", NULL})) {
+        corpus->err_msg = "Error running tar.";
+    }
+    
+    *num_ops = corpus->num_bundle_ranges;
+    return corpus->num_bundle_ranges;
+}
+
+static unsigned long bench_unpack_tarball(BenchCorpus *corpus, size_t *num_ops) {
+    char tarball_file[PATH_MAX];
+    char *output_dir = corpus->output_dir;
+    
+    if ((size_t)snprintf(output_dir, PATH_MAX, "%s/%s", corpus->work_dir, BENCH_UNTAR_DIR_NAME) >= PATH_MAX ||
+        (size_t)snprintf(tarball_file, PATH_MAX, "%s/%s/%s", corpus->work_dir, BENCH_TARBALL_DIR_NAME, BENCH_TARBALL_FILE_NAME) >= PATH_MAX) {
+        corpus->err_msg = "Path too long.";
+    } else if (!run_tar((char *[]){"tar", "-xzf", tarball_file, "-C", output_dir, NULL})) {
+        corpus->err_msg = "Error running tar.";
+    }
+    
+    *num_ops = corpus->num_bundle_ranges;
+    return corpus->num_bundle_ranges;
+}
+
+static Benchmark benchmarks[] = {
+    {"copy_line", bench_copy_line, false},
+    {"tokenize_csv", bench_tokenize_csv, false},
+    {"decode_csv_fields", bench_decode_csv_fields, false},
+    {"detect_columns", bench_detect_columns, false},
+    {"parse_cidr", bench_parse_cidr, false},
+    {"ranges_contiguous", bench_ranges_contiguous, false},
+    {"inc_addr", bench_inc_addr, false},
+    {"get_country", bench_get_country, false},
+    {"country_code_pos", bench_country_code_pos, false},
+    {"convert_xt_geoip", bench_convert_xt_geoip, true},
+    {"convert_ipset", bench_convert_ipset, true},
+    {"convert_lpm", bench_convert_lpm, true},
+    {"convert_allowed", bench_convert_allowed, true},
+    {"convert_bundle", bench_convert_bundle, true},
+    {"unpack_bundle", bench_unpack_bundle, true},
+    {"pack_tarball", bench_pack_tarball, true},
+    {"unpack_tarball", bench_unpack_tarball, true}
+};
+
+
+//opens a counter of the cycles this thread spends in user space, initially stopped
+//returns -1 if the kernel or the CPU can't count them, as in many virtual machines
+int open_cycle_counter(void) {
+    struct perf_event_attr attr;
+    
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int compare_doubles(const void *value1, const void *value2) {
+    double d1 = *(const double *)value1;
+    double d2 = *(const double *)value2;
+    
+    return (d1 > d2) - (d1 < d2);
+}
+
+//runs a benchmark for warmup, then measures each repetition
+void measure(Benchmark *benchmark, BenchCorpus *corpus, BenchArguments *arguments, int cycle_fd, BenchResult *result) {
+    static volatile unsigned long sink;
+    double ns[BENCH_MAX_REPETITIONS];
+    double cycles[BENCH_MAX_REPETITIONS];
+    struct timespec start;
+    struct timespec end;
+    uint64_t count;
+    size_t num_ops = 0;
+    unsigned i;
+    
+    for (i = 0; i < arguments->warmup; i++) {
+        sink += benchmark->run(corpus, &num_ops);
+    }
+    
+    for (i = 0; i < arguments->repetitions; i++) {
+        if (arguments->cold && benchmark->reads_files) {
+            drop_corpus_cache(corpus);
+        }
+        
+        if (cycle_fd >= 0) {
+            ioctl(cycle_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cycle_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sink += benchmark->run(corpus, &num_ops);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        cycles[i] = -1;
+        if (cycle_fd >= 0) {
+            ioctl(cycle_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(cycle_fd, &count, sizeof(count)) == sizeof(count) && num_ops) {
+                cycles[i] = (double)count / num_ops;
+            }
+        }
+        
+        ns[i] = num_ops ? ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / num_ops : 0;
+    }
+    
+    qsort(ns, arguments->repetitions, sizeof(double), compare_doubles);
+    qsort(cycles, arguments->repetitions, sizeof(double), compare_doubles);
+    
+    result->name = benchmark->name;
+    result->num_ops = num_ops;
+    result->ns_per_op = ns[arguments->repetitions / 2];
+    result->ns_per_op_min = ns[0];
+    result->cycles_per_op = cycles[arguments->repetitions / 2];
+    result->baseline_ns_per_op = -1;
+    result->baseline_cycles_per_op = -1;
+    result->change = 0;
+    result->regression = false;
+    
+    //every repetition writes the same files
+    result->output_bytes = 0;
+    if (corpus->output_dir[0]) {
+        result->output_bytes = directory_size(corpus->output_dir);
+        corpus->output_dir[0] = '\0';
+    }
+}
+
+//reads the results of an earlier run, written by print_results as JSON with one benchmark per line,
+//and flags the benchmarks that got slower by more than threshold percent
+//returns false if the baseline can't be read
+bool compare_to_baseline(char *baseline_file, BenchResult *results, size_t num_results, double threshold) {
+    FILE *file;
+    char line[BENCH_MAX_BASELINE_LINE];
+    char name[BENCH_MAX_NAME_SIZE];
+    char *field;
+    BenchResult *result;
+    size_t i;
+    
+    file = fopen(baseline_file, "r");
+    if (file == NULL) {
+        return false;
+    }
+    
+    while (fgets(line, sizeof(line), file) != NULL) {
+        field = strstr(line, "\"name\": \"");
+        if (field == NULL || sscanf(field, "\"name\": \"%63[^\"]\"", name) != 1) {
+            continue;
+        }
+        
+        for (i = 0; i < num_results && strcmp(results[i].name, name) != 0; i++);
+        if (i == num_results) {
+            continue;
+        }
+        result = &results[i];
+        
+        //cycles are null when they couldn't be counted, which strtod leaves at 0
+        field = strstr(line, "\"ns_per_op\": ");
+        result->baseline_ns_per_op = field != NULL ? strtod(field + strlen("\"ns_per_op\": "), NULL) : -1;
+        field = strstr(line, "\"cycles_per_op\": ");
+        result->baseline_cycles_per_op = field != NULL ? strtod(field + strlen("\"cycles_per_op\": "), NULL) : -1;
+        if (result->baseline_cycles_per_op <= 0) {
+            result->baseline_cycles_per_op = -1;
+        }
+        
+        if (result->cycles_per_op > 0 && result->baseline_cycles_per_op > 0) {
+            result->change = result->cycles_per_op / result->baseline_cycles_per_op - 1;
+        }
+        else if (result->baseline_ns_per_op > 0) {
+            result->change = result->ns_per_op / result->baseline_ns_per_op - 1;
+        }
+        
+        result->regression = result->change * 100 > threshold;
+    }
+    
+    fclose(file);
+    
+    return true;
+}
+
+void print_results(BenchArguments *arguments, BenchResult *results, size_t num_results, bool cycles_available) {
+    size_t i;
+    
+    if (arguments->json) {
+        printf("{\n");
+        printf("  \"rows\": %u,\n", arguments->rows);
+        printf("  \"warmup\": %u,\n", arguments->warmup);
+        printf("  \"repetitions\": %u,\n", arguments->repetitions);
+        printf("  \"cold\": %s,\n", arguments->cold ? "true" : "false");
+        printf("  \"cycles_available\": %s,\n", cycles_available ? "true" : "false");
+        printf("  \"benchmarks\": [\n");
+        
+        for (i = 0; i < num_results; i++) {
+            printf("    {\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.3f, \"ns_per_op_min\": %.3f, ",
+                   results[i].name, results[i].num_ops, results[i].ns_per_op, results[i].ns_per_op_min);
+            
+            if (results[i].cycles_per_op > 0) {
+                printf("\"cycles_per_op\": %.3f", results[i].cycles_per_op);
+            }
+            else {
+                printf("\"cycles_per_op\": null");
+            }
+            
+            if (results[i].output_bytes) {
+                printf(", \"output_bytes\": %llu", results[i].output_bytes);
+            }
+            
+            if (arguments->baseline_file != NULL && results[i].baseline_ns_per_op > 0) {
+                printf(", \"change\": %.4f, \"regression\": %s", results[i].change, results[i].regression ? "true" : "false");
+            }
+            
+            printf("}%s\n", i + 1 < num_results ? "," : "");
+        }
+        
+        printf("  ]\n");
+        printf("}\n");
+        return;
+    }
+    
+    if (!cycles_available) {
+        printf("Cycles can't be counted here, only times are reported.\n");
+    }
+    
+    printf("%-20s %10s %10s %10s %10s %12s", "benchmark", "ops", "ns/op", "min ns/op", "cycles/op", "bytes");
+    if (arguments->baseline_file != NULL) {
+        printf(" %10s", "change");
+    }
+    printf("\n");
+    
+    for (i = 0; i < num_results; i++) {
+        printf("%-20s %10zu %10.2f %10.2f ", results[i].name, results[i].num_ops, results[i].ns_per_op, results[i].ns_per_op_min);
+        
+        if (results[i].cycles_per_op > 0) {
+            printf("%10.2f", results[i].cycles_per_op);
+        }
+        else {
+            printf("%10s", "-");
+        }
+        
+        if (results[i].output_bytes) {
+            printf(" %12llu", results[i].output_bytes);
+        }
+        else {
+            printf(" %12s", "-");
+        }
+        
+        if (arguments->baseline_file != NULL) {
+            if (results[i].baseline_ns_per_op > 0) {
+                printf(" %+9.1f%%%s", results[i].change * 100, results[i].regression ? " REGRESSION" : "");
+            }
+            else {
+                printf(" %10s", "new");
+            }
+        }
+        
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchArguments arguments;
+    BenchCorpus corpus;
+    BenchResult results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+    size_t num_results = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    int cycle_fd;
+    char *err_msg;
+    bool regressed = false;
+    size_t i;
+    
+    
+    //set default arguments
+    arguments.country_file = BENCH_DEFAULT_COUNTRY_FILE_NAME;
+    arguments.ipv4_file = BENCH_DEFAULT_IPV4_RANGE_FILE_NAME;
+    arguments.ipv6_file = BENCH_DEFAULT_IPV6_RANGE_FILE_NAME;
+    arguments.allowed_countries = BENCH_DEFAULT_ALLOWED_COUNTRIES;
+    arguments.rows = BENCH_DEFAULT_ROWS;
+    arguments.warmup = BENCH_DEFAULT_WARMUP;
+    arguments.repetitions = BENCH_DEFAULT_REPETITIONS;
+    arguments.baseline_file = NULL;
+    arguments.threshold = BENCH_DEFAULT_THRESHOLD;
+    arguments.json = false;
+    arguments.cold = false;
+    
+    //parse arguments from command line
+    argp_parse(&argp_parser, argc, argv, 0, 0, &arguments);
+    
+    
+    err_msg = read_corpus(&arguments, &corpus);
+    if (err_msg != NULL) {
+        fprintf(stderr, "Unable to read corpus: %s\n", err_msg);
+        free_corpus(&corpus);
+        return 1;
+    }
+    
+    cycle_fd = open_cycle_counter();
+    
+    for (i = 0; i < num_results; i++) {
+        measure(&benchmarks[i], &corpus, &arguments, cycle_fd, &results[i]);
+        
+        if (corpus.err_msg != NULL) {
+            fprintf(stderr, "Unable to run %s: %s\n", benchmarks[i].name, corpus.err_msg);
+            free_corpus(&corpus);
+            return 1;
+        }
+    }
+    
+    if (cycle_fd >= 0) {
+        close(cycle_fd);
+    }
+    
+    free_corpus(&corpus);
+    
+    
+    if (arguments.baseline_file != NULL) {
+        if (!compare_to_baseline(arguments.baseline_file, results, num_results, arguments.threshold)) {
+            fprintf(stderr, "Unable to read baseline: %s\n", strerror(errno));
+            return 1;
+        }
+        
+        for (i = 0; i < num_results; i++) {
+            regressed = regressed || results[i].regression;
+        }
+    }
+    
+    print_results(&arguments, results, num_results, cycle_fd >= 0);
+    
+    return regressed ? 2 : EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#define BENCH_DEFAULT_COUNTRY_FILE_NAME "GeoLite2-Country-Locations-en.csv"
+#define BENCH_DEFAULT_IPV4_RANGE_FILE_NAME "GeoLite2-Country-Blocks-IPv4.csv"
+#define BENCH_DEFAULT_IPV6_RANGE_FILE_NAME "GeoLite2-Country-Blocks-IPv6.csv"
+#define BENCH_DEFAULT_ALLOWED_COUNTRIES "MV,LU"
+#define BENCH_DEFAULT_ROWS 65536
+#define BENCH_DEFAULT_WARMUP 2
+#define BENCH_DEFAULT_REPETITIONS 11
+#define BENCH_DEFAULT_THRESHOLD 5.0
+#define BENCH_MAX_REPETITIONS 1000
+#define BENCH_RANGE_COLUMNS 5
+#define BENCH_MAX_NAME_SIZE 64
+#define BENCH_MAX_BASELINE_LINE 512
+#define BENCH_WORK_DIR_TEMPLATE "/tmp/mm2xtgeoip_bench-XXXXXX"
+#define BENCH_IPV4_CORPUS_FILE_NAME "ipv4.csv"
+#define BENCH_IPV6_CORPUS_FILE_NAME "ipv6.csv"
+#define BENCH_UNPACK_DIR_NAME "unpack"
+#define BENCH_ALLOWED_DIR_NAME "allowed"
+#define BENCH_TARBALL_DIR_NAME "tarball"
+#define BENCH_UNTAR_DIR_NAME "untar"
+#define BENCH_TARBALL_FILE_NAME "geoip.tar.gz"
+#define BENCH_MAX_OPEN_DIRS 16
+
+
+typedef struct BenchArguments {
+    char *country_file;
+    char *ipv4_file;
+    char *ipv6_file;
+    char *allowed_countries;
+    unsigned rows;
+    unsigned warmup;
+    unsigned repetitions;
+    char *baseline_file;
+    double threshold;
+    bool json;
+    bool cold;
+} BenchArguments;
+
+//rows taken from the range files, in file order, and what each per-row function needs from them
+//lines are kept pristine, since tokenizing modifies them, and copied into line_buf before each use
+//the rows of each range file are also written to range_files, in work_dir, for the conversion benchmarks,
+//which set err_msg when a conversion fails and output_dir to the directory they write to
+//num_bundle_ranges is the number of ranges unpack_bundle unpacks, which the tarball benchmarks pack and unpack too
+typedef struct BenchCorpus {
+    char **lines;
+    size_t num_lines;
+    size_t num_file_lines[2];
+    char *headers[2];
+    char **networks;
+    AddressRange *ranges;
+    size_t num_ranges;
+    unsigned long *geoname_ids;
+    bool *proxies;
+    bool *sats;
+    char **country_codes;
+    ParsePlan plan;
+    GeoipContext *ctx;
+    GeoipContext *allowed_ctx;
+    char work_dir[PATH_MAX];
+    char range_files[2][PATH_MAX];
+    char output_dir[PATH_MAX];
+    char *err_msg;
+    size_t num_bundle_ranges;
+    char line_buf[MAX_LINE];
+} BenchCorpus;
+
+//a function measured over the whole corpus, returning a value that depends on every call so none can be skipped
+//reads_files is set for the benchmarks whose files -C (--cold) drops from the page cache
+typedef struct Benchmark {
+    const char *name;
+    unsigned long (*run)(BenchCorpus *corpus, size_t *num_ops);
+    bool reads_files;
+} Benchmark;
+
+//medians over the repetitions, with cycles_per_op negative when cycles can't be counted
+//the baseline fields are negative when there's no baseline for the benchmark
+//output_bytes is the size of the files written by a benchmark that writes files, else 0
+typedef struct BenchResult {
+    const char *name;
+    size_t num_ops;
+    double ns_per_op;
+    double ns_per_op_min;
+    double cycles_per_op;
+    double baseline_ns_per_op;
+    double baseline_cycles_per_op;
+    double change;
+    bool regression;
+    unsigned long long output_bytes;
+} BenchResult;
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+char *read_corpus(BenchArguments *arguments, BenchCorpus *corpus);
+char *write_corpus_files(BenchCorpus *corpus);
+unsigned long long directory_size(char *directory);
+void drop_file_cache(char *file_name);
+void drop_corpus_cache(BenchCorpus *corpus);
+bool run_tar(char *const *argv);
+void free_corpus(BenchCorpus *corpus);
+int open_cycle_counter(void);
+int compare_doubles(const void *value1, const void *value2);
+void measure(Benchmark *benchmark, BenchCorpus *corpus, BenchArguments *arguments, int cycle_fd, BenchResult *result);
+bool compare_to_baseline(char *baseline_file, BenchResult *results, size_t num_results, double threshold);
+void print_results(BenchArguments *arguments, BenchResult *results, size_t num_results, bool cycles_available);
+int main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef _STDIO_H
+#include <stdio.h>
+#endif
+
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#ifndef _CTYPE_H
+#include <ctype.h>
+#endif
+
+#ifndef _ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#ifndef _ENDIAN_H
+#include <endian.h>
+#endif
+
+#include "cidr.h"
+#include "hash.h"
+#include "libmm2xtgeoip.h"
+#include "libmm2xtgeoip_private.h"
+#include "bundle.h"
+
+//bundle numbers are little endian, so bundles can be moved between hosts
+void put_le32(uint8_t *p, uint32_t value) {
+    unsigned i;
+    
+    for (i = 0; i < 4; i++) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+void put_le64(uint8_t *p, uint64_t value) {
+    unsigned i;
+    
+    for (i = 0; i < 8; i++) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+//writes value 7 bits at a time, least significant first, with the high bit set on all bytes but the last
+//returns the number of bytes written, at most BUNDLE_MAX_VARINT_SIZE
+size_t encode_varint(unsigned __int128 value, uint8_t *out) {
+    size_t len = 0;
+    
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    
+    return len;
+}
+
+//returns the number of bytes read, or 0 if the varint is truncated or too long for 128 bits
+size_t decode_varint(const uint8_t *in, size_t len, unsigned __int128 *value) {
+    uint64_t low = 0;
+    unsigned __int128 result;
+    size_t i;
+    
+    //most values fit in the first 9 bytes, which can be put together with 64-bit shifts
+    for (i = 0; i < len && i < BUNDLE_SHORT_VARINT_SIZE; i++) {
+        low |= (uint64_t)(in[i] & 0x7f) << (i * 7);
+        
+        if (!(in[i] & 0x80)) {
+            *value = low;
+            return i + 1;
+        }
+    }
+    
+    result = low;
+    for (; i < len && i < BUNDLE_MAX_VARINT_SIZE; i++) {
+        //the last byte of a 128-bit varint only has 2 bits left
+        if (i == BUNDLE_MAX_VARINT_SIZE - 1 && in[i] > 0x03) {
+            return 0;
+        }
+        
+        result |= (unsigned __int128)(in[i] & 0x7f) << (i * 7);
+        
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    
+    return 0;
+}
+
+//appends a range to a country, as the distance from the end of the previous range and the size minus one
+//ranges must arrive in ascending order and not overlap
+bool add_bundle_range(BundleCountry *country, uint8_t *start, uint8_t *end, size_t addr_bytes) {
+    unsigned __int128 start_addr = 0;
+    unsigned __int128 end_addr = 0;
+    uint8_t *data;
+    size_t capacity;
+    size_t i;
+    
+    if (country->len + 2 * BUNDLE_MAX_VARINT_SIZE > country->capacity) {
+        capacity = country->capacity ? country->capacity * 2 : BUNDLE_MIN_CAPACITY;
+        data = realloc(country->data, capacity);
+        if (data == NULL) {
+            return false;
+        }
+        
+        country->data = data;
+        country->capacity = capacity;
+    }
+    
+    //load the addresses as big-endian numbers
+    for (i = 0; i < addr_bytes; i++) {
+        start_addr = (start_addr << 8) | start[i];
+        end_addr = (end_addr << 8) | end[i];
+    }
+    
+    country->len += encode_varint(start_addr - country->next_start, country->data + country->len);
+    country->len += encode_varint(end_addr - start_addr, country->data + country->len);
+    country->num_ranges++;
+    country->next_start = end_addr + 1;
+    
+    return true;
+}
+
+//writes the header, the index and every country's ranges
+//the header checksum covers the rest of the header and the index, each index entry has its country's checksum
+bool write_bundle(FILE *out_file, int addr_family, BundleCountry *countries, char **country_codes, unsigned num_countries) {
+    uint8_t header[BUNDLE_HEADER_SIZE];
+    uint8_t *index;
+    uint8_t *entry;
+    uint64_t offset = 0;
+    unsigned i;
+    bool ok = false;
+    HashState hash;
+    
+    index = calloc(num_countries ? num_countries : 1, BUNDLE_INDEX_ENTRY_SIZE);
+    if (index == NULL) {
+        return false;
+    }
+    
+    for (i = 0; i < num_countries; i++) {
+        entry = index + i * BUNDLE_INDEX_ENTRY_SIZE;
+        memcpy(entry, country_codes[i], GEOIP_COUNTRY_CODE_SIZE);
+        put_le32(entry + 4, countries[i].num_ranges);
+        put_le64(entry + 8, offset);
+        put_le64(entry + 16, countries[i].len);
+        
+        hash_init(&hash, 0);
+        hash_update(&hash, countries[i].data, countries[i].len);
+        put_le64(entry + 24, hash_final(&hash));
+        
+        offset += countries[i].len;
+    }
+    
+    memset(header, 0, sizeof(header));
+    memcpy(header, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE);
+    put_le32(header + 8, BUNDLE_VERSION);
+    put_le32(header + 12, addr_family == AF_INET6 ? 6 : 4);
+    put_le32(header + 16, num_countries);
+    
+    hash_init(&hash, 0);
+    hash_update(&hash, header, BUNDLE_CHECKED_HEADER_SIZE);
+    hash_update(&hash, index, (size_t)num_countries * BUNDLE_INDEX_ENTRY_SIZE);
+    put_le64(header + BUNDLE_CHECKED_HEADER_SIZE, hash_final(&hash));
+    
+    if (!fwrite(header, sizeof(header), 1, out_file) ||
+        (num_countries && !fwrite(index, (size_t)num_countries * BUNDLE_INDEX_ENTRY_SIZE, 1, out_file))) {
+        goto end;
+    }
+    
+    for (i = 0; i < num_countries; i++) {
+        if (countries[i].len && !fwrite(countries[i].data, countries[i].len, 1, out_file)) {
+            goto end;
+        }
+    }
+    
+    ok = true;
+    
+    end:
+    
+    free(index);
+    
+    return ok;
+}
+
+//stores an address as big-endian bytes, converting whole words rather than shifting out each byte
+static void store_addr(uint8_t *out, unsigned __int128 addr, size_t addr_bytes) {
+    uint32_t word;
+    uint64_t half;
+    
+    if (addr_bytes == IPV4_BYTES) {
+        word = htonl((uint32_t)addr);
+        memcpy(out, &word, sizeof(word));
+        return;
+    }
+    
+    half = htobe64((uint64_t)(addr >> 64));
+    memcpy(out, &half, sizeof(half));
+    half = htobe64((uint64_t)addr);
+    memcpy(out + sizeof(half), &half, sizeof(half));
+}
+
+//decodes a country's ranges into start and end address pairs, as written to xt_geoip files
+//out must have room for num_ranges pairs
+//returns false unless data holds exactly num_ranges valid ranges
+bool decode_bundle_ranges(const uint8_t *data, size_t len, uint32_t num_ranges, size_t addr_bytes, uint8_t *out) {
+    unsigned __int128 next_start = 0;
+    unsigned __int128 start;
+    unsigned __int128 size;
+    unsigned __int128 end;
+    unsigned __int128 max_addr = addr_bytes == IPV6_BYTES ? ~(unsigned __int128)0 : UINT32_MAX;
+    size_t pos = 0;
+    size_t used;
+    uint32_t i;
+    
+    for (i = 0; i < num_ranges; i++) {
+        //the address space can't go on after a range that ends at its last address
+        if (i && !next_start) {
+            return false;
+        }
+        
+        used = decode_varint(data + pos, len - pos, &start);
+        if (!used || start > max_addr - next_start) {
+            return false;
+        }
+        pos += used;
+        start += next_start;
+        
+        used = decode_varint(data + pos, len - pos, &size);
+        if (!used || size > max_addr - start) {
+            return false;
+        }
+        pos += used;
+        end = start + size;
+        
+        store_addr(out, start, addr_bytes);
+        store_addr(out + addr_bytes, end, addr_bytes);
+        out += 2 * addr_bytes;
+        
+        next_start = end == max_addr ? 0 : end + 1;
+    }
+    
+    return pos == len;
+}
@@ -0,0 +1,31 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#define BUNDLE_HEADER_SIZE 32
+#define BUNDLE_CHECKED_HEADER_SIZE 24
+#define BUNDLE_INDEX_ENTRY_SIZE 32
+#define BUNDLE_MAX_VARINT_SIZE 19
+#define BUNDLE_SHORT_VARINT_SIZE 9
+#define BUNDLE_MIN_CAPACITY 256
+
+//one country's encoded ranges while a bundle is being written
+//next_start is the address after the last range, which the next range's start is encoded against
+typedef struct BundleCountry {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    uint32_t num_ranges;
+    unsigned __int128 next_start;
+} BundleCountry;
+
+size_t encode_varint(unsigned __int128 value, uint8_t *out);
+size_t decode_varint(const uint8_t *in, size_t len, unsigned __int128 *value);
+bool add_bundle_range(BundleCountry *country, uint8_t *start, uint8_t *end, size_t addr_bytes);
+bool write_bundle(FILE *out_file, int addr_family, BundleCountry *countries, char **country_codes, unsigned num_countries);
+bool decode_bundle_ranges(const uint8_t *data, size_t len, uint32_t num_ranges, size_t addr_bytes, uint8_t *out);
+void put_le32(uint8_t *p, uint32_t value);
+void put_le64(uint8_t *p, uint64_t value);
+uint32_t get_le32(const uint8_t *p);
+uint64_t get_le64(const uint8_t *p);
+
+#endif
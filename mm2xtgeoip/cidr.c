@@ -2,6 +2,10 @@
 #include <stdio.h>
 #endif
 
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
 #ifndef _STDINT_H
 #include <stdint.h>
 #endif
@@ -257,3 +261,74 @@ bool ranges_contiguous(AddressRange *range1, AddressRange *range2) {
     
     return false;
 }
+
+//splits the range from start to end into the fewest CIDR prefixes that cover it exactly
+//prefixes must have room for MAX_RANGE_PREFIXES entries
+//returns the number of prefixes, or 0 if the range is invalid
+unsigned range_to_prefixes(uint8_t *start, uint8_t *end, int addr_family, AddressRange *prefixes) {
+    unsigned __int128 first = 0;
+    unsigned __int128 last = 0;
+    unsigned __int128 host_mask;
+    size_t addr_bytes;
+    unsigned addr_bits;
+    unsigned host_bits;
+    unsigned num_prefixes = 0;
+    unsigned i;
+    AddressRange *prefix;
+    
+    if (addr_family == AF_INET) {
+        addr_bytes = IPV4_BYTES;
+    }
+    else if (addr_family == AF_INET6) {
+        addr_bytes = IPV6_BYTES;
+    }
+    else {
+        errno = 1;
+        return 0;
+    }
+    
+    addr_bits = addr_bytes * 8;
+    
+    //load the addresses as big-endian numbers
+    for (i = 0; i < addr_bytes; i++) {
+        first = (first << 8) | start[i];
+        last = (last << 8) | end[i];
+    }
+    
+    if (first > last) {
+        errno = 2;
+        return 0;
+    }
+    
+    for (;;) {
+        //the largest block aligned at first that doesn't go past last
+        for (host_bits = 0; host_bits < addr_bits && !((first >> host_bits) & 1); host_bits++);
+        for (;; host_bits--) {
+            host_mask = host_bits == 128 ? ~(unsigned __int128)0 : ((unsigned __int128)1 << host_bits) - 1;
+            if (host_mask <= last - first) {
+                break;
+            }
+        }
+        
+        prefix = &prefixes[num_prefixes++];
+        prefix->addr_family = addr_family;
+        prefix->addr_bytes = addr_bytes;
+        prefix->prefix_length = addr_bits - host_bits;
+        
+        for (i = 0; i < addr_bytes; i++) {
+            prefix->start[i] = first >> ((addr_bytes - 1 - i) * 8);
+            prefix->end[i] = (first | host_mask) >> ((addr_bytes - 1 - i) * 8);
+            prefix->mask[i] = ~host_mask >> ((addr_bytes - 1 - i) * 8);
+            prefix->base[i] = prefix->start[i];
+        }
+        
+        if ((first | host_mask) == last) {
+            break;
+        }
+        
+        first = (first | host_mask) + 1;
+    }
+    
+    errno = 0;
+    return num_prefixes;
+}
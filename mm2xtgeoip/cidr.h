@@ -3,6 +3,7 @@
 
 #define IPV4_BYTES 4
 #define IPV6_BYTES 16
+#define MAX_RANGE_PREFIXES (2 * 128)
 
 typedef struct AddressRange {
     int addr_family;
@@ -19,5 +20,6 @@ bool unparse_cidr(AddressRange *range, char *dest, size_t length);
 int compare_addrs(uint8_t *addr1, uint8_t *addr2, int addr_family);
 bool inc_addr(uint8_t *addr, int addr_family, int inc_dec);
 bool ranges_contiguous(AddressRange *range1, AddressRange *range2);
+unsigned range_to_prefixes(uint8_t *start, uint8_t *end, int addr_family, AddressRange *prefixes);
 
 #endif
@@ -0,0 +1,169 @@
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#ifndef _ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#include "cidr.h"
+#include "overlay.h"
+#include "compact.h"
+
+//a gap between 2 ranges of a country, by size for the --max-ranges budget
+typedef struct RangeGap {
+    unsigned __int128 size;
+    size_t pos;
+} RangeGap;
+
+//adds the built-in unroutable blocks to a pair of IPv4 and IPv6 overlay sets
+bool load_unroutable_cidrs(OverlaySet *sets) {
+    const char *CIDRS[] = UNROUTABLE_CIDRS;
+    char cidr[INET6_ADDRSTRLEN + 4];
+    AddressRange range;
+    unsigned i;
+    
+    for (i = 0; CIDRS[i] != NULL; i++) {
+        //parse_cidr needs a writable copy
+        strcpy(cidr, CIDRS[i]);
+        
+        if (!parse_cidr(cidr, &range) || !add_overlay_range(&sets[range.addr_family == AF_INET6], 0, range.start, range.end)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//checks whether every address between 2 ranges that don't touch is unroutable
+//the set must be prepared, so a gap can only be covered by a single range
+bool gap_unroutable(OverlaySet *unroutable, uint8_t *end, uint8_t *next_start) {
+    uint8_t gap_start[IPV6_BYTES];
+    uint8_t gap_end[IPV6_BYTES];
+    size_t start = 0;
+    size_t stop = unroutable->num_ranges;
+    size_t mid;
+    
+    next_addr(end, gap_start, unroutable->addr_bytes);
+    prev_addr(next_start, gap_end, unroutable->addr_bytes);
+    
+    //find the last unroutable range starting at or before the gap
+    while (start < stop) {
+        mid = start + (stop - start) / 2;
+        
+        if (memcmp(unroutable->ranges[mid].start, gap_start, unroutable->addr_bytes) <= 0) {
+            start = mid + 1;
+        }
+        else {
+            stop = mid;
+        }
+    }
+    
+    return start && memcmp(unroutable->ranges[start - 1].end, gap_end, unroutable->addr_bytes) >= 0;
+}
+
+static unsigned __int128 gap_size(uint8_t *end, uint8_t *next_start, size_t addr_bytes) {
+    unsigned __int128 end_addr = 0;
+    unsigned __int128 next_start_addr = 0;
+    size_t i;
+    
+    for (i = 0; i < addr_bytes; i++) {
+        end_addr = (end_addr << 8) | end[i];
+        next_start_addr = (next_start_addr << 8) | next_start[i];
+    }
+    
+    return next_start_addr - end_addr - 1;
+}
+
+//smallest gaps first, lower addresses first among equal ones
+static int compare_gaps(const void *gap1, const void *gap2) {
+    const RangeGap *g1 = gap1;
+    const RangeGap *g2 = gap2;
+    
+    if (g1->size != g2->size) {
+        return g1->size < g2->size ? -1 : 1;
+    }
+    
+    return g1->pos < g2->pos ? -1 : g1->pos > g2->pos;
+}
+
+//merges ranges that are separated only by unroutable addresses, then, if more than max_ranges remain
+//and max_ranges isn't 0, closes the smallest remaining gaps until max_ranges are left
+//ranges must be sorted and not touch each other, and are compacted in place
+//returns false if memory runs out, leaving the ranges as they were after the first step
+bool compact_ranges(OverlayRange *ranges, size_t *num_ranges, OverlaySet *unroutable, unsigned max_ranges) {
+    RangeGap *gaps;
+    bool *close_gap;
+    size_t addr_bytes = unroutable->addr_bytes;
+    size_t num_merged = 0;
+    size_t num_gaps;
+    size_t i;
+    
+    for (i = 0; i < *num_ranges; i++) {
+        if (num_merged && gap_unroutable(unroutable, ranges[num_merged - 1].end, ranges[i].start)) {
+            memcpy(ranges[num_merged - 1].end, ranges[i].end, addr_bytes);
+            continue;
+        }
+        
+        if (num_merged != i) {
+            ranges[num_merged] = ranges[i];
+        }
+        num_merged++;
+    }
+    
+    *num_ranges = num_merged;
+    
+    if (!max_ranges || *num_ranges <= max_ranges) {
+        return true;
+    }
+    
+    //gap i is the one before range i + 1
+    num_gaps = *num_ranges - 1;
+    gaps = malloc(num_gaps * sizeof(RangeGap));
+    close_gap = calloc(num_gaps, sizeof(bool));
+    if (gaps == NULL || close_gap == NULL) {
+        free(gaps);
+        free(close_gap);
+        return false;
+    }
+    
+    for (i = 0; i < num_gaps; i++) {
+        gaps[i].size = gap_size(ranges[i].end, ranges[i + 1].start, addr_bytes);
+        gaps[i].pos = i;
+    }
+    
+    qsort(gaps, num_gaps, sizeof(RangeGap), compare_gaps);
+    
+    for (i = 0; i < *num_ranges - max_ranges; i++) {
+        close_gap[gaps[i].pos] = true;
+    }
+    
+    num_merged = 1;
+    for (i = 1; i < *num_ranges; i++) {
+        if (close_gap[i - 1]) {
+            memcpy(ranges[num_merged - 1].end, ranges[i].end, addr_bytes);
+            continue;
+        }
+        
+        ranges[num_merged++] = ranges[i];
+    }
+    
+    *num_ranges = num_merged;
+    
+    free(gaps);
+    free(close_gap);
+    
+    return true;
+}
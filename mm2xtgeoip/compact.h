@@ -0,0 +1,19 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+//special-purpose and unallocated blocks that can't be the source of routable traffic
+//IPv4 from the IANA special-purpose registry, IPv6 everything outside the global unicast space
+//plus the special-purpose blocks within it
+#define UNROUTABLE_CIDRS { \
+    "0.0.0.0/8", "10.0.0.0/8", "100.64.0.0/10", "127.0.0.0/8", "169.254.0.0/16", "172.16.0.0/12", \
+    "192.0.0.0/24", "192.0.2.0/24", "192.168.0.0/16", "198.18.0.0/15", "198.51.100.0/24", \
+    "203.0.113.0/24", "224.0.0.0/4", "240.0.0.0/4", \
+    "::/3", "4000::/2", "8000::/1", "2001:2::/48", "2001:db8::/32", "3fff::/20", \
+    NULL \
+}
+
+bool load_unroutable_cidrs(OverlaySet *sets);
+bool gap_unroutable(OverlaySet *unroutable, uint8_t *end, uint8_t *next_start);
+bool compact_ranges(OverlayRange *ranges, size_t *num_ranges, OverlaySet *unroutable, unsigned max_ranges);
+
+#endif
@@ -6,6 +6,10 @@
 #include <string.h>
 #endif
 
+#ifndef _LIBC_LIMITS_H_
+#include <limits.h>
+#endif
+
 #include "csv.h"
 
 unsigned tokenize_csv(char *line, char **tokens, size_t max_columns) {
@@ -129,3 +133,132 @@ unsigned detect_columns(char **header, size_t header_size, const char **required
     
     return num_found;
 }
+
+//compiles the column positions of the required columns into a plan for decode_csv_fields
+//field i of the decoded line will be the column at column_positions[i]
+bool compile_parse_plan(ParsePlan *plan, unsigned *column_positions, size_t num_fields, unsigned highest_column) {
+    unsigned i;
+    
+    if (highest_column >= CSV_MAX_PLAN_COLUMNS) {
+        return false;
+    }
+    
+    plan->num_columns = highest_column + 1;
+    
+    for (i = 0; i < plan->num_columns; i++) {
+        plan->column_fields[i] = -1;
+    }
+    
+    for (i = 0; i < num_fields; i++) {
+        if (column_positions[i] > highest_column) {
+            return false;
+        }
+        
+        plan->column_fields[column_positions[i]] = i;
+    }
+    
+    return true;
+}
+
+//finds the fields wanted by a plan in a single pass over a line, without modifying it
+//scanning stops after the highest wanted column
+//returns the number of columns scanned, which is less than plan->num_columns if the line is short
+//quotes around a field are left out, doubled quotes inside it are not collapsed
+unsigned decode_csv_fields(char *line, ParsePlan *plan, CsvField *fields) {
+    char *p = line;
+    char *start;
+    char *end;
+    unsigned col;
+    int field;
+    
+    for (col = 0; col < plan->num_columns; ) {
+        if (*p == CSV_QUOTE) {
+            //quoted column, separators don't count until the closing quote
+            start = ++p;
+            for (; *p; p++) {
+                if (*p == CSV_QUOTE) {
+                    if (p[1] != CSV_QUOTE) {
+                        break;
+                    }
+                    
+                    p++;
+                }
+            }
+            
+            end = p;
+            
+            if (*p) {
+                p++;
+            }
+            
+            //anything between the closing quote and the separator is malformed, skip it
+            for (; *p && *p != CSV_SEPARATOR && *p != CSV_EOL; p++);
+        }
+        else {
+            start = p;
+            for (; *p && *p != CSV_SEPARATOR && *p != CSV_EOL; p++);
+            end = p;
+        }
+        
+        field = plan->column_fields[col];
+        if (field >= 0) {
+            fields[field].start = start;
+            fields[field].len = end - start;
+        }
+        
+        col++;
+        
+        if (*p != CSV_SEPARATOR) {
+            //end of line
+            break;
+        }
+        
+        p++;
+    }
+    
+    return col;
+}
+
+//finds the fields wanted by a plan like decode_csv_fields, but in a single line of len bytes that doesn't need to be NUL-terminated,
+//so a row can be looked at in the buffer it was read into before deciding whether to copy it
+//quoted columns need the full decoder, so this gives up on them by returning 0
+unsigned peek_csv_fields(char *line, size_t len, ParsePlan *plan, CsvField *fields) {
+    char *p = line;
+    char *line_end = line + len;
+    char *end;
+    unsigned col;
+    int field;
+    
+    //the line break isn't part of the last column
+    if (line_end > line && line_end[-1] == CSV_EOL) {
+        line_end--;
+    }
+    
+    for (col = 0; col < plan->num_columns; ) {
+        if (p < line_end && *p == CSV_QUOTE) {
+            return 0;
+        }
+        
+        end = memchr(p, CSV_SEPARATOR, line_end - p);
+        if (end == NULL) {
+            end = line_end;
+        }
+        
+        field = plan->column_fields[col];
+        if (field >= 0) {
+            fields[field].start = p;
+            fields[field].len = end - p;
+        }
+        
+        col++;
+        
+        if (end == line_end) {
+            //end of line
+            break;
+        }
+        
+        p = end + 1;
+    }
+    
+    return col;
+}
@@ -5,9 +5,59 @@
 #define CSV_QUOTE '"'
 #define CSV_EOL '\n'
 #define CSV_STRIP_EOL true
+#define CSV_MAX_PLAN_COLUMNS 64
+
+//a field inside a line, not NUL-terminated
+typedef struct CsvField {
+    char *start;
+    unsigned len;
+} CsvField;
+
+//which columns of a line are wanted, compiled from the positions found by detect_columns
+//column_fields maps each column up to the highest wanted one to its field, or -1 if unused
+typedef struct ParsePlan {
+    int column_fields[CSV_MAX_PLAN_COLUMNS];
+    unsigned num_columns;
+} ParsePlan;
 
 unsigned tokenize_csv(char *line, char **tokens, size_t max_columns);
 
 unsigned detect_columns(char **header, size_t header_size, const char **required_columns, unsigned *column_positions, size_t max_columns, unsigned *highest_column);
 
+bool compile_parse_plan(ParsePlan *plan, unsigned *column_positions, size_t num_fields, unsigned highest_column);
+
+unsigned decode_csv_fields(char *line, ParsePlan *plan, CsvField *fields);
+
+unsigned peek_csv_fields(char *line, size_t len, ParsePlan *plan, CsvField *fields);
+
+//parses the leading digits of a field, like strtoul but without needing a terminated string
+//returns false if the field doesn't start with a digit
+static inline bool csv_field_to_ulong(CsvField *field, unsigned long *value) {
+    const char *p = field->start;
+    const char *end = p + field->len;
+    unsigned long result = 0;
+    unsigned long digit;
+    unsigned digits = 0;
+    
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        digit = *p - '0';
+        if (result > (ULONG_MAX - digit) / 10) {
+            //saturate on overflow, as strtoul does
+            *value = ULONG_MAX;
+            return true;
+        }
+        
+        result = result * 10 + digit;
+    }
+    
+    *value = result;
+    
+    return digits > 0;
+}
+
+//a field is false if it's empty or "0", true otherwise
+static inline bool csv_field_to_bool(CsvField *field) {
+    return field->len > 1 || (field->len == 1 && field->start[0] != '0');
+}
+
 #endif
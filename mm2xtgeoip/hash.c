@@ -0,0 +1,185 @@
+#ifndef _STDIO_H_
+#include <stdio.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#ifndef _TIME_H
+#include <time.h>
+#endif
+
+#ifndef _PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "polite.h"
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+//reads little endian values regardless of the host's byte order
+static inline uint64_t read64(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t hash_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= hash_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+//consumes one 32 byte stripe
+static inline void hash_stripe(uint64_t *acc, const uint8_t *p) {
+    acc[0] = hash_round(acc[0], read64(p));
+    acc[1] = hash_round(acc[1], read64(p + 8));
+    acc[2] = hash_round(acc[2], read64(p + 16));
+    acc[3] = hash_round(acc[3], read64(p + 24));
+}
+
+void hash_init(HashState *state, uint64_t seed) {
+    state->total_len = 0;
+    state->acc[0] = seed + PRIME64_1 + PRIME64_2;
+    state->acc[1] = seed + PRIME64_2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - PRIME64_1;
+    state->buf_len = 0;
+    state->seed = seed;
+}
+
+//feeds data into the hash, can be called any number of times
+void hash_update(HashState *state, const void *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    size_t fill;
+    
+    state->total_len += len;
+    
+    //complete a stripe left over from the previous call
+    if (state->buf_len) {
+        fill = HASH_STRIPE_SIZE - state->buf_len;
+        if (len < fill) {
+            memcpy(state->buf + state->buf_len, p, len);
+            state->buf_len += len;
+            return;
+        }
+        
+        memcpy(state->buf + state->buf_len, p, fill);
+        hash_stripe(state->acc, state->buf);
+        p += fill;
+        state->buf_len = 0;
+    }
+    
+    //hash whole stripes straight from the input
+    for (; p + HASH_STRIPE_SIZE <= end; p += HASH_STRIPE_SIZE) {
+        hash_stripe(state->acc, p);
+    }
+    
+    //keep the remainder for later
+    if (p < end) {
+        memcpy(state->buf, p, end - p);
+        state->buf_len = end - p;
+    }
+}
+
+//returns the hash of everything fed so far
+uint64_t hash_final(HashState *state) {
+    const uint8_t *p = state->buf;
+    const uint8_t *end = p + state->buf_len;
+    uint64_t h;
+    
+    if (state->total_len >= HASH_STRIPE_SIZE) {
+        h = rotl64(state->acc[0], 1) + rotl64(state->acc[1], 7) +
+            rotl64(state->acc[2], 12) + rotl64(state->acc[3], 18);
+        h = hash_merge_round(h, state->acc[0]);
+        h = hash_merge_round(h, state->acc[1]);
+        h = hash_merge_round(h, state->acc[2]);
+        h = hash_merge_round(h, state->acc[3]);
+    }
+    else {
+        h = state->seed + PRIME64_5;
+    }
+    
+    h += state->total_len;
+    
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    
+    //final avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    
+    return h;
+}
+
+//hashes the contents of a file, read through polite_fopen unless io is NULL
+bool hash_file(char *file_name, uint64_t *hash, PoliteIo *io) {
+    FILE *file;
+    HashState state;
+    uint8_t buf[HASH_FILE_BUF_SIZE];
+    size_t len;
+    bool ok;
+    
+    file = io != NULL ? polite_fopen(io, file_name, "rb") : fopen(file_name, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    
+    hash_init(&state, 0);
+    
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        hash_update(&state, buf, len);
+    }
+    
+    ok = !ferror(file);
+    fclose(file);
+    
+    if (ok) {
+        *hash = hash_final(&state);
+    }
+    
+    return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#define HASH_STRIPE_SIZE 32
+#define HASH_FILE_BUF_SIZE 65536
+
+//streaming state for the 64-bit xxHash algorithm (XXH64)
+typedef struct HashState {
+    uint64_t total_len;
+    uint64_t acc[4];
+    uint8_t buf[HASH_STRIPE_SIZE];
+    size_t buf_len;
+    uint64_t seed;
+} HashState;
+
+//defined in polite.h
+struct PoliteIo;
+
+void hash_init(HashState *state, uint64_t seed);
+void hash_update(HashState *state, const void *data, size_t len);
+uint64_t hash_final(HashState *state);
+bool hash_file(char *file_name, uint64_t *hash, struct PoliteIo *io);
+
+#endif
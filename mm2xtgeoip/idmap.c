@@ -0,0 +1,121 @@
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#include "idmap.h"
+
+//spreads ids over the table, capacity is always a power of 2
+static inline size_t idmap_slot(uint64_t key, size_t capacity) {
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (key ^ (key >> 32)) & (capacity - 1);
+}
+
+static bool idmap_alloc(IdMap *map, size_t capacity) {
+    map->keys = calloc(capacity, sizeof(uint64_t));
+    map->values = malloc(capacity * sizeof(unsigned));
+    
+    if (map->keys == NULL || map->values == NULL) {
+        free(map->keys);
+        free(map->values);
+        return false;
+    }
+    
+    map->capacity = capacity;
+    map->size = 0;
+    
+    return true;
+}
+
+//doubles the table and reinserts everything
+static bool idmap_grow(IdMap *map) {
+    IdMap old = *map;
+    size_t i;
+    
+    if (!idmap_alloc(map, old.capacity * 2)) {
+        *map = old;
+        return false;
+    }
+    
+    for (i = 0; i < old.capacity; i++) {
+        if (old.keys[i]) {
+            idmap_put(map, old.keys[i], old.values[i]);
+        }
+    }
+    
+    free(old.keys);
+    free(old.values);
+    
+    return true;
+}
+
+//sizes the map so that expected_size ids fit without growing
+bool idmap_init(IdMap *map, size_t expected_size) {
+    size_t capacity = IDMAP_MIN_CAPACITY;
+    
+    while (capacity * IDMAP_MAX_LOAD_PERCENT / 100 < expected_size) {
+        capacity *= 2;
+    }
+    
+    return idmap_alloc(map, capacity);
+}
+
+//adds an id or replaces its value
+bool idmap_put(IdMap *map, uint64_t key, unsigned value) {
+    size_t i;
+    
+    if (!key) {
+        return false;
+    }
+    
+    if ((map->size + 1) * 100 > map->capacity * IDMAP_MAX_LOAD_PERCENT && !idmap_grow(map)) {
+        return false;
+    }
+    
+    for (i = idmap_slot(key, map->capacity); map->keys[i]; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == key) {
+            map->values[i] = value;
+            return true;
+        }
+    }
+    
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->size++;
+    
+    return true;
+}
+
+//looks up an id, returns false if it isn't in the map
+bool idmap_get(IdMap *map, uint64_t key, unsigned *value) {
+    size_t i;
+    
+    if (!key) {
+        return false;
+    }
+    
+    for (i = idmap_slot(key, map->capacity); map->keys[i]; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == key) {
+            *value = map->values[i];
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void idmap_free(IdMap *map) {
+    free(map->keys);
+    free(map->values);
+    map->keys = NULL;
+    map->values = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
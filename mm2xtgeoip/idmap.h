@@ -0,0 +1,21 @@
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#define IDMAP_MIN_CAPACITY 1024
+#define IDMAP_MAX_LOAD_PERCENT 70
+
+//open addressing hash map from nonzero 64-bit ids to unsigned values
+//key 0 marks empty slots and can't be stored
+typedef struct IdMap {
+    uint64_t *keys;
+    unsigned *values;
+    size_t capacity;
+    size_t size;
+} IdMap;
+
+bool idmap_init(IdMap *map, size_t expected_size);
+bool idmap_put(IdMap *map, uint64_t key, unsigned value);
+bool idmap_get(IdMap *map, uint64_t key, unsigned *value);
+void idmap_free(IdMap *map);
+
+#endif
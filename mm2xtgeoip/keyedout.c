@@ -0,0 +1,242 @@
+#ifndef _STDIO_H_
+#include <stdio.h>
+#endif
+
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#ifndef _ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#ifndef _TIME_H
+#include <time.h>
+#endif
+
+#ifndef _PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "cidr.h"
+#include "polite.h"
+#include "keyedout.h"
+
+bool init_keyed_outputs(KeyedOutputSet *set, char *directory, char *suffix, int addr_family, size_t max_pending_bytes, PoliteIo *io) {
+    set->outputs = NULL;
+    set->num_outputs = 0;
+    set->capacity = 0;
+    set->addr_family = addr_family;
+    set->addr_bytes = addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    set->pending_bytes = 0;
+    set->max_pending_bytes = max_pending_bytes;
+    set->directory = directory;
+    set->suffix = suffix;
+    set->io = io;
+    
+    set->file_name = malloc(strlen(directory) + 1 + KEYED_OUTPUT_NAME_SIZE + strlen(suffix) + 1);
+    if (set->file_name == NULL) {
+        return false;
+    }
+    
+    return true;
+}
+
+//adds an output file to the set, its index is stored in output
+//nothing is written until the output gets ranges
+bool add_keyed_output(KeyedOutputSet *set, char *name, unsigned *output) {
+    KeyedOutput *outputs;
+    unsigned capacity;
+    
+    if (strlen(name) >= KEYED_OUTPUT_NAME_SIZE) {
+        return false;
+    }
+    
+    if (set->num_outputs == set->capacity) {
+        capacity = set->capacity ? set->capacity * 2 : KEYED_OUTPUT_MIN_CAPACITY;
+        outputs = realloc(set->outputs, capacity * sizeof(KeyedOutput));
+        if (outputs == NULL) {
+            return false;
+        }
+        
+        set->outputs = outputs;
+        set->capacity = capacity;
+    }
+    
+    strcpy(set->outputs[set->num_outputs].name, name);
+    set->outputs[set->num_outputs].buf = NULL;
+    set->outputs[set->num_outputs].buf_len = 0;
+    set->outputs[set->num_outputs].buf_cap = 0;
+    set->outputs[set->num_outputs].created = false;
+    
+    *output = set->num_outputs++;
+    
+    return true;
+}
+
+//queues a range for an output, merging it with the previous one if they're contiguous
+//ranges must be added in ascending order for each output
+bool add_keyed_range(KeyedOutputSet *set, unsigned output, uint8_t *start, uint8_t *end) {
+    KeyedOutput *out = &set->outputs[output];
+    size_t pair_bytes = set->addr_bytes * 2;
+    uint8_t next[IPV6_BYTES];
+    uint8_t *buf;
+    size_t buf_cap;
+    
+    //merge with the last range?
+    if (out->buf_len) {
+        memcpy(next, out->buf + out->buf_len - set->addr_bytes, set->addr_bytes);
+        inc_addr(next, set->addr_family, 1);
+        
+        if (memcmp(next, start, set->addr_bytes) == 0) {
+            //overwrite previous end address with current end address
+            memcpy(out->buf + out->buf_len - set->addr_bytes, end, set->addr_bytes);
+            return true;
+        }
+    }
+    
+    if (out->buf_len + pair_bytes > out->buf_cap) {
+        buf_cap = out->buf_cap ? out->buf_cap * 2 : pair_bytes * 4;
+        buf = realloc(out->buf, buf_cap);
+        if (buf == NULL) {
+            return false;
+        }
+        
+        out->buf = buf;
+        out->buf_cap = buf_cap;
+    }
+    
+    //the last range of each output isn't flushable, so it doesn't count towards the budget
+    if (out->buf_len) {
+        set->pending_bytes += pair_bytes;
+    }
+    
+    memcpy(out->buf + out->buf_len, start, set->addr_bytes);
+    memcpy(out->buf + out->buf_len + set->addr_bytes, end, set->addr_bytes);
+    out->buf_len += pair_bytes;
+    
+    if (set->pending_bytes > set->max_pending_bytes) {
+        return flush_keyed_outputs(set, false);
+    }
+    
+    return true;
+}
+
+//sorts outputs by the size of their buffers, largest first
+static int compare_buffered_outputs(const void *output1, const void *output2) {
+    const KeyedOutput *out1 = *(KeyedOutput * const *)output1;
+    const KeyedOutput *out2 = *(KeyedOutput * const *)output2;
+    
+    if (out1->buf_len != out2->buf_len) {
+        return out1->buf_len < out2->buf_len ? 1 : -1;
+    }
+    
+    return out1 < out2 ? -1 : out1 > out2;
+}
+
+//appends the queued ranges of one output to its file
+static bool flush_keyed_output(KeyedOutputSet *set, KeyedOutput *out, bool final) {
+    FILE *file;
+    size_t pair_bytes = set->addr_bytes * 2;
+    size_t write_len;
+    bool ok;
+    
+    write_len = out->buf_len;
+    if (!final && write_len) {
+        write_len -= pair_bytes;
+    }
+    
+    if (!write_len) {
+        return true;
+    }
+    
+    strcpy(set->file_name, set->directory);
+    strcat(set->file_name, "/");
+    strcat(set->file_name, out->name);
+    strcat(set->file_name, set->suffix);
+    
+    //truncate files on the first write, append afterwards
+    file = polite_fopen(set->io, set->file_name, out->created ? "ab" : "wb");
+    if (file == NULL) {
+        return false;
+    }
+    
+    ok = fwrite(out->buf, write_len, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        return false;
+    }
+    
+    out->created = true;
+    
+    //keep what wasn't written at the beginning of the buffer
+    memmove(out->buf, out->buf + write_len, out->buf_len - write_len);
+    out->buf_len -= write_len;
+    set->pending_bytes -= final ? write_len - pair_bytes : write_len;
+    
+    return true;
+}
+
+//appends queued ranges to their files, opening one file at a time
+//unless final is true, the last range of each output is kept for merging
+//and only the largest buffers are written, until half of the budget is free
+bool flush_keyed_outputs(KeyedOutputSet *set, bool final) {
+    KeyedOutput **by_size;
+    unsigned i;
+    bool ok = true;
+    
+    if (final) {
+        for (i = 0; i < set->num_outputs && ok; i++) {
+            ok = flush_keyed_output(set, &set->outputs[i], true);
+        }
+        
+        return ok;
+    }
+    
+    by_size = malloc(set->num_outputs * sizeof(KeyedOutput *));
+    if (by_size == NULL) {
+        return false;
+    }
+    
+    for (i = 0; i < set->num_outputs; i++) {
+        by_size[i] = &set->outputs[i];
+    }
+    
+    qsort(by_size, set->num_outputs, sizeof(KeyedOutput *), compare_buffered_outputs);
+    
+    for (i = 0; i < set->num_outputs && ok && set->pending_bytes > set->max_pending_bytes / 2; i++) {
+        ok = flush_keyed_output(set, by_size[i], false);
+    }
+    
+    free(by_size);
+    
+    return ok;
+}
+
+void free_keyed_outputs(KeyedOutputSet *set) {
+    unsigned i;
+    
+    for (i = 0; i < set->num_outputs; i++) {
+        free(set->outputs[i].buf);
+    }
+    
+    free(set->outputs);
+    free(set->file_name);
+    
+    set->outputs = NULL;
+    set->file_name = NULL;
+    set->num_outputs = 0;
+    set->capacity = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef KEYEDOUT_H
+#define KEYEDOUT_H
+
+#define KEYED_OUTPUT_NAME_SIZE 16
+#define KEYED_OUTPUT_MAX_PENDING (64 * 1024 * 1024)
+#define KEYED_OUTPUT_MIN_CAPACITY 256
+
+//ranges waiting to be appended to one output file
+//the last range is always kept in memory so that it can still be merged with the next one
+typedef struct KeyedOutput {
+    char name[KEYED_OUTPUT_NAME_SIZE];
+    uint8_t *buf;
+    size_t buf_len;
+    size_t buf_cap;
+    bool created;
+} KeyedOutput;
+
+//a set of output files, one per key, written in the same format as the country files
+//only one file is open at any time, so the number of outputs isn't limited by file descriptors
+typedef struct KeyedOutputSet {
+    KeyedOutput *outputs;
+    unsigned num_outputs;
+    unsigned capacity;
+    int addr_family;
+    size_t addr_bytes;
+    size_t pending_bytes;
+    size_t max_pending_bytes;
+    char *directory;
+    char *suffix;
+    char *file_name;
+    PoliteIo *io;
+} KeyedOutputSet;
+
+bool init_keyed_outputs(KeyedOutputSet *set, char *directory, char *suffix, int addr_family, size_t max_pending_bytes, PoliteIo *io);
+bool add_keyed_output(KeyedOutputSet *set, char *name, unsigned *output);
+bool add_keyed_range(KeyedOutputSet *set, unsigned output, uint8_t *start, uint8_t *end);
+bool flush_keyed_outputs(KeyedOutputSet *set, bool final);
+void free_keyed_outputs(KeyedOutputSet *set);
+
+#endif
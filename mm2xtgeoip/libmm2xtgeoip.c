@@ -0,0 +1,4553 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "csv.h"
+#include "cidr.h"
+#include "idmap.h"
+#include "polite.h"
+#include "keyedout.h"
+#include "overlay.h"
+#include "compact.h"
+#include "hash.h"
+#include "bundle.h"
+#include "simulate.h"
+#include "sweep.h"
+#include "libmm2xtgeoip.h"
+#include "libmm2xtgeoip_private.h"
+#include "patch.h"
+#include "probes.h"
+
+
+
+//country subdivisions from a city locations file
+//city_index maps city geoname_ids to subdivisions, key_index maps packed keys to subdivisions
+typedef struct Subdivisions {
+    IdMap city_index;
+    IdMap key_index;
+    char (*names)[KEYED_OUTPUT_NAME_SIZE];
+    unsigned num_subdivisions;
+    unsigned capacity;
+} Subdivisions;
+
+//state of a range file being pushed through geoip_feed_ranges
+//the last range is held back until it's known that the next one can't be merged with it
+//forbidden_ids is a bitmap of the geoname_ids of forbidden countries below num_forbidden_ids, whose rows are skipped undecoded
+typedef struct RangeParser {
+    int addr_family;
+    GeoipRangeCallback callback;
+    void *user_data;
+    char line[MAX_LINE];
+    size_t line_len;
+    unsigned line_num;
+    unsigned highest_col;
+    unsigned num_ranges;
+    ParsePlan plan;
+    bool active;
+    bool failed;
+    Country *pending_country;
+    AddressRange pending_range;
+    uint8_t *forbidden_ids;
+    size_t forbidden_ids_size;
+    unsigned long num_forbidden_ids;
+} RangeParser;
+
+//where a country is in the overlay pipeline of the range file being processed
+//the last range is held back until it's known that no later range touches it
+typedef struct OverlayState {
+    size_t inclusion_pos;
+    bool held;
+    uint8_t held_start[IPV6_BYTES];
+    uint8_t held_end[IPV6_BYTES];
+} OverlayState;
+
+struct GeoipContext {
+    Country *countries;
+    Country **country_code_lookup;
+    unsigned num_countries;
+    unsigned long cached_geoname_id;
+    Country *cached_country;
+    bool cache_valid;
+    Subdivisions subdivisions;
+    bool have_subdivisions;
+    RangeParser parser;
+    GeoipCountryStats *stats;
+    GeoipRouteStats route_stats;
+    GeoipCombinedStats combined_stats;
+    OverlayState *overlay_states;
+    unsigned stats_capacity;
+    OverlaySet exclusions[2];
+    OverlaySet inclusions[2];
+    OverlaySet *family_exclusions;
+    OverlaySet *family_inclusions;
+    size_t exclusion_pos;
+    bool use_overlays;
+    OverlaySet unroutable[2];
+    bool have_unroutable;
+    OverlaySet compaction_buffer;
+    bool compact;
+    unsigned max_ranges;
+    bool report;
+    SweepSet sources[2];
+    uint16_t num_sources;
+    SweepSet sweep;
+    PoliteIo polite;
+    PoliteSched sched;
+    char *err_msg;
+    char err_msg_buf[MAX_ERR_MSG];
+};
+
+//output files of a sink, indexed by country position
+//num_prefixes counts the entries written to each file in formats that need prefixes
+//formats writing all countries to one file use set_file, with set_indexes giving each of the num_set_countries its index in it,
+//set_values holding the LPM values that go after the keys and bundle_countries the encoded bundle ranges
+//GEOIP_FORMAT_CODEGEN resolves the ranges of all countries in intervals, then writes them from collected to set_file and its header to aux_files[0]
+//GEOIP_FORMAT_ROUTES writes BIRD routes to set_file and FRR routes and prefix lists to aux_files,
+//and GEOIP_FORMAT_COMBINED its set to set_file and the match selecting the countries to aux_files[0],
+//but only once the ranges of all countries have been collected and merged
+typedef struct RangeWriter {
+    FILE **out_files;
+    unsigned *num_prefixes;
+    FILE *set_file;
+    uint16_t *set_indexes;
+    unsigned num_set_countries;
+    uint16_t *set_values;
+    unsigned num_set_values;
+    unsigned set_values_capacity;
+    BundleCountry *bundle_countries;
+    char **bundle_codes;
+    FILE *aux_files[2];
+    OverlaySet collected;
+    SweepSet intervals;
+    unsigned num_route_prefixes;
+    GeoipRouteStats route_stats;
+    GeoipCombinedStats combined_stats;
+} RangeWriter;
+
+typedef struct RangeSink RangeSink;
+
+//how a sink writes one of the GEOIP_FORMAT_* formats
+//open creates the files before parsing starts, write_range gets each coalesced range as it's parsed,
+//and finish, if any, completes the files once all ranges are in
+typedef struct SinkFormat {
+    char *name;
+    bool (*open)(GeoipContext *ctx, RangeSink *sink);
+    GeoipRangeCallback write_range;
+    bool (*finish)(GeoipContext *ctx, RangeSink *sink);
+    void (*discard)(RangeSink *sink);
+} SinkFormat;
+
+//an output of geoip_process_range_outputs: the files of one format in one directory
+struct RangeSink {
+    GeoipContext *ctx;
+    const SinkFormat *format;
+    char *directory;
+    int addr_family;
+    RangeWriter writer;
+};
+
+//the sinks a range file is parsed into
+typedef struct SinkSet {
+    RangeSink *sinks;
+    unsigned num_sinks;
+} SinkSet;
+
+
+GeoipContext *geoip_new_context(void) {
+    GeoipContext *ctx;
+    
+    ctx = calloc(1, sizeof(GeoipContext));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    
+    init_polite_io(&ctx->polite);
+    init_polite_sched(&ctx->sched);
+    
+    ctx->countries = malloc(GEOIP_MAX_COUNTRIES * sizeof(Country));
+    ctx->country_code_lookup = calloc(GEOIP_MAX_COUNTRIES, sizeof(Country *));
+    
+    if (ctx->countries == NULL || ctx->country_code_lookup == NULL) {
+        geoip_free_context(ctx);
+        return NULL;
+    }
+    
+    init_overlay_set(&ctx->exclusions[0], IPV4_BYTES);
+    init_overlay_set(&ctx->exclusions[1], IPV6_BYTES);
+    init_overlay_set(&ctx->inclusions[0], IPV4_BYTES);
+    init_overlay_set(&ctx->inclusions[1], IPV6_BYTES);
+    init_overlay_set(&ctx->unroutable[0], IPV4_BYTES);
+    init_overlay_set(&ctx->unroutable[1], IPV6_BYTES);
+    init_overlay_set(&ctx->compaction_buffer, IPV4_BYTES);
+    init_sweep_set(&ctx->sources[0], IPV4_BYTES);
+    init_sweep_set(&ctx->sources[1], IPV6_BYTES);
+    init_sweep_set(&ctx->sweep, IPV4_BYTES);
+    
+    return ctx;
+}
+
+void geoip_free_context(GeoipContext *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    
+    if (ctx->have_subdivisions) {
+        idmap_free(&ctx->subdivisions.city_index);
+        idmap_free(&ctx->subdivisions.key_index);
+        free(ctx->subdivisions.names);
+    }
+    
+    geoip_clear_overlays(ctx);
+    free_overlay_set(&ctx->unroutable[0]);
+    free_overlay_set(&ctx->unroutable[1]);
+    free_overlay_set(&ctx->compaction_buffer);
+    geoip_clear_sources(ctx);
+    free_sweep_set(&ctx->sweep);
+    free_polite_io(&ctx->polite);
+    free_polite_sched(&ctx->sched);
+    
+    free(ctx->parser.forbidden_ids);
+    free(ctx->stats);
+    free(ctx->overlay_states);
+    free(ctx->countries);
+    free(ctx->country_code_lookup);
+    free(ctx);
+}
+
+//returns the message of the last error, or NULL if the last operation succeeded
+char *geoip_error(GeoipContext *ctx) {
+    return ctx->err_msg;
+}
+
+//adds a line number to the current error message
+static void add_line_to_error(GeoipContext *ctx, unsigned line_num) {
+    if (ctx->err_msg != ctx->err_msg_buf) {
+        snprintf(ctx->err_msg_buf, MAX_ERR_MSG, "%s (Line %u)", ctx->err_msg, line_num);
+        ctx->err_msg = ctx->err_msg_buf;
+    }
+}
+
+//checks whether a geoname_id is reserved for internal use by the library
+static inline bool geoname_id_reserved(unsigned long geoname_id) {
+    if (geoname_id == PROXY_GEONAME_ID || geoname_id == SAT_GEONAME_ID ||
+        geoname_id == OTHER_GEONAME_ID) {
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+//searches for a country in the context's countries by geoname_id
+static inline Country *get_country(GeoipContext *ctx, unsigned long geoname_id, bool proxy, bool sat) {
+    unsigned start = 0;
+    unsigned mid;
+    unsigned end = ctx->num_countries;
+    Country *countries = ctx->countries;
+    
+    if (proxy) {
+        geoname_id = PROXY_GEONAME_ID;
+    }
+    else if (sat) {
+        geoname_id = SAT_GEONAME_ID;
+    }
+    else if (!geoname_id) {
+        geoname_id = OTHER_GEONAME_ID;
+    }
+    
+    //ranges for a particular country are often contiguous
+    //caching the last country might save some time
+    if (ctx->cache_valid && geoname_id == ctx->cached_geoname_id) {
+        return ctx->cached_country;
+    }
+    
+    ctx->cached_geoname_id = geoname_id;
+    ctx->cache_valid = true;
+    
+    //the countries are sorted, so use binary search
+    //end is one past the last candidate, so it can't wrap around below the first country
+    while (start < end) {
+        mid = start + (end - start) / 2;
+        
+        if (countries[mid].geoname_id == geoname_id) {
+            //found
+            ctx->cached_country = &countries[mid];
+            return ctx->cached_country;
+        }
+        
+        if (countries[mid].geoname_id < geoname_id) {
+            start = mid + 1;
+        }
+        else {
+            end = mid;
+        }
+    }
+    
+    //not found
+    ctx->cached_country = NULL;
+    return NULL;
+}
+
+Country *find_country(GeoipContext *ctx, unsigned long geoname_id, bool proxy, bool sat) {
+    return get_country(ctx, geoname_id, proxy, sat);
+}
+
+void reset_country_cache(GeoipContext *ctx) {
+    ctx->cache_valid = false;
+}
+
+
+static unsigned read_country_file(GeoipContext *ctx, char *country_file_name) {
+    const unsigned MIN_COLS = 3;
+    const unsigned GEONAME_ID_COL_IDX = 0;
+    const unsigned CONTINENT_CODE_COL_IDX = 1;
+    const unsigned COUNTRY_CODE_COL_IDX = 2;
+    const char* REQUIRED_COLS[] = {
+        "geoname_id",
+        "continent_code",
+        "country_iso_code"
+    };
+    
+    FILE *country_file;
+    Country *countries;
+    Country **country_code_lookup;
+    char line[MAX_LINE];
+    char *line_data[MAX_COLS];
+    char *country_code;
+    unsigned num_cols;
+    unsigned highest_col;
+    unsigned geoname_id_col;
+    unsigned continent_code_col;
+    unsigned country_code_col;
+    unsigned line_num = 0;
+    unsigned num_countries = 0;
+    unsigned column_positions[MIN_COLS];
+    unsigned long last_geoname_id = 0;
+    unsigned long geoname_id;
+    uint16_t country_pos;
+    
+    //the table is read into new arrays, so that a file that can't be used leaves the previous one in place
+    countries = malloc(GEOIP_MAX_COUNTRIES * sizeof(Country));
+    country_code_lookup = calloc(GEOIP_MAX_COUNTRIES, sizeof(Country *));
+    if (countries == NULL || country_code_lookup == NULL) {
+        free(countries);
+        free(country_code_lookup);
+        ctx->err_msg = "Error allocating buffers.";
+        return 0;
+    }
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    country_file = polite_fopen(&ctx->polite, country_file_name, "r");
+    if (country_file == NULL) {
+        free(countries);
+        free(country_code_lookup);
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    PROBE1(country_file_open, country_file_name);
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_LINE, country_file) == NULL) {
+            //could be an error or could be eof
+            if (ferror(country_file)) {
+                ctx->err_msg = "Read error.";
+                num_countries = 0;
+            }
+            goto end;
+        }
+        
+        if (line_num == GEOIP_MAX_COUNTRIES) {
+            ctx->err_msg = "File too long.";
+            num_countries = 0;
+            goto end;
+        }
+        
+        switch (strlen(line)) {
+            case 0:
+                //skip empty lines
+                continue;
+            
+            case MAX_LINE - 1:
+                ctx->err_msg = "Line too long.";
+                num_countries = 0;
+                goto end;
+        }
+        
+        num_cols = tokenize_csv(line, line_data, MAX_COLS);
+        
+        if (line_num == 1) {
+            //this is the header, find the position of the required columns
+            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
+                ctx->err_msg = "Required columns not found in header.";
+                num_countries = 0;
+                goto end;
+            }
+            
+            PROBE2(country_header, num_cols, highest_col);
+            
+            geoname_id_col = column_positions[GEONAME_ID_COL_IDX];
+            continent_code_col = column_positions[CONTINENT_CODE_COL_IDX];
+            country_code_col = column_positions[COUNTRY_CODE_COL_IDX];
+            
+            //nothing else to do with the header, move on to the next line
+            continue;
+        }
+        
+        if (num_cols < highest_col + 1) {
+            ctx->err_msg = "Insufficient columns.";
+            num_countries = 0;
+            goto end;
+        }
+        
+        geoname_id = strtoul(line_data[geoname_id_col], NULL, 10);
+        if (geoname_id <= last_geoname_id) {
+            ctx->err_msg = "Invalid, duplicate, or unsorted geoname_id.";
+            num_countries = 0;
+            goto end;
+        }
+        
+        if (geoname_id_reserved(geoname_id)) {
+            ctx->err_msg = "Reserved geoname_id.";
+            num_countries = 0;
+            goto end;
+        }
+        
+        //country code may be empty
+        //if so, use continent code
+        if (line_data[country_code_col][0]) {
+            country_code = line_data[country_code_col];
+        }
+        else {
+            country_code = line_data[continent_code_col];
+        }
+        
+        country_pos = country_code_pos(country_code);
+        if (!country_pos) {
+            //invalid country code, skip line
+            continue;
+        }
+        
+        if (country_code_lookup[country_pos] != NULL) {
+            //duplicate country code, skip line
+            continue;
+        }
+        
+        //store data
+        countries[num_countries].geoname_id = geoname_id;
+        strcpy(countries[num_countries].country_code, country_code);
+        countries[num_countries].forbidden = false;
+        country_code_lookup[country_pos] = &countries[num_countries];
+        
+        num_countries++;
+    }
+    
+    end:
+    
+    fclose(country_file);
+    
+    PROBE2(country_file_close, country_file_name, num_countries);
+    
+    if (num_countries) {
+        //clear default error message
+        ctx->err_msg = NULL;
+        
+        free(ctx->countries);
+        free(ctx->country_code_lookup);
+        ctx->countries = countries;
+        ctx->country_code_lookup = country_code_lookup;
+        ctx->num_countries = num_countries;
+        ctx->cache_valid = false;
+    }
+    else {
+        free(countries);
+        free(country_code_lookup);
+        
+        if (line_num) {
+            add_line_to_error(ctx, line_num);
+        }
+    }
+    
+    return num_countries;
+}
+
+//replaces the context's countries with data from a country file
+//a file that can't be used leaves the countries read before, along with their filtering and virtual countries
+unsigned geoip_read_country_file(GeoipContext *ctx, char *country_file_name) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = read_country_file(ctx, country_file_name);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//adds a virtual country to the context
+static void add_virtual_country(GeoipContext *ctx, unsigned long geoname_id, char *country_code) {
+    Country *country = &ctx->countries[ctx->num_countries];
+    
+    country->geoname_id = geoname_id;
+    strcpy(country->country_code, country_code);
+    country->forbidden = false;
+    ctx->country_code_lookup[country_code_pos(country_code)] = country;
+    
+    ctx->num_countries++;
+}
+
+//adds virtual countries (proxies, sat providers, and unknown ranges) to the context
+//because virtual countries have very high geoname_ids, this should be called only after reading a country file
+unsigned geoip_add_virtual_countries(GeoipContext *ctx) {
+    //add proxies (A1)
+    add_virtual_country(ctx, PROXY_GEONAME_ID, PROXY_COUNTRY_CODE);
+    
+    //add sat providers (A2)
+    add_virtual_country(ctx, SAT_GEONAME_ID, SAT_COUNTRY_CODE);
+    
+    //add unknown ranges (O1)
+    add_virtual_country(ctx, OTHER_GEONAME_ID, OTHER_COUNTRY_CODE);
+    
+    ctx->cache_valid = false;
+    
+    return 3;
+}
+
+//sets or clears the forbidden attribute of countries specified by a 0-terminated array of country positions
+//if forbid is true, only the countries specified are forbidden
+//else, only those are allowed
+unsigned geoip_set_filtered_countries(GeoipContext *ctx, uint16_t *country_positions, bool forbid) {
+    Country **country_code_lookup = ctx->country_code_lookup;
+    unsigned i;
+    unsigned processed = 0;
+    uint16_t country_pos;
+    
+    if (!ctx->num_countries) {
+        //nothing to do
+        return 0;
+    }
+    
+    //start from a clean slate, so that filters can be set again
+    for (i = 0; i < ctx->num_countries; i++) {
+        ctx->countries[i].forbidden = !forbid;
+    }
+    
+    i = 0;
+    country_pos = country_positions[0];
+    for (; country_pos != 0; country_pos = country_positions[++i]) {
+        if (country_code_lookup[country_pos] == NULL) {
+            //country_positions may contain positions for unknown country codes
+            continue;
+        }
+        
+        if (country_code_lookup[country_pos]->forbidden != forbid) {
+            //country_positions may contain duplicates
+            country_code_lookup[country_pos]->forbidden = forbid;
+            processed++;
+        }
+    }
+    
+    return processed;
+}
+
+//parses a comma-separated list of country codes into a 0-terminated array of country positions
+//the list is modified in the process
+unsigned geoip_parse_country_code_list(char *country_codes, uint16_t *country_positions) {
+    char **parsed_country_codes;
+    unsigned num_countries;
+    unsigned i;
+    
+    parsed_country_codes = malloc(GEOIP_MAX_COUNTRIES * sizeof(char *));
+    if (parsed_country_codes == NULL) {
+        *country_positions = 0;
+        return 0;
+    }
+    
+    num_countries = tokenize_csv(country_codes, parsed_country_codes, GEOIP_MAX_COUNTRIES);
+    
+    for (i = 0; i < num_countries; i++) {
+        *country_positions = country_code_pos(parsed_country_codes[i]);
+        
+        //ensure only valid country codes are left in the array
+        if (*country_positions) {
+            country_positions++;
+        }
+    }
+    *country_positions = 0;
+    
+    free(parsed_country_codes);
+    
+    return num_countries;
+}
+
+//reads a file of CIDRs, one per line, into a pair of IPv4 and IPv6 overlay sets
+//empty lines and lines starting with # are ignored
+//returns the number of CIDRs read
+static unsigned read_cidr_file(GeoipContext *ctx, char *overlay_file_name, OverlaySet *sets, uint16_t country_pos) {
+    FILE *overlay_file;
+    char line[MAX_LINE];
+    char *cidr;
+    char *cidr_end;
+    unsigned line_num = 0;
+    unsigned num_cidrs = 0;
+    AddressRange range;
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    overlay_file = polite_fopen(&ctx->polite, overlay_file_name, "r");
+    if (overlay_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_LINE, overlay_file) == NULL) {
+            //could be an error or could be eof
+            if (ferror(overlay_file)) {
+                ctx->err_msg = "Read error.";
+                num_cidrs = 0;
+            }
+            goto end;
+        }
+        
+        if (strlen(line) == MAX_LINE - 1) {
+            ctx->err_msg = "Line too long.";
+            num_cidrs = 0;
+            goto end;
+        }
+        
+        //trim surrounding whitespace
+        for (cidr = line; isspace((unsigned char)*cidr); cidr++);
+        for (cidr_end = cidr + strlen(cidr); cidr_end > cidr && isspace((unsigned char)cidr_end[-1]); cidr_end--);
+        *cidr_end = '\0';
+        
+        if (!cidr[0] || cidr[0] == '#') {
+            //skip empty lines and comments
+            continue;
+        }
+        
+        if (!parse_cidr(cidr, &range)) {
+            ctx->err_msg = "Invalid CIDR.";
+            num_cidrs = 0;
+            goto end;
+        }
+        
+        if (!add_overlay_range(&sets[range.addr_family == AF_INET6], country_pos, range.start, range.end)) {
+            ctx->err_msg = "Error allocating overlay.";
+            num_cidrs = 0;
+            goto end;
+        }
+        
+        num_cidrs++;
+    }
+    
+    end:
+    
+    fclose(overlay_file);
+    
+    if (num_cidrs) {
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else if (line_num) {
+        add_line_to_error(ctx, line_num);
+    }
+    
+    return num_cidrs;
+}
+
+static unsigned read_overlay_file(GeoipContext *ctx, char *overlay_file_name, char *country_code) {
+    uint16_t country_pos;
+    
+    if (country_code == NULL) {
+        return read_cidr_file(ctx, overlay_file_name, ctx->exclusions, 0);
+    }
+    
+    country_pos = country_code_pos(country_code);
+    if (!country_pos || (ctx->num_countries && ctx->country_code_lookup[country_pos] == NULL)) {
+        ctx->err_msg = "Unknown country code.";
+        return 0;
+    }
+    
+    return read_cidr_file(ctx, overlay_file_name, ctx->inclusions, country_pos);
+}
+
+//reads a file of CIDRs, one per line, to be punched out of every country (country_code NULL)
+//or added to one country's ranges (country_code set) in the following range files
+//returns the number of CIDRs read
+unsigned geoip_read_overlay_file(GeoipContext *ctx, char *overlay_file_name, char *country_code) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = read_overlay_file(ctx, overlay_file_name, country_code);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+static unsigned read_delegated_file(GeoipContext *ctx, char *delegated_file_name, int priority) {
+    const unsigned MIN_FIELDS = 7;
+    const unsigned CC_FIELD_IDX = 1;
+    const unsigned TYPE_FIELD_IDX = 2;
+    const unsigned START_FIELD_IDX = 3;
+    const unsigned VALUE_FIELD_IDX = 4;
+    const unsigned STATUS_FIELD_IDX = 6;
+    
+    FILE *delegated_file;
+    char line[MAX_LINE];
+    char cidr[MAX_LINE];
+    char *fields[MAX_COLS];
+    char *field;
+    char *next;
+    char *line_end;
+    char *value_end;
+    unsigned num_fields;
+    unsigned line_num;
+    unsigned num_records = 0;
+    unsigned long count;
+    uint32_t start;
+    uint32_t end;
+    size_t num_intervals[2] = {ctx->sources[0].num_intervals, ctx->sources[1].num_intervals};
+    AddressRange range;
+    Country *country;
+    bool ipv6;
+    int i;
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    if (ctx->num_sources == UINT16_MAX) {
+        ctx->err_msg = "Too many sources.";
+        return 0;
+    }
+    
+    delegated_file = polite_fopen(&ctx->polite, delegated_file_name, "r");
+    if (delegated_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_LINE, delegated_file) == NULL) {
+            //could be an error or could be eof
+            if (ferror(delegated_file)) {
+                ctx->err_msg = "Read error.";
+                num_records = 0;
+            }
+            goto end;
+        }
+        
+        if (strlen(line) == MAX_LINE - 1) {
+            ctx->err_msg = "Line too long.";
+            num_records = 0;
+            goto end;
+        }
+        
+        for (line_end = line + strlen(line); line_end > line && isspace((unsigned char)line_end[-1]); line_end--);
+        *line_end = '\0';
+        
+        if (!line[0] || line[0] == '#') {
+            //skip empty lines and comments
+            continue;
+        }
+        
+        for (num_fields = 0, field = line; field != NULL && num_fields < MAX_COLS; field = next) {
+            next = strchr(field, '|');
+            if (next != NULL) {
+                *next++ = '\0';
+            }
+            
+            fields[num_fields++] = field;
+        }
+        
+        //the version line starts with the format version, summary lines are shorter than records
+        if (num_fields < MIN_FIELDS || isdigit((unsigned char)fields[0][0])) {
+            continue;
+        }
+        
+        //ASNs and addresses that are available or reserved have no country
+        if ((strcmp(fields[TYPE_FIELD_IDX], "ipv4") != 0 && strcmp(fields[TYPE_FIELD_IDX], "ipv6") != 0) ||
+            (strcmp(fields[STATUS_FIELD_IDX], "allocated") != 0 && strcmp(fields[STATUS_FIELD_IDX], "assigned") != 0)) {
+            continue;
+        }
+        
+        ipv6 = strcmp(fields[TYPE_FIELD_IDX], "ipv6") == 0;
+        
+        //IPv6 records give a prefix length, IPv4 records a number of addresses that needn't make a CIDR
+        count = strtoul(fields[VALUE_FIELD_IDX], &value_end, 10);
+        if (value_end == fields[VALUE_FIELD_IDX] || *value_end) {
+            ctx->err_msg = "Invalid record.";
+            num_records = 0;
+            goto end;
+        }
+        
+        if (ipv6) {
+            snprintf(cidr, sizeof(cidr), "%s/%s", fields[START_FIELD_IDX], fields[VALUE_FIELD_IDX]);
+            if (!parse_cidr(cidr, &range) || range.addr_family != AF_INET6) {
+                ctx->err_msg = "Invalid record.";
+                num_records = 0;
+                goto end;
+            }
+        }
+        else {
+            memset(&range, 0, sizeof(AddressRange));
+            if (inet_pton(AF_INET, fields[START_FIELD_IDX], range.start) != 1) {
+                ctx->err_msg = "Invalid record.";
+                num_records = 0;
+                goto end;
+            }
+            
+            start = (uint32_t)range.start[0] << 24 | range.start[1] << 16 | range.start[2] << 8 | range.start[3];
+            if (!count || count - 1 > UINT32_MAX - start) {
+                ctx->err_msg = "Invalid record.";
+                num_records = 0;
+                goto end;
+            }
+            
+            end = start + (uint32_t)(count - 1);
+            for (i = IPV4_BYTES - 1; i >= 0; i--, end >>= 8) {
+                range.end[i] = end & 0xff;
+            }
+        }
+        
+        country = ctx->country_code_lookup[country_code_pos(fields[CC_FIELD_IDX])];
+        if (country == NULL) {
+            country = get_country(ctx, OTHER_GEONAME_ID, false, false);
+        }
+        if (country == NULL) {
+            //country not found, skip record
+            continue;
+        }
+        
+        //the range files are source 0
+        if (!add_sweep_interval(&ctx->sources[ipv6], ctx->num_sources + 1, priority, country_code_pos(country->country_code), range.start, range.end)) {
+            ctx->err_msg = "Error allocating buffers.";
+            num_records = 0;
+            goto end;
+        }
+        
+        num_records++;
+    }
+    
+    end:
+    
+    fclose(delegated_file);
+    
+    if (num_records) {
+        ctx->num_sources++;
+        
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else {
+        //a file that can't be used adds nothing, rather than part of its records
+        ctx->sources[0].num_intervals = num_intervals[0];
+        ctx->sources[1].num_intervals = num_intervals[1];
+        
+        add_line_to_error(ctx, line_num);
+    }
+    
+    return num_records;
+}
+
+//reads an RIR delegated or delegated-extended statistics file as a source to merge with the following range files
+//the addresses of its allocated and assigned IPv4 and IPv6 records go to their countries unless a source of a higher priority claims them,
+//range files having priority 0 and winning ties, and delegated files winning ties in the order they're read
+//records of country codes missing from the country table go to O1 if there is one, so the country file must be read first
+//returns the number of records read
+unsigned geoip_read_delegated_file(GeoipContext *ctx, char *delegated_file_name, int priority) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = read_delegated_file(ctx, delegated_file_name, priority);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//drops all delegated files read so far
+void geoip_clear_sources(GeoipContext *ctx) {
+    free_sweep_set(&ctx->sources[0]);
+    free_sweep_set(&ctx->sources[1]);
+    ctx->num_sources = 0;
+}
+
+static unsigned read_unroutable_file(GeoipContext *ctx, char *unroutable_file_name) {
+    unsigned num_cidrs;
+    
+    free_overlay_set(&ctx->unroutable[0]);
+    free_overlay_set(&ctx->unroutable[1]);
+    
+    num_cidrs = read_cidr_file(ctx, unroutable_file_name, ctx->unroutable, 0);
+    
+    //a file that can't be used leaves no list, rather than part of one
+    if (!num_cidrs) {
+        free_overlay_set(&ctx->unroutable[0]);
+        free_overlay_set(&ctx->unroutable[1]);
+    }
+    
+    ctx->have_unroutable = num_cidrs > 0;
+    
+    return num_cidrs;
+}
+
+//replaces the built-in list of unroutable blocks used by compaction with the CIDRs in a file
+//returns the number of CIDRs read
+unsigned geoip_read_unroutable_file(GeoipContext *ctx, char *unroutable_file_name) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = read_unroutable_file(ctx, unroutable_file_name);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//enables or disables compaction of the following range files
+//each country's ranges separated only by unroutable addresses are merged, then if max_ranges isn't 0,
+//the smallest remaining gaps are closed until the country has no more than max_ranges ranges
+//the built-in unroutable blocks are used unless geoip_read_unroutable_file was called first
+bool geoip_set_compaction(GeoipContext *ctx, bool compact, unsigned max_ranges) {
+    ctx->compact = false;
+    
+    if (compact && !ctx->have_unroutable) {
+        if (!load_unroutable_cidrs(ctx->unroutable)) {
+            ctx->err_msg = "Error allocating unroutable blocks.";
+            free_overlay_set(&ctx->unroutable[0]);
+            free_overlay_set(&ctx->unroutable[1]);
+            return false;
+        }
+        
+        ctx->have_unroutable = true;
+    }
+    
+    ctx->compact = compact;
+    ctx->max_ranges = max_ranges;
+    ctx->err_msg = NULL;
+    
+    return true;
+}
+
+//enables or disables counting the addresses of each country's final ranges and the prefixes they split into
+//in the following range files, which only a report needs, so conversions without one don't pay for it
+//rows and ranges are always counted
+void geoip_set_report(GeoipContext *ctx, bool report) {
+    ctx->report = report;
+}
+
+//makes the context's work easier on the rest of the system, for conversions sharing a host with busier work
+//when polite, input and output files are dropped from the page cache as they're read and written,
+//reads and writes are each limited to max_rate bytes per second unless it's 0,
+//and the context's calls that read or write files run at the lowest best-effort I/O priority, pinned to cpu_list (e.g. "0,2-3") unless it's NULL
+//that only holds for the calling thread while such a call runs and for the threads the call starts,
+//the calling thread gets its own CPUs and I/O priority back when the call returns and other threads are left alone
+bool geoip_set_polite(GeoipContext *ctx, bool polite, double max_rate, char *cpu_list) {
+    set_polite_io(&ctx->polite, false, 0);
+    free_polite_sched(&ctx->sched);
+    
+    if (!polite) {
+        ctx->err_msg = NULL;
+        return true;
+    }
+    
+    if (max_rate < 0) {
+        ctx->err_msg = "Invalid rate.";
+        return false;
+    }
+    
+    ctx->err_msg = set_polite_sched(&ctx->sched, true, cpu_list);
+    if (ctx->err_msg != NULL) {
+        return false;
+    }
+    
+    set_polite_io(&ctx->polite, true, max_rate);
+    
+    return true;
+}
+
+//drops all overlays read so far
+void geoip_clear_overlays(GeoipContext *ctx) {
+    unsigned i;
+    
+    for (i = 0; i < 2; i++) {
+        free_overlay_set(&ctx->exclusions[i]);
+        free_overlay_set(&ctx->inclusions[i]);
+    }
+}
+
+unsigned geoip_num_countries(GeoipContext *ctx) {
+    return ctx->num_countries;
+}
+
+//countries are numbered from 0 to geoip_num_countries() - 1, in geoname_id order
+char *geoip_country_code(GeoipContext *ctx, unsigned country) {
+    return ctx->countries[country].country_code;
+}
+
+bool geoip_country_forbidden(GeoipContext *ctx, unsigned country) {
+    return ctx->countries[country].forbidden;
+}
+
+//returns the counters of a country for the last range file processed, or NULL if none was
+GeoipCountryStats *geoip_country_stats(GeoipContext *ctx, unsigned country) {
+    if (ctx->stats == NULL || country >= ctx->stats_capacity) {
+        return NULL;
+    }
+    
+    return &ctx->stats[country];
+}
+
+//returns the set written for the last range file processed with GEOIP_FORMAT_COMBINED, all zero if there was none
+GeoipCombinedStats *geoip_combined_stats(GeoipContext *ctx) {
+    return &ctx->combined_stats;
+}
+
+//returns the counters of the last range file processed with GEOIP_FORMAT_ROUTES, all zero if there was none
+GeoipRouteStats *geoip_route_stats(GeoipContext *ctx) {
+    return &ctx->route_stats;
+}
+
+//number of trailing zero bits of a nonzero 128-bit number
+static inline unsigned ctz128(unsigned __int128 value) {
+    return (uint64_t)value ? __builtin_ctzll((uint64_t)value) : 64 + __builtin_ctzll((uint64_t)(value >> 64));
+}
+
+//number of leading zero bits of a nonzero 128-bit number
+static inline unsigned clz128(unsigned __int128 value) {
+    return value >> 64 ? __builtin_clzll((uint64_t)(value >> 64)) : 64 + __builtin_clzll((uint64_t)value);
+}
+
+//adds the number of addresses from start to end to a 128-bit count,
+//and the prefixes the range splits into, as the formats writing prefixes do, to the prefix length histogram
+static inline void add_range_stats(GeoipCountryStats *stats, uint8_t *start, uint8_t *end, size_t addr_bytes) {
+    unsigned __int128 start_addr = 0;
+    unsigned __int128 end_addr = 0;
+    unsigned __int128 size;
+    unsigned __int128 total;
+    unsigned __int128 span;
+    unsigned __int128 host_mask;
+    unsigned host_bits;
+    unsigned align_bits;
+    size_t i;
+    
+    //load the addresses as big-endian numbers
+    for (i = 0; i < addr_bytes; i++) {
+        start_addr = (start_addr << 8) | start[i];
+        end_addr = (end_addr << 8) | end[i];
+    }
+    
+    //size only wraps around for the whole IPv6 address space
+    size = end_addr - start_addr + 1;
+    total = ((unsigned __int128)stats->addresses_high << 64) | stats->addresses_low;
+    
+    if (!size || total + size < total) {
+        total = ~(unsigned __int128)0;
+    }
+    else {
+        total += size;
+    }
+    
+    stats->addresses_high = total >> 64;
+    stats->addresses_low = (uint64_t)total;
+    
+    //the largest block aligned at start_addr that doesn't go past end_addr, like range_to_prefixes, until the range is covered
+    for (;;) {
+        span = end_addr - start_addr;
+        host_bits = span == ~(unsigned __int128)0 ? 128 : 127 - clz128(span + 1);
+        
+        if (start_addr) {
+            align_bits = ctz128(start_addr);
+            if (align_bits < host_bits) {
+                host_bits = align_bits;
+            }
+        }
+        
+        stats->prefix_lengths[addr_bytes * 8 - host_bits]++;
+        
+        host_mask = host_bits == 128 ? ~(unsigned __int128)0 : ((unsigned __int128)1 << host_bits) - 1;
+        if ((start_addr | host_mask) == end_addr) {
+            break;
+        }
+        
+        start_addr = (start_addr | host_mask) + 1;
+    }
+}
+
+//passes a final range to the callback
+static bool output_range(GeoipContext *ctx, Country *country, uint8_t *start, uint8_t *end) {
+    RangeParser *parser = &ctx->parser;
+    GeoipCountryStats *stats;
+    
+    stats = &ctx->stats[country - ctx->countries];
+    stats->ranges++;
+    if (ctx->report) {
+        add_range_stats(stats, start, end, parser->addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES);
+    }
+    
+    if (!parser->callback(parser->user_data, country->country_code, parser->addr_family, start, end)) {
+        ctx->err_msg = "Error writing ranges.";
+        return false;
+    }
+    
+    return true;
+}
+
+//passes a range on to the callback, or keeps it for compaction once the whole file is known
+static bool deliver_range(GeoipContext *ctx, Country *country, uint8_t *start, uint8_t *end) {
+    unsigned country_index = country - ctx->countries;
+    
+    ctx->stats[country_index].uncompacted_ranges++;
+    
+    if (!ctx->compact) {
+        return output_range(ctx, country, start, end);
+    }
+    
+    //the buffer's country_pos is the country's index here, not the position of its code
+    if (!add_overlay_range(&ctx->compaction_buffer, country_index, start, end)) {
+        ctx->err_msg = "Error allocating compaction buffer.";
+        return false;
+    }
+    
+    return true;
+}
+
+//compacts the ranges kept by deliver_range and passes them to the callback, one country at a time
+static bool finish_compaction(GeoipContext *ctx) {
+    OverlaySet *buffer = &ctx->compaction_buffer;
+    OverlaySet *unroutable = &ctx->unroutable[ctx->parser.addr_family == AF_INET6];
+    size_t first;
+    size_t last;
+    size_t num_ranges;
+    size_t i;
+    
+    //ranges of a country don't touch, so this only sorts them by country
+    prepare_overlay_set(buffer);
+    prepare_overlay_set(unroutable);
+    
+    for (first = 0; first < buffer->num_ranges; first = last) {
+        for (last = first + 1; last < buffer->num_ranges && buffer->ranges[last].country_pos == buffer->ranges[first].country_pos; last++);
+        
+        num_ranges = last - first;
+        if (!compact_ranges(&buffer->ranges[first], &num_ranges, unroutable, ctx->max_ranges)) {
+            ctx->err_msg = "Error allocating compaction buffer.";
+            return false;
+        }
+        
+        for (i = first; i < first + num_ranges; i++) {
+            if (!output_range(ctx, &ctx->countries[buffer->ranges[i].country_pos], buffer->ranges[i].start, buffer->ranges[i].end)) {
+                return false;
+            }
+        }
+    }
+    
+    free_overlay_set(buffer);
+    
+    return true;
+}
+
+//adds a range to the one held back for a country, delivering the held one if they don't touch
+//ranges of each country must arrive in ascending order of start address
+static bool hold_range(GeoipContext *ctx, Country *country, uint8_t *start, uint8_t *end) {
+    OverlayState *state = &ctx->overlay_states[country - ctx->countries];
+    size_t addr_bytes = ctx->family_inclusions->addr_bytes;
+    uint8_t after_held[IPV6_BYTES];
+    
+    if (state->held) {
+        //a held range ending at the last address swallows everything after it
+        if (!next_addr(state->held_end, after_held, addr_bytes) || memcmp(start, after_held, addr_bytes) <= 0) {
+            if (memcmp(end, state->held_end, addr_bytes) > 0) {
+                memcpy(state->held_end, end, addr_bytes);
+            }
+            return true;
+        }
+        
+        if (!deliver_range(ctx, country, state->held_start, state->held_end)) {
+            return false;
+        }
+    }
+    
+    memcpy(state->held_start, start, addr_bytes);
+    memcpy(state->held_end, end, addr_bytes);
+    state->held = true;
+    
+    return true;
+}
+
+//adds a range that survived the exclusions to its country, along with the inclusions that start before it
+static bool include_range(GeoipContext *ctx, Country *country, uint8_t *start, uint8_t *end) {
+    OverlayState *state = &ctx->overlay_states[country - ctx->countries];
+    OverlaySet *inclusions = ctx->family_inclusions;
+    OverlayRange *inclusion;
+    uint16_t country_pos = country_code_pos(country->country_code);
+    
+    for (; state->inclusion_pos < inclusions->num_ranges; state->inclusion_pos++) {
+        inclusion = &inclusions->ranges[state->inclusion_pos];
+        if (inclusion->country_pos != country_pos || memcmp(inclusion->start, start, inclusions->addr_bytes) > 0) {
+            break;
+        }
+        
+        if (!hold_range(ctx, country, inclusion->start, inclusion->end)) {
+            return false;
+        }
+    }
+    
+    return hold_range(ctx, country, start, end);
+}
+
+//punches the exclusions out of a coalesced range and passes on what's left
+//coalesced ranges arrive in ascending order, so the exclusions are walked only once per range file
+static bool overlay_range(GeoipContext *ctx, Country *country, uint8_t *start, uint8_t *end) {
+    OverlaySet *exclusions = ctx->family_exclusions;
+    OverlayRange *exclusion;
+    size_t addr_bytes = exclusions->addr_bytes;
+    size_t i;
+    uint8_t piece_start[IPV6_BYTES];
+    uint8_t piece_end[IPV6_BYTES];
+    
+    //skip exclusions that end before this range
+    while (ctx->exclusion_pos < exclusions->num_ranges &&
+           memcmp(exclusions->ranges[ctx->exclusion_pos].end, start, addr_bytes) < 0) {
+        ctx->exclusion_pos++;
+    }
+    
+    memcpy(piece_start, start, addr_bytes);
+    
+    for (i = ctx->exclusion_pos; i < exclusions->num_ranges; i++) {
+        exclusion = &exclusions->ranges[i];
+        if (memcmp(exclusion->start, end, addr_bytes) > 0) {
+            break;
+        }
+        
+        //keep whatever comes before the exclusion
+        if (memcmp(exclusion->start, piece_start, addr_bytes) > 0) {
+            prev_addr(exclusion->start, piece_end, addr_bytes);
+            if (!include_range(ctx, country, piece_start, piece_end)) {
+                return false;
+            }
+        }
+        
+        //nothing left if the exclusion reaches the end of the range
+        if (memcmp(exclusion->end, end, addr_bytes) >= 0) {
+            return true;
+        }
+        
+        next_addr(exclusion->end, piece_start, addr_bytes);
+    }
+    
+    return include_range(ctx, country, piece_start, end);
+}
+
+//passes the held back range on to the overlays, or straight to the callback if there are none
+static bool emit_pending_range(GeoipContext *ctx) {
+    RangeParser *parser = &ctx->parser;
+    bool emitted;
+    
+    if (parser->pending_country == NULL) {
+        return true;
+    }
+    
+    if (ctx->use_overlays) {
+        emitted = overlay_range(ctx, parser->pending_country, parser->pending_range.start, parser->pending_range.end);
+    }
+    else {
+        emitted = deliver_range(ctx, parser->pending_country, parser->pending_range.start, parser->pending_range.end);
+    }
+    
+    parser->pending_country = NULL;
+    
+    return emitted;
+}
+
+//delivers the remaining inclusions and held back ranges of every country
+static bool finish_overlays(GeoipContext *ctx) {
+    OverlaySet *inclusions = ctx->family_inclusions;
+    OverlayState *state;
+    OverlayRange *inclusion;
+    Country *country;
+    uint16_t country_pos;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        country = &ctx->countries[i];
+        if (country->forbidden) {
+            //forbidden countries get no ranges, not even included ones
+            continue;
+        }
+        
+        state = &ctx->overlay_states[i];
+        country_pos = country_code_pos(country->country_code);
+        
+        for (; state->inclusion_pos < inclusions->num_ranges; state->inclusion_pos++) {
+            inclusion = &inclusions->ranges[state->inclusion_pos];
+            if (inclusion->country_pos != country_pos) {
+                break;
+            }
+            
+            if (!hold_range(ctx, country, inclusion->start, inclusion->end)) {
+                return false;
+            }
+        }
+        
+        if (state->held && !deliver_range(ctx, country, state->held_start, state->held_end)) {
+            return false;
+        }
+        
+        state->held = false;
+    }
+    
+    return true;
+}
+
+//merges a range into the pending one if they're contiguous and of the same country,
+//otherwise emits the pending range and holds this one back
+//this relies on ranges coming in order
+static bool merge_pending_range(GeoipContext *ctx, Country *country, AddressRange *range) {
+    RangeParser *parser = &ctx->parser;
+    
+    if (country == parser->pending_country && ranges_contiguous(range, &parser->pending_range)) {
+        //to merge, overwrite previous end address with current end address
+        memcpy(parser->pending_range.end, range->end, range->addr_bytes);
+        PROBE2(range_merge, country->country_code, parser->line_num);
+        return true;
+    }
+    
+    if (!emit_pending_range(ctx)) {
+        return false;
+    }
+    
+    parser->pending_country = country;
+    parser->pending_range = *range;
+    
+    return true;
+}
+
+//handles one complete, NUL-terminated line of a range file
+static bool process_range_line(GeoipContext *ctx, char *line) {
+    const unsigned MIN_COLS = 5;
+    const unsigned CIDR_COL_IDX = 0;
+    const unsigned GEONAME_ID_COL_IDX = 1;
+    const unsigned REGISTERED_GEONAME_ID_COL_IDX = 2;
+    const unsigned PROXY_COL_IDX = 3;
+    const unsigned SAT_COL_IDX = 4;
+    const char* REQUIRED_COLS[] = {
+        "network",
+        "geoname_id",
+        "registered_country_geoname_id",
+        "is_anonymous_proxy",
+        "is_satellite_provider"
+    };
+    
+    RangeParser *parser = &ctx->parser;
+    char *line_data[MAX_COLS];
+    unsigned num_cols;
+    unsigned column_positions[MIN_COLS];
+    unsigned long geoname_id;
+    Country *country;
+    AddressRange range;
+    CsvField fields[MIN_COLS];
+    GeoipCountryStats *stats;
+    bool proxy;
+    bool sat;
+    
+    if (parser->line_num == 1) {
+        //this is the header, find the position of the required columns
+        num_cols = tokenize_csv(line, line_data, MAX_COLS);
+        if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &parser->highest_col) != MIN_COLS) {
+            ctx->err_msg = "Required columns not found in header.";
+            return false;
+        }
+        
+        PROBE3(range_header, num_cols, parser->highest_col, parser->addr_family);
+        
+        //only the required columns will be decoded from now on
+        if (!compile_parse_plan(&parser->plan, column_positions, MIN_COLS, parser->highest_col)) {
+            ctx->err_msg = "Too many columns.";
+            return false;
+        }
+        
+        //nothing else to do with the header, move on to the next line
+        return true;
+    }
+    
+    PROBE_ROWS(parser->line_num - 1, parser->num_ranges, parser->addr_family);
+    
+    num_cols = decode_csv_fields(line, &parser->plan, fields);
+    if (num_cols < parser->highest_col + 1) {
+        ctx->err_msg = "Insufficient columns.";
+        return false;
+    }
+    
+    //geoname_id may be empty
+    //if so, use registered_geoname_id
+    if (!csv_field_to_ulong(&fields[GEONAME_ID_COL_IDX], &geoname_id)) {
+        csv_field_to_ulong(&fields[REGISTERED_GEONAME_ID_COL_IDX], &geoname_id);
+    }
+    
+    if (geoname_id_reserved(geoname_id)) {
+        ctx->err_msg = "Reserved geoname_id.";
+        return false;
+    }
+    
+    proxy = csv_field_to_bool(&fields[PROXY_COL_IDX]);
+    sat = csv_field_to_bool(&fields[SAT_COL_IDX]);
+    
+    country = get_country(ctx, geoname_id, proxy, sat);
+    if (country == NULL) {
+        //country not found, use O1
+        PROBE2(unknown_country, geoname_id, parser->line_num);
+        country = get_country(ctx, OTHER_GEONAME_ID, false, false);
+    }
+    if (country == NULL) {
+        //country not found, skip line
+        return true;
+    }
+    
+    //ignore ranges belonging to forbidden countries
+    //when merging sources, they still keep their addresses from lower priority sources, so they're only dropped once resolved
+    if (country->forbidden && !ctx->num_sources) {
+        return true;
+    }
+    
+    //parse cidr to get start and end addresses
+    //the other fields have been decoded, so the cidr can be terminated in place
+    fields[CIDR_COL_IDX].start[fields[CIDR_COL_IDX].len] = '\0';
+    if (!parse_cidr(fields[CIDR_COL_IDX].start, &range)) {
+        ctx->err_msg = "Invalid CIDR.";
+        return false;
+    }
+    
+    if (range.addr_family != parser->addr_family) {
+        ctx->err_msg = "Wrong address family.";
+        return false;
+    }
+    
+    if (!country->forbidden) {
+        stats = &ctx->stats[country - ctx->countries];
+        stats->rows++;
+    }
+    
+    if (ctx->num_sources) {
+        //the range file is source 0, resolved against the others once it's all been read
+        if (!add_sweep_interval(&ctx->sweep, 0, 0, country_code_pos(country->country_code), range.start, range.end)) {
+            ctx->err_msg = "Error allocating buffers.";
+            return false;
+        }
+        
+        return true;
+    }
+    
+    parser->num_ranges++;
+    
+    return merge_pending_range(ctx, country, &range);
+}
+
+//takes a piece of the address space, as resolved from all sources, into the pipeline unless its country is forbidden
+static bool resolve_range(void *user_data, uint16_t country_pos, uint8_t *start, uint8_t *end) {
+    GeoipContext *ctx = user_data;
+    RangeParser *parser = &ctx->parser;
+    Country *country = ctx->country_code_lookup[country_pos];
+    AddressRange range;
+    
+    if (country == NULL || country->forbidden) {
+        return true;
+    }
+    
+    range.addr_family = parser->addr_family;
+    range.addr_bytes = parser->addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    memcpy(range.start, start, range.addr_bytes);
+    memcpy(range.end, end, range.addr_bytes);
+    
+    parser->num_ranges++;
+    
+    return merge_pending_range(ctx, country, &range);
+}
+
+//resolves the ranges collected from the range file against those of the delegated files, by priority
+static bool resolve_sources(GeoipContext *ctx) {
+    char *err_msg = ctx->err_msg;
+    bool resolved;
+    
+    //unless a range fails with a message of its own
+    ctx->err_msg = "Error allocating buffers.";
+    
+    resolved = add_sweep_set(&ctx->sweep, &ctx->sources[ctx->parser.addr_family == AF_INET6]) &&
+               sweep_intervals(&ctx->sweep, resolve_range, ctx);
+    
+    free_sweep_set(&ctx->sweep);
+    
+    if (resolved) {
+        ctx->err_msg = err_msg;
+    }
+    
+    return resolved;
+}
+
+//looks at a row where it was read, decoding only the columns that tell its country, to skip it early if the country is forbidden
+//rows of proxies and satellite providers, quoted or short rows and the header are left to process_range_line,
+//as are rows of countries whose geoname_ids aren't in the bitmap, which are only skipped once looked up
+static inline bool range_row_forbidden(RangeParser *parser, char *line, size_t len) {
+    const unsigned MIN_COLS = 5;
+    const unsigned GEONAME_ID_COL_IDX = 1;
+    const unsigned REGISTERED_GEONAME_ID_COL_IDX = 2;
+    const unsigned PROXY_COL_IDX = 3;
+    const unsigned SAT_COL_IDX = 4;
+    
+    CsvField fields[MIN_COLS];
+    unsigned long geoname_id;
+    
+    if (!parser->num_forbidden_ids || parser->line_num == 0 || peek_csv_fields(line, len, &parser->plan, fields) < parser->highest_col + 1) {
+        return false;
+    }
+    
+    if (csv_field_to_bool(&fields[PROXY_COL_IDX]) || csv_field_to_bool(&fields[SAT_COL_IDX])) {
+        return false;
+    }
+    
+    if (!csv_field_to_ulong(&fields[GEONAME_ID_COL_IDX], &geoname_id)) {
+        csv_field_to_ulong(&fields[REGISTERED_GEONAME_ID_COL_IDX], &geoname_id);
+    }
+    
+    return geoname_id < parser->num_forbidden_ids && (parser->forbidden_ids[geoname_id / 8] & (1 << geoname_id % 8));
+}
+
+//fills the bitmap of forbidden geoname_ids for range_row_forbidden
+//rows that get past the bitmap are decoded twice, so it's only used when most countries are forbidden, as with short allow lists
+//it covers neither 0, which stands for O1, nor geoname_ids from MAX_FILTERED_GEONAME_ID up,
+//which include the reserved ones
+static bool mark_forbidden_ids(GeoipContext *ctx) {
+    RangeParser *parser = &ctx->parser;
+    unsigned long geoname_id;
+    unsigned long num_ids = 0;
+    size_t size;
+    uint8_t *forbidden_ids;
+    unsigned num_forbidden = 0;
+    unsigned i;
+    
+    parser->num_forbidden_ids = 0;
+    
+    //rows of forbidden countries are needed to resolve sources
+    if (ctx->num_sources) {
+        return true;
+    }
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        num_forbidden += ctx->countries[i].forbidden;
+    }
+    
+    if (num_forbidden * 2 <= ctx->num_countries) {
+        return true;
+    }
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        geoname_id = ctx->countries[i].geoname_id;
+        if (ctx->countries[i].forbidden && geoname_id && geoname_id < MAX_FILTERED_GEONAME_ID && geoname_id >= num_ids) {
+            num_ids = geoname_id + 1;
+        }
+    }
+    
+    if (!num_ids) {
+        return true;
+    }
+    
+    size = (num_ids + 7) / 8;
+    if (parser->forbidden_ids_size < size) {
+        forbidden_ids = realloc(parser->forbidden_ids, size);
+        if (forbidden_ids == NULL) {
+            ctx->err_msg = "Error allocating buffers.";
+            return false;
+        }
+        
+        parser->forbidden_ids = forbidden_ids;
+        parser->forbidden_ids_size = size;
+    }
+    
+    memset(parser->forbidden_ids, 0, size);
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        geoname_id = ctx->countries[i].geoname_id;
+        if (ctx->countries[i].forbidden && geoname_id && geoname_id < num_ids) {
+            parser->forbidden_ids[geoname_id / 8] |= 1 << geoname_id % 8;
+        }
+    }
+    
+    parser->num_forbidden_ids = num_ids;
+    
+    return true;
+}
+
+//starts pushing a range file into the context
+//coalesced ranges of countries that aren't forbidden will be passed to callback
+bool geoip_begin_ranges(GeoipContext *ctx, int addr_family, GeoipRangeCallback callback, void *user_data) {
+    RangeParser *parser = &ctx->parser;
+    GeoipCountryStats *stats;
+    OverlayState *overlay_states;
+    unsigned family = addr_family == AF_INET6;
+    unsigned i;
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    if (!ctx->num_countries) {
+        //nothing to do
+        ctx->err_msg = "No countries to process.";
+        return false;
+    }
+    
+    if (addr_family != AF_INET && addr_family != AF_INET6) {
+        ctx->err_msg = "Invalid address family.";
+        return false;
+    }
+    
+    //counters and overlay states are kept per country, so the tables grow with the country table
+    if (ctx->stats_capacity < ctx->num_countries) {
+        stats = realloc(ctx->stats, ctx->num_countries * sizeof(GeoipCountryStats));
+        if (stats != NULL) {
+            ctx->stats = stats;
+        }
+        
+        overlay_states = realloc(ctx->overlay_states, ctx->num_countries * sizeof(OverlayState));
+        if (overlay_states != NULL) {
+            ctx->overlay_states = overlay_states;
+        }
+        
+        if (stats == NULL || overlay_states == NULL) {
+            ctx->err_msg = "Error allocating country statistics.";
+            return false;
+        }
+        
+        ctx->stats_capacity = ctx->num_countries;
+    }
+    
+    memset(ctx->stats, 0, ctx->stats_capacity * sizeof(GeoipCountryStats));
+    
+    if (!mark_forbidden_ids(ctx)) {
+        return false;
+    }
+    
+    //overlays are sorted once, when first needed
+    ctx->family_exclusions = &ctx->exclusions[family];
+    ctx->family_inclusions = &ctx->inclusions[family];
+    prepare_overlay_set(ctx->family_exclusions);
+    prepare_overlay_set(ctx->family_inclusions);
+    
+    ctx->use_overlays = ctx->family_exclusions->num_ranges || ctx->family_inclusions->num_ranges;
+    ctx->exclusion_pos = 0;
+    
+    //ranges left over from a file that failed are dropped
+    free_overlay_set(&ctx->compaction_buffer);
+    init_overlay_set(&ctx->compaction_buffer, family ? IPV6_BYTES : IPV4_BYTES);
+    free_sweep_set(&ctx->sweep);
+    init_sweep_set(&ctx->sweep, family ? IPV6_BYTES : IPV4_BYTES);
+    
+    if (ctx->use_overlays) {
+        for (i = 0; i < ctx->num_countries; i++) {
+            ctx->overlay_states[i].inclusion_pos = find_overlay_ranges(ctx->family_inclusions, country_code_pos(ctx->countries[i].country_code));
+            ctx->overlay_states[i].held = false;
+        }
+    }
+    
+    parser->addr_family = addr_family;
+    parser->callback = callback;
+    parser->user_data = user_data;
+    parser->line_len = 0;
+    parser->line_num = 0;
+    parser->num_ranges = 0;
+    parser->active = true;
+    parser->failed = false;
+    parser->pending_country = NULL;
+    
+    return true;
+}
+
+//pushes the next bytes of a range file, which may end anywhere within a line
+//returns false once processing has failed, geoip_end_ranges must still be called
+bool geoip_feed_ranges(GeoipContext *ctx, char *data, size_t len) {
+    RangeParser *parser = &ctx->parser;
+    char *newline;
+    size_t line_part;
+    
+    if (!parser->active || parser->failed) {
+        return false;
+    }
+    
+    while (len) {
+        newline = memchr(data, CSV_EOL, len);
+        line_part = newline != NULL ? (size_t)(newline - data) + 1 : len;
+        
+        if (parser->line_len + line_part >= MAX_LINE - 1) {
+            parser->line_num++;
+            ctx->err_msg = "Line too long.";
+            parser->failed = true;
+            return false;
+        }
+        
+        //a whole row in the data can be skipped without copying it, if its country is forbidden
+        if (newline != NULL && !parser->line_len && range_row_forbidden(parser, data, line_part)) {
+            parser->line_num++;
+            PROBE_ROWS(parser->line_num - 1, parser->num_ranges, parser->addr_family);
+            data += line_part;
+            len -= line_part;
+            continue;
+        }
+        
+        memcpy(parser->line + parser->line_len, data, line_part);
+        parser->line_len += line_part;
+        data += line_part;
+        len -= line_part;
+        
+        if (newline == NULL) {
+            //wait for the rest of the line
+            break;
+        }
+        
+        parser->line[parser->line_len] = '\0';
+        parser->line_len = 0;
+        parser->line_num++;
+        
+        if (!process_range_line(ctx, parser->line)) {
+            parser->failed = true;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//finishes pushing a range file
+//returns the number of ranges processed, or 0 on error
+unsigned geoip_end_ranges(GeoipContext *ctx) {
+    RangeParser *parser = &ctx->parser;
+    unsigned num_ranges = 0;
+    
+    if (!parser->active) {
+        return 0;
+    }
+    
+    //the last line may lack a line break
+    if (!parser->failed && parser->line_len) {
+        parser->line[parser->line_len] = '\0';
+        parser->line_len = 0;
+        parser->line_num++;
+        
+        if (!process_range_line(ctx, parser->line)) {
+            parser->failed = true;
+        }
+    }
+    
+    if (!parser->failed) {
+        if ((!ctx->num_sources || resolve_sources(ctx)) && emit_pending_range(ctx) && (!ctx->use_overlays || finish_overlays(ctx)) && (!ctx->compact || finish_compaction(ctx))) {
+            num_ranges = parser->num_ranges;
+        }
+        
+        //the problem wasn't in any particular line, so point past the last one
+        parser->line_num++;
+    }
+    
+    parser->active = false;
+    
+    if (num_ranges) {
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else {
+        //add line number to error message
+        add_line_to_error(ctx, parser->line_num);
+    }
+    
+    return num_ranges;
+}
+
+//writes a coalesced range to its country's output file
+static bool write_xtgeoip_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    FILE *out_file = writer->out_files[country_code_pos(country_code)];
+    size_t addr_bytes = addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    
+    //there must be a valid open file for the country
+    assert(out_file != NULL);
+    
+    //write start and end addresses
+    if (!fwrite(start, addr_bytes, 1, out_file) || !fwrite(end, addr_bytes, 1, out_file)) {
+        return false;
+    }
+    
+    return true;
+}
+
+//writes the create and flush commands at the beginning of an ipset restore file
+//the sizes are padded so that the real ones can be written over them once known
+static bool write_ipset_header(FILE *out_file, char *country_code, int addr_family, unsigned num_prefixes) {
+    char *family_name = addr_family == AF_INET6 ? "inet6" : "inet";
+    char *set_suffix = addr_family == AF_INET6 ? GEOIP_IPSET_IPV6_SET_SUFFIX : GEOIP_IPSET_IPV4_SET_SUFFIX;
+    unsigned hashsize;
+    
+    //a hash size that's a power of 2 and holds every prefix without resizing
+    for (hashsize = IPSET_MIN_HASHSIZE; hashsize < num_prefixes; hashsize *= 2);
+    
+    if (fprintf(out_file, "create " GEOIP_IPSET_SET_PREFIX "%s%s hash:net family %s hashsize %-10u maxelem %-10u -exist\n"
+                "flush " GEOIP_IPSET_SET_PREFIX "%s%s\n", country_code, set_suffix, family_name, hashsize,
+                num_prefixes ? num_prefixes : 1, country_code, set_suffix) < 0) {
+        return false;
+    }
+    
+    return true;
+}
+
+//writes a coalesced range to its country's ipset restore file, as the fewest prefixes that cover it
+static bool write_ipset_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    uint16_t country_pos = country_code_pos(country_code);
+    FILE *out_file = writer->out_files[country_pos];
+    char *set_suffix = addr_family == AF_INET6 ? GEOIP_IPSET_IPV6_SET_SUFFIX : GEOIP_IPSET_IPV4_SET_SUFFIX;
+    char cidr[INET6_ADDRSTRLEN + 4];
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    unsigned num_prefixes;
+    unsigned i;
+    
+    //there must be a valid open file for the country
+    assert(out_file != NULL);
+    
+    num_prefixes = range_to_prefixes(start, end, addr_family, prefixes);
+    
+    for (i = 0; i < num_prefixes; i++) {
+        if (!unparse_cidr(&prefixes[i], cidr, sizeof(cidr)) ||
+            fprintf(out_file, "add " GEOIP_IPSET_SET_PREFIX "%s%s %s\n", country_code, set_suffix, cidr) < 0) {
+            return false;
+        }
+    }
+    
+    writer->num_prefixes[country_pos] += num_prefixes;
+    
+    return num_prefixes > 0;
+}
+
+//writes the header and country codes at the beginning of an LPM trie batch file
+//the number of entries is written over once known
+static bool write_lpm_header(GeoipContext *ctx, FILE *out_file, int addr_family, unsigned num_entries) {
+    GeoipLpmBatchHeader header;
+    char code[GEOIP_LPM_BATCH_CODE_SIZE];
+    unsigned i;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GEOIP_LPM_BATCH_MAGIC, GEOIP_LPM_BATCH_MAGIC_SIZE);
+    header.version = GEOIP_LPM_BATCH_VERSION;
+    header.byte_order = GEOIP_LPM_BATCH_BYTE_ORDER;
+    header.addr_family = addr_family == AF_INET6 ? 6 : 4;
+    header.key_size = sizeof(uint32_t) + (addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES);
+    header.value_size = sizeof(uint16_t);
+    header.num_entries = num_entries;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        if (!ctx->countries[i].forbidden) {
+            header.num_countries++;
+        }
+    }
+    
+    if (!fwrite(&header, sizeof(header), 1, out_file)) {
+        return false;
+    }
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        if (ctx->countries[i].forbidden) {
+            continue;
+        }
+        
+        memset(code, 0, sizeof(code));
+        memcpy(code, ctx->countries[i].country_code, GEOIP_COUNTRY_CODE_SIZE);
+        if (!fwrite(code, sizeof(code), 1, out_file)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//writes a coalesced range to the LPM trie batch file, as the fewest prefixes that cover it
+//the keys go straight to the file, the values are kept until all keys have been written
+static bool write_lpm_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    uint16_t index = writer->set_indexes[country_code_pos(country_code)];
+    size_t addr_bytes = addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    uint8_t key[sizeof(uint32_t) + IPV6_BYTES];
+    uint32_t prefix_length;
+    uint16_t *values;
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    unsigned num_prefixes;
+    unsigned capacity;
+    unsigned i;
+    
+    num_prefixes = range_to_prefixes(start, end, addr_family, prefixes);
+    
+    if (writer->num_set_values + num_prefixes > writer->set_values_capacity) {
+        for (capacity = writer->set_values_capacity ? writer->set_values_capacity : EXPECTED_LPM_ENTRIES;
+             capacity < writer->num_set_values + num_prefixes; capacity *= 2);
+        
+        values = realloc(writer->set_values, capacity * sizeof(uint16_t));
+        if (values == NULL) {
+            return false;
+        }
+        
+        writer->set_values = values;
+        writer->set_values_capacity = capacity;
+    }
+    
+    for (i = 0; i < num_prefixes; i++) {
+        prefix_length = prefixes[i].prefix_length;
+        memcpy(key, &prefix_length, sizeof(uint32_t));
+        memcpy(key + sizeof(uint32_t), prefixes[i].start, addr_bytes);
+        
+        if (!fwrite(key, sizeof(uint32_t) + addr_bytes, 1, writer->set_file)) {
+            return false;
+        }
+        
+        writer->set_values[writer->num_set_values++] = index;
+    }
+    
+    return num_prefixes > 0;
+}
+
+//adds a coalesced range to its country's part of the bundle
+static bool write_bundle_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    uint16_t index = writer->set_indexes[country_code_pos(country_code)];
+    
+    return add_bundle_range(&writer->bundle_countries[index], start, end, addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES);
+}
+
+//collects a coalesced range for the blackhole routes, which can only be aggregated once all countries' ranges are known
+//the prefixes it would take on its own are counted to show what aggregation saves
+static bool write_route_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    
+    writer->num_route_prefixes += range_to_prefixes(start, end, addr_family, prefixes);
+    
+    return add_overlay_range(&writer->collected, 0, start, end);
+}
+
+//merges the collected ranges of all countries, contiguous or overlapping, and writes each merged range
+//as the fewest prefixes that cover it to the BIRD, FRR route and FRR prefix list files
+//no prefix spans more than one merged range, so there's no smaller set of prefixes covering exactly the same addresses
+static bool write_routes(RangeWriter *writer, int addr_family) {
+    GeoipRouteStats *stats = &writer->route_stats;
+    char *ip_name = addr_family == AF_INET6 ? "ipv6" : "ip";
+    char *prefix_list_name = addr_family == AF_INET6 ? GEOIP_ROUTES_PREFIX_LIST_IPV6_NAME : GEOIP_ROUTES_PREFIX_LIST_IPV4_NAME;
+    char cidr[INET6_ADDRSTRLEN + 4];
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    OverlayRange *range;
+    unsigned num_prefixes;
+    unsigned i;
+    size_t j;
+    
+    stats->ranges = writer->collected.num_ranges;
+    stats->prefixes = writer->num_route_prefixes;
+    
+    prepare_overlay_set(&writer->collected);
+    stats->merged_ranges = writer->collected.num_ranges;
+    
+    for (j = 0; j < writer->collected.num_ranges; j++) {
+        range = &writer->collected.ranges[j];
+        num_prefixes = range_to_prefixes(range->start, range->end, addr_family, prefixes);
+        
+        for (i = 0; i < num_prefixes; i++) {
+            stats->routes++;
+            
+            if (!unparse_cidr(&prefixes[i], cidr, sizeof(cidr)) ||
+                fprintf(writer->set_file, "route %s blackhole;\n", cidr) < 0 ||
+                fprintf(writer->aux_files[0], "%s route %s blackhole\n", ip_name, cidr) < 0 ||
+                fprintf(writer->aux_files[1], "%s prefix-list %s seq %u permit %s\n", ip_name, prefix_list_name,
+                        stats->routes * ROUTES_PREFIX_LIST_SEQ_STEP, cidr) < 0) {
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+//collects a coalesced range for the combined set, which can only be chosen once all countries' ranges are known
+static bool write_combined_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    
+    return add_overlay_range(&writer->collected, 0, start, end);
+}
+
+//merges the collected ranges of all countries and writes either them or their complement over the whole address space,
+//whichever takes fewer ranges, to the combined set file in xt_geoip format, and to the marker file the match that selects the countries
+static bool write_combined(RangeWriter *writer) {
+    GeoipCombinedStats *stats = &writer->combined_stats;
+    OverlaySet *set = &writer->collected;
+    size_t addr_bytes = set->addr_bytes;
+    uint8_t start[IPV6_BYTES];
+    uint8_t end[IPV6_BYTES];
+    bool have_start = true;
+    size_t i;
+    
+    prepare_overlay_set(set);
+    stats->ranges = set->num_ranges;
+    
+    //the complement has a range before each of the countries' ranges, but one starting at the first address,
+    //and one after the last, unless it ends at the last address
+    stats->complement_ranges = set->num_ranges + 1;
+    if (set->num_ranges && !prev_addr(set->ranges[0].start, end, addr_bytes)) {
+        stats->complement_ranges--;
+    }
+    
+    if (set->num_ranges && !next_addr(set->ranges[set->num_ranges - 1].end, start, addr_bytes)) {
+        stats->complement_ranges--;
+    }
+    
+    //on a tie, the countries' ranges are kept, so no negation is needed
+    stats->negated = stats->complement_ranges < stats->ranges;
+    
+    if (!stats->negated) {
+        for (i = 0; i < set->num_ranges; i++) {
+            if (!fwrite(set->ranges[i].start, addr_bytes, 1, writer->set_file) || !fwrite(set->ranges[i].end, addr_bytes, 1, writer->set_file)) {
+                return false;
+            }
+        }
+    }
+    else {
+        //start is where the next range of the complement begins, unless the last range ended at the last address
+        memset(start, 0, addr_bytes);
+        
+        for (i = 0; i < set->num_ranges; i++) {
+            if (prev_addr(set->ranges[i].start, end, addr_bytes) &&
+                (!fwrite(start, addr_bytes, 1, writer->set_file) || !fwrite(end, addr_bytes, 1, writer->set_file))) {
+                return false;
+            }
+            
+            have_start = next_addr(set->ranges[i].end, start, addr_bytes);
+        }
+        
+        memset(end, 0xff, addr_bytes);
+        if (have_start && (!fwrite(start, addr_bytes, 1, writer->set_file) || !fwrite(end, addr_bytes, 1, writer->set_file))) {
+            return false;
+        }
+    }
+    
+    if (fprintf(writer->aux_files[0], "%s--src-cc " GEOIP_COMBINED_COUNTRY_CODE "\n", stats->negated ? "! " : "") < 0) {
+        return false;
+    }
+    
+    return true;
+}
+
+//collects a coalesced range for the generated lookup table, which needs the ranges of all countries in one sorted array
+//ranges of different countries only overlap through included CIDRs, so they're resolved like sources, the nested one winning
+static bool write_codegen_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    
+    return add_sweep_interval(&writer->intervals, 0, 0, writer->set_indexes[country_code_pos(country_code)], start, end);
+}
+
+//takes a resolved range into the lookup table, merging it with the last one if they're contiguous and of the same country
+//collected is kept in address order, with each range's index in the country code table as its country_pos
+static bool add_codegen_range(void *user_data, uint16_t index, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    OverlaySet *table = &writer->collected;
+    OverlayRange *last = table->num_ranges ? &table->ranges[table->num_ranges - 1] : NULL;
+    uint8_t after_last[IPV6_BYTES];
+    
+    if (last != NULL && last->country_pos == index && next_addr(last->end, after_last, table->addr_bytes) &&
+        memcmp(after_last, start, table->addr_bytes) == 0) {
+        memcpy(last->end, end, table->addr_bytes);
+        return true;
+    }
+    
+    return add_overlay_range(table, index, start, end);
+}
+
+//writes a header declaring the lookup table, with an inline lookup function whose number of steps is a constant the compiler sees
+//the search is a binary search over the starts that takes log2(ranges) steps for every address,
+//moving the base with a conditional move instead of branching, then a single check of the range found
+static bool write_codegen_header(GeoipContext *ctx, RangeWriter *writer, int addr_family) {
+    FILE *out_file = writer->aux_files[0];
+    bool ipv6 = addr_family == AF_INET6;
+    char *name = ipv6 ? "geoip6" : "geoip4";
+    char *macro = ipv6 ? "GEOIP6" : "GEOIP4";
+    unsigned num_countries = writer->collected.num_ranges ? writer->num_set_countries : 0;
+    
+    if (fprintf(out_file,
+                "//generated by mm2xtgeoip, do not edit\n"
+                "#ifndef %s_H\n"
+                "#define %s_H\n\n"
+                "#include <stddef.h>\n"
+                "#include <stdint.h>\n\n"
+                "#define %s_NUM_RANGES %u\n"
+                "#define %s_NUM_COUNTRIES %u\n\n"
+                "#ifdef __cplusplus\n"
+                "extern \"C\" {\n"
+                "#endif\n\n",
+                macro, macro, macro, (unsigned)writer->collected.num_ranges, macro, num_countries) < 0) {
+        return false;
+    }
+    
+    //C has no empty arrays, so an empty table only has a lookup that never finds anything
+    if (!writer->collected.num_ranges) {
+        if (fprintf(out_file,
+                    "//the table is empty, so no address is found\n"
+                    "static inline const char *%s_lookup(%s) {\n"
+                    "    (void)addr;\n"
+                    "    \n"
+                    "    return NULL;\n"
+                    "}\n\n", name, ipv6 ? "const uint8_t *addr" : "uint32_t addr") < 0) {
+            return false;
+        }
+    }
+    else if (!ipv6) {
+        if (fprintf(out_file,
+                    "//disjoint ranges sorted by start, and the index in geoip4_country_codes of each range's country\n"
+                    "extern const uint32_t geoip4_starts[GEOIP4_NUM_RANGES];\n"
+                    "extern const uint32_t geoip4_ends[GEOIP4_NUM_RANGES];\n"
+                    "extern const uint16_t geoip4_countries[GEOIP4_NUM_RANGES];\n"
+                    "extern const char geoip4_country_codes[GEOIP4_NUM_COUNTRIES][3];\n\n"
+                    "//returns the country code of an IPv4 address in host byte order, or NULL if no range holds it\n"
+                    "static inline const char *geoip4_lookup(uint32_t addr) {\n"
+                    "    const uint32_t *base = geoip4_starts;\n"
+                    "    size_t n = GEOIP4_NUM_RANGES;\n"
+                    "    size_t half;\n"
+                    "    \n"
+                    "    while (n > 1) {\n"
+                    "        half = n / 2;\n"
+                    "        base = base[half] <= addr ? base + half : base;\n"
+                    "        n -= half;\n"
+                    "    }\n"
+                    "    \n"
+                    "    if (addr < *base || addr > geoip4_ends[base - geoip4_starts]) {\n"
+                    "        return NULL;\n"
+                    "    }\n"
+                    "    \n"
+                    "    return geoip4_country_codes[geoip4_countries[base - geoip4_starts]];\n"
+                    "}\n\n") < 0) {
+            return false;
+        }
+    }
+    else {
+        if (fprintf(out_file,
+                    "//disjoint ranges sorted by start, and the index in geoip6_country_codes of each range's country\n"
+                    "//each address takes four 32-bit words, most significant first\n"
+                    "extern const uint32_t geoip6_starts[4 * GEOIP6_NUM_RANGES];\n"
+                    "extern const uint32_t geoip6_ends[4 * GEOIP6_NUM_RANGES];\n"
+                    "extern const uint16_t geoip6_countries[GEOIP6_NUM_RANGES];\n"
+                    "extern const char geoip6_country_codes[GEOIP6_NUM_COUNTRIES][3];\n\n"
+                    "//joins two words of an address into one of its 64-bit halves\n"
+                    "static inline uint64_t geoip6_join(const uint32_t *words) {\n"
+                    "    return (uint64_t)words[0] << 32 | words[1];\n"
+                    "}\n\n"
+                    "//returns the country code of an IPv6 address given as 16 bytes in network byte order, or NULL if no range holds it\n"
+                    "static inline const char *geoip6_lookup(const uint8_t *addr) {\n"
+                    "    const uint32_t *base = geoip6_starts;\n"
+                    "    uint64_t high = 0;\n"
+                    "    uint64_t low = 0;\n"
+                    "    size_t n = GEOIP6_NUM_RANGES;\n"
+                    "    size_t half;\n"
+                    "    size_t i;\n"
+                    "    \n"
+                    "    for (i = 0; i < 8; i++) {\n"
+                    "        high = high << 8 | addr[i];\n"
+                    "        low = low << 8 | addr[i + 8];\n"
+                    "    }\n"
+                    "    \n"
+                    "    while (n > 1) {\n"
+                    "        half = n / 2;\n"
+                    "        i = 4 * half;\n"
+                    "        base = ((geoip6_join(base + i) < high) | ((geoip6_join(base + i) == high) & (geoip6_join(base + i + 2) <= low))) ?\n"
+                    "               base + i : base;\n"
+                    "        n -= half;\n"
+                    "    }\n"
+                    "    \n"
+                    "    i = base - geoip6_starts;\n"
+                    "    if (high < geoip6_join(base) || (high == geoip6_join(base) && low < geoip6_join(base + 2)) ||\n"
+                    "        high > geoip6_join(geoip6_ends + i) || (high == geoip6_join(geoip6_ends + i) && low > geoip6_join(geoip6_ends + i + 2))) {\n"
+                    "        return NULL;\n"
+                    "    }\n"
+                    "    \n"
+                    "    return geoip6_country_codes[geoip6_countries[i / 4]];\n"
+                    "}\n\n") < 0) {
+            return false;
+        }
+    }
+    
+    if (fprintf(out_file, "#ifdef __cplusplus\n}\n#endif\n\n#endif\n") < 0) {
+        return false;
+    }
+    
+    return true;
+}
+
+//writes one address of the lookup table as 32-bit words, most significant first
+//IPv6 addresses aren't written as 64-bit halves, since GCC takes minutes to build a few hundred thousand distinct
+//64-bit constants whose low 32 bits are all zero, as the high halves of most IPv6 ranges are
+//they aren't nested in braces either, as compilers also slow down on millions of nested initializers
+static bool write_codegen_addr(FILE *out_file, uint8_t *addr, size_t addr_bytes, bool last) {
+    unsigned long word;
+    size_t i;
+    
+    for (i = 0; i < addr_bytes; i += 4) {
+        word = (unsigned long)addr[i] << 24 | (unsigned long)addr[i + 1] << 16 | (unsigned long)addr[i + 2] << 8 | addr[i + 3];
+        if (fprintf(out_file, "%s0x%08lx", i ? ", " : "", word) < 0) {
+            return false;
+        }
+    }
+    
+    return last || fputc(',', out_file) != EOF;
+}
+
+//writes the source defining the lookup table, so it's compiled into .rodata once and shared through the page cache
+static bool write_codegen_source(GeoipContext *ctx, RangeWriter *writer, int addr_family) {
+    FILE *out_file = writer->set_file;
+    OverlaySet *table = &writer->collected;
+    bool ipv6 = addr_family == AF_INET6;
+    char *name = ipv6 ? "geoip6" : "geoip4";
+    char *macro = ipv6 ? "GEOIP6" : "GEOIP4";
+    char *size_factor = ipv6 ? "4 * " : "";
+    unsigned per_line = ipv6 ? CODEGEN_IPV6_VALUES_PER_LINE : CODEGEN_IPV4_VALUES_PER_LINE;
+    unsigned num_codes = 0;
+    bool last;
+    size_t i;
+    unsigned j;
+    
+    if (fprintf(out_file, "//generated by mm2xtgeoip, do not edit\n#include \"%s.h\"\n", name) < 0) {
+        return false;
+    }
+    
+    if (!table->num_ranges) {
+        return true;
+    }
+    
+    if (fprintf(out_file, "\nconst char %s_country_codes[%s_NUM_COUNTRIES][3] = {", name, macro) < 0) {
+        return false;
+    }
+    
+    for (j = 0; j < ctx->num_countries; j++) {
+        if (ctx->countries[j].forbidden) {
+            continue;
+        }
+        
+        if (fprintf(out_file, "%s\"%s\"%s", num_codes % 16 ? " " : "\n    ", ctx->countries[j].country_code,
+                    num_codes + 1 < writer->num_set_countries ? "," : "") < 0) {
+            return false;
+        }
+        
+        num_codes++;
+    }
+    
+    if (fprintf(out_file, "\n};\n\nconst uint32_t %s_starts[%s%s_NUM_RANGES] = {", name, size_factor, macro) < 0) {
+        return false;
+    }
+    
+    for (i = 0; i < table->num_ranges; i++) {
+        last = i + 1 == table->num_ranges;
+        if (fputs(i % per_line ? " " : "\n    ", out_file) < 0 || !write_codegen_addr(out_file, table->ranges[i].start, table->addr_bytes, last)) {
+            return false;
+        }
+    }
+    
+    if (fprintf(out_file, "\n};\n\nconst uint32_t %s_ends[%s%s_NUM_RANGES] = {", name, size_factor, macro) < 0) {
+        return false;
+    }
+    
+    for (i = 0; i < table->num_ranges; i++) {
+        last = i + 1 == table->num_ranges;
+        if (fputs(i % per_line ? " " : "\n    ", out_file) < 0 || !write_codegen_addr(out_file, table->ranges[i].end, table->addr_bytes, last)) {
+            return false;
+        }
+    }
+    
+    if (fprintf(out_file, "\n};\n\nconst uint16_t %s_countries[%s_NUM_RANGES] = {", name, macro) < 0) {
+        return false;
+    }
+    
+    for (i = 0; i < table->num_ranges; i++) {
+        if (fprintf(out_file, "%s%u%s", i % 16 ? " " : "\n    ", table->ranges[i].country_pos, i + 1 < table->num_ranges ? "," : "") < 0) {
+            return false;
+        }
+    }
+    
+    return fprintf(out_file, "\n};\n") >= 0;
+}
+
+//writes the beginning of an nftables set definition, to be included in a table
+//the elements and the closing brace are written by write_nft_range and finish_nft_sink
+static bool write_nft_header(FILE *out_file, char *country_code, int addr_family) {
+    char *set_suffix = addr_family == AF_INET6 ? GEOIP_NFT_IPV6_SET_SUFFIX : GEOIP_NFT_IPV4_SET_SUFFIX;
+    char *type_name = addr_family == AF_INET6 ? "ipv6_addr" : "ipv4_addr";
+    
+    if (fprintf(out_file, "set " GEOIP_NFT_SET_PREFIX "%s%s {\n\ttype %s\n\tflags interval\n", country_code, set_suffix, type_name) < 0) {
+        return false;
+    }
+    
+    return true;
+}
+
+//writes a coalesced range to its country's nftables set file
+//interval sets take any range as a single element, so only ranges that are exactly one prefix are written as prefixes
+static bool write_nft_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    uint16_t country_pos = country_code_pos(country_code);
+    FILE *out_file = writer->out_files[country_pos];
+    char element[2 * INET6_ADDRSTRLEN + 4];
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    size_t len;
+    
+    //there must be a valid open file for the country
+    assert(out_file != NULL);
+    
+    if (range_to_prefixes(start, end, addr_family, prefixes) == 1) {
+        if (!unparse_cidr(&prefixes[0], element, sizeof(element))) {
+            return false;
+        }
+    }
+    else {
+        if (inet_ntop(addr_family, start, element, INET6_ADDRSTRLEN) == NULL) {
+            return false;
+        }
+        
+        len = strlen(element);
+        element[len++] = '-';
+        if (inet_ntop(addr_family, end, element + len, sizeof(element) - len) == NULL) {
+            return false;
+        }
+    }
+    
+    //the first element opens the list, the others follow a comma
+    if (fprintf(out_file, writer->num_prefixes[country_pos] ? ",\n\t\t%s" : "\telements = {\n\t\t%s", element) < 0) {
+        return false;
+    }
+    
+    writer->num_prefixes[country_pos]++;
+    
+    return true;
+}
+
+//writes a coalesced range to its country's CIDR list, as the fewest prefixes that cover it, one per line
+static bool write_cidr_range(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    RangeWriter *writer = user_data;
+    FILE *out_file = writer->out_files[country_code_pos(country_code)];
+    char cidr[INET6_ADDRSTRLEN + 4];
+    AddressRange prefixes[MAX_RANGE_PREFIXES];
+    unsigned num_prefixes;
+    unsigned i;
+    
+    //there must be a valid open file for the country
+    assert(out_file != NULL);
+    
+    num_prefixes = range_to_prefixes(start, end, addr_family, prefixes);
+    
+    for (i = 0; i < num_prefixes; i++) {
+        if (!unparse_cidr(&prefixes[i], cidr, sizeof(cidr)) || fprintf(out_file, "%s\n", cidr) < 0) {
+            return false;
+        }
+    }
+    
+    return num_prefixes > 0;
+}
+
+//builds the name of an output file of a sink, named after a country code or the single file of a format
+//returns NULL if the name can't be allocated
+static char *sink_file_name(RangeSink *sink, char *name, char *suffix) {
+    char *file_name;
+    
+    file_name = malloc(strlen(sink->directory) + strlen(name) + strlen(suffix) + 2);
+    if (file_name == NULL) {
+        return NULL;
+    }
+    
+    strcpy(file_name, sink->directory);
+    strcat(file_name, "/");
+    strcat(file_name, name);
+    strcat(file_name, suffix);
+    
+    return file_name;
+}
+
+//opens an output file of a sink
+static FILE *open_sink_file(GeoipContext *ctx, RangeSink *sink, char *name, char *suffix) {
+    FILE *file;
+    char *file_name;
+    
+    file_name = sink_file_name(sink, name, suffix);
+    if (file_name == NULL) {
+        ctx->err_msg = "Error allocating buffer for output file name.";
+        return NULL;
+    }
+    
+    file = polite_fopen(&ctx->polite, file_name, "w");
+    free(file_name);
+    
+    if (file == NULL) {
+        ctx->err_msg = "Error opening an output file.";
+    }
+    
+    return file;
+}
+
+//removes an output file of a sink, if it was created
+static void remove_sink_file(RangeSink *sink, char *name, char *suffix) {
+    char *file_name;
+    
+    file_name = sink_file_name(sink, name, suffix);
+    if (file_name != NULL) {
+        unlink(file_name);
+        free(file_name);
+    }
+}
+
+//opens one output file per allowed country
+static bool open_country_files(GeoipContext *ctx, RangeSink *sink, char *suffix) {
+    RangeWriter *writer = &sink->writer;
+    char *country_code;
+    uint16_t country_pos;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        if (ctx->countries[i].forbidden) {
+            //don't open files for forbidden countries
+            continue;
+        }
+        
+        country_code = ctx->countries[i].country_code;
+        country_pos = country_code_pos(country_code);
+        
+        writer->out_files[country_pos] = open_sink_file(ctx, sink, country_code, suffix);
+        if (writer->out_files[country_pos] == NULL) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//numbers the allowed countries for formats writing all countries to one file, in the order their codes are written
+static void number_countries(GeoipContext *ctx, RangeWriter *writer) {
+    char *country_code;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        if (ctx->countries[i].forbidden) {
+            continue;
+        }
+        
+        country_code = ctx->countries[i].country_code;
+        if (writer->bundle_codes != NULL) {
+            writer->bundle_codes[writer->num_set_countries] = country_code;
+        }
+        
+        writer->set_indexes[country_code_pos(country_code)] = writer->num_set_countries++;
+    }
+}
+
+static bool open_xtgeoip_sink(GeoipContext *ctx, RangeSink *sink) {
+    return open_country_files(ctx, sink, sink->addr_family == AF_INET6 ? GEOIP_IPV6_SUFFIX : GEOIP_IPV4_SUFFIX);
+}
+
+static bool open_ipset_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    char *country_code;
+    uint16_t country_pos;
+    unsigned i;
+    
+    if (!open_country_files(ctx, sink, sink->addr_family == AF_INET6 ? GEOIP_IPSET_IPV6_SUFFIX : GEOIP_IPSET_IPV4_SUFFIX)) {
+        return false;
+    }
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        country_code = ctx->countries[i].country_code;
+        country_pos = country_code_pos(country_code);
+        if (writer->out_files[country_pos] != NULL && !write_ipset_header(writer->out_files[country_pos], country_code, sink->addr_family, 0)) {
+            ctx->err_msg = "Error writing ranges.";
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//now that the number of prefixes is known, sizes the sets
+static bool finish_ipset_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    char *country_code;
+    uint16_t country_pos;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        country_code = ctx->countries[i].country_code;
+        country_pos = country_code_pos(country_code);
+        if (writer->out_files[country_pos] == NULL) {
+            continue;
+        }
+        
+        if (fseek(writer->out_files[country_pos], 0, SEEK_SET) != 0 ||
+            !write_ipset_header(writer->out_files[country_pos], country_code, sink->addr_family, writer->num_prefixes[country_pos])) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static bool open_lpm_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    
+    writer->set_file = open_sink_file(ctx, sink, GEOIP_LPM_BATCH_FILE_NAME, sink->addr_family == AF_INET6 ? GEOIP_LPM_BATCH_IPV6_SUFFIX : GEOIP_LPM_BATCH_IPV4_SUFFIX);
+    if (writer->set_file == NULL) {
+        return false;
+    }
+    
+    number_countries(ctx, writer);
+    
+    if (!write_lpm_header(ctx, writer->set_file, sink->addr_family, 0)) {
+        ctx->err_msg = "Error writing ranges.";
+        return false;
+    }
+    
+    return true;
+}
+
+//now that all keys are written, appends the values and the number of entries
+static bool finish_lpm_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    
+    if ((writer->num_set_values && fwrite(writer->set_values, sizeof(uint16_t), writer->num_set_values, writer->set_file) != writer->num_set_values) ||
+        fseek(writer->set_file, 0, SEEK_SET) != 0 || !write_lpm_header(ctx, writer->set_file, sink->addr_family, writer->num_set_values)) {
+        return false;
+    }
+    
+    return true;
+}
+
+static bool open_bundle_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    
+    writer->bundle_countries = calloc(ctx->num_countries, sizeof(BundleCountry));
+    writer->bundle_codes = calloc(ctx->num_countries, sizeof(char *));
+    if (writer->bundle_countries == NULL || writer->bundle_codes == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        return false;
+    }
+    
+    writer->set_file = open_sink_file(ctx, sink, GEOIP_BUNDLE_FILE_NAME, sink->addr_family == AF_INET6 ? GEOIP_BUNDLE_IPV6_SUFFIX : GEOIP_BUNDLE_IPV4_SUFFIX);
+    if (writer->set_file == NULL) {
+        return false;
+    }
+    
+    number_countries(ctx, writer);
+    
+    return true;
+}
+
+static bool finish_bundle_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    
+    return write_bundle(writer->set_file, sink->addr_family, writer->bundle_countries, writer->bundle_codes, writer->num_set_countries);
+}
+
+static bool open_routes_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    bool ipv6 = sink->addr_family == AF_INET6;
+    
+    writer->set_file = open_sink_file(ctx, sink, GEOIP_ROUTES_FILE_NAME, ipv6 ? GEOIP_ROUTES_BIRD_IPV6_SUFFIX : GEOIP_ROUTES_BIRD_IPV4_SUFFIX);
+    if (writer->set_file == NULL) {
+        return false;
+    }
+    
+    writer->aux_files[0] = open_sink_file(ctx, sink, GEOIP_ROUTES_FILE_NAME, ipv6 ? GEOIP_ROUTES_FRR_IPV6_SUFFIX : GEOIP_ROUTES_FRR_IPV4_SUFFIX);
+    if (writer->aux_files[0] == NULL) {
+        return false;
+    }
+    
+    writer->aux_files[1] = open_sink_file(ctx, sink, GEOIP_ROUTES_FILE_NAME, ipv6 ? GEOIP_ROUTES_PREFIX_LIST_IPV6_SUFFIX : GEOIP_ROUTES_PREFIX_LIST_IPV4_SUFFIX);
+    if (writer->aux_files[1] == NULL) {
+        return false;
+    }
+    
+    return true;
+}
+
+static bool finish_routes_sink(GeoipContext *ctx, RangeSink *sink) {
+    return write_routes(&sink->writer, sink->addr_family);
+}
+
+static bool open_nft_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    char *country_code;
+    uint16_t country_pos;
+    unsigned i;
+    
+    if (!open_country_files(ctx, sink, sink->addr_family == AF_INET6 ? GEOIP_NFT_IPV6_SUFFIX : GEOIP_NFT_IPV4_SUFFIX)) {
+        return false;
+    }
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        country_code = ctx->countries[i].country_code;
+        country_pos = country_code_pos(country_code);
+        if (writer->out_files[country_pos] != NULL && !write_nft_header(writer->out_files[country_pos], country_code, sink->addr_family)) {
+            ctx->err_msg = "Error writing ranges.";
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//closes the element lists and the sets
+//sets without elements are left without an element list, as nft rejects empty ones
+static bool finish_nft_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    uint16_t country_pos;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        country_pos = country_code_pos(ctx->countries[i].country_code);
+        if (writer->out_files[country_pos] == NULL) {
+            continue;
+        }
+        
+        if (fputs(writer->num_prefixes[country_pos] ? "\n\t}\n}\n" : "}\n", writer->out_files[country_pos]) < 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//the combined set is loaded by xt_geoip like a country, so no country may have its code
+static bool open_combined_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    bool ipv6 = sink->addr_family == AF_INET6;
+    unsigned i;
+    
+    for (i = 0; i < ctx->num_countries; i++) {
+        if (strcmp(ctx->countries[i].country_code, GEOIP_COMBINED_COUNTRY_CODE) == 0) {
+            ctx->err_msg = "A country has the combined set's code.";
+            return false;
+        }
+    }
+    
+    writer->set_file = open_sink_file(ctx, sink, GEOIP_COMBINED_COUNTRY_CODE, ipv6 ? GEOIP_IPV6_SUFFIX : GEOIP_IPV4_SUFFIX);
+    if (writer->set_file == NULL) {
+        return false;
+    }
+    
+    writer->aux_files[0] = open_sink_file(ctx, sink, GEOIP_COMBINED_COUNTRY_CODE, ipv6 ? GEOIP_COMBINED_MARKER_IPV6_SUFFIX : GEOIP_COMBINED_MARKER_IPV4_SUFFIX);
+    if (writer->aux_files[0] == NULL) {
+        return false;
+    }
+    
+    return true;
+}
+
+static bool finish_combined_sink(GeoipContext *ctx, RangeSink *sink) {
+    return write_combined(&sink->writer);
+}
+
+static bool open_cidr_sink(GeoipContext *ctx, RangeSink *sink) {
+    return open_country_files(ctx, sink, sink->addr_family == AF_INET6 ? GEOIP_CIDR_IPV6_SUFFIX : GEOIP_CIDR_IPV4_SUFFIX);
+}
+
+static bool open_codegen_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    bool ipv6 = sink->addr_family == AF_INET6;
+    
+    writer->set_file = open_sink_file(ctx, sink, GEOIP_CODEGEN_FILE_NAME, ipv6 ? GEOIP_CODEGEN_IPV6_SOURCE_SUFFIX : GEOIP_CODEGEN_IPV4_SOURCE_SUFFIX);
+    if (writer->set_file == NULL) {
+        return false;
+    }
+    
+    writer->aux_files[0] = open_sink_file(ctx, sink, GEOIP_CODEGEN_FILE_NAME, ipv6 ? GEOIP_CODEGEN_IPV6_HEADER_SUFFIX : GEOIP_CODEGEN_IPV4_HEADER_SUFFIX);
+    if (writer->aux_files[0] == NULL) {
+        return false;
+    }
+    
+    number_countries(ctx, writer);
+    
+    return true;
+}
+
+//the table's size is only known once the ranges are resolved, so both files are written at the end
+static bool finish_codegen_sink(GeoipContext *ctx, RangeSink *sink) {
+    RangeWriter *writer = &sink->writer;
+    
+    if (!sweep_intervals(&writer->intervals, add_codegen_range, writer)) {
+        return false;
+    }
+    
+    free_sweep_set(&writer->intervals);
+    
+    return write_codegen_header(ctx, writer, sink->addr_family) && write_codegen_source(ctx, writer, sink->addr_family);
+}
+
+//a source without its header, or one cut short, would only fail later in the build of the program using it
+static void discard_codegen_sink(RangeSink *sink) {
+    bool ipv6 = sink->addr_family == AF_INET6;
+    
+    remove_sink_file(sink, GEOIP_CODEGEN_FILE_NAME, ipv6 ? GEOIP_CODEGEN_IPV6_SOURCE_SUFFIX : GEOIP_CODEGEN_IPV4_SOURCE_SUFFIX);
+    remove_sink_file(sink, GEOIP_CODEGEN_FILE_NAME, ipv6 ? GEOIP_CODEGEN_IPV6_HEADER_SUFFIX : GEOIP_CODEGEN_IPV4_HEADER_SUFFIX);
+}
+
+//sink formats, indexed by GEOIP_FORMAT_*
+//name is how programs using the library call the format, discard, if set, removes the files of an output that failed
+static const SinkFormat SINK_FORMATS[GEOIP_NUM_FORMATS] = {
+    {"xt_geoip", open_xtgeoip_sink, write_xtgeoip_range, NULL, NULL},
+    {"ipset", open_ipset_sink, write_ipset_range, finish_ipset_sink, NULL},
+    {"lpm", open_lpm_sink, write_lpm_range, finish_lpm_sink, NULL},
+    {"bundle", open_bundle_sink, write_bundle_range, finish_bundle_sink, NULL},
+    {"routes", open_routes_sink, write_route_range, finish_routes_sink, NULL},
+    {"nft", open_nft_sink, write_nft_range, finish_nft_sink, NULL},
+    {"cidr", open_cidr_sink, write_cidr_range, NULL, NULL},
+    {"combined", open_combined_sink, write_combined_range, finish_combined_sink, NULL},
+    {"codegen", open_codegen_sink, write_codegen_range, finish_codegen_sink, discard_codegen_sink}
+};
+
+//returns the name of a GEOIP_FORMAT_* format, or NULL if there's no such format
+char *geoip_format_name(int format) {
+    if (format < 0 || format >= GEOIP_NUM_FORMATS) {
+        return NULL;
+    }
+    
+    return SINK_FORMATS[format].name;
+}
+
+//returns the GEOIP_FORMAT_* format called name, or -1 if there's no such format
+int geoip_find_format(char *name) {
+    int i;
+    
+    for (i = 0; i < GEOIP_NUM_FORMATS; i++) {
+        if (strcmp(name, SINK_FORMATS[i].name) == 0) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+//parser callback: passes a coalesced range to every sink
+static bool write_range_to_sinks(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end) {
+    SinkSet *set = user_data;
+    unsigned i;
+    
+    for (i = 0; i < set->num_sinks; i++) {
+        if (!set->sinks[i].format->write_range(&set->sinks[i].writer, country_code, addr_family, start, end)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//parses a range file into every sink, then finishes their files if the whole file was parsed
+//returns the number of ranges processed, or 0 on error
+static unsigned parse_range_file(GeoipContext *ctx, FILE *range_file, int addr_family, RangeSink *sinks, unsigned num_sinks) {
+    SinkSet set = {sinks, num_sinks};
+    char *buf;
+    size_t len;
+    bool read_error;
+    unsigned num_ranges;
+    unsigned i;
+    
+    buf = malloc(RANGE_FILE_BUF_SIZE);
+    if (buf == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        return 0;
+    }
+    
+    posix_fadvise(fileno(range_file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    if (!geoip_begin_ranges(ctx, addr_family, write_range_to_sinks, &set)) {
+        free(buf);
+        return 0;
+    }
+    
+    while ((len = fread(buf, 1, RANGE_FILE_BUF_SIZE, range_file)) > 0) {
+        if (!geoip_feed_ranges(ctx, buf, len)) {
+            break;
+        }
+    }
+    
+    read_error = ferror(range_file);
+    num_ranges = geoip_end_ranges(ctx);
+    free(buf);
+    
+    if (read_error) {
+        ctx->err_msg = "Read error.";
+        add_line_to_error(ctx, ctx->parser.line_num);
+        return 0;
+    }
+    
+    for (i = 0; num_ranges && i < num_sinks; i++) {
+        if (sinks[i].format->finish != NULL && !sinks[i].format->finish(ctx, &sinks[i])) {
+            ctx->err_msg = "Error writing ranges.";
+            num_ranges = 0;
+        }
+    }
+    
+    return num_ranges;
+}
+
+//sets up a sink for an output and opens its files
+//the sink must be closed with close_sink even if this fails
+static bool open_sink(GeoipContext *ctx, RangeSink *sink, GeoipOutput *output, int addr_family) {
+    RangeWriter *writer = &sink->writer;
+    
+    init_overlay_set(&writer->collected, addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES);
+    init_sweep_set(&writer->intervals, addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES);
+    sink->ctx = ctx;
+    sink->format = &SINK_FORMATS[output->format];
+    sink->directory = output->directory;
+    sink->addr_family = addr_family;
+    
+    writer->out_files = calloc(GEOIP_MAX_COUNTRIES, sizeof(FILE *));
+    writer->num_prefixes = calloc(GEOIP_MAX_COUNTRIES, sizeof(unsigned));
+    writer->set_indexes = calloc(GEOIP_MAX_COUNTRIES, sizeof(uint16_t));
+    if (writer->out_files == NULL || writer->num_prefixes == NULL || writer->set_indexes == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        return false;
+    }
+    
+    return sink->format->open(ctx, sink);
+}
+
+//closes the files of a sink and frees its buffers
+//returns num_ranges, or 0 if a file couldn't be written
+static unsigned close_sink(GeoipContext *ctx, RangeSink *sink, unsigned num_ranges) {
+    RangeWriter *writer = &sink->writer;
+    unsigned i;
+    
+    free_overlay_set(&writer->collected);
+    free_sweep_set(&writer->intervals);
+    free(writer->num_prefixes);
+    free(writer->set_indexes);
+    free(writer->set_values);
+    free(writer->bundle_codes);
+    
+    if (writer->bundle_countries != NULL) {
+        for (i = 0; i < writer->num_set_countries; i++) {
+            free(writer->bundle_countries[i].data);
+        }
+        
+        free(writer->bundle_countries);
+    }
+    
+    //single files are flushed as country position 0
+    if (writer->set_file != NULL) {
+        PROBE1(output_flush_start, 0);
+        if (fclose(writer->set_file) != 0 && num_ranges) {
+            ctx->err_msg = "Error writing ranges.";
+            num_ranges = 0;
+        }
+        PROBE2(output_flush_done, 0, num_ranges);
+    }
+    
+    for (i = 0; i < 2; i++) {
+        if (writer->aux_files[i] == NULL) {
+            continue;
+        }
+        
+        PROBE1(output_flush_start, 0);
+        if (fclose(writer->aux_files[i]) != 0 && num_ranges) {
+            ctx->err_msg = "Error writing ranges.";
+            num_ranges = 0;
+        }
+        PROBE2(output_flush_done, 0, num_ranges);
+    }
+    
+    //close all output files
+    if (writer->out_files != NULL) {
+        for (i = 0; i < GEOIP_MAX_COUNTRIES; i++) {
+            if (writer->out_files[i] == NULL) {
+                continue;
+            }
+            
+            PROBE1(output_flush_start, i);
+            if (fclose(writer->out_files[i]) != 0 && num_ranges) {
+                ctx->err_msg = "Error writing ranges.";
+                num_ranges = 0;
+            }
+            PROBE2(output_flush_done, i, num_ranges);
+        }
+        
+        free(writer->out_files);
+    }
+    
+    return num_ranges;
+}
+
+static unsigned process_range_outputs(GeoipContext *ctx, char *range_file_name, int addr_family, GeoipOutput *outputs, unsigned num_outputs) {
+    FILE *range_file;
+    RangeSink *sinks;
+    unsigned num_open = 0;
+    unsigned num_ranges = 0;
+    unsigned i;
+    
+    memset(&ctx->route_stats, 0, sizeof(GeoipRouteStats));
+    memset(&ctx->combined_stats, 0, sizeof(GeoipCombinedStats));
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    if (!ctx->num_countries) {
+        //nothing to do
+        ctx->err_msg = "No countries to process.";
+        return 0;
+    }
+    
+    if (addr_family != AF_INET && addr_family != AF_INET6) {
+        ctx->err_msg = "Invalid address family.";
+        return 0;
+    }
+    
+    if (!num_outputs) {
+        ctx->err_msg = "No outputs to write.";
+        return 0;
+    }
+    
+    for (i = 0; i < num_outputs; i++) {
+        if (outputs[i].format < 0 || outputs[i].format >= GEOIP_NUM_FORMATS) {
+            ctx->err_msg = "Invalid output format.";
+            return 0;
+        }
+    }
+    
+    range_file = polite_fopen(&ctx->polite, range_file_name, "r");
+    if (range_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    PROBE2(range_file_open, range_file_name, addr_family);
+    
+    sinks = calloc(num_outputs, sizeof(RangeSink));
+    if (sinks == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        goto end;
+    }
+    
+    for (; num_open < num_outputs; num_open++) {
+        if (!open_sink(ctx, &sinks[num_open], &outputs[num_open], addr_family)) {
+            //partly opened, so it's closed too
+            num_open++;
+            goto end;
+        }
+    }
+    
+    num_ranges = parse_range_file(ctx, range_file, addr_family, sinks, num_outputs);
+    
+    for (i = 0; num_ranges && i < num_outputs; i++) {
+        if (outputs[i].format == GEOIP_FORMAT_ROUTES) {
+            ctx->route_stats = sinks[i].writer.route_stats;
+        }
+        
+        if (outputs[i].format == GEOIP_FORMAT_COMBINED) {
+            ctx->combined_stats = sinks[i].writer.combined_stats;
+        }
+    }
+    
+    end:
+    
+    fclose(range_file);
+    
+    for (i = 0; i < num_open; i++) {
+        num_ranges = close_sink(ctx, &sinks[i], num_ranges);
+    }
+    
+    //the outputs that can't be left half written are removed if anything failed
+    for (i = 0; !num_ranges && i < num_open; i++) {
+        if (sinks[i].format->discard != NULL) {
+            sinks[i].format->discard(&sinks[i]);
+        }
+    }
+    
+    free(sinks);
+    
+    PROBE2(range_file_close, range_file_name, num_ranges);
+    
+    return num_ranges;
+}
+
+//writes ranges from a range file to several outputs, each in one of the GEOIP_FORMAT_* formats and in its own directory
+//the range file is parsed once, and each output is written from the coalesced ranges
+unsigned geoip_process_range_outputs(GeoipContext *ctx, char *range_file_name, int addr_family, GeoipOutput *outputs, unsigned num_outputs) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = process_range_outputs(ctx, range_file_name, addr_family, outputs, num_outputs);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//writes ranges from a range file to one output file per country, in one of the GEOIP_FORMAT_* formats
+//GEOIP_FORMAT_LPM and GEOIP_FORMAT_BUNDLE write a single file with all countries instead,
+//and GEOIP_FORMAT_ROUTES a BIRD, an FRR route and an FRR prefix list file with all countries
+unsigned geoip_process_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory, int output_format) {
+    GeoipOutput output;
+    
+    output.format = output_format;
+    output.directory = output_directory;
+    
+    return geoip_process_range_outputs(ctx, range_file_name, addr_family, &output, 1);
+}
+
+//reads a whole file into a buffer that must be freed by the caller
+//returns NULL on success, or an error message
+static char *read_whole_file(PoliteIo *io, char *file_name, uint8_t **data, size_t *size) {
+    FILE *file;
+    long file_size;
+    char *err_msg = NULL;
+    
+    *data = NULL;
+    
+    file = polite_fopen(io, file_name, "r");
+    if (file == NULL) {
+        return "Error opening file.";
+    }
+    
+    if (fseek(file, 0, SEEK_END) != 0 || (file_size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        err_msg = "Error reading file.";
+        goto end;
+    }
+    *size = file_size;
+    
+    *data = malloc(*size ? *size : 1);
+    if (*data == NULL) {
+        err_msg = "Error allocating buffers.";
+        goto end;
+    }
+    
+    if (*size && !fread(*data, *size, 1, file)) {
+        err_msg = "Error reading file.";
+        free(*data);
+        *data = NULL;
+    }
+    
+    end:
+    
+    fclose(file);
+    
+    return err_msg;
+}
+
+static unsigned unpack_bundle(GeoipContext *ctx, char *bundle_file_name, int addr_family, char *output_directory) {
+    FILE *out_file;
+    uint8_t *bundle = NULL;
+    uint8_t *data;
+    uint8_t *entry;
+    uint8_t *ranges = NULL;
+    size_t ranges_size;
+    size_t addr_bytes = addr_family == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    size_t size;
+    size_t index_size;
+    size_t data_size;
+    uint64_t offset;
+    uint64_t len;
+    uint32_t num_countries;
+    uint32_t num_ranges;
+    uint32_t max_ranges = 0;
+    unsigned i;
+    unsigned num_written = 0;
+    unsigned total_ranges = 0;
+    char *output_file_name = NULL;
+    char country_code[GEOIP_COUNTRY_CODE_SIZE + 1];
+    HashState hash;
+    
+    if (addr_family != AF_INET && addr_family != AF_INET6) {
+        ctx->err_msg = "Invalid address family.";
+        return 0;
+    }
+    
+    ctx->err_msg = read_whole_file(&ctx->polite, bundle_file_name, &bundle, &size);
+    if (ctx->err_msg != NULL) {
+        return 0;
+    }
+    
+    if (size < BUNDLE_HEADER_SIZE) {
+        ctx->err_msg = "Bundle is truncated.";
+        goto end;
+    }
+    
+    //check the header and the index
+    if (memcmp(bundle, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE) != 0 || get_le32(bundle + 8) != BUNDLE_VERSION) {
+        ctx->err_msg = "Not a bundle, or a bundle of another version.";
+        goto end;
+    }
+    
+    if (get_le32(bundle + 12) != (addr_family == AF_INET6 ? 6 : 4)) {
+        ctx->err_msg = "Bundle is for another address family.";
+        goto end;
+    }
+    
+    num_countries = get_le32(bundle + 16);
+    if (num_countries > GEOIP_MAX_COUNTRIES || (size - BUNDLE_HEADER_SIZE) / BUNDLE_INDEX_ENTRY_SIZE < num_countries) {
+        ctx->err_msg = "Bundle is truncated.";
+        goto end;
+    }
+    index_size = (size_t)num_countries * BUNDLE_INDEX_ENTRY_SIZE;
+    data = bundle + BUNDLE_HEADER_SIZE + index_size;
+    data_size = size - BUNDLE_HEADER_SIZE - index_size;
+    
+    hash_init(&hash, 0);
+    hash_update(&hash, bundle, BUNDLE_CHECKED_HEADER_SIZE);
+    hash_update(&hash, bundle + BUNDLE_HEADER_SIZE, index_size);
+    if (hash_final(&hash) != get_le64(bundle + BUNDLE_CHECKED_HEADER_SIZE)) {
+        ctx->err_msg = "Bundle index checksum mismatch.";
+        goto end;
+    }
+    
+    //check every country's data
+    for (i = 0; i < num_countries; i++) {
+        entry = bundle + BUNDLE_HEADER_SIZE + i * BUNDLE_INDEX_ENTRY_SIZE;
+        num_ranges = get_le32(entry + 4);
+        offset = get_le64(entry + 8);
+        len = get_le64(entry + 16);
+        
+        //codes become file names, so only allow what country files can hold
+        if (!isalnum(entry[0]) || !isalnum(entry[1]) || entry[2] || entry[3]) {
+            ctx->err_msg = "Invalid country code in bundle.";
+            goto end;
+        }
+        
+        //every range takes at least 2 bytes
+        if (offset > data_size || len > data_size - offset || num_ranges > len / 2) {
+            ctx->err_msg = "Bundle is truncated.";
+            goto end;
+        }
+        
+        hash_init(&hash, 0);
+        hash_update(&hash, data + offset, len);
+        if (hash_final(&hash) != get_le64(entry + 24)) {
+            ctx->err_msg = "Bundle data checksum mismatch.";
+            goto end;
+        }
+        
+        if (num_ranges > max_ranges) {
+            max_ranges = num_ranges;
+        }
+    }
+    
+    ranges = malloc(max_ranges ? (size_t)max_ranges * 2 * addr_bytes : 1);
+    output_file_name = malloc(strlen(output_directory) + 1 + GEOIP_COUNTRY_CODE_SIZE + strlen(GEOIP_IPV6_SUFFIX) + 1);
+    if (ranges == NULL || output_file_name == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        goto end;
+    }
+    
+    for (i = 0; i < num_countries; i++) {
+        entry = bundle + BUNDLE_HEADER_SIZE + i * BUNDLE_INDEX_ENTRY_SIZE;
+        num_ranges = get_le32(entry + 4);
+        offset = get_le64(entry + 8);
+        len = get_le64(entry + 16);
+        ranges_size = (size_t)num_ranges * 2 * addr_bytes;
+        
+        if (!decode_bundle_ranges(data + offset, len, num_ranges, addr_bytes, ranges)) {
+            ctx->err_msg = "Invalid ranges in bundle.";
+            goto end;
+        }
+        
+        memcpy(country_code, entry, GEOIP_COUNTRY_CODE_SIZE);
+        country_code[GEOIP_COUNTRY_CODE_SIZE] = '\0';
+        
+        //generate file name
+        strcpy(output_file_name, output_directory);
+        strcat(output_file_name, "/");
+        strcat(output_file_name, country_code);
+        strcat(output_file_name, addr_family == AF_INET6 ? GEOIP_IPV6_SUFFIX : GEOIP_IPV4_SUFFIX);
+        
+        out_file = polite_fopen(&ctx->polite, output_file_name, "w");
+        if (out_file == NULL) {
+            ctx->err_msg = "Error opening an output file.";
+            goto end;
+        }
+        
+        if ((ranges_size && !fwrite(ranges, ranges_size, 1, out_file)) | (fclose(out_file) != 0)) {
+            ctx->err_msg = "Error writing ranges.";
+            goto end;
+        }
+        
+        total_ranges += num_ranges;
+    }
+    
+    num_written = total_ranges;
+    if (!num_written) {
+        ctx->err_msg = "No usable data in file.";
+    }
+    
+    end:
+    
+    free(bundle);
+    free(ranges);
+    free(output_file_name);
+    
+    return num_written;
+}
+
+//writes the xt_geoip files of every country in a bundle written with GEOIP_FORMAT_BUNDLE
+//the whole bundle is checked before any file is written, so a corrupt bundle leaves the output directory alone
+unsigned geoip_unpack_bundle(GeoipContext *ctx, char *bundle_file_name, int addr_family, char *output_directory) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = unpack_bundle(ctx, bundle_file_name, addr_family, output_directory);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//tells which address family an xt_geoip file name is for, or 0 if it isn't one
+//names are limited to letters, digits and dashes before the suffix, so that patches can't reach outside the directory
+static int xtgeoip_file_family(const char *name) {
+    size_t len = strlen(name);
+    size_t i;
+    
+    if (len <= strlen(GEOIP_IPV4_SUFFIX) || len > PATCH_MAX_NAME_SIZE) {
+        return 0;
+    }
+    
+    for (i = 0; i < len - strlen(GEOIP_IPV4_SUFFIX); i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-') {
+            return 0;
+        }
+    }
+    
+    if (strcmp(name + len - strlen(GEOIP_IPV4_SUFFIX), GEOIP_IPV4_SUFFIX) == 0) {
+        return AF_INET;
+    }
+    
+    if (strcmp(name + len - strlen(GEOIP_IPV6_SUFFIX), GEOIP_IPV6_SUFFIX) == 0) {
+        return AF_INET6;
+    }
+    
+    return 0;
+}
+
+static int is_xtgeoip_file(const struct dirent *entry) {
+    return xtgeoip_file_family(entry->d_name) != 0;
+}
+
+//sorts directory entries by plain byte order, which the diff relies on to pair files up
+static int compare_file_names(const struct dirent **entry1, const struct dirent **entry2) {
+    return strcmp((*entry1)->d_name, (*entry2)->d_name);
+}
+
+//returns directory/name followed by suffix, in a buffer that must be freed by the caller
+static char *make_file_name(char *directory, char *name, char *suffix) {
+    char *file_name;
+    
+    file_name = malloc(strlen(directory) + 1 + strlen(name) + strlen(suffix) + 1);
+    if (file_name != NULL) {
+        strcpy(file_name, directory);
+        strcat(file_name, "/");
+        strcat(file_name, name);
+        strcat(file_name, suffix);
+    }
+    
+    return file_name;
+}
+
+static void free_file_list(struct dirent **entries, int num_entries) {
+    int i;
+    
+    for (i = 0; i < num_entries; i++) {
+        free(entries[i]);
+    }
+    
+    free(entries);
+}
+
+//writes the record of a file that is in the old directory, the new one or both, unless it's the same in both
+//old_directory or new_directory is NULL when the file isn't there
+static bool diff_file(GeoipContext *ctx, PatchStream *stream, char *old_directory, char *new_directory, char *name, GeoipPatchStats *stats) {
+    char *file_name;
+    uint8_t *old_data = NULL;
+    uint8_t *new_data = NULL;
+    size_t old_size = 0;
+    size_t new_size = 0;
+    size_t range_size = xtgeoip_file_family(name) == AF_INET6 ? 2 * IPV6_BYTES : 2 * IPV4_BYTES;
+    uint8_t record[2];
+    uint8_t hash_buf[8];
+    HashState hash;
+    bool ok = false;
+    
+    //read both generations
+    if (old_directory != NULL) {
+        file_name = make_file_name(old_directory, name, "");
+        ctx->err_msg = file_name != NULL ? read_whole_file(&ctx->polite, file_name, &old_data, &old_size) : "Error allocating buffers.";
+        free(file_name);
+        if (ctx->err_msg != NULL) {
+            goto end;
+        }
+    }
+    
+    if (new_directory != NULL) {
+        file_name = make_file_name(new_directory, name, "");
+        ctx->err_msg = file_name != NULL ? read_whole_file(&ctx->polite, file_name, &new_data, &new_size) : "Error allocating buffers.";
+        free(file_name);
+        if (ctx->err_msg != NULL) {
+            goto end;
+        }
+    }
+    
+    if (old_size % range_size || new_size % range_size) {
+        ctx->err_msg = "Invalid xt_geoip file.";
+        goto end;
+    }
+    
+    //unchanged files need no record
+    if (old_data != NULL && new_data != NULL && old_size == new_size && memcmp(old_data, new_data, old_size) == 0) {
+        ok = true;
+        goto end;
+    }
+    
+    if (old_data == NULL) {
+        record[0] = PATCH_CREATE;
+        stats->created_files++;
+    }
+    else if (new_data == NULL) {
+        record[0] = PATCH_DELETE;
+        stats->deleted_files++;
+    }
+    else {
+        record[0] = PATCH_MODIFY;
+        stats->modified_files++;
+    }
+    record[1] = strlen(name);
+    
+    patch_put(stream, record, sizeof(record));
+    patch_put(stream, name, record[1]);
+    
+    if (old_data != NULL) {
+        hash_init(&hash, 0);
+        hash_update(&hash, old_data, old_size);
+        put_le64(hash_buf, hash_final(&hash));
+        patch_put(stream, hash_buf, sizeof(hash_buf));
+    }
+    
+    if (new_data != NULL) {
+        hash_init(&hash, 0);
+        hash_update(&hash, new_data, new_size);
+        put_le64(hash_buf, hash_final(&hash));
+        patch_put(stream, hash_buf, sizeof(hash_buf));
+        
+        if (!diff_ranges(stream, old_data, old_size / range_size, new_data, new_size / range_size, range_size / 2, stats)) {
+            ctx->err_msg = stream->failed ? "Error writing patch." : "Ranges of a new file are not in ascending order.";
+            goto end;
+        }
+    }
+    
+    ok = true;
+    
+    end:
+    
+    free(old_data);
+    free(new_data);
+    
+    return ok;
+}
+
+static bool diff_directories(GeoipContext *ctx, char *old_directory, char *new_directory, FILE *patch_file, GeoipPatchStats *stats) {
+    struct dirent **old_files = NULL;
+    struct dirent **new_files = NULL;
+    int num_old_files;
+    int num_new_files;
+    int i = 0;
+    int j = 0;
+    int cmp;
+    uint8_t header[PATCH_HEADER_SIZE];
+    uint8_t end_record[1 + sizeof(uint64_t)];
+    PatchStream stream;
+    bool ok = false;
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    num_old_files = scandir(old_directory, &old_files, is_xtgeoip_file, compare_file_names);
+    num_new_files = scandir(new_directory, &new_files, is_xtgeoip_file, compare_file_names);
+    if (num_old_files < 0 || num_new_files < 0) {
+        ctx->err_msg = "Error reading directory.";
+        goto end;
+    }
+    
+    stream.file = patch_file;
+    stream.failed = false;
+    hash_init(&stream.hash, 0);
+    
+    memset(header, 0, sizeof(header));
+    memcpy(header, PATCH_MAGIC, PATCH_MAGIC_SIZE);
+    put_le32(header + PATCH_MAGIC_SIZE, PATCH_VERSION);
+    patch_put(&stream, header, sizeof(header));
+    
+    //walk both sorted lists, pairing up files with the same name
+    while (i < num_old_files || j < num_new_files) {
+        if (i == num_old_files) {
+            cmp = 1;
+        }
+        else if (j == num_new_files) {
+            cmp = -1;
+        }
+        else {
+            cmp = strcmp(old_files[i]->d_name, new_files[j]->d_name);
+        }
+        
+        if (!diff_file(ctx, &stream, cmp <= 0 ? old_directory : NULL, cmp >= 0 ? new_directory : NULL,
+                       cmp <= 0 ? old_files[i]->d_name : new_files[j]->d_name, stats)) {
+            goto end;
+        }
+        
+        i += cmp <= 0;
+        j += cmp >= 0;
+    }
+    
+    //the checksum covers everything before it
+    end_record[0] = PATCH_END;
+    patch_put(&stream, end_record, 1);
+    put_le64(end_record + 1, hash_final(&stream.hash));
+    
+    if (stream.failed || !fwrite(end_record + 1, sizeof(uint64_t), 1, patch_file) || fflush(patch_file) != 0) {
+        ctx->err_msg = "Error writing patch.";
+        goto end;
+    }
+    
+    ok = true;
+    
+    end:
+    
+    if (old_files != NULL) {
+        free_file_list(old_files, num_old_files);
+    }
+    
+    if (new_files != NULL) {
+        free_file_list(new_files, num_new_files);
+    }
+    
+    return ok;
+}
+
+//writes a patch that turns the xt_geoip files in old_directory into those in new_directory
+//files are paired up by name, and the ranges of each changed file are merge-walked to find the ones inserted and deleted
+bool geoip_diff_directories(GeoipContext *ctx, char *old_directory, char *new_directory, FILE *patch_file, GeoipPatchStats *stats) {
+    bool result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = diff_directories(ctx, old_directory, new_directory, patch_file, stats);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//applies one file's record, writing the new generation next to the file
+//returns NULL on success, or an error message
+static char *apply_file(PoliteIo *io, PatchStream *stream, int kind, char *name, PatchedFile *patched_file, GeoipPatchStats *stats) {
+    FILE *old_file = NULL;
+    FILE *new_file;
+    uint8_t hash_buf[8];
+    uint64_t old_hash = 0;
+    uint64_t new_hash = 0;
+    uint64_t hash;
+    size_t addr_bytes = xtgeoip_file_family(name) == AF_INET6 ? IPV6_BYTES : IPV4_BYTES;
+    HashState old_state;
+    HashState new_state;
+    char *err_msg;
+    
+    if (kind != PATCH_CREATE) {
+        if (!patch_get(stream, hash_buf, sizeof(hash_buf))) {
+            return "Patch is truncated or invalid.";
+        }
+        old_hash = get_le64(hash_buf);
+    }
+    
+    if (kind != PATCH_DELETE) {
+        if (!patch_get(stream, hash_buf, sizeof(hash_buf))) {
+            return "Patch is truncated or invalid.";
+        }
+        new_hash = get_le64(hash_buf);
+    }
+    
+    //files are only deleted once the whole patch is verified, but they must be the ones the patch was made from
+    if (kind == PATCH_DELETE) {
+        stats->deleted_files++;
+        
+        if (!hash_file(patched_file->file_name, &hash, io) || hash != old_hash) {
+            return "Patch doesn't match the files in the directory.";
+        }
+        
+        return NULL;
+    }
+    
+    if (kind == PATCH_CREATE) {
+        stats->created_files++;
+        
+        if (access(patched_file->file_name, F_OK) == 0) {
+            return "Patch doesn't match the files in the directory.";
+        }
+    }
+    else {
+        stats->modified_files++;
+        
+        old_file = polite_fopen(io, patched_file->file_name, "r");
+        if (old_file == NULL) {
+            return "Patch doesn't match the files in the directory.";
+        }
+    }
+    
+    new_file = polite_fopen(io, patched_file->tmp_file_name, "w");
+    if (new_file == NULL) {
+        if (old_file != NULL) {
+            fclose(old_file);
+        }
+        
+        return "Error opening an output file.";
+    }
+    
+    hash_init(&old_state, 0);
+    hash_init(&new_state, 0);
+    err_msg = apply_ranges(stream, old_file, new_file, addr_bytes, &old_state, &new_state, stats);
+    
+    if (old_file != NULL) {
+        fclose(old_file);
+    }
+    
+    if (fclose(new_file) != 0 && err_msg == NULL) {
+        err_msg = "Error writing ranges.";
+    }
+    
+    if (err_msg == NULL && kind == PATCH_MODIFY && hash_final(&old_state) != old_hash) {
+        err_msg = "Patch doesn't match the files in the directory.";
+    }
+    
+    if (err_msg == NULL && hash_final(&new_state) != new_hash) {
+        err_msg = "Patched file checksum mismatch.";
+    }
+    
+    return err_msg;
+}
+
+static bool apply_patch(GeoipContext *ctx, FILE *patch_file, char *directory, GeoipPatchStats *stats) {
+    PatchStream stream;
+    PatchedFile *patched_files = NULL;
+    PatchedFile *patched_file;
+    size_t num_patched_files = 0;
+    size_t patched_files_capacity = 0;
+    uint8_t header[PATCH_HEADER_SIZE];
+    uint8_t record[2];
+    uint8_t hash_buf[8];
+    char name[PATCH_MAX_NAME_SIZE + 1];
+    size_t i;
+    bool ok = false;
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    stream.file = patch_file;
+    stream.failed = false;
+    hash_init(&stream.hash, 0);
+    
+    if (!patch_get(&stream, header, sizeof(header)) || memcmp(header, PATCH_MAGIC, PATCH_MAGIC_SIZE) != 0 ||
+        get_le32(header + PATCH_MAGIC_SIZE) != PATCH_VERSION) {
+        ctx->err_msg = "Not a patch, or a patch of another version.";
+        return false;
+    }
+    
+    while (true) {
+        if (!patch_get(&stream, record, 1)) {
+            ctx->err_msg = "Patch is truncated or invalid.";
+            goto end;
+        }
+        
+        if (record[0] == PATCH_END) {
+            break;
+        }
+        
+        if (record[0] > PATCH_DELETE || !patch_get(&stream, record + 1, 1) || !patch_get(&stream, name, record[1])) {
+            ctx->err_msg = "Patch is truncated or invalid.";
+            goto end;
+        }
+        
+        name[record[1]] = '\0';
+        if (!xtgeoip_file_family(name)) {
+            ctx->err_msg = "Invalid file name in patch.";
+            goto end;
+        }
+        
+        if (num_patched_files == patched_files_capacity) {
+            patched_files_capacity = patched_files_capacity ? patched_files_capacity * 2 : PATCH_MIN_FILES;
+            patched_file = realloc(patched_files, patched_files_capacity * sizeof(PatchedFile));
+            if (patched_file == NULL) {
+                ctx->err_msg = "Error allocating buffers.";
+                goto end;
+            }
+            
+            patched_files = patched_file;
+        }
+        
+        //keep track of the file before touching it, so that it's cleaned up on errors
+        patched_file = &patched_files[num_patched_files++];
+        patched_file->file_name = make_file_name(directory, name, "");
+        patched_file->tmp_file_name = record[0] != PATCH_DELETE ? make_file_name(directory, name, PATCH_TMP_SUFFIX) : NULL;
+        if (patched_file->file_name == NULL || (record[0] != PATCH_DELETE && patched_file->tmp_file_name == NULL)) {
+            ctx->err_msg = "Error allocating buffers.";
+            goto end;
+        }
+        
+        ctx->err_msg = apply_file(&ctx->polite, &stream, record[0], name, patched_file, stats);
+        if (ctx->err_msg != NULL) {
+            goto end;
+        }
+    }
+    
+    //the checksum covers everything before it, and nothing may come after it
+    if (!fread(hash_buf, sizeof(hash_buf), 1, patch_file) || get_le64(hash_buf) != hash_final(&stream.hash) || getc(patch_file) != EOF) {
+        ctx->err_msg = "Patch checksum mismatch.";
+        goto end;
+    }
+    
+    //everything checks out, so replace the files
+    for (i = 0; i < num_patched_files; i++) {
+        if (patched_files[i].tmp_file_name != NULL ?
+            rename(patched_files[i].tmp_file_name, patched_files[i].file_name) != 0 :
+            unlink(patched_files[i].file_name) != 0) {
+            ctx->err_msg = "Error replacing files.";
+            goto end;
+        }
+        
+        free(patched_files[i].tmp_file_name);
+        patched_files[i].tmp_file_name = NULL;
+    }
+    
+    ok = true;
+    
+    end:
+    
+    for (i = 0; i < num_patched_files; i++) {
+        if (patched_files[i].tmp_file_name != NULL) {
+            unlink(patched_files[i].tmp_file_name);
+        }
+        
+        free(patched_files[i].file_name);
+        free(patched_files[i].tmp_file_name);
+    }
+    
+    free(patched_files);
+    
+    return ok;
+}
+
+//applies a patch written by geoip_diff_directories to the xt_geoip files in directory
+//the patch is read once, from start to end; new files are written next to the old ones and only moved over them
+//once every file and the patch itself have been checked, so a bad patch leaves the directory as it was
+bool geoip_apply_patch(GeoipContext *ctx, FILE *patch_file, char *directory, GeoipPatchStats *stats) {
+    bool result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = apply_patch(ctx, patch_file, directory, stats);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//parses a rule of a simulated rule set: a comma-separated list of up to GEOIP_SIM_RULE_MAX_COUNTRIES country codes,
+//preceded by ! for an inverted match
+bool geoip_parse_sim_rule(char *rule_spec, GeoipSimRule *rule) {
+    char *code;
+    size_t len;
+    
+    memset(rule, 0, sizeof(GeoipSimRule));
+    
+    if (*rule_spec == '!') {
+        rule->inverted = true;
+        rule_spec++;
+    }
+    
+    for (code = rule_spec; ; code += len + 1) {
+        len = strcspn(code, ",");
+        if (len != GEOIP_COUNTRY_CODE_SIZE || !isalnum((unsigned char)code[0]) || !isalnum((unsigned char)code[1]) || rule->num_countries == GEOIP_SIM_RULE_MAX_COUNTRIES) {
+            return false;
+        }
+        
+        rule->country_codes[rule->num_countries][0] = toupper(code[0]);
+        rule->country_codes[rule->num_countries++][1] = toupper(code[1]);
+        
+        if (code[len] == '\0') {
+            return true;
+        }
+    }
+}
+
+//loads both address families of a rule's country from its xt_geoip files, unless it's already loaded
+static bool load_sim_country(GeoipContext *ctx, char *directory, char *country_code, SimSubnets *subnets) {
+    char *suffixes[] = {GEOIP_IPV4_SUFFIX, GEOIP_IPV6_SUFFIX};
+    size_t addr_bytes[] = {IPV4_BYTES, IPV6_BYTES};
+    char *file_name;
+    char *err_msg;
+    uint8_t *data;
+    size_t size;
+    bool loaded;
+    unsigned i;
+    
+    for (i = 0; i < 2; i++) {
+        if (subnets[i].data != NULL) {
+            continue;
+        }
+        
+        file_name = malloc(strlen(directory) + GEOIP_COUNTRY_CODE_SIZE + strlen(suffixes[i]) + 2);
+        if (file_name == NULL) {
+            ctx->err_msg = "Error allocating buffers.";
+            return false;
+        }
+        
+        sprintf(file_name, "%s/%s%s", directory, country_code, suffixes[i]);
+        err_msg = read_whole_file(&ctx->polite, file_name, &data, &size);
+        free(file_name);
+        
+        if (err_msg != NULL) {
+            snprintf(ctx->err_msg_buf, MAX_ERR_MSG, "%s (%s%s)", err_msg, country_code, suffixes[i]);
+            ctx->err_msg = ctx->err_msg_buf;
+            return false;
+        }
+        
+        loaded = load_sim_subnets(&subnets[i], data, size, addr_bytes[i]);
+        free(data);
+        
+        if (!loaded) {
+            snprintf(ctx->err_msg_buf, MAX_ERR_MSG, "Invalid xt_geoip file. (%s%s)", country_code, suffixes[i]);
+            ctx->err_msg = ctx->err_msg_buf;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//adds a packet's cost to the points kept for percentiles
+static bool add_sim_point(SimPoint **points, size_t num_points, size_t *capacity, unsigned value, double weight) {
+    SimPoint *new_points;
+    size_t new_capacity;
+    
+    if (num_points == *capacity) {
+        new_capacity = *capacity ? *capacity * 2 : SIM_MIN_POINTS;
+        new_points = realloc(*points, new_capacity * sizeof(SimPoint));
+        if (new_points == NULL) {
+            return false;
+        }
+        
+        *points = new_points;
+        *capacity = new_capacity;
+    }
+    
+    (*points)[num_points].value = value;
+    (*points)[num_points].weight = weight;
+    
+    return true;
+}
+
+static bool simulate_rules(GeoipContext *ctx, char *directory, GeoipSimRule *rules, unsigned num_rules, char *sample_file_name, GeoipSimStats *stats) {
+    SimSubnets (*countries)[2];
+    SimSubnets *subnets;
+    SimCost *cost = NULL;
+    SimPoint *comparison_points = NULL;
+    SimPoint *line_points = NULL;
+    size_t num_points = 0;
+    size_t comparison_capacity = 0;
+    size_t line_capacity = 0;
+    FILE *sample_file = NULL;
+    char line[MAX_LINE];
+    char *address;
+    char *weight_text;
+    char *end;
+    char *save;
+    uint8_t addr[IPV6_BYTES];
+    unsigned line_num = 0;
+    unsigned family;
+    unsigned i;
+    unsigned j;
+    double weight;
+    double total_comparisons = 0;
+    double total_probes = 0;
+    double total_lines = 0;
+    bool found;
+    bool decided;
+    bool ok = false;
+    
+    memset(stats, 0, sizeof(GeoipSimStats));
+    
+    countries = calloc(GEOIP_MAX_COUNTRIES, sizeof(*countries));
+    if (countries == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        return false;
+    }
+    
+    for (i = 0; i < num_rules; i++) {
+        memset(rules[i].lookups, 0, sizeof(rules[i].lookups));
+        memset(rules[i].hits, 0, sizeof(rules[i].hits));
+        rules[i].matches = 0;
+        
+        for (j = 0; j < rules[i].num_countries; j++) {
+            if (!load_sim_country(ctx, directory, rules[i].country_codes[j], countries[country_code_pos(rules[i].country_codes[j])])) {
+                goto end;
+            }
+        }
+    }
+    
+    cost = calloc(1, sizeof(SimCost));
+    if (cost == NULL) {
+        ctx->err_msg = "Error allocating buffers.";
+        goto end;
+    }
+    
+    sample_file = polite_fopen(&ctx->polite, sample_file_name, "r");
+    if (sample_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        goto end;
+    }
+    
+    while (fgets(line, MAX_LINE, sample_file) != NULL) {
+        line_num++;
+        
+        if (strchr(line, '\n') == NULL && !feof(sample_file)) {
+            ctx->err_msg = "Line too long.";
+            add_line_to_error(ctx, line_num);
+            goto end;
+        }
+        
+        address = strtok_r(line, " \t\r\n", &save);
+        if (address == NULL || *address == '#') {
+            continue;
+        }
+        
+        family = strchr(address, ':') != NULL;
+        if (inet_pton(family ? AF_INET6 : AF_INET, address, addr) != 1) {
+            ctx->err_msg = "Invalid address.";
+            add_line_to_error(ctx, line_num);
+            goto end;
+        }
+        
+        weight = 1;
+        weight_text = strtok_r(NULL, " \t\r\n", &save);
+        if (weight_text != NULL) {
+            weight = strtod(weight_text, &end);
+            if (end == weight_text || *end != '\0' || !(weight > 0 && weight <= GEOIP_SIM_MAX_WEIGHT)) {
+                ctx->err_msg = "Invalid weight.";
+                add_line_to_error(ctx, line_num);
+                goto end;
+            }
+        }
+        
+        begin_sim_packet(cost);
+        decided = false;
+        
+        for (i = 0; i < num_rules && !decided; i++) {
+            found = false;
+            
+            for (j = 0; j < rules[i].num_countries && !found; j++) {
+                subnets = &countries[country_code_pos(rules[i].country_codes[j])][family];
+                rules[i].lookups[j] += weight;
+                
+                if (sim_lookup(subnets, addr, cost)) {
+                    rules[i].hits[j] += weight;
+                    found = true;
+                }
+            }
+            
+            if (found != rules[i].inverted) {
+                rules[i].matches += weight;
+                decided = true;
+            }
+        }
+        
+        if (!decided) {
+            stats->unmatched += weight;
+        }
+        
+        if (!add_sim_point(&comparison_points, num_points, &comparison_capacity, cost->comparisons, weight) ||
+            !add_sim_point(&line_points, num_points, &line_capacity, cost->cache_lines, weight)) {
+            ctx->err_msg = "Error allocating buffers.";
+            goto end;
+        }
+        num_points++;
+        
+        stats->packets += weight;
+        total_comparisons += cost->comparisons * weight;
+        total_probes += cost->probes * weight;
+        total_lines += cost->cache_lines * weight;
+    }
+    
+    if (ferror(sample_file)) {
+        ctx->err_msg = "Read error.";
+        goto end;
+    }
+    
+    if (!num_points) {
+        ctx->err_msg = "No addresses in sample.";
+        goto end;
+    }
+    
+    stats->addresses = num_points;
+    stats->comparisons = total_comparisons / stats->packets;
+    stats->probes = total_probes / stats->packets;
+    stats->cache_lines = total_lines / stats->packets;
+    
+    sort_sim_points(comparison_points, num_points);
+    stats->comparisons_p50 = sim_percentile(comparison_points, num_points, stats->packets, 0.5);
+    stats->comparisons_p90 = sim_percentile(comparison_points, num_points, stats->packets, 0.9);
+    stats->comparisons_p99 = sim_percentile(comparison_points, num_points, stats->packets, 0.99);
+    stats->comparisons_max = comparison_points[num_points - 1].value;
+    
+    sort_sim_points(line_points, num_points);
+    stats->cache_lines_p99 = sim_percentile(line_points, num_points, stats->packets, 0.99);
+    stats->cache_lines_max = line_points[num_points - 1].value;
+    
+    ok = true;
+    
+    end:
+    
+    if (sample_file != NULL) {
+        fclose(sample_file);
+    }
+    
+    for (i = 0; i < GEOIP_MAX_COUNTRIES; i++) {
+        free_sim_subnets(&countries[i][0]);
+        free_sim_subnets(&countries[i][1]);
+    }
+    
+    free(countries);
+    free(cost);
+    free(comparison_points);
+    free(line_points);
+    
+    return ok;
+}
+
+//replays a traffic sample against a rule set, with each country's ranges loaded from the xt_geoip files in directory
+//and searched the way the xt_geoip module does: in rule order, then in --src-cc order within a rule,
+//a rule's countries only until one holds the address, and no further rules once one matches
+//the sample holds an IPv4 or IPv6 address per line, optionally followed by a weight such as a packet count (1 if missing)
+//blank lines and lines starting with # are skipped
+//fills in the rules' counters and stats, returns false on error
+bool geoip_simulate(GeoipContext *ctx, char *directory, GeoipSimRule *rules, unsigned num_rules, char *sample_file_name, GeoipSimStats *stats) {
+    bool result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = simulate_rules(ctx, directory, rules, num_rules, sample_file_name, stats);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+static unsigned process_asn_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory) {
+    const unsigned MIN_COLS = 2;
+    const unsigned CIDR_COL_IDX = 0;
+    const unsigned ASN_COL_IDX = 1;
+    const char* REQUIRED_COLS[] = {
+        "network",
+        "autonomous_system_number"
+    };
+    
+    FILE *range_file;
+    char line[MAX_LINE];
+    char *line_data[MAX_COLS];
+    char *file_name_suffix;
+    char output_name[KEYED_OUTPUT_NAME_SIZE];
+    unsigned num_cols;
+    unsigned highest_col;
+    unsigned line_num = 0;
+    unsigned num_ranges = 0;
+    unsigned column_positions[MIN_COLS];
+    unsigned output;
+    unsigned long asn;
+    KeyedOutputSet outputs;
+    IdMap asn_outputs;
+    AddressRange range;
+    ParsePlan plan;
+    CsvField fields[MIN_COLS];
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    if (addr_family == AF_INET) {
+        file_name_suffix = GEOIP_IPV4_SUFFIX;
+    }
+    else if (addr_family == AF_INET6) {
+        file_name_suffix = GEOIP_IPV6_SUFFIX;
+    }
+    else {
+        ctx->err_msg = "Invalid address family.";
+        return 0;
+    }
+    
+    range_file = polite_fopen(&ctx->polite, range_file_name, "r");
+    if (range_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    if (!idmap_init(&asn_outputs, EXPECTED_ASNS)) {
+        ctx->err_msg = "Error allocating ASN index.";
+        fclose(range_file);
+        return 0;
+    }
+    
+    if (!init_keyed_outputs(&outputs, output_directory, file_name_suffix, addr_family, KEYED_OUTPUT_MAX_PENDING, &ctx->polite)) {
+        ctx->err_msg = "Error allocating buffer for output file name.";
+        goto end;
+    }
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_LINE, range_file) == NULL) {
+            if (ferror(range_file)) {
+                ctx->err_msg = "Read error.";
+                num_ranges = 0;
+                goto end;
+            }
+            else {
+                break;
+            }
+        }
+        
+        switch (strlen(line)) {
+            case 0:
+                //skip empty lines
+                continue;
+            
+            case MAX_LINE - 1:
+                ctx->err_msg = "Line too long.";
+                num_ranges = 0;
+                goto end;
+        }
+        
+        if (line_num == 1) {
+            //this is the header, find the position of the required columns
+            num_cols = tokenize_csv(line, line_data, MAX_COLS);
+            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
+                ctx->err_msg = "Required columns not found in header.";
+                num_ranges = 0;
+                goto end;
+            }
+            
+            //only the required columns will be decoded from now on
+            if (!compile_parse_plan(&plan, column_positions, MIN_COLS, highest_col)) {
+                ctx->err_msg = "Too many columns.";
+                num_ranges = 0;
+                goto end;
+            }
+            
+            //nothing else to do with the header, move on to the next line
+            continue;
+        }
+        
+        num_cols = decode_csv_fields(line, &plan, fields);
+        if (num_cols < highest_col + 1) {
+            ctx->err_msg = "Insufficient columns.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        if (!csv_field_to_ulong(&fields[ASN_COL_IDX], &asn) || !asn || asn > UINT32_MAX) {
+            //no usable ASN, skip line
+            continue;
+        }
+        
+        //find this ASN's output, adding it if it's new
+        if (!idmap_get(&asn_outputs, asn, &output)) {
+            snprintf(output_name, sizeof(output_name), "%s%lu", ASN_PREFIX, asn);
+            
+            if (!add_keyed_output(&outputs, output_name, &output) || !idmap_put(&asn_outputs, asn, output)) {
+                ctx->err_msg = "Error allocating output.";
+                num_ranges = 0;
+                goto end;
+            }
+        }
+        
+        //parse cidr to get start and end addresses
+        fields[CIDR_COL_IDX].start[fields[CIDR_COL_IDX].len] = '\0';
+        if (!parse_cidr(fields[CIDR_COL_IDX].start, &range)) {
+            ctx->err_msg = "Invalid CIDR.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        if (range.addr_family != addr_family) {
+            ctx->err_msg = "Wrong address family.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        //this relies on the range file being sorted
+        if (!add_keyed_range(&outputs, output, range.start, range.end)) {
+            ctx->err_msg = "Error writing ranges.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        num_ranges++;
+    }
+    
+    //write whatever is still buffered
+    if (!flush_keyed_outputs(&outputs, true)) {
+        ctx->err_msg = "Error writing ranges.";
+        num_ranges = 0;
+    }
+    
+    end:
+    
+    fclose(range_file);
+    free_keyed_outputs(&outputs);
+    idmap_free(&asn_outputs);
+    
+    if (num_ranges) {
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else if (line_num) {
+        add_line_to_error(ctx, line_num);
+    }
+    
+    return num_ranges;
+}
+
+//writes ranges from an ASN range file to one binary file per autonomous system
+//outputs are buffered and written one file at a time, so any number of ASNs can be handled
+unsigned geoip_process_asn_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = process_asn_range_file(ctx, range_file_name, addr_family, output_directory);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+//packs a subdivision key such as "PT-11" into a nonzero integer for indexing
+static uint64_t pack_subdivision_key(char *key) {
+    uint64_t packed = 0;
+    unsigned i;
+    
+    for (i = 0; key[i] && i < sizeof(packed); i++) {
+        packed = (packed << 8) | (uint8_t)key[i];
+    }
+    
+    return packed;
+}
+
+//finds a subdivision by its key, adding it if it's new
+static bool get_subdivision(Subdivisions *subdivisions, char *key, unsigned *subdivision) {
+    char (*names)[KEYED_OUTPUT_NAME_SIZE];
+    unsigned capacity;
+    uint64_t packed_key;
+    
+    packed_key = pack_subdivision_key(key);
+    if (idmap_get(&subdivisions->key_index, packed_key, subdivision)) {
+        return true;
+    }
+    
+    if (subdivisions->num_subdivisions == subdivisions->capacity) {
+        capacity = subdivisions->capacity ? subdivisions->capacity * 2 : EXPECTED_SUBDIVISIONS;
+        names = realloc(subdivisions->names, capacity * KEYED_OUTPUT_NAME_SIZE);
+        if (names == NULL) {
+            return false;
+        }
+        
+        subdivisions->names = names;
+        subdivisions->capacity = capacity;
+    }
+    
+    *subdivision = subdivisions->num_subdivisions;
+    if (!idmap_put(&subdivisions->key_index, packed_key, *subdivision)) {
+        return false;
+    }
+    
+    strcpy(subdivisions->names[*subdivision], key);
+    subdivisions->num_subdivisions++;
+    
+    return true;
+}
+
+//replaces the context's subdivisions with an empty table
+static bool reset_subdivisions(GeoipContext *ctx) {
+    Subdivisions *subdivisions = &ctx->subdivisions;
+    
+    if (ctx->have_subdivisions) {
+        idmap_free(&subdivisions->city_index);
+        idmap_free(&subdivisions->key_index);
+        free(subdivisions->names);
+        ctx->have_subdivisions = false;
+    }
+    
+    subdivisions->names = NULL;
+    subdivisions->num_subdivisions = 0;
+    subdivisions->capacity = 0;
+    
+    if (!idmap_init(&subdivisions->city_index, EXPECTED_CITIES)) {
+        return false;
+    }
+    
+    if (!idmap_init(&subdivisions->key_index, EXPECTED_SUBDIVISIONS)) {
+        idmap_free(&subdivisions->city_index);
+        return false;
+    }
+    
+    ctx->have_subdivisions = true;
+    
+    return true;
+}
+
+//tells whether a code is made of letters and digits only, so that file names built from it stay in the output directory
+static bool is_alnum_code(const char *code) {
+    for (; *code; code++) {
+        if (!isalnum((unsigned char)*code)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static unsigned read_city_file(GeoipContext *ctx, char *city_file_name) {
+    const unsigned MIN_COLS = 3;
+    const unsigned GEONAME_ID_COL_IDX = 0;
+    const unsigned COUNTRY_CODE_COL_IDX = 1;
+    const unsigned SUBDIVISION_CODE_COL_IDX = 2;
+    const char* REQUIRED_COLS[] = {
+        "geoname_id",
+        "country_iso_code",
+        "subdivision_1_iso_code"
+    };
+    
+    FILE *city_file;
+    Subdivisions *subdivisions = &ctx->subdivisions;
+    char line[MAX_CITY_LINE];
+    char *line_data[MAX_COLS];
+    char *country_code;
+    char *subdivision_code;
+    char key[KEYED_OUTPUT_NAME_SIZE];
+    unsigned num_cols;
+    unsigned highest_col;
+    unsigned geoname_id_col;
+    unsigned country_code_col;
+    unsigned subdivision_code_col;
+    unsigned line_num = 0;
+    unsigned num_cities = 0;
+    unsigned column_positions[MIN_COLS];
+    unsigned subdivision;
+    unsigned long geoname_id;
+    
+    if (!reset_subdivisions(ctx)) {
+        ctx->err_msg = "Error allocating subdivision index.";
+        return 0;
+    }
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    city_file = polite_fopen(&ctx->polite, city_file_name, "r");
+    if (city_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_CITY_LINE, city_file) == NULL) {
+            //could be an error or could be eof
+            if (ferror(city_file)) {
+                ctx->err_msg = "Read error.";
+                num_cities = 0;
+            }
+            goto end;
+        }
+        
+        switch (strlen(line)) {
+            case 0:
+                //skip empty lines
+                continue;
+            
+            case MAX_CITY_LINE - 1:
+                ctx->err_msg = "Line too long.";
+                num_cities = 0;
+                goto end;
+        }
+        
+        num_cols = tokenize_csv(line, line_data, MAX_COLS);
+        
+        if (line_num == 1) {
+            //this is the header, find the position of the required columns
+            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
+                ctx->err_msg = "Required columns not found in header.";
+                num_cities = 0;
+                goto end;
+            }
+            
+            geoname_id_col = column_positions[GEONAME_ID_COL_IDX];
+            country_code_col = column_positions[COUNTRY_CODE_COL_IDX];
+            subdivision_code_col = column_positions[SUBDIVISION_CODE_COL_IDX];
+            
+            //nothing else to do with the header, move on to the next line
+            continue;
+        }
+        
+        if (num_cols < highest_col + 1) {
+            ctx->err_msg = "Insufficient columns.";
+            num_cities = 0;
+            goto end;
+        }
+        
+        geoname_id = strtoul(line_data[geoname_id_col], NULL, 10);
+        if (!geoname_id) {
+            ctx->err_msg = "Invalid geoname_id.";
+            num_cities = 0;
+            goto end;
+        }
+        
+        country_code = line_data[country_code_col];
+        subdivision_code = line_data[subdivision_code_col];
+        
+        if (!country_code_pos(country_code) || !subdivision_code[0] ||
+            strlen(subdivision_code) > MAX_SUBDIVISION_CODE_SIZE) {
+            //not within a known subdivision, skip line
+            continue;
+        }
+        
+        if (!is_alnum_code(country_code) || !is_alnum_code(subdivision_code)) {
+            //the codes become file names, skip codes like "/" or ".." that would reach outside the output directory
+            continue;
+        }
+        
+        snprintf(key, sizeof(key), "%s-%s", country_code, subdivision_code);
+        
+        if (!get_subdivision(subdivisions, key, &subdivision) ||
+            !idmap_put(&subdivisions->city_index, geoname_id, subdivision)) {
+            ctx->err_msg = "Error allocating subdivision index.";
+            num_cities = 0;
+            goto end;
+        }
+        
+        num_cities++;
+    }
+    
+    end:
+    
+    fclose(city_file);
+    
+    if (num_cities) {
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else {
+        //leave no partial table behind
+        subdivisions->num_subdivisions = 0;
+        
+        if (line_num) {
+            add_line_to_error(ctx, line_num);
+        }
+    }
+    
+    return num_cities;
+}
+
+//maps the geoname_ids of a city locations file to country-subdivision keys
+//locations without a subdivision, or with codes that aren't only letters and digits, are left out
+unsigned geoip_read_city_file(GeoipContext *ctx, char *city_file_name) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = read_city_file(ctx, city_file_name);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
+
+unsigned geoip_num_subdivisions(GeoipContext *ctx) {
+    return ctx->subdivisions.num_subdivisions;
+}
+
+static unsigned process_city_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory) {
+    const unsigned MIN_COLS = 2;
+    const unsigned CIDR_COL_IDX = 0;
+    const unsigned GEONAME_ID_COL_IDX = 1;
+    const char* REQUIRED_COLS[] = {
+        "network",
+        "geoname_id"
+    };
+    
+    FILE *range_file;
+    Subdivisions *subdivisions = &ctx->subdivisions;
+    char line[MAX_CITY_LINE];
+    char *line_data[MAX_COLS];
+    char *file_name_suffix;
+    unsigned num_cols;
+    unsigned highest_col;
+    unsigned line_num = 0;
+    unsigned num_ranges = 0;
+    unsigned column_positions[MIN_COLS];
+    unsigned subdivision;
+    unsigned output;
+    unsigned long geoname_id;
+    KeyedOutputSet outputs;
+    AddressRange range;
+    ParsePlan plan;
+    CsvField fields[MIN_COLS];
+    
+    //default error message
+    ctx->err_msg = "No usable data in file.";
+    
+    if (!subdivisions->num_subdivisions) {
+        //nothing to do
+        ctx->err_msg = "No subdivisions to process.";
+        return 0;
+    }
+    
+    if (addr_family == AF_INET) {
+        file_name_suffix = GEOIP_IPV4_SUFFIX;
+    }
+    else if (addr_family == AF_INET6) {
+        file_name_suffix = GEOIP_IPV6_SUFFIX;
+    }
+    else {
+        ctx->err_msg = "Invalid address family.";
+        return 0;
+    }
+    
+    range_file = polite_fopen(&ctx->polite, range_file_name, "r");
+    if (range_file == NULL) {
+        ctx->err_msg = "Error opening file.";
+        return 0;
+    }
+    
+    //outputs are added in subdivision order, so subdivision indexes double as output indexes
+    if (!init_keyed_outputs(&outputs, output_directory, file_name_suffix, addr_family, KEYED_OUTPUT_MAX_PENDING, &ctx->polite)) {
+        ctx->err_msg = "Error allocating buffer for output file name.";
+        goto end;
+    }
+    
+    for (subdivision = 0; subdivision < subdivisions->num_subdivisions; subdivision++) {
+        if (!add_keyed_output(&outputs, subdivisions->names[subdivision], &output)) {
+            ctx->err_msg = "Error allocating output.";
+            goto end;
+        }
+    }
+    
+    for (line_num = 1; ; line_num++) {
+        //read line
+        if (fgets(line, MAX_CITY_LINE, range_file) == NULL) {
+            if (ferror(range_file)) {
+                ctx->err_msg = "Read error.";
+                num_ranges = 0;
+                goto end;
+            }
+            else {
+                break;
+            }
+        }
+        
+        switch (strlen(line)) {
+            case 0:
+                //skip empty lines
+                continue;
+            
+            case MAX_CITY_LINE - 1:
+                ctx->err_msg = "Line too long.";
+                num_ranges = 0;
+                goto end;
+        }
+        
+        if (line_num == 1) {
+            //this is the header, find the position of the required columns
+            num_cols = tokenize_csv(line, line_data, MAX_COLS);
+            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
+                ctx->err_msg = "Required columns not found in header.";
+                num_ranges = 0;
+                goto end;
+            }
+            
+            //only the required columns will be decoded from now on
+            if (!compile_parse_plan(&plan, column_positions, MIN_COLS, highest_col)) {
+                ctx->err_msg = "Too many columns.";
+                num_ranges = 0;
+                goto end;
+            }
+            
+            //nothing else to do with the header, move on to the next line
+            continue;
+        }
+        
+        num_cols = decode_csv_fields(line, &plan, fields);
+        if (num_cols < highest_col + 1) {
+            ctx->err_msg = "Insufficient columns.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        if (!csv_field_to_ulong(&fields[GEONAME_ID_COL_IDX], &geoname_id) ||
+            !idmap_get(&subdivisions->city_index, geoname_id, &subdivision)) {
+            //location unknown or not within a subdivision, skip line
+            continue;
+        }
+        
+        //parse cidr to get start and end addresses
+        fields[CIDR_COL_IDX].start[fields[CIDR_COL_IDX].len] = '\0';
+        if (!parse_cidr(fields[CIDR_COL_IDX].start, &range)) {
+            ctx->err_msg = "Invalid CIDR.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        if (range.addr_family != addr_family) {
+            ctx->err_msg = "Wrong address family.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        //this relies on the range file being sorted
+        if (!add_keyed_range(&outputs, subdivision, range.start, range.end)) {
+            ctx->err_msg = "Error writing ranges.";
+            num_ranges = 0;
+            goto end;
+        }
+        
+        num_ranges++;
+    }
+    
+    //write whatever is still buffered
+    if (!flush_keyed_outputs(&outputs, true)) {
+        ctx->err_msg = "Error writing ranges.";
+        num_ranges = 0;
+    }
+    
+    end:
+    
+    fclose(range_file);
+    free_keyed_outputs(&outputs);
+    
+    if (num_ranges) {
+        //clear default error message
+        ctx->err_msg = NULL;
+    }
+    else if (line_num) {
+        add_line_to_error(ctx, line_num);
+    }
+    
+    return num_ranges;
+}
+
+//writes ranges from a city range file to one binary file per subdivision
+//ranges whose location isn't within a subdivision are skipped
+unsigned geoip_process_city_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory) {
+    unsigned result;
+    
+    enter_polite_sched(&ctx->sched);
+    result = process_city_range_file(ctx, range_file_name, addr_family, output_directory);
+    leave_polite_sched(&ctx->sched);
+    
+    return result;
+}
@@ -0,0 +1,240 @@
+#ifndef LIBMM2XTGEOIP_H
+#define LIBMM2XTGEOIP_H
+
+//this header is meant for programs using the library, so it pulls in what it needs
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define GEOIP_COUNTRY_CODE_SIZE 2
+#define GEOIP_MAX_COUNTRIES UINT16_MAX
+#define GEOIP_IPV4_SUFFIX ".iv4"
+#define GEOIP_IPV6_SUFFIX ".iv6"
+#define GEOIP_IPSET_IPV4_SUFFIX ".ipset4"
+#define GEOIP_IPSET_IPV6_SUFFIX ".ipset6"
+#define GEOIP_IPSET_SET_PREFIX "geoip-"
+#define GEOIP_IPSET_IPV4_SET_SUFFIX "-v4"
+#define GEOIP_IPSET_IPV6_SET_SUFFIX "-v6"
+#define GEOIP_LPM_BATCH_FILE_NAME "geoip"
+#define GEOIP_LPM_BATCH_IPV4_SUFFIX ".lpm4"
+#define GEOIP_LPM_BATCH_IPV6_SUFFIX ".lpm6"
+#define GEOIP_LPM_BATCH_MAGIC "MMLPMBAT"
+#define GEOIP_LPM_BATCH_MAGIC_SIZE 8
+#define GEOIP_LPM_BATCH_VERSION 1
+#define GEOIP_LPM_BATCH_BYTE_ORDER 0x01020304
+#define GEOIP_LPM_BATCH_CODE_SIZE 4
+#define GEOIP_BUNDLE_FILE_NAME "geoip"
+#define GEOIP_BUNDLE_IPV4_SUFFIX ".bundle4"
+#define GEOIP_BUNDLE_IPV6_SUFFIX ".bundle6"
+#define GEOIP_ROUTES_FILE_NAME "geoip"
+#define GEOIP_ROUTES_BIRD_IPV4_SUFFIX ".bird4"
+#define GEOIP_ROUTES_BIRD_IPV6_SUFFIX ".bird6"
+#define GEOIP_ROUTES_FRR_IPV4_SUFFIX ".frr4"
+#define GEOIP_ROUTES_FRR_IPV6_SUFFIX ".frr6"
+#define GEOIP_ROUTES_PREFIX_LIST_IPV4_SUFFIX ".plist4"
+#define GEOIP_ROUTES_PREFIX_LIST_IPV6_SUFFIX ".plist6"
+#define GEOIP_ROUTES_PREFIX_LIST_IPV4_NAME "geoip-v4"
+#define GEOIP_ROUTES_PREFIX_LIST_IPV6_NAME "geoip-v6"
+#define GEOIP_NFT_IPV4_SUFFIX ".nft4"
+#define GEOIP_NFT_IPV6_SUFFIX ".nft6"
+#define GEOIP_NFT_SET_PREFIX "geoip_"
+#define GEOIP_NFT_IPV4_SET_SUFFIX "_v4"
+#define GEOIP_NFT_IPV6_SET_SUFFIX "_v6"
+#define GEOIP_CIDR_IPV4_SUFFIX ".cidr4"
+#define GEOIP_CIDR_IPV6_SUFFIX ".cidr6"
+#define GEOIP_COMBINED_COUNTRY_CODE "ZZ"
+#define GEOIP_COMBINED_MARKER_IPV4_SUFFIX ".match4"
+#define GEOIP_COMBINED_MARKER_IPV6_SUFFIX ".match6"
+#define GEOIP_CODEGEN_FILE_NAME "geoip"
+#define GEOIP_CODEGEN_IPV4_HEADER_SUFFIX "4.h"
+#define GEOIP_CODEGEN_IPV6_HEADER_SUFFIX "6.h"
+#define GEOIP_CODEGEN_IPV4_SOURCE_SUFFIX "4.c"
+#define GEOIP_CODEGEN_IPV6_SOURCE_SUFFIX "6.c"
+#define GEOIP_SIM_RULE_MAX_COUNTRIES 15
+#define GEOIP_SIM_MAX_WEIGHT 1e15
+#define GEOIP_MAX_PREFIX_LENGTH 128
+#define GEOIP_FORMAT_XTGEOIP 0
+#define GEOIP_FORMAT_IPSET 1
+#define GEOIP_FORMAT_LPM 2
+#define GEOIP_FORMAT_BUNDLE 3
+#define GEOIP_FORMAT_ROUTES 4
+#define GEOIP_FORMAT_NFT 5
+#define GEOIP_FORMAT_CIDR 6
+#define GEOIP_FORMAT_COMBINED 7
+#define GEOIP_FORMAT_CODEGEN 8
+#define GEOIP_NUM_FORMATS 9
+
+//conversion state: country table, lookup cache, range parser and error message
+//contexts are independent of each other, so each thread can use its own
+typedef struct GeoipContext GeoipContext;
+
+//receives coalesced ranges from geoip_feed_ranges
+//ranges of each country arrive in ascending order, contiguous ranges of a country are merged
+//overlays are applied before ranges reach the callback
+//with compaction, ranges only reach the callback when the range file ends, one country after another
+//returning false aborts processing
+typedef bool (*GeoipRangeCallback)(void *user_data, char *country_code, int addr_family, uint8_t *start, uint8_t *end);
+
+//an output of geoip_process_range_outputs: the files of one GEOIP_FORMAT_* format, written to directory
+typedef struct GeoipOutput {
+    int format;
+    char *directory;
+} GeoipOutput;
+
+//what one country contributed to the last range file processed
+//uncompacted_ranges counts the ranges before compaction, which is the same as ranges without it
+//addresses is a 128-bit count split in two halves, saturating at the maximum
+//prefix_lengths counts the prefixes the final ranges split into by length, as written by the formats that write prefixes
+//addresses and prefix_lengths are only counted after geoip_set_report enables them, and are 0 otherwise
+typedef struct GeoipCountryStats {
+    unsigned rows;
+    unsigned ranges;
+    unsigned uncompacted_ranges;
+    uint64_t addresses_high;
+    uint64_t addresses_low;
+    unsigned prefix_lengths[GEOIP_MAX_PREFIX_LENGTH + 1];
+} GeoipCountryStats;
+
+//blackhole routes written for the last range file processed with GEOIP_FORMAT_ROUTES
+//prefixes is how many the ranges of each country take on their own, as ipset files hold them
+//routes is how many are left once the ranges of all countries are merged and split into the fewest prefixes
+typedef struct GeoipRouteStats {
+    unsigned ranges;
+    unsigned prefixes;
+    unsigned merged_ranges;
+    unsigned routes;
+} GeoipRouteStats;
+
+//the combined set written for the last range file processed with GEOIP_FORMAT_COMBINED
+//ranges is how many the allowed countries take once merged, complement_ranges how many the rest of the address space takes
+//negated tells that the complement was written, so the countries are selected by ! --src-cc
+typedef struct GeoipCombinedStats {
+    unsigned ranges;
+    unsigned complement_ranges;
+    bool negated;
+} GeoipCombinedStats;
+
+//what a patch changes, counted by geoip_diff_directories and geoip_apply_patch
+typedef struct GeoipPatchStats {
+    unsigned modified_files;
+    unsigned created_files;
+    unsigned deleted_files;
+    unsigned inserted_ranges;
+    unsigned deleted_ranges;
+} GeoipPatchStats;
+
+//a rule of a simulated rule set: an xt_geoip match on a --src-cc list, inverted as with ! --src-cc
+//xt_geoip takes at most GEOIP_SIM_RULE_MAX_COUNTRIES countries per match
+//geoip_simulate adds up, for each country, the weight of the packets looked up in and found in it,
+//and the weight of the packets the rule matched
+typedef struct GeoipSimRule {
+    char country_codes[GEOIP_SIM_RULE_MAX_COUNTRIES][GEOIP_COUNTRY_CODE_SIZE + 1];
+    unsigned num_countries;
+    bool inverted;
+    double lookups[GEOIP_SIM_RULE_MAX_COUNTRIES];
+    double hits[GEOIP_SIM_RULE_MAX_COUNTRIES];
+    double matches;
+} GeoipSimRule;
+
+//cost of a traffic sample replayed by geoip_simulate, per packet and weighted by packets
+//comparisons are address comparisons and probes the subnets visited by the binary searches,
+//cache_lines the distinct cache lines of the subnet arrays a packet touches
+//unmatched is the weight of the packets no rule matched
+typedef struct GeoipSimStats {
+    unsigned addresses;
+    double packets;
+    double unmatched;
+    double comparisons;
+    unsigned comparisons_p50;
+    unsigned comparisons_p90;
+    unsigned comparisons_p99;
+    unsigned comparisons_max;
+    double probes;
+    double cache_lines;
+    unsigned cache_lines_p99;
+    unsigned cache_lines_max;
+} GeoipSimStats;
+
+//header of an LPM trie batch file, which holds every allowed country of one address family
+//it's followed by num_countries codes of GEOIP_LPM_BATCH_CODE_SIZE bytes, NUL-padded,
+//then num_entries keys of key_size bytes and num_entries values of value_size bytes,
+//so the keys and values can be handed to BPF_MAP_UPDATE_BATCH as they are
+//keys are laid out like struct bpf_lpm_trie_key_u8: a prefix length followed by the big-endian address
+//values are uint16_t indexes into the country codes
+//addr_family is the IP version, 4 or 6
+//numbers are in host byte order, as the kernel expects them, and byte_order tells whether the file was written on a compatible host
+typedef struct GeoipLpmBatchHeader {
+    char magic[GEOIP_LPM_BATCH_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t addr_family;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t num_countries;
+    uint32_t num_entries;
+    uint32_t reserved;
+} GeoipLpmBatchHeader;
+
+//a bundle holds every allowed country's ranges of one address family, for geoip_unpack_bundle to turn back into xt_geoip files
+//header: magic, then version, IP version (4 or 6), number of countries and 4 reserved bytes as 32-bit numbers,
+//then a 64-bit xxHash of the first 24 bytes and the index
+//index: one 32-byte entry per country, with its code (NUL-padded to 4 bytes), number of ranges as a 32-bit number,
+//then offset from the end of the index, length and xxHash of its data as 64-bit numbers
+//data: each range as a varint of its distance from the end of the previous one (from address 0 for the first),
+//then a varint of its size minus one; varints hold 7 bits per byte, least significant first, high bit set but on the last
+//all numbers are little endian
+
+//a patch turns one generation of a directory of xt_geoip files into the next, one file at a time
+//header: magic, then version and 4 reserved bytes as 32-bit little endian numbers
+//each changed file then has a record: its kind (PATCH_MODIFY, PATCH_CREATE or PATCH_DELETE in one byte),
+//the length of its name in one byte, its name, then the 64-bit little endian xxHash of the old file (not for PATCH_CREATE)
+//and of the new file (not for PATCH_DELETE), then a list of operations (not for PATCH_DELETE)
+//operations: varints of the number of ranges to copy from the old file, to skip in it and to insert,
+//followed by the inserted ranges encoded like in bundles; an operation of 3 zeros ends the list, and the rest of the old file is copied
+//a PATCH_END byte ends the patch, followed by the 64-bit little endian xxHash of everything before it
+
+GeoipContext *geoip_new_context(void);
+void geoip_free_context(GeoipContext *ctx);
+char *geoip_error(GeoipContext *ctx);
+
+unsigned geoip_read_country_file(GeoipContext *ctx, char *country_file_name);
+unsigned geoip_add_virtual_countries(GeoipContext *ctx);
+unsigned geoip_parse_country_code_list(char *country_codes, uint16_t *country_positions);
+unsigned geoip_set_filtered_countries(GeoipContext *ctx, uint16_t *country_positions, bool forbid);
+unsigned geoip_read_overlay_file(GeoipContext *ctx, char *overlay_file_name, char *country_code);
+void geoip_clear_overlays(GeoipContext *ctx);
+unsigned geoip_read_unroutable_file(GeoipContext *ctx, char *unroutable_file_name);
+unsigned geoip_read_delegated_file(GeoipContext *ctx, char *delegated_file_name, int priority);
+void geoip_clear_sources(GeoipContext *ctx);
+bool geoip_set_compaction(GeoipContext *ctx, bool compact, unsigned max_ranges);
+void geoip_set_report(GeoipContext *ctx, bool report);
+bool geoip_set_polite(GeoipContext *ctx, bool polite, double max_rate, char *cpu_list);
+unsigned geoip_num_countries(GeoipContext *ctx);
+char *geoip_country_code(GeoipContext *ctx, unsigned country);
+bool geoip_country_forbidden(GeoipContext *ctx, unsigned country);
+GeoipCountryStats *geoip_country_stats(GeoipContext *ctx, unsigned country);
+GeoipRouteStats *geoip_route_stats(GeoipContext *ctx);
+GeoipCombinedStats *geoip_combined_stats(GeoipContext *ctx);
+char *geoip_format_name(int format);
+int geoip_find_format(char *name);
+
+bool geoip_begin_ranges(GeoipContext *ctx, int addr_family, GeoipRangeCallback callback, void *user_data);
+bool geoip_feed_ranges(GeoipContext *ctx, char *data, size_t len);
+unsigned geoip_end_ranges(GeoipContext *ctx);
+unsigned geoip_process_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory, int output_format);
+unsigned geoip_process_range_outputs(GeoipContext *ctx, char *range_file_name, int addr_family, GeoipOutput *outputs, unsigned num_outputs);
+unsigned geoip_unpack_bundle(GeoipContext *ctx, char *bundle_file_name, int addr_family, char *output_directory);
+bool geoip_diff_directories(GeoipContext *ctx, char *old_directory, char *new_directory, FILE *patch_file, GeoipPatchStats *stats);
+bool geoip_apply_patch(GeoipContext *ctx, FILE *patch_file, char *directory, GeoipPatchStats *stats);
+bool geoip_parse_sim_rule(char *rule_spec, GeoipSimRule *rule);
+bool geoip_simulate(GeoipContext *ctx, char *directory, GeoipSimRule *rules, unsigned num_rules, char *sample_file_name, GeoipSimStats *stats);
+
+unsigned geoip_process_asn_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory);
+
+unsigned geoip_read_city_file(GeoipContext *ctx, char *city_file_name);
+unsigned geoip_num_subdivisions(GeoipContext *ctx);
+unsigned geoip_process_city_range_file(GeoipContext *ctx, char *range_file_name, int addr_family, char *output_directory);
+
+#endif
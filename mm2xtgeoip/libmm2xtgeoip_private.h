@@ -0,0 +1,62 @@
+#ifndef LIBMM2XTGEOIP_PRIVATE_H
+#define LIBMM2XTGEOIP_PRIVATE_H
+
+//limits and file format constants shared by the library's modules, not installed with libmm2xtgeoip.h
+#define MAX_LINE 256
+#define MAX_CITY_LINE 1024
+#define MAX_COLS 16
+#define MAX_ERR_MSG 256
+#define PROXY_GEONAME_ID (ULONG_MAX - 3)
+#define SAT_GEONAME_ID (ULONG_MAX - 2)
+#define OTHER_GEONAME_ID (ULONG_MAX - 1)
+#define MAX_FILTERED_GEONAME_ID (1UL << 27)
+#define PROXY_COUNTRY_CODE "A1"
+#define SAT_COUNTRY_CODE "A2"
+#define OTHER_COUNTRY_CODE "O1"
+#define IPSET_MIN_HASHSIZE 64
+#define BUNDLE_MAGIC "MMXTBNDL"
+#define BUNDLE_MAGIC_SIZE 8
+#define BUNDLE_VERSION 1
+#define ROUTES_PREFIX_LIST_SEQ_STEP 5
+#define CODEGEN_IPV4_VALUES_PER_LINE 8
+#define CODEGEN_IPV6_VALUES_PER_LINE 2
+#define PATCH_MAGIC "MMXTPTCH"
+#define PATCH_MAGIC_SIZE 8
+#define PATCH_VERSION 1
+#define ASN_PREFIX "AS"
+#define EXPECTED_ASNS 100000
+#define EXPECTED_CITIES 150000
+#define EXPECTED_SUBDIVISIONS 4096
+#define EXPECTED_LPM_ENTRIES 65536
+#define MAX_SUBDIVISION_CODE_SIZE 3
+#define RANGE_FILE_BUF_SIZE 65536
+
+
+typedef struct Country {
+    unsigned long geoname_id;
+    char country_code[GEOIP_COUNTRY_CODE_SIZE + 1];
+    bool forbidden;
+} Country;
+
+
+//converts a 2-letter country code to an uint16_t that can be used as an index
+static inline uint16_t country_code_pos(char *country_code) {
+    if (!country_code[0] || !country_code[1] || country_code[2]) {
+        return 0;
+    }
+    
+    char buf[GEOIP_COUNTRY_CODE_SIZE];
+    
+    buf[0] = toupper(country_code[0]);
+    buf[1] = toupper(country_code[1]);
+    
+    uint16_t *pos = (uint16_t *)buf;
+    
+    return *pos;
+}
+
+//get_country and a way to start its cache cold, exported for mm2xtgeoip_bench
+Country *find_country(GeoipContext *ctx, unsigned long geoname_id, bool proxy, bool sat);
+void reset_country_cache(GeoipContext *ctx);
+
+#endif
@@ -0,0 +1,579 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <argp.h>
+
+#include "cidr.h"
+#include "libmm2xtgeoip.h"
+#include "lpmload.h"
+
+
+
+const char *argp_program_version = "mm2xtgeoip_lpmload 0.9";
+
+const char *argp_program_bug_address = "https://github.com/josedpedroso/mm2xtgeoip/issues";
+
+static char argp_doc[] = "mm2xtgeoip_lpmload -- loads an LPM trie batch file written by mm2xtgeoip -o lpm into a pinned BPF map\v"
+                         "If no map is pinned at MAP, a BPF_MAP_TYPE_LPM_TRIE map is created and pinned there. "
+                         "Otherwise the pinned map is updated in place: entries from the file are added first, "
+                         "then the entries that aren't in the file are removed, so lookups never miss an address that's in both. "
+                         "The file is always checked before the map is touched.\n"
+                         "\n"
+                         "Return values:\n"
+                         "    0 - Success\n"
+                         "    1 - Unable to read or check the batch file\n"
+                         "    2 - Unable to load the batch into the map\n"
+                         "Other - Unable to parse command-line arguments";
+
+static char argp_args_doc[] = "FILE [MAP]";
+
+static struct argp_option argp_options[] = {
+    {"check",       'c', 0, 0, "Only check that FILE is a well-formed batch: sizes, prefix lengths, country indexes and duplicate keys. "
+                               "Doesn't need a kernel with BPF support, nor MAP."},
+    {"print",       'p', 0, 0, "Write the entries of FILE to stdout, one CIDR and country code per line, after checking it. Implies -c (--check)."},
+    {"max-entries", 'm', "N", 0, "When creating the map, make room for N entries. "
+                                 "Default: twice the entries in FILE, so later batches can grow without recreating the map"},
+    {"verbose",     'v', 0, 0, "Write details of the program's activity to stdout."},
+    {0}
+};
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    LoadArguments *arguments = state->input;
+    char *end;
+    unsigned long max_entries;
+    
+    switch (key) {
+        case 'c':
+            arguments->check = true;
+            break;
+        
+        case 'p':
+            arguments->check = true;
+            arguments->print = true;
+            break;
+        
+        case 'm':
+            errno = 0;
+            max_entries = strtoul(arg, &end, 10);
+            if (errno || *end != '\0' || !max_entries || max_entries > UINT32_MAX) {
+                argp_error(state, "Invalid number of entries: %s", arg);
+            }
+            
+            arguments->max_entries = max_entries;
+            break;
+        
+        case 'v':
+            arguments->verbose = true;
+            break;
+        
+        case ARGP_KEY_ARG:
+            if (state->arg_num == 0) {
+                arguments->batch_file = arg;
+            }
+            else if (state->arg_num == 1) {
+                arguments->map_path = arg;
+            }
+            else {
+                argp_usage(state);
+            }
+            break;
+        
+        case ARGP_KEY_END:
+            if (arguments->batch_file == NULL) {
+                argp_usage(state);
+            }
+            
+            if (!arguments->check && arguments->map_path == NULL) {
+                argp_error(state, "A pinned map path is needed, unless only checking the file.");
+            }
+            break;
+        
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    
+    return 0;
+}
+
+static struct argp argp_parser = {argp_options, parse_opt, argp_args_doc, argp_doc};
+
+
+//reads a whole batch file and finds its sections
+//returns NULL on success or an error message
+char *read_batch_file(char *file_name, LpmBatch *batch) {
+    FILE *batch_file;
+    GeoipLpmBatchHeader *header;
+    long file_size;
+    size_t expected_size;
+    char *err_msg = NULL;
+    
+    memset(batch, 0, sizeof(LpmBatch));
+    
+    batch_file = fopen(file_name, "r");
+    if (batch_file == NULL) {
+        return "Error opening file.";
+    }
+    
+    if (fseek(batch_file, 0, SEEK_END) != 0 || (file_size = ftell(batch_file)) < 0 || fseek(batch_file, 0, SEEK_SET) != 0) {
+        err_msg = "Error reading file.";
+        goto end;
+    }
+    
+    if ((size_t)file_size < sizeof(GeoipLpmBatchHeader)) {
+        err_msg = "File too short for a batch header.";
+        goto end;
+    }
+    
+    batch->size = file_size;
+    batch->data = malloc(batch->size);
+    if (batch->data == NULL) {
+        err_msg = "Error allocating buffer for file.";
+        goto end;
+    }
+    
+    if (fread(batch->data, 1, batch->size, batch_file) != batch->size) {
+        err_msg = "Error reading file.";
+        goto end;
+    }
+    
+    header = batch->header = (GeoipLpmBatchHeader *)batch->data;
+    
+    if (memcmp(header->magic, GEOIP_LPM_BATCH_MAGIC, GEOIP_LPM_BATCH_MAGIC_SIZE) != 0) {
+        err_msg = "Not an LPM trie batch file.";
+        goto end;
+    }
+    
+    if (header->byte_order != GEOIP_LPM_BATCH_BYTE_ORDER) {
+        err_msg = "File was written on a host with a different byte order.";
+        goto end;
+    }
+    
+    if (header->version != GEOIP_LPM_BATCH_VERSION) {
+        err_msg = "Unsupported batch file version.";
+        goto end;
+    }
+    
+    if (header->addr_family != 4 && header->addr_family != 6) {
+        err_msg = "Invalid address family.";
+        goto end;
+    }
+    
+    if (header->key_size != sizeof(uint32_t) + (header->addr_family == 6 ? IPV6_BYTES : IPV4_BYTES) ||
+        header->value_size != sizeof(uint16_t)) {
+        err_msg = "Invalid key or value size.";
+        goto end;
+    }
+    
+    if (header->num_countries > GEOIP_MAX_COUNTRIES) {
+        err_msg = "Too many countries.";
+        goto end;
+    }
+    
+    expected_size = sizeof(GeoipLpmBatchHeader) + (size_t)header->num_countries * GEOIP_LPM_BATCH_CODE_SIZE +
+                    (size_t)header->num_entries * (header->key_size + header->value_size);
+    if (expected_size != batch->size) {
+        err_msg = "File size doesn't match the number of countries and entries.";
+        goto end;
+    }
+    
+    batch->codes = (char (*)[GEOIP_LPM_BATCH_CODE_SIZE])(batch->data + sizeof(GeoipLpmBatchHeader));
+    batch->keys = (uint8_t *)(batch->codes + header->num_countries);
+    batch->values = (uint16_t *)(batch->keys + (size_t)header->num_entries * header->key_size);
+    
+    end:
+    
+    fclose(batch_file);
+    
+    if (err_msg != NULL) {
+        free_batch(batch);
+    }
+    
+    return err_msg;
+}
+
+//compares 2 zero-padded keys for sorting
+int compare_keys(const void *key1, const void *key2) {
+    return memcmp(key1, key2, LPM_KEY_MAX_SIZE);
+}
+
+//checks every entry of a batch that was read successfully, and sorts a copy of the keys
+//returns NULL on success or an error message
+char *check_batch(LpmBatch *batch) {
+    GeoipLpmBatchHeader *header = batch->header;
+    size_t addr_bytes = header->key_size - sizeof(uint32_t);
+    uint8_t *key;
+    uint32_t prefix_length;
+    unsigned prefix_bits;
+    unsigned i;
+    unsigned j;
+    
+    for (i = 0; i < header->num_countries; i++) {
+        if (batch->codes[i][0] == '\0' || batch->codes[i][GEOIP_LPM_BATCH_CODE_SIZE - 1] != '\0') {
+            return "Invalid country code.";
+        }
+    }
+    
+    batch->sorted_keys = calloc(header->num_entries ? header->num_entries : 1, LPM_KEY_MAX_SIZE);
+    if (batch->sorted_keys == NULL) {
+        return "Error allocating buffer for keys.";
+    }
+    
+    for (i = 0; i < header->num_entries; i++) {
+        key = batch->keys + (size_t)i * header->key_size;
+        memcpy(&prefix_length, key, sizeof(uint32_t));
+        
+        if (prefix_length > addr_bytes * 8) {
+            return "Prefix length too long for the address family.";
+        }
+        
+        //bits past the prefix length must be clear, or the entry wouldn't be the network the ranges describe
+        for (j = 0; j < addr_bytes; j++) {
+            prefix_bits = prefix_length > j * 8 ? prefix_length - j * 8 : 0;
+            if (prefix_bits < 8 && (key[sizeof(uint32_t) + j] & (0xff >> prefix_bits))) {
+                return "Address has bits set past the prefix length.";
+            }
+        }
+        
+        if (batch->values[i] >= header->num_countries) {
+            return "Country index out of range.";
+        }
+        
+        memcpy(batch->sorted_keys + (size_t)i * LPM_KEY_MAX_SIZE, key, header->key_size);
+    }
+    
+    qsort(batch->sorted_keys, header->num_entries, LPM_KEY_MAX_SIZE, compare_keys);
+    
+    //a duplicate key would silently replace an entry of another country
+    for (i = 1; i < header->num_entries; i++) {
+        if (compare_keys(batch->sorted_keys + (size_t)(i - 1) * LPM_KEY_MAX_SIZE, batch->sorted_keys + (size_t)i * LPM_KEY_MAX_SIZE) == 0) {
+            return "Duplicate key.";
+        }
+    }
+    
+    return NULL;
+}
+
+//writes each entry as CIDR and country code
+void print_batch(LpmBatch *batch) {
+    GeoipLpmBatchHeader *header = batch->header;
+    int addr_family = header->addr_family == 6 ? AF_INET6 : AF_INET;
+    char addr[INET6_ADDRSTRLEN];
+    uint8_t *key;
+    uint32_t prefix_length;
+    unsigned i;
+    
+    for (i = 0; i < header->num_entries; i++) {
+        key = batch->keys + (size_t)i * header->key_size;
+        memcpy(&prefix_length, key, sizeof(uint32_t));
+        inet_ntop(addr_family, key + sizeof(uint32_t), addr, sizeof(addr));
+        printf("%s/%u %s\n", addr, prefix_length, batch->codes[batch->values[i]]);
+    }
+}
+
+long sys_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+//opens the map pinned at the map path, creating and pinning one if there's none
+//returns the map's file descriptor, or -1 with an error written to stderr
+int open_map(LoadArguments *arguments, LpmBatch *batch) {
+    GeoipLpmBatchHeader *header = batch->header;
+    union bpf_attr attr;
+    struct bpf_map_info info;
+    char *map_name = header->addr_family == 6 ? LPM_LOAD_IPV6_MAP_NAME : LPM_LOAD_IPV4_MAP_NAME;
+    unsigned max_entries;
+    int map_fd;
+    
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uintptr_t)arguments->map_path;
+    map_fd = sys_bpf(BPF_OBJ_GET, &attr);
+    
+    if (map_fd >= 0) {
+        memset(&info, 0, sizeof(info));
+        memset(&attr, 0, sizeof(attr));
+        attr.info.bpf_fd = map_fd;
+        attr.info.info_len = sizeof(info);
+        attr.info.info = (uintptr_t)&info;
+        
+        if (sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &attr) != 0) {
+            fprintf(stderr, "Unable to get information on map %s: %s\n", arguments->map_path, strerror(errno));
+            close(map_fd);
+            return -1;
+        }
+        
+        if (info.type != BPF_MAP_TYPE_LPM_TRIE || info.key_size != header->key_size || info.value_size != header->value_size) {
+            fprintf(stderr, "Map %s isn't an LPM trie with %u byte keys and %u byte values.\n", arguments->map_path, header->key_size, header->value_size);
+            close(map_fd);
+            return -1;
+        }
+        
+        if (info.max_entries < header->num_entries) {
+            fprintf(stderr, "Map %s only has room for %u entries, %u needed.\n", arguments->map_path, info.max_entries, header->num_entries);
+            close(map_fd);
+            return -1;
+        }
+        
+        if (arguments->verbose) {
+            printf("Updating map %s (%u entries at most).\n", arguments->map_path, info.max_entries);
+        }
+        
+        return map_fd;
+    }
+    
+    if (errno != ENOENT) {
+        fprintf(stderr, "Unable to open map %s: %s\n", arguments->map_path, strerror(errno));
+        return -1;
+    }
+    
+    max_entries = arguments->max_entries;
+    if (!max_entries) {
+        max_entries = header->num_entries ? header->num_entries * LPM_LOAD_MAX_ENTRIES_FACTOR : 1;
+    }
+    
+    //LPM tries can only be created without preallocation
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_LPM_TRIE;
+    attr.key_size = header->key_size;
+    attr.value_size = header->value_size;
+    attr.max_entries = max_entries;
+    attr.map_flags = BPF_F_NO_PREALLOC;
+    strncpy(attr.map_name, map_name, BPF_OBJ_NAME_LEN - 1);
+    
+    map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        fprintf(stderr, "Unable to create map: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uintptr_t)arguments->map_path;
+    attr.bpf_fd = map_fd;
+    
+    if (sys_bpf(BPF_OBJ_PIN, &attr) != 0) {
+        fprintf(stderr, "Unable to pin map at %s: %s\n", arguments->map_path, strerror(errno));
+        close(map_fd);
+        return -1;
+    }
+    
+    if (arguments->verbose) {
+        printf("Created map %s (%u entries at most).\n", arguments->map_path, max_entries);
+    }
+    
+    return map_fd;
+}
+
+//adds or replaces every entry of the batch in the map
+//uses BPF_MAP_UPDATE_BATCH, falling back to one update per entry on kernels that don't batch LPM tries
+bool update_entries(int map_fd, LpmBatch *batch, bool verbose) {
+    GeoipLpmBatchHeader *header = batch->header;
+    union bpf_attr attr;
+    unsigned done = 0;
+    unsigned count;
+    bool batched = true;
+    
+    while (done < header->num_entries) {
+        count = header->num_entries - done;
+        if (count > LPM_LOAD_BATCH_SIZE) {
+            count = LPM_LOAD_BATCH_SIZE;
+        }
+        
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = map_fd;
+        
+        if (batched) {
+            attr.batch.map_fd = map_fd;
+            attr.batch.keys = (uintptr_t)(batch->keys + (size_t)done * header->key_size);
+            attr.batch.values = (uintptr_t)(batch->values + done);
+            attr.batch.count = count;
+            attr.batch.elem_flags = BPF_ANY;
+            
+            if (sys_bpf(BPF_MAP_UPDATE_BATCH, &attr) == 0) {
+                done += count;
+                continue;
+            }
+            
+            //entries before the failing one were updated
+            done += attr.batch.count;
+            
+            if (errno != EINVAL && errno != EOPNOTSUPP && errno != ENOTSUPP_KERNEL) {
+                fprintf(stderr, "Unable to update map: %s\n", strerror(errno));
+                return false;
+            }
+            
+            if (verbose) {
+                printf("Batch updates not supported, updating one entry at a time.\n");
+            }
+            
+            batched = false;
+            continue;
+        }
+        
+        attr.key = (uintptr_t)(batch->keys + (size_t)done * header->key_size);
+        attr.value = (uintptr_t)(batch->values + done);
+        attr.flags = BPF_ANY;
+        
+        if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+            fprintf(stderr, "Unable to update map: %s\n", strerror(errno));
+            return false;
+        }
+        
+        done++;
+    }
+    
+    if (verbose) {
+        printf("Loaded %u entries.\n", done);
+    }
+    
+    return true;
+}
+
+//removes the entries of the map that aren't in the batch
+//stale keys are gathered first, since deleting while iterating would restart the walk
+bool remove_stale_entries(int map_fd, LpmBatch *batch, bool verbose) {
+    GeoipLpmBatchHeader *header = batch->header;
+    union bpf_attr attr;
+    uint8_t key[LPM_KEY_MAX_SIZE];
+    uint8_t next_key[LPM_KEY_MAX_SIZE];
+    uint8_t *stale_keys = NULL;
+    uint8_t *resized;
+    size_t num_stale = 0;
+    size_t capacity = 0;
+    size_t i;
+    bool first = true;
+    bool ok = false;
+    
+    memset(key, 0, sizeof(key));
+    
+    for (;;) {
+        memset(next_key, 0, sizeof(next_key));
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = map_fd;
+        attr.key = first ? 0 : (uintptr_t)key;
+        attr.next_key = (uintptr_t)next_key;
+        
+        if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) != 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            
+            fprintf(stderr, "Unable to walk map: %s\n", strerror(errno));
+            goto end;
+        }
+        
+        first = false;
+        memcpy(key, next_key, sizeof(key));
+        
+        if (bsearch(next_key, batch->sorted_keys, header->num_entries, LPM_KEY_MAX_SIZE, compare_keys) != NULL) {
+            continue;
+        }
+        
+        if (num_stale == capacity) {
+            capacity = capacity ? capacity * 2 : LPM_LOAD_STALE_CAPACITY;
+            resized = realloc(stale_keys, capacity * LPM_KEY_MAX_SIZE);
+            if (resized == NULL) {
+                fputs("Error allocating buffer for stale keys.\n", stderr);
+                goto end;
+            }
+            
+            stale_keys = resized;
+        }
+        
+        memcpy(stale_keys + num_stale++ * LPM_KEY_MAX_SIZE, next_key, LPM_KEY_MAX_SIZE);
+    }
+    
+    for (i = 0; i < num_stale; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = map_fd;
+        attr.key = (uintptr_t)(stale_keys + i * LPM_KEY_MAX_SIZE);
+        
+        if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) != 0 && errno != ENOENT) {
+            fprintf(stderr, "Unable to remove stale entry: %s\n", strerror(errno));
+            goto end;
+        }
+    }
+    
+    if (verbose) {
+        printf("Removed %zu stale entries.\n", num_stale);
+    }
+    
+    ok = true;
+    
+    end:
+    
+    free(stale_keys);
+    
+    return ok;
+}
+
+void free_batch(LpmBatch *batch) {
+    free(batch->data);
+    free(batch->sorted_keys);
+    memset(batch, 0, sizeof(LpmBatch));
+}
+
+int main(int argc, char **argv) {
+    LoadArguments arguments;
+    LpmBatch batch;
+    char *err_msg;
+    int map_fd;
+    int ret = 0;
+    
+    //set default arguments
+    arguments.batch_file = NULL;
+    arguments.map_path = NULL;
+    arguments.max_entries = 0;
+    arguments.check = false;
+    arguments.print = false;
+    arguments.verbose = false;
+    
+    //parse arguments from command line
+    argp_parse(&argp_parser, argc, argv, 0, 0, &arguments);
+    
+    err_msg = read_batch_file(arguments.batch_file, &batch);
+    if (err_msg == NULL) {
+        err_msg = check_batch(&batch);
+    }
+    
+    if (err_msg != NULL) {
+        fprintf(stderr, "Unable to check batch file (%s): %s\n", arguments.batch_file, err_msg);
+        free_batch(&batch);
+        return 1;
+    }
+    
+    if (arguments.verbose) {
+        printf("Checked batch file (%s): IPv%u, %u countries, %u entries.\n", arguments.batch_file,
+               batch.header->addr_family, batch.header->num_countries, batch.header->num_entries);
+    }
+    
+    if (arguments.print) {
+        print_batch(&batch);
+    }
+    
+    if (arguments.check) {
+        free_batch(&batch);
+        return 0;
+    }
+    
+    map_fd = open_map(&arguments, &batch);
+    if (map_fd < 0) {
+        free_batch(&batch);
+        return 2;
+    }
+    
+    if (!update_entries(map_fd, &batch, arguments.verbose) || !remove_stale_entries(map_fd, &batch, arguments.verbose)) {
+        ret = 2;
+    }
+    
+    close(map_fd);
+    free_batch(&batch);
+    
+    return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef LPMLOAD_H
+#define LPMLOAD_H
+
+#define LPM_LOAD_BATCH_SIZE 4096
+#define LPM_LOAD_MAX_ENTRIES_FACTOR 2
+#define LPM_LOAD_IPV4_MAP_NAME "geoip_v4"
+#define LPM_LOAD_IPV6_MAP_NAME "geoip_v6"
+#define LPM_LOAD_STALE_CAPACITY 1024
+#define LPM_KEY_MAX_SIZE (sizeof(uint32_t) + IPV6_BYTES)
+#define ENOTSUPP_KERNEL 524
+
+
+typedef struct LoadArguments {
+    char *batch_file;
+    char *map_path;
+    unsigned max_entries;
+    bool check;
+    bool print;
+    bool verbose;
+} LoadArguments;
+
+//a batch file read into memory, with pointers to its sections
+//sorted_keys holds a copy of the keys, zero-padded to LPM_KEY_MAX_SIZE and sorted, for finding entries
+typedef struct LpmBatch {
+    char *data;
+    size_t size;
+    GeoipLpmBatchHeader *header;
+    char (*codes)[GEOIP_LPM_BATCH_CODE_SIZE];
+    uint8_t *keys;
+    uint16_t *values;
+    uint8_t *sorted_keys;
+} LpmBatch;
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+char *read_batch_file(char *file_name, LpmBatch *batch);
+int compare_keys(const void *key1, const void *key2);
+char *check_batch(LpmBatch *batch);
+void print_batch(LpmBatch *batch);
+long sys_bpf(int cmd, union bpf_attr *attr);
+int open_map(LoadArguments *arguments, LpmBatch *batch);
+bool update_entries(int map_fd, LpmBatch *batch, bool verbose);
+bool remove_stale_entries(int map_fd, LpmBatch *batch, bool verbose);
+void free_batch(LpmBatch *batch);
+int main(int argc, char **argv);
+
+#endif
@@ -8,11 +8,21 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <argp.h>
 
-#include "csv.h"
-#include "cidr.h"
+#include "hash.h"
+#include "polite.h"
+#include "libmm2xtgeoip.h"
 #include "mm2xtgeoip.h"
 
 
@@ -26,7 +36,16 @@ static char argp_doc[] = "mm2xtgeoip -- converts MaxMind geoip CSV databases to
                          "    0 - Success\n"
                          "    1 - Unable to process country file\n"
                          "    2 - Unable to process range files\n"
-                         "Other - Unable to parse command-line arguments";
+                         "    3 - Unable to watch input files\n"
+                         "    4 - Unable to process CIDR overlay or unroutable files\n"
+                         "    5 - Unable to write or apply patch\n"
+                         "    6 - Unable to set up polite mode\n"
+                         "    7 - Unable to simulate rule set\n"
+                         "Other - Unable to parse command-line arguments\n"
+                         "\n"
+                         "A manifest of the input files, the settings and the files written is kept in the target directory. "
+                         "If the inputs and settings haven't changed since the last conversion and the files written are all still there, "
+                         "unchanged, nothing is done.";
 
 static struct argp_option argp_options[] = {
     {"allow-countries",      'a', "COUNTRIES", 0, "Process ranges only from the specified comma-separated country codes. "
@@ -45,7 +64,92 @@ static struct argp_option argp_options[] = {
                                                                "If you use this option without specifying a FILE, no IPv6 ranges will be processed. "
                                                                "Default: " DEFAULT_IPV6_RANGE_FILE_NAME},
     {"target-dir",           'd', "DIRECTORY", 0, "Write output files to the specified directory. "
-                                                  "Default: " DEFAULT_OUTPUT_DIRECTORY},
+                                                  "Can't be used with -O (--output). Default: " DEFAULT_OUTPUT_DIRECTORY},
+    {"output-format",        'o', "FORMAT", 0, "Write output files in the specified format: "
+                                               "xt_geoip (binary CC" GEOIP_IPV4_SUFFIX " and CC" GEOIP_IPV6_SUFFIX " files for the xtables geoip match module) or "
+                                               "ipset (CC" GEOIP_IPSET_IPV4_SUFFIX " and CC" GEOIP_IPSET_IPV6_SUFFIX " files for ipset restore, "
+                                               "creating hash:net sets named " GEOIP_IPSET_SET_PREFIX "CC" GEOIP_IPSET_IPV4_SET_SUFFIX " and " GEOIP_IPSET_SET_PREFIX "CC" GEOIP_IPSET_IPV6_SET_SUFFIX ") or "
+                                               "lpm (" GEOIP_LPM_BATCH_FILE_NAME GEOIP_LPM_BATCH_IPV4_SUFFIX " and " GEOIP_LPM_BATCH_FILE_NAME GEOIP_LPM_BATCH_IPV6_SUFFIX " batches "
+                                               "of every allowed country for BPF LPM trie maps, to be loaded with mm2xtgeoip_lpmload) or "
+                                               "bundle (" GEOIP_BUNDLE_FILE_NAME GEOIP_BUNDLE_IPV4_SUFFIX " and " GEOIP_BUNDLE_FILE_NAME GEOIP_BUNDLE_IPV6_SUFFIX " files "
+                                               "holding the xt_geoip ranges of every allowed country in compact form, to be unpacked with -U (--unpack)) or "
+                                               "routes (blackhole routes for the ranges of all allowed countries together, merged and split into the fewest prefixes: "
+                                               GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_BIRD_IPV4_SUFFIX " and " GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_BIRD_IPV6_SUFFIX " to include in BIRD static protocols, "
+                                               GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_FRR_IPV4_SUFFIX " and " GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_FRR_IPV6_SUFFIX " FRR static routes, "
+                                               GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_PREFIX_LIST_IPV4_SUFFIX " and " GEOIP_ROUTES_FILE_NAME GEOIP_ROUTES_PREFIX_LIST_IPV6_SUFFIX " FRR prefix lists "
+                                               "named " GEOIP_ROUTES_PREFIX_LIST_IPV4_NAME " and " GEOIP_ROUTES_PREFIX_LIST_IPV6_NAME ") or "
+                                               "nft (CC" GEOIP_NFT_IPV4_SUFFIX " and CC" GEOIP_NFT_IPV6_SUFFIX " nftables interval sets named " GEOIP_NFT_SET_PREFIX "CC" GEOIP_NFT_IPV4_SET_SUFFIX
+                                               " and " GEOIP_NFT_SET_PREFIX "CC" GEOIP_NFT_IPV6_SET_SUFFIX ", to include in a table) or "
+                                               "cidr (CC" GEOIP_CIDR_IPV4_SUFFIX " and CC" GEOIP_CIDR_IPV6_SUFFIX " lists of CIDRs, one per line) or "
+                                               "combined (the ranges of all allowed countries together, or the rest of the address space if that takes fewer ranges, "
+                                               "in " GEOIP_COMBINED_COUNTRY_CODE GEOIP_IPV4_SUFFIX " and " GEOIP_COMBINED_COUNTRY_CODE GEOIP_IPV6_SUFFIX " xt_geoip files, with "
+                                               GEOIP_COMBINED_COUNTRY_CODE GEOIP_COMBINED_MARKER_IPV4_SUFFIX " and " GEOIP_COMBINED_COUNTRY_CODE GEOIP_COMBINED_MARKER_IPV6_SUFFIX
+                                               " holding the match to use: --src-cc " GEOIP_COMBINED_COUNTRY_CODE " or ! --src-cc " GEOIP_COMBINED_COUNTRY_CODE ") or "
+                                               "codegen (" GEOIP_CODEGEN_FILE_NAME GEOIP_CODEGEN_IPV4_HEADER_SUFFIX ", " GEOIP_CODEGEN_FILE_NAME GEOIP_CODEGEN_IPV4_SOURCE_SUFFIX ", "
+                                               GEOIP_CODEGEN_FILE_NAME GEOIP_CODEGEN_IPV6_HEADER_SUFFIX " and " GEOIP_CODEGEN_FILE_NAME GEOIP_CODEGEN_IPV6_SOURCE_SUFFIX
+                                               " C sources holding the ranges of all allowed countries as sorted constant arrays, "
+                                               "with inline lookup functions in the headers, to compile into C and C++ programs). "
+                                               "Only xt_geoip is available outside country mode. Can't be used with -O (--output). Default: xt_geoip"},
+    {"output",               'O', "FORMAT:DIRECTORY", 0, "Write output files in FORMAT, as in -o (--output-format), to DIRECTORY. "
+                                                         "Can be used several times to write several formats, or the same format to several directories, "
+                                                         "from a single pass over each range file. "
+                                                         "The manifest is kept in the first DIRECTORY. Only available in country mode."},
+    {"asn",                  'A', 0, 0, "Treat the range files as GeoLite2-ASN files and write one file per autonomous system "
+                                        "(AS<number>" GEOIP_IPV4_SUFFIX ", AS<number>" GEOIP_IPV6_SUFFIX "). "
+                                        "The country file and country filtering are not used. "
+                                        "Default range files: " DEFAULT_ASN_IPV4_RANGE_FILE_NAME ", " DEFAULT_ASN_IPV6_RANGE_FILE_NAME},
+    {"city",                 'C', 0, 0, "Treat the input files as GeoLite2-City files and write one file per country subdivision "
+                                        "(e.g. PT-11" GEOIP_IPV4_SUFFIX "), taken from subdivision_1_iso_code. "
+                                        "Ranges of locations without a subdivision are skipped. Country filtering is not used. "
+                                        "Default files: " DEFAULT_CITY_FILE_NAME ", " DEFAULT_CITY_IPV4_RANGE_FILE_NAME ", " DEFAULT_CITY_IPV6_RANGE_FILE_NAME},
+    {"unpack",               'U', 0, 0, "Treat the IPv4 and IPv6 files as bundles written with -o bundle and write the xt_geoip files they hold. "
+                                        "Bundles are checked before any file is written. The country file and country filtering are not used. "
+                                        "Default files: " DEFAULT_BUNDLE_IPV4_FILE_NAME ", " DEFAULT_BUNDLE_IPV6_FILE_NAME},
+    {"diff",                 'D', "OLD_DIRECTORY", 0, "Write a patch to stdout that turns the xt_geoip files in OLD_DIRECTORY into those in the target directory, "
+                                                     "holding only the ranges inserted and deleted in each file. No input files are used."},
+    {"apply",                'P', "PATCH", 0, "Apply PATCH, written with -D (--diff), to the xt_geoip files in the target directory. "
+                                              "Use - to read it from stdin. The patched files are checked against the patch's checksums "
+                                              "and only replace the old ones once the whole patch is verified. No input files are used."},
+    {"simulate",             'S', "SAMPLE", 0, "Load the xt_geoip files in the target directory as the xt_geoip module would, "
+                                               "replay the traffic in SAMPLE against the rules given with -s (--src-cc) and report "
+                                               "the comparisons and cache lines each packet costs and how often each rule and country is hit. "
+                                               "SAMPLE holds an IPv4 or IPv6 address per line, optionally followed by a weight such as a packet count. "
+                                               "No input files are used."},
+    {"src-cc",               's', "[!]COUNTRIES", 0, "Add a rule matching the comma-separated country codes, up to 15, or any other country if preceded by !, "
+                                                    "as xt_geoip's [!] --src-cc. Rules are tried in the order given and the first that matches decides the packet. "
+                                                    "Can be used several times. Only available in simulate mode."},
+    {"exclude-cidrs",        'x', "FILE", 0, "Punch the CIDRs listed in FILE, one per line, out of every country's ranges. "
+                                             "Can be used several times. Only available in country mode."},
+    {"include-cidrs",        'i', "FILE:CC", 0, "Add the CIDRs listed in FILE, one per line, to the ranges of country CC. "
+                                                "Included CIDRs are not affected by -x (--exclude-cidrs). "
+                                                "Can be used several times. Only available in country mode."},
+    {"delegated",            'g', "FILE[:PRIORITY]", 0, "Merge the allocated and assigned IPv4 and IPv6 records of FILE, an RIR delegated or delegated-extended "
+                                                       "statistics file, with the range files. Where sources overlap, the addresses go to the country given by "
+                                                       "the source with the highest PRIORITY. Range files have priority 0 and win ties, delegated files win ties "
+                                                       "in the order given. Default PRIORITY: 0, so FILE only fills in addresses missing from the range files. "
+                                                       "Can be used several times. Only available in country mode."},
+    {"compact",              'k', 0, 0, "Merge each country's ranges that are separated only by unroutable addresses "
+                                        "(special-purpose and unallocated blocks), which can't be the source of routable traffic. "
+                                        "Only available in country mode."},
+    {"unroutable-cidrs",     'u', "FILE", 0, "Use the CIDRs listed in FILE, one per line, as the unroutable blocks for -k (--compact), "
+                                             "instead of the built-in list. Implies -k (--compact)."},
+    {"max-ranges",           'm', "N", 0, "After merging across unroutable blocks, close the smallest remaining gaps of each country "
+                                          "until it has no more than N ranges. Closed gaps become part of the country. "
+                                          "Implies -k (--compact)."},
+    {"polite",               'p', 0, 0, "Go easy on the rest of the system: drop input and output files from the page cache as they're read and written, "
+                                        "limit reads and writes (see -R) and lower the I/O priority to the lowest best-effort level."},
+    {"io-rate",              'R', "MIB", 0, "Limit reads and writes to MIB MiB/s each in polite mode, 0 for no limit. Implies -p (--polite). Default: 32"},
+    {"cpus",                 'T', "CPUS", 0, "Run on the CPUs in the comma-separated list CPUS (e.g. 0,2-3), such as housekeeping CPUs "
+                                             "kept free of packet processing. Implies -p (--polite)."},
+    {"force",                'F', 0, 0, "Convert even if the input files and settings match the manifest in the target directory."},
+    {"report",               'r', 0, 0, "After converting each range file, write a per-country report to stdout: "
+                                        "input rows, merged ranges, addresses covered, prefixes written by length, output file size, "
+                                        "and the estimated kernel memory and lookup depth when the country is loaded by xt_geoip. "
+                                        "Implies -F (--force). Only available in country mode."},
+    {"watch",                'w', 0, 0, "After converting, keep running and convert again whenever an input file is replaced. "
+                                        "Input files include overlays (-i, -x), delegated files (-g) and the unroutable list (-u). "
+                                        "Only the affected address family is converted, unless the country file or one of those changes. "
+                                        "A country file that can't be read leaves the last good one in use."},
     {"verbose",              'v', 0, 0, "Write details of the program's activity to stdout. "
                                         "Without this option, only error messages will be written (to stderr)."},
     {0}
@@ -54,6 +158,15 @@ static struct argp_option argp_options[] = {
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     Arguments *arguments = state->input;
+    char *country_code;
+    char *priority;
+    char *end;
+    long priority_value;
+    unsigned long max_ranges;
+    double rate;
+    char *directory;
+    int format;
+    unsigned i;
     
     switch (key) {
         case 'a':
@@ -99,14 +212,269 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             break;
         
         case 'd':
+            arguments->single_output = true;
             arguments->target_dir = arg;
             break;
         
+        case 'o':
+            format = geoip_find_format(arg);
+            if (format < 0) {
+                argp_error(state, "Unknown output format: %s", arg);
+            }
+            
+            arguments->single_output = true;
+            arguments->output_format = format;
+            break;
+        
+        case 'O':
+            if (arguments->num_outputs == MAX_OUTPUTS) {
+                argp_error(state, "Too many outputs.");
+            }
+            
+            //format names have no colons, so directories may
+            directory = strchr(arg, ':');
+            if (directory == NULL || directory[1] == '\0') {
+                argp_error(state, "Outputs must be given as FORMAT:DIRECTORY.");
+            }
+            
+            *directory++ = '\0';
+            format = geoip_find_format(arg);
+            if (format < 0) {
+                argp_error(state, "Unknown output format: %s", arg);
+            }
+            
+            //two threads writing the same files would garble them
+            for (i = 0; i < arguments->num_outputs; i++) {
+                if (arguments->outputs[i].format == format && strcmp(arguments->outputs[i].directory, directory) == 0) {
+                    argp_error(state, "Output given twice: %s:%s", arg, directory);
+                }
+            }
+            
+            arguments->outputs[arguments->num_outputs].format = format;
+            arguments->outputs[arguments->num_outputs++].directory = directory;
+            break;
+        
+        case 'A':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_ASN;
+            break;
+        
+        case 'C':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_CITY;
+            break;
+        
+        case 'U':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_UNPACK;
+            break;
+        
+        case 'D':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_DIFF;
+            arguments->old_dir = arg;
+            break;
+        
+        case 'P':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_APPLY;
+            arguments->patch_file = arg;
+            break;
+        
+        case 'S':
+            if (arguments->mode != MODE_COUNTRY) {
+                argp_error(state, "Can't use more than one of ASN, City, unpack, diff, apply and simulate modes.");
+            }
+            
+            arguments->mode = MODE_SIMULATE;
+            arguments->sample_file = arg;
+            break;
+        
+        case 's':
+            if (arguments->num_sim_rules == MAX_SIM_RULES) {
+                argp_error(state, "Too many rules.");
+            }
+            
+            if (!geoip_parse_sim_rule(arg, &arguments->sim_rules[arguments->num_sim_rules++])) {
+                argp_error(state, "Invalid rule, expected up to %u comma-separated country codes: %s", GEOIP_SIM_RULE_MAX_COUNTRIES, arg);
+            }
+            break;
+        
+        case 'x':
+            if (arguments->num_exclude_files == MAX_OVERLAY_FILES) {
+                argp_error(state, "Too many CIDR overlay files.");
+            }
+            
+            arguments->exclude_files[arguments->num_exclude_files++] = arg;
+            break;
+        
+        case 'i':
+            if (arguments->num_include_files == MAX_OVERLAY_FILES) {
+                argp_error(state, "Too many CIDR overlay files.");
+            }
+            
+            //the country code comes after the last colon, so file names may contain colons
+            country_code = strrchr(arg, ':');
+            if (country_code == NULL || country_code == arg || strlen(country_code + 1) != GEOIP_COUNTRY_CODE_SIZE) {
+                argp_error(state, "CIDRs to include must be given as FILE:CC.");
+            }
+            
+            *country_code++ = '\0';
+            arguments->include_files[arguments->num_include_files] = arg;
+            arguments->include_codes[arguments->num_include_files++] = country_code;
+            break;
+        
+        case 'g':
+            if (arguments->num_delegated_files == MAX_OVERLAY_FILES) {
+                argp_error(state, "Too many delegated files.");
+            }
+            
+            //the priority comes after the last colon, if what follows it is a number
+            priority_value = 0;
+            priority = strrchr(arg, ':');
+            if (priority != NULL && priority != arg) {
+                errno = 0;
+                priority_value = strtol(priority + 1, &end, 10);
+                if (end == priority + 1 || *end) {
+                    priority_value = 0;
+                }
+                else if (errno || priority_value < INT_MIN || priority_value > INT_MAX) {
+                    argp_error(state, "Invalid priority: %s", priority + 1);
+                }
+                else {
+                    *priority = '\0';
+                }
+            }
+            
+            arguments->delegated_files[arguments->num_delegated_files] = arg;
+            arguments->delegated_priorities[arguments->num_delegated_files++] = priority_value;
+            break;
+        
+        case 'k':
+            arguments->compact = true;
+            break;
+        
+        case 'u':
+            arguments->compact = true;
+            arguments->unroutable_file = arg;
+            break;
+        
+        case 'm':
+            errno = 0;
+            max_ranges = strtoul(arg, &end, 10);
+            if (errno || *end != '\0' || !max_ranges || max_ranges > UINT_MAX) {
+                argp_error(state, "Invalid number of ranges: %s", arg);
+            }
+            
+            arguments->compact = true;
+            arguments->max_ranges = max_ranges;
+            break;
+        
+        case 'p':
+            arguments->polite = true;
+            break;
+        
+        case 'R':
+            errno = 0;
+            rate = strtod(arg, &end);
+            if (errno || end == arg || *end != '\0' || !(rate >= 0 && rate <= MAX_POLITE_RATE)) {
+                argp_error(state, "Invalid rate: %s", arg);
+            }
+            
+            arguments->polite = true;
+            arguments->polite_rate = rate;
+            break;
+        
+        case 'T':
+            arguments->polite = true;
+            arguments->polite_cpus = arg;
+            break;
+        
+        case 'F':
+            arguments->force = true;
+            break;
+        
+        case 'r':
+            arguments->report = true;
+            break;
+        
+        case 'w':
+            arguments->watch = true;
+            break;
+        
         case 'v':
             arguments->verbose = true;
             break;
         
         case ARGP_KEY_END:
+            if (arguments->mode != MODE_COUNTRY && arguments->watch) {
+                argp_error(state, "Can't watch input files outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->filtered_countries != NULL) {
+                argp_error(state, "Can't filter countries outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->report) {
+                argp_error(state, "Can't report on ranges outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && (arguments->num_exclude_files || arguments->num_include_files)) {
+                argp_error(state, "Can't use CIDR overlays outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->num_delegated_files) {
+                argp_error(state, "Can't merge delegated files outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->compact) {
+                argp_error(state, "Can't compact ranges outside country mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->output_format != GEOIP_FORMAT_XTGEOIP) {
+                argp_error(state, "Only the xt_geoip output format is available outside country mode.");
+            }
+            
+            if (arguments->mode == MODE_SIMULATE && !arguments->num_sim_rules) {
+                argp_error(state, "Simulate mode needs at least one rule.");
+            }
+            
+            if (arguments->mode != MODE_SIMULATE && arguments->num_sim_rules) {
+                argp_error(state, "Can't simulate rules outside simulate mode.");
+            }
+            
+            if (arguments->mode != MODE_COUNTRY && arguments->num_outputs) {
+                argp_error(state, "Can't write several outputs outside country mode.");
+            }
+            
+            if (arguments->num_outputs && arguments->single_output) {
+                argp_error(state, "Can't use -o (--output-format) or -d (--target-dir) with -O (--output).");
+            }
+            
+            //a single output is the one given by -o and -d, several keep the manifest in the first one's directory
+            if (!arguments->num_outputs) {
+                arguments->outputs[0].format = arguments->output_format;
+                arguments->outputs[0].directory = arguments->target_dir;
+                arguments->num_outputs = 1;
+            }
+            else {
+                arguments->target_dir = arguments->outputs[0].directory;
+            }
             break;
         
         case ARGP_KEY_ARG:
@@ -119,645 +487,1075 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp_parser = {argp_options, parse_opt, 0, argp_doc};
 
+//checks whether any output is written in a format
+bool writes_format(Arguments *arguments, int format) {
+    unsigned i;
+    
+    for (i = 0; i < arguments->num_outputs; i++) {
+        if (arguments->outputs[i].format == format) {
+            return true;
+        }
+    }
+    
+    return false;
+}
 
-inline bool str2bool(char *s) {
-    if (!s[0] || strcmp(s, "0") == 0) {
-        return false;
+//compares 2 country codes for sorting
+int compare_country_codes(const void *code1, const void *code2) {
+    return memcmp(code1, code2, GEOIP_COUNTRY_CODE_SIZE);
+}
+
+//describes the input files and the settings that affect the output
+//returns a buffer that must be freed by the caller, or NULL if an input file can't be hashed
+char *build_manifest(Arguments *arguments, uint16_t *filtered_country_pos) {
+    char *manifest;
+    char *filter_mode;
+    char *file_names[] = {arguments->country_file, arguments->ipv4_file, arguments->ipv6_file};
+    char *file_labels[] = {"country", "ipv4", "ipv6"};
+    const char *MODE_NAMES[] = {"country", "asn", "city", "unpack", "diff", "apply", "simulate"};
+    char (*codes)[GEOIP_COUNTRY_CODE_SIZE] = NULL;
+    size_t manifest_size;
+    size_t len;
+    unsigned num_codes = 0;
+    unsigned num_unique_codes = 0;
+    unsigned i;
+    uint64_t hash;
+    
+    //count the filtered countries
+    if (filtered_country_pos != NULL) {
+        for (; filtered_country_pos[num_codes]; num_codes++);
+    }
+    
+    manifest_size = MANIFEST_FIXED_SIZE + num_codes * (GEOIP_COUNTRY_CODE_SIZE + 1);
+    manifest_size += (arguments->num_exclude_files + arguments->num_include_files) * MANIFEST_OVERLAY_SIZE;
+    manifest_size += arguments->num_delegated_files * MANIFEST_SOURCE_SIZE;
+    for (i = 0; i < arguments->num_outputs; i++) {
+        manifest_size += strlen(arguments->outputs[i].directory) + MANIFEST_OUTPUT_SIZE;
+    }
+    manifest = malloc(manifest_size);
+    if (manifest == NULL) {
+        return NULL;
+    }
+    
+    len = snprintf(manifest, manifest_size, "format %u\nmode %s\n", OUTPUT_FORMAT_VERSION, MODE_NAMES[arguments->mode]);
+    
+    //a single output is listed without its directory, where the manifest is
+    for (i = 0; i < arguments->num_outputs; i++) {
+        len += snprintf(manifest + len, manifest_size - len, "output %s%s%s\n", geoip_format_name(arguments->outputs[i].format),
+                        arguments->num_outputs > 1 ? " " : "", arguments->num_outputs > 1 ? arguments->outputs[i].directory : "");
+    }
+    
+    //hash the input files
+    for (i = 0; i < 3; i++) {
+        if (file_names[i] == NULL) {
+            len += snprintf(manifest + len, manifest_size - len, "%s none\n", file_labels[i]);
+            continue;
+        }
+        
+        if (!hash_file(file_names[i], &hash, arguments->polite_io)) {
+            free(manifest);
+            return NULL;
+        }
+        
+        len += snprintf(manifest + len, manifest_size - len, "%s %016llx\n", file_labels[i], (unsigned long long)hash);
+    }
+    
+    //normalize the country filter, so that order and duplicates don't matter
+    if (num_codes) {
+        codes = malloc(num_codes * GEOIP_COUNTRY_CODE_SIZE);
+        if (codes == NULL) {
+            free(manifest);
+            return NULL;
+        }
+        
+        //positions are the country codes themselves, as bytes
+        memcpy(codes, filtered_country_pos, num_codes * GEOIP_COUNTRY_CODE_SIZE);
+        qsort(codes, num_codes, GEOIP_COUNTRY_CODE_SIZE, compare_country_codes);
+        
+        for (i = 0; i < num_codes; i++) {
+            if (i && memcmp(codes[i], codes[num_unique_codes - 1], GEOIP_COUNTRY_CODE_SIZE) == 0) {
+                continue;
+            }
+            
+            memmove(codes[num_unique_codes++], codes[i], GEOIP_COUNTRY_CODE_SIZE);
+        }
+        
+        filter_mode = arguments->forbid_filtered_countries ? "forbid" : "allow";
     }
     else {
-        return true;
+        filter_mode = "none";
+    }
+    
+    len += snprintf(manifest + len, manifest_size - len, "filter %s", filter_mode);
+    for (i = 0; i < num_unique_codes; i++) {
+        len += snprintf(manifest + len, manifest_size - len, "%c%.2s", i ? ',' : ' ', codes[i]);
+    }
+    
+    len += snprintf(manifest + len, manifest_size - len, "\nvirtual %s\n", arguments->no_virtual_countries ? "no" : "yes");
+    
+    free(codes);
+    
+    if (!arguments->compact) {
+        len += snprintf(manifest + len, manifest_size - len, "compact no\n");
+    }
+    else if (arguments->unroutable_file == NULL) {
+        len += snprintf(manifest + len, manifest_size - len, "compact %u builtin\n", arguments->max_ranges);
     }
+    else {
+        if (!hash_file(arguments->unroutable_file, &hash, arguments->polite_io)) {
+            free(manifest);
+            return NULL;
+        }
+        
+        len += snprintf(manifest + len, manifest_size - len, "compact %u %016llx\n", arguments->max_ranges, (unsigned long long)hash);
+    }
+    
+    //overlays are applied in order, so they're listed in order
+    for (i = 0; i < arguments->num_exclude_files; i++) {
+        if (!hash_file(arguments->exclude_files[i], &hash, arguments->polite_io)) {
+            free(manifest);
+            return NULL;
+        }
+        
+        len += snprintf(manifest + len, manifest_size - len, "exclude %016llx\n", (unsigned long long)hash);
+    }
+    
+    for (i = 0; i < arguments->num_include_files; i++) {
+        if (!hash_file(arguments->include_files[i], &hash, arguments->polite_io)) {
+            free(manifest);
+            return NULL;
+        }
+        
+        len += snprintf(manifest + len, manifest_size - len, "include %.2s %016llx\n", arguments->include_codes[i], (unsigned long long)hash);
+    }
+    
+    //ties between sources are won in order, so they're listed in order
+    for (i = 0; i < arguments->num_delegated_files; i++) {
+        if (!hash_file(arguments->delegated_files[i], &hash, arguments->polite_io)) {
+            free(manifest);
+            return NULL;
+        }
+        
+        len += snprintf(manifest + len, manifest_size - len, "delegated %d %016llx\n", arguments->delegated_priorities[i], (unsigned long long)hash);
+    }
+    
+    return manifest;
 }
 
-//checks whether a geoname_id is reserved for internal use by the program
-inline bool geoname_id_reserved(unsigned long geoname_id) {
-    if (geoname_id == PROXY_GEONAME_ID || geoname_id == SAT_GEONAME_ID ||
-        geoname_id == OTHER_GEONAME_ID) {
-        return true;
+//generates the manifest file name for a target directory
+//returns a buffer that must be freed by the caller
+char *manifest_file_name(char *target_dir) {
+    char *file_name;
+    
+    file_name = malloc(strlen(target_dir) + strlen(MANIFEST_FILE_NAME) + 2);
+    if (file_name == NULL) {
+        return NULL;
     }
-    else {
+    
+    strcpy(file_name, target_dir);
+    strcat(file_name, "/");
+    strcat(file_name, MANIFEST_FILE_NAME);
+    
+    return file_name;
+}
+
+//lists every file in the output directories after the manifest, by output, name, size and hash
+//names starting with a dot, like the manifest's, aren't outputs
+//returns false if a directory or a file can't be read
+bool write_output_files(Arguments *arguments, FILE *manifest_file) {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat file_stat;
+    char file_name[PATH_MAX];
+    uint64_t hash;
+    bool ok = true;
+    unsigned i;
+    
+    for (i = 0; i < arguments->num_outputs && ok; i++) {
+        dir = opendir(arguments->outputs[i].directory);
+        if (dir == NULL) {
+            return false;
+        }
+        
+        while (ok && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            
+            if ((size_t)snprintf(file_name, PATH_MAX, "%s/%s", arguments->outputs[i].directory, entry->d_name) >= PATH_MAX ||
+                stat(file_name, &file_stat) != 0) {
+                ok = false;
+                break;
+            }
+            
+            if (!S_ISREG(file_stat.st_mode)) {
+                continue;
+            }
+            
+            ok = hash_file(file_name, &hash, arguments->polite_io) &&
+                 fprintf(manifest_file, "file %u %s %llu %016llx\n", i, entry->d_name,
+                         (unsigned long long)file_stat.st_size, (unsigned long long)hash) >= 0;
+        }
+        
+        closedir(dir);
+    }
+    
+    return ok;
+}
+
+//checks the files listed after the manifest, which must all still be in their output directories, unchanged
+bool output_files_match(Arguments *arguments, FILE *manifest_file) {
+    struct stat file_stat;
+    char line[MANIFEST_FILE_LINE_SIZE];
+    char name[MANIFEST_FILE_LINE_SIZE];
+    char file_name[PATH_MAX];
+    unsigned output;
+    unsigned long long size;
+    unsigned long long listed_hash;
+    uint64_t hash;
+    
+    while (fgets(line, MANIFEST_FILE_LINE_SIZE, manifest_file) != NULL) {
+        if (sscanf(line, "file %u %s %llu %llx", &output, name, &size, &listed_hash) != 4 || output >= arguments->num_outputs ||
+            strchr(name, '/') != NULL) {
+            return false;
+        }
+        
+        if ((size_t)snprintf(file_name, PATH_MAX, "%s/%s", arguments->outputs[output].directory, name) >= PATH_MAX ||
+            stat(file_name, &file_stat) != 0 || (unsigned long long)file_stat.st_size != size) {
+            return false;
+        }
+        
+        if (!hash_file(file_name, &hash, arguments->polite_io) || hash != listed_hash) {
+            return false;
+        }
+    }
+    
+    return !ferror(manifest_file);
+}
+
+//checks whether the manifest in the target directory matches the given one, and its output files are unchanged
+bool manifest_matches(Arguments *arguments, char *manifest) {
+    FILE *manifest_file;
+    char *file_name;
+    char *buf;
+    size_t len;
+    size_t manifest_len;
+    bool matches = false;
+    
+    file_name = manifest_file_name(arguments->target_dir);
+    if (file_name == NULL) {
         return false;
     }
+    
+    manifest_file = fopen(file_name, "r");
+    free(file_name);
+    if (manifest_file == NULL) {
+        return false;
+    }
+    
+    //the output files follow the manifest
+    manifest_len = strlen(manifest);
+    buf = malloc(manifest_len);
+    if (buf != NULL) {
+        len = fread(buf, 1, manifest_len, manifest_file);
+        matches = len == manifest_len && memcmp(buf, manifest, manifest_len) == 0;
+        matches = matches && output_files_match(arguments, manifest_file);
+        free(buf);
+    }
+    
+    fclose(manifest_file);
+    
+    return matches;
 }
 
-//searches for a country in countries by geoname_id
-inline Country *get_country(unsigned long geoname_id, bool proxy, bool sat, unsigned num_countries, Country *countries) {
-    unsigned start = 0;
-    unsigned mid;
-    unsigned end = num_countries - 1;
-    static unsigned long cached_geoname_id = 0;
-    static Country *cached_country_arr = NULL;
-    static Country *cached_country = NULL;
+//writes the manifest and the output files to the target directory, or removes it if the output is incomplete
+//the manifest is replaced atomically, so that an interrupted write can't cause a bogus match
+bool update_manifest(Arguments *arguments, uint16_t *filtered_country_pos, bool output_complete) {
+    FILE *manifest_file;
+    char *file_name;
+    char *tmp_file_name;
+    char *manifest = NULL;
+    bool ok = false;
+    
+    file_name = manifest_file_name(arguments->target_dir);
+    if (file_name == NULL) {
+        return false;
+    }
+    
+    if (output_complete) {
+        manifest = build_manifest(arguments, filtered_country_pos);
+    }
+    
+    if (manifest == NULL) {
+        unlink(file_name);
+        free(file_name);
+        return false;
+    }
+    
+    tmp_file_name = malloc(strlen(file_name) + strlen(MANIFEST_TMP_SUFFIX) + 1);
+    if (tmp_file_name != NULL) {
+        strcpy(tmp_file_name, file_name);
+        strcat(tmp_file_name, MANIFEST_TMP_SUFFIX);
+        
+        manifest_file = fopen(tmp_file_name, "w");
+        if (manifest_file != NULL) {
+            ok = fputs(manifest, manifest_file) >= 0;
+            ok = ok && write_output_files(arguments, manifest_file);
+            ok = fclose(manifest_file) == 0 && ok;
+            ok = ok && rename(tmp_file_name, file_name) == 0;
+            
+            if (!ok) {
+                unlink(tmp_file_name);
+            }
+        }
+        
+        free(tmp_file_name);
+    }
+    
+    if (!ok) {
+        unlink(file_name);
+    }
     
-    //nothing to do
+    free(manifest);
+    free(file_name);
+    
+    return ok;
+}
+
+//reads the country file, adds virtual countries and applies country filtering
+//filtered_country_pos may be NULL if no filtering was requested
+unsigned load_countries(Arguments *arguments, GeoipContext *ctx, uint16_t *filtered_country_pos) {
+    unsigned num_countries;
+    unsigned num_virtual_countries;
+    unsigned num_filtered_countries;
+    
+    //get countries from country file
+    if (arguments->verbose) {
+        printf("Processing country file (%s)...\n", arguments->country_file);
+    }
+    
+    num_countries = geoip_read_country_file(ctx, arguments->country_file);
     if (!num_countries) {
-        return NULL;
+        fprintf(stderr, "Unable to process country file: %s\n", geoip_error(ctx));
+        return 0;
+    }
+    
+    if (arguments->verbose) {
+        printf("Read %u countries.\n", num_countries);
+    }
+    
+    
+    //add virtual countries (A1, A2, O1)
+    if (!arguments->no_virtual_countries) {
+        if (arguments->verbose) {
+            printf("Adding virtual countries...\n");
+        }
+        
+        num_virtual_countries = geoip_add_virtual_countries(ctx);
+        assert(num_virtual_countries);
+        num_countries += num_virtual_countries;
+        
+        if (arguments->verbose) {
+            printf("Added %u virtual countries.\n", num_virtual_countries);
+        }
+    }
+    
+    
+    //setup country filtering
+    if (filtered_country_pos != NULL) {
+        if (arguments->verbose) {
+            printf("Setting up country filtering...\n");
+        }
+        
+        num_filtered_countries = geoip_set_filtered_countries(ctx, filtered_country_pos, arguments->forbid_filtered_countries);
+        
+        if (arguments->verbose) {
+            printf("Filtered by %u countries.\n", num_filtered_countries);
+        }
     }
     
-    if (proxy) {
-        geoname_id = PROXY_GEONAME_ID;
+    return num_countries;
+}
+
+//formats a 128-bit count in decimal
+//buf must hold at least REPORT_U128_DIGITS + 1 chars
+char *format_u128(uint64_t high, uint64_t low, char *buf) {
+    unsigned __int128 value = ((unsigned __int128)high << 64) | low;
+    char *pos = buf + REPORT_U128_DIGITS;
+    
+    *pos = '\0';
+    do {
+        *--pos = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    
+    return pos;
+}
+
+//suffix of the file a format writes for each country, or NULL if it doesn't write one per country
+char *country_file_suffix(int format, int addr_family) {
+    switch (format) {
+        case GEOIP_FORMAT_XTGEOIP:
+            return addr_family == AF_INET6 ? GEOIP_IPV6_SUFFIX : GEOIP_IPV4_SUFFIX;
+        case GEOIP_FORMAT_IPSET:
+            return addr_family == AF_INET6 ? GEOIP_IPSET_IPV6_SUFFIX : GEOIP_IPSET_IPV4_SUFFIX;
+        case GEOIP_FORMAT_NFT:
+            return addr_family == AF_INET6 ? GEOIP_NFT_IPV6_SUFFIX : GEOIP_NFT_IPV4_SUFFIX;
+        case GEOIP_FORMAT_CIDR:
+            return addr_family == AF_INET6 ? GEOIP_CIDR_IPV6_SUFFIX : GEOIP_CIDR_IPV4_SUFFIX;
+        default:
+            return NULL;
     }
-    else if (sat) {
-        geoname_id = SAT_GEONAME_ID;
+}
+
+//writes what each allowed country contributed to the last range file, and what loading it costs the kernel
+//file sizes are those of the files written by the first output with a file per country, - if there's none
+//xt_geoip keeps each country's ranges in one array and binary searches it for every packet
+void print_range_report(Arguments *arguments, GeoipContext *ctx, int addr_family) {
+    GeoipCountryStats *stats;
+    GeoipOutput *output = NULL;
+    struct stat file_stat;
+    char file_name[PATH_MAX];
+    char size_buf[REPORT_U128_DIGITS + 1];
+    char count_buf[REPORT_U128_DIGITS + 1];
+    char *suffix = NULL;
+    unsigned num_countries = geoip_num_countries(ctx);
+    unsigned i;
+    unsigned len;
+    unsigned depth;
+    unsigned max_depth = 0;
+    unsigned long total_rows = 0;
+    unsigned long total_ranges = 0;
+    unsigned long long file_size;
+    unsigned long long kernel_size;
+    unsigned long long total_file_size = 0;
+    unsigned long long total_kernel_size = 0;
+    unsigned __int128 addresses;
+    unsigned __int128 total_addresses = 0;
+    size_t subnet_size = addr_family == AF_INET6 ? REPORT_KERNEL_SUBNET6_SIZE : REPORT_KERNEL_SUBNET4_SIZE;
+    
+    for (i = 0; i < arguments->num_outputs && suffix == NULL; i++) {
+        output = &arguments->outputs[i];
+        suffix = country_file_suffix(output->format, addr_family);
     }
-    else if (!geoname_id) {
-        geoname_id = OTHER_GEONAME_ID;
+    
+    printf("%s report\n", addr_family == AF_INET6 ? "IPv6" : "IPv4");
+    printf("%-7s %10s %10s %39s %12s %12s %5s  %s\n", "country", "rows", "ranges", "addresses", "file_bytes", "kernel_bytes", "depth", "prefixes");
+    
+    for (i = 0; i < num_countries; i++) {
+        stats = geoip_country_stats(ctx, i);
+        if (stats == NULL || geoip_country_forbidden(ctx, i)) {
+            //forbidden countries get no file, so there's nothing to load
+            continue;
+        }
+        
+        //a country without ranges gets no file
+        strcpy(size_buf, "-");
+        if (suffix != NULL) {
+            snprintf(file_name, PATH_MAX, "%s/%s%s", output->directory, geoip_country_code(ctx, i), suffix);
+            if (stat(file_name, &file_stat) == 0) {
+                file_size = file_stat.st_size;
+                total_file_size += file_size;
+                snprintf(size_buf, sizeof(size_buf), "%llu", file_size);
+            }
+        }
+        
+        //xt_geoip loads the ranges as-is, into a page-granular allocation
+        kernel_size = (unsigned long long)stats->ranges * subnet_size;
+        kernel_size = (kernel_size + REPORT_KERNEL_PAGE_SIZE - 1) / REPORT_KERNEL_PAGE_SIZE * REPORT_KERNEL_PAGE_SIZE;
+        kernel_size += REPORT_KERNEL_COUNTRY_SIZE;
+        
+        //comparisons needed by a binary search that doesn't find a match
+        for (depth = 0; (stats->ranges >> depth) != 0; depth++);
+        
+        printf("%-7s %10u %10u %39s %12s %12llu %5u ", geoip_country_code(ctx, i), stats->rows, stats->ranges,
+               format_u128(stats->addresses_high, stats->addresses_low, count_buf), size_buf, kernel_size, depth);
+        
+        for (len = 0; len <= GEOIP_MAX_PREFIX_LENGTH; len++) {
+            if (stats->prefix_lengths[len]) {
+                printf(" /%u:%u", len, stats->prefix_lengths[len]);
+            }
+        }
+        putchar('\n');
+        
+        addresses = ((unsigned __int128)stats->addresses_high << 64) | stats->addresses_low;
+        total_addresses = total_addresses + addresses < total_addresses ? ~(unsigned __int128)0 : total_addresses + addresses;
+        total_rows += stats->rows;
+        total_ranges += stats->ranges;
+        total_kernel_size += kernel_size;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+    
+    if (suffix != NULL) {
+        snprintf(size_buf, sizeof(size_buf), "%llu", total_file_size);
+    }
+    else {
+        strcpy(size_buf, "-");
     }
     
-    //ranges for a particular country are often contiguous
-    //caching the last country might save some time
-    if (cached_country_arr == countries && geoname_id == cached_geoname_id) {
-        return cached_country;
+    printf("%-7s %10lu %10lu %39s %12s %12llu %5u\n", "total", total_rows, total_ranges,
+           format_u128(total_addresses >> 64, (uint64_t)total_addresses, count_buf), size_buf, total_kernel_size, max_depth);
+}
+
+//shows how much compaction reduced each country's ranges
+void print_compaction_report(GeoipContext *ctx, int addr_family) {
+    GeoipCountryStats *stats;
+    unsigned num_countries = geoip_num_countries(ctx);
+    unsigned i;
+    unsigned long total_before = 0;
+    unsigned long total_after = 0;
+    
+    printf("%s compaction\n", addr_family == AF_INET6 ? "IPv6" : "IPv4");
+    printf("%-7s %10s %10s %9s\n", "country", "before", "after", "reduction");
+    
+    for (i = 0; i < num_countries; i++) {
+        stats = geoip_country_stats(ctx, i);
+        if (stats == NULL || geoip_country_forbidden(ctx, i)) {
+            continue;
+        }
+        
+        printf("%-7s %10u %10u %8.1f%%\n", geoip_country_code(ctx, i), stats->uncompacted_ranges, stats->ranges,
+               stats->uncompacted_ranges ? 100.0 * (stats->uncompacted_ranges - stats->ranges) / stats->uncompacted_ranges : 0.0);
+        
+        total_before += stats->uncompacted_ranges;
+        total_after += stats->ranges;
     }
     
-    cached_geoname_id = geoname_id;
-    cached_country_arr = countries;
+    printf("%-7s %10lu %10lu %8.1f%%\n", "total", total_before, total_after,
+           total_before ? 100.0 * (total_before - total_after) / total_before : 0.0);
+}
+
+//shows how many prefixes merging the ranges of all countries saved in the blackhole routes
+void print_route_report(GeoipContext *ctx, int addr_family) {
+    GeoipRouteStats *stats = geoip_route_stats(ctx);
+    
+    printf("%s routes\n", addr_family == AF_INET6 ? "IPv6" : "IPv4");
+    printf("%-11s %10s %10s %9s\n", "", "ranges", "prefixes", "reduction");
+    printf("%-11s %10u %10u\n", "per country", stats->ranges, stats->prefixes);
+    printf("%-11s %10u %10u %8.1f%%\n", "aggregated", stats->merged_ranges, stats->routes,
+           stats->prefixes ? 100.0 * (stats->prefixes - stats->routes) / stats->prefixes : 0.0);
+}
+
+//reads the CIDR overlay files into the context
+bool load_overlays(Arguments *arguments, GeoipContext *ctx) {
+    unsigned num_cidrs;
+    unsigned i;
     
-    //the countries are sorted, so use binary search
-    while (start <= end) {
-        mid = start + (end - start) / 2;
+    for (i = 0; i < arguments->num_exclude_files; i++) {
+        if (arguments->verbose) {
+            printf("Processing CIDRs to exclude (%s)...\n", arguments->exclude_files[i]);
+        }
         
-        if (countries[mid].geoname_id == geoname_id) {
-            //found
-            cached_country = &countries[mid];
-            return cached_country;
+        num_cidrs = geoip_read_overlay_file(ctx, arguments->exclude_files[i], NULL);
+        if (!num_cidrs) {
+            fprintf(stderr, "Unable to process CIDRs to exclude (%s): %s\n", arguments->exclude_files[i], geoip_error(ctx));
+            return false;
         }
         
-        if (countries[mid].geoname_id < geoname_id) {
-            start = mid + 1;
+        if (arguments->verbose) {
+            printf("Read %u CIDRs to exclude.\n", num_cidrs);
         }
-        else {
-            end = mid - 1;
+    }
+    
+    for (i = 0; i < arguments->num_include_files; i++) {
+        if (arguments->verbose) {
+            printf("Processing CIDRs to include in %s (%s)...\n", arguments->include_codes[i], arguments->include_files[i]);
+        }
+        
+        num_cidrs = geoip_read_overlay_file(ctx, arguments->include_files[i], arguments->include_codes[i]);
+        if (!num_cidrs) {
+            fprintf(stderr, "Unable to process CIDRs to include in %s (%s): %s\n", arguments->include_codes[i], arguments->include_files[i], geoip_error(ctx));
+            return false;
+        }
+        
+        if (arguments->verbose) {
+            printf("Read %u CIDRs to include.\n", num_cidrs);
         }
     }
     
-    //not found
-    cached_country = NULL;
-    return NULL;
+    return true;
 }
 
-//converts a 2-letter country code to an uint16_t that can be used as an index
-inline uint16_t country_code_pos(char *country_code) {
-    if (!country_code[0] || !country_code[1] || country_code[2]) {
-        return 0;
-    }
-    
-    char buf[COUNTRY_CODE_SIZE];
-    
-    buf[0] = toupper(country_code[0]);
-    buf[1] = toupper(country_code[1]);
+//reads the delegated files to merge with the range files into the context
+bool load_sources(Arguments *arguments, GeoipContext *ctx) {
+    unsigned num_records;
+    unsigned i;
     
-    uint16_t *pos = (uint16_t *)buf;
+    for (i = 0; i < arguments->num_delegated_files; i++) {
+        if (arguments->verbose) {
+            printf("Processing delegated file with priority %d (%s)...\n", arguments->delegated_priorities[i], arguments->delegated_files[i]);
+        }
+        
+        num_records = geoip_read_delegated_file(ctx, arguments->delegated_files[i], arguments->delegated_priorities[i]);
+        if (!num_records) {
+            fprintf(stderr, "Unable to process delegated file (%s): %s\n", arguments->delegated_files[i], geoip_error(ctx));
+            return false;
+        }
+        
+        if (arguments->verbose) {
+            printf("Read %u delegated records.\n", num_records);
+        }
+    }
     
-    return *pos;
+    return true;
 }
 
-//initializes country_code_lookup with null pointers
-void init_country_code_lookup(Country **country_code_lookup) {
-    unsigned i;
+//sets up range compaction, with unroutable blocks from a file or the built-in ones
+bool load_compaction(Arguments *arguments, GeoipContext *ctx) {
+    unsigned num_cidrs;
+    
+    if (arguments->unroutable_file != NULL) {
+        if (arguments->verbose) {
+            printf("Processing unroutable CIDRs (%s)...\n", arguments->unroutable_file);
+        }
+        
+        num_cidrs = geoip_read_unroutable_file(ctx, arguments->unroutable_file);
+        if (!num_cidrs) {
+            fprintf(stderr, "Unable to process unroutable CIDRs (%s): %s\n", arguments->unroutable_file, geoip_error(ctx));
+            return false;
+        }
+        
+        if (arguments->verbose) {
+            printf("Read %u unroutable CIDRs.\n", num_cidrs);
+        }
+    }
     
-    for (i = 0; i < MAX_COUNTRIES; i++) {
-        country_code_lookup[i] = NULL;
+    if (!geoip_set_compaction(ctx, arguments->compact, arguments->max_ranges)) {
+        fprintf(stderr, "Unable to set up range compaction: %s\n", geoip_error(ctx));
+        return false;
     }
+    
+    return true;
 }
 
-//populates a country array and its country code lookup array with data from a country file
-//assumes country_code_lookup has been initialized with NULL pointers for its empty slots
-unsigned read_country_file(char *country_file_name, Country *countries, Country **country_code_lookup, char **err_msg) {
-    const unsigned MIN_COLS = 3;
-    const unsigned GEONAME_ID_COL_IDX = 0;
-    const unsigned CONTINENT_CODE_COL_IDX = 1;
-    const unsigned COUNTRY_CODE_COL_IDX = 2;
-    const char* REQUIRED_COLS[] = {
-        "geoname_id",
-        "continent_code",
-        "country_iso_code"
-    };
-    
-    FILE *country_file;
-    static char err_msg_buf[MAX_LINE];
-    char line[MAX_LINE];
-    char *line_data[MAX_COLS];
-    char *country_code;
-    unsigned i;
-    unsigned num_cols;
-    unsigned highest_col;
-    unsigned geoname_id_col;
-    unsigned continent_code_col;
-    unsigned country_code_col;
-    unsigned line_num = 0;
-    unsigned num_countries = 0;
-    unsigned column_positions[MIN_COLS];
-    unsigned long last_geoname_id = 0;
-    unsigned long geoname_id;
-    uint16_t country_pos;
+//processes the range file for one address family, reporting progress and errors
+unsigned convert_range_file(Arguments *arguments, int addr_family, GeoipContext *ctx) {
+    char *range_file_name;
+    char *family_name;
+    unsigned num_ranges;
     
-    //default error message
-    *err_msg = "No usable data in file.";
+    if (addr_family == AF_INET) {
+        range_file_name = arguments->ipv4_file;
+        family_name = "IPv4";
+    }
+    else {
+        range_file_name = arguments->ipv6_file;
+        family_name = "IPv6";
+    }
     
-    country_file = fopen(country_file_name, "r");
-    if (country_file == NULL) {
-        *err_msg = "Error opening file.";
-        return 0;
+    if (arguments->verbose) {
+        printf("Processing %s range file (%s)...\n", family_name, range_file_name);
     }
     
-    for (line_num = 1; ; line_num++) {
-        //read line
-        if (fgets(line, MAX_LINE, country_file) == NULL) {
-            //could be an error or could be eof
-            if (ferror(country_file)) {
-                *err_msg = "Read error.";
-                num_countries = 0;
-            }
-            goto end;
-        }
+    switch (arguments->mode) {
+        case MODE_ASN:
+            num_ranges = geoip_process_asn_range_file(ctx, range_file_name, addr_family, arguments->target_dir);
+            break;
         
-        if (line_num == MAX_COUNTRIES) {
-            *err_msg = "File too long.";
-            num_countries = 0;
-            goto end;
-        }
+        case MODE_CITY:
+            num_ranges = geoip_process_city_range_file(ctx, range_file_name, addr_family, arguments->target_dir);
+            break;
         
-        switch (strlen(line)) {
-            case 0:
-                //skip empty lines
-                continue;
+        case MODE_UNPACK:
+            num_ranges = geoip_unpack_bundle(ctx, range_file_name, addr_family, arguments->target_dir);
+            break;
+        
+        default:
+            num_ranges = geoip_process_range_outputs(ctx, range_file_name, addr_family, arguments->outputs, arguments->num_outputs);
+    }
+    if (num_ranges) {
+        if (arguments->verbose) {
+            printf("Processed %u %s ranges.\n", num_ranges, family_name);
+            
+            if (writes_format(arguments, GEOIP_FORMAT_ROUTES)) {
+                printf("Aggregated %u %s prefixes into %u routes.\n", geoip_route_stats(ctx)->prefixes, family_name, geoip_route_stats(ctx)->routes);
+            }
             
-            case MAX_LINE - 1:
-                *err_msg = "Line too long.";
-                num_countries = 0;
-                goto end;
+            if (writes_format(arguments, GEOIP_FORMAT_COMBINED)) {
+                printf("Combined %u %s ranges, complement %u: writing the %s.\n", geoip_combined_stats(ctx)->ranges, family_name,
+                       geoip_combined_stats(ctx)->complement_ranges, geoip_combined_stats(ctx)->negated ? "complement" : "ranges");
+            }
         }
         
-        num_cols = tokenize_csv(line, line_data, MAX_COLS);
-        
-        if (line_num == 1) {
-            //this is the header, find the position of the required columns
-            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
-                *err_msg = "Required columns not found in header.";
-                num_countries = 0;
-                goto end;
-            }
+        if (arguments->report) {
+            print_range_report(arguments, ctx, addr_family);
             
-            geoname_id_col = column_positions[GEONAME_ID_COL_IDX];
-            continent_code_col = column_positions[CONTINENT_CODE_COL_IDX];
-            country_code_col = column_positions[COUNTRY_CODE_COL_IDX];
+            if (arguments->compact) {
+                print_compaction_report(ctx, addr_family);
+            }
             
-            //nothing else to do with the header, move on to the next line
-            continue;
+            if (writes_format(arguments, GEOIP_FORMAT_ROUTES)) {
+                print_route_report(ctx, addr_family);
+            }
         }
+    }
+    else {
+        fprintf(stderr, "Unable to process %s range file: %s\n", family_name, geoip_error(ctx));
+    }
+    
+    return num_ranges;
+}
+
+//writes or applies a patch between generations of the target directory
+int convert_patch(Arguments *arguments) {
+    GeoipContext *ctx;
+    GeoipPatchStats stats;
+    FILE *patch_file;
+    FILE *info_file;
+    bool ok;
+    
+    ctx = geoip_new_context();
+    if (ctx == NULL) {
+        fputs("Unable to allocate conversion context.\n", stderr);
+        return 5;
+    }
+    
+    if (arguments->mode == MODE_DIFF) {
+        //the patch goes to stdout, so progress goes to stderr
+        info_file = stderr;
         
-        if (num_cols < highest_col + 1) {
-            *err_msg = "Insufficient columns.";
-            num_countries = 0;
-            goto end;
+        if (isatty(STDOUT_FILENO)) {
+            fputs("Not writing a patch to a terminal.\n", stderr);
+            geoip_free_context(ctx);
+            return 5;
         }
         
-        geoname_id = strtoul(line_data[geoname_id_col], NULL, 10);
-        if (geoname_id <= last_geoname_id) {
-            *err_msg = "Invalid, duplicate, or unsorted geoname_id.";
-            num_countries = 0;
-            goto end;
+        if (arguments->verbose) {
+            fprintf(info_file, "Comparing %s to %s...\n", arguments->old_dir, arguments->target_dir);
         }
         
-        if (geoname_id_reserved(geoname_id)) {
-            *err_msg = "Reserved geoname_id.";
-            num_countries = 0;
-            goto end;
-        }
+        ok = geoip_diff_directories(ctx, arguments->old_dir, arguments->target_dir, stdout, &stats);
+    }
+    else {
+        info_file = stdout;
         
-        //country code may be empty
-        //if so, use continent code
-        if (line_data[country_code_col][0]) {
-            country_code = line_data[country_code_col];
+        if (strcmp(arguments->patch_file, "-") == 0) {
+            patch_file = stdin;
         }
         else {
-            country_code = line_data[continent_code_col];
+            patch_file = polite_fopen(arguments->polite_io, arguments->patch_file, "r");
+            if (patch_file == NULL) {
+                fprintf(stderr, "Unable to open patch: %s\n", strerror(errno));
+                geoip_free_context(ctx);
+                return 5;
+            }
         }
         
-        country_pos = country_code_pos(country_code);
-        if (!country_pos) {
-            //invalid country code, skip line
-            continue;
+        if (arguments->verbose) {
+            printf("Applying %s to %s...\n", arguments->patch_file, arguments->target_dir);
         }
         
-        if (country_code_lookup[country_pos] != NULL) {
-            //duplicate country code, skip line
-            continue;
-        }
+        ok = geoip_apply_patch(ctx, patch_file, arguments->target_dir, &stats);
         
-        //store data
-        countries[num_countries].geoname_id = geoname_id;
-        strcpy(countries[num_countries].country_code, country_code);
-        countries[num_countries].forbidden = false;
-        country_code_lookup[country_pos] = &countries[num_countries];
+        if (patch_file != stdin) {
+            fclose(patch_file);
+        }
         
-        num_countries++;
+        //the manifest describes the inputs of the old files
+        if (ok) {
+            update_manifest(arguments, NULL, false);
+        }
     }
     
-    end:
-    
-    fclose(country_file);
-    
-    //clear default error message
-    if (num_countries) {
-        *err_msg = NULL;
+    if (!ok) {
+        fprintf(stderr, "Unable to %s patch: %s\n", arguments->mode == MODE_DIFF ? "write" : "apply", geoip_error(ctx));
     }
-    else if (line_num) {
-        //add line number to error message
-        snprintf(err_msg_buf, MAX_LINE, "%s (Line %u)", *err_msg, line_num);
-        *err_msg = err_msg_buf;
+    else if (arguments->verbose) {
+        fprintf(info_file, "%u files modified, %u created, %u deleted; %u ranges inserted, %u deleted.\n",
+                stats.modified_files, stats.created_files, stats.deleted_files, stats.inserted_ranges, stats.deleted_ranges);
     }
     
-    return num_countries;
-}
-
-//adds virtual countries (proxies, sat providers, and unknown ranges) to a country array and its country code lookup array
-//because virtual countries have very high geoname_ids, this should be called only after adding real countries from a country file
-unsigned add_virtual_countries(unsigned num_countries, Country *countries, Country **country_code_lookup) {
-    uint16_t country_pos;
-    
-    //add proxies (A1)
-    countries[num_countries].geoname_id = PROXY_GEONAME_ID;
-    strcpy(countries[num_countries].country_code, PROXY_COUNTRY_CODE);
-    countries[num_countries].forbidden = false;
-    country_pos = country_code_pos(PROXY_COUNTRY_CODE);
-    country_code_lookup[country_pos] = &countries[num_countries];
-    
-    num_countries++;
-    
-    //add sat providers (A2)
-    countries[num_countries].geoname_id = SAT_GEONAME_ID;
-    strcpy(countries[num_countries].country_code, SAT_COUNTRY_CODE);
-    countries[num_countries].forbidden = false;
-    country_pos = country_code_pos(SAT_COUNTRY_CODE);
-    country_code_lookup[country_pos] = &countries[num_countries];
-    
-    num_countries++;
-    
-    //add unknown ranges (O1)
-    countries[num_countries].geoname_id = OTHER_GEONAME_ID;
-    strcpy(countries[num_countries].country_code, OTHER_COUNTRY_CODE);
-    countries[num_countries].forbidden = false;
-    country_pos = country_code_pos(OTHER_COUNTRY_CODE);
-    country_code_lookup[country_pos] = &countries[num_countries];
-    
-    return 3;
+    geoip_free_context(ctx);
+    
+    return ok ? EXIT_SUCCESS : 5;
 }
 
-//sets or clears the forbidden attribute of countries specified by a 0-terminated array of country positions
-//if forbid is true, only the countries specified are forbidden
-//else, only those are allowed
-unsigned set_filtered_countries(unsigned num_countries, Country *countries, Country **country_code_lookup, uint16_t *country_positions, bool forbid) {
+//replays a traffic sample against a rule set loaded from the target directory and reports the cost
+int simulate_rule_set(Arguments *arguments) {
+    GeoipContext *ctx;
+    GeoipSimStats stats;
+    GeoipSimRule *rule;
     unsigned i;
-    unsigned processed = 0;
-    uint16_t country_pos;
+    unsigned j;
     
-    if (!num_countries) {
-        //nothing to do
-        return;
+    ctx = geoip_new_context();
+    if (ctx == NULL) {
+        fputs("Unable to allocate conversion context.\n", stderr);
+        return 7;
     }
     
-    if (!forbid) {
-        //only the countries in country_positions are allowed
-        //so forbid all by default
-        for (i = 0; i < num_countries; i++) {
-            countries[i].forbidden = true;
-        }
+    if (arguments->verbose) {
+        printf("Replaying %s against %u rules from %s...\n", arguments->sample_file, arguments->num_sim_rules, arguments->target_dir);
     }
     
-    i = 0;
-    country_pos = country_positions[0];
-    for (; country_pos != 0; country_pos = country_positions[++i]) {
-        if (country_code_lookup[country_pos] == NULL) {
-            //country_positions may contain positions for unknown country codes
-            continue;
-        }
+    if (!geoip_simulate(ctx, arguments->target_dir, arguments->sim_rules, arguments->num_sim_rules, arguments->sample_file, &stats)) {
+        fprintf(stderr, "Unable to simulate rule set: %s\n", geoip_error(ctx));
+        geoip_free_context(ctx);
+        return 7;
+    }
+    
+    //every share below is of the packets, so a sample without any can't be reported
+    if (!(stats.packets > 0)) {
+        fputs("Unable to simulate rule set: No packets in sample.\n", stderr);
+        geoip_free_context(ctx);
+        return 7;
+    }
+    
+    printf("%u addresses, %.0f packets, %.2f%% matched by no rule\n", stats.addresses, stats.packets, 100 * stats.unmatched / stats.packets);
+    printf("comparisons per packet: avg %.2f, p50 %u, p90 %u, p99 %u, max %u\n", stats.comparisons,
+           stats.comparisons_p50, stats.comparisons_p90, stats.comparisons_p99, stats.comparisons_max);
+    printf("subnets probed per packet: avg %.2f\n", stats.probes);
+    printf("cache lines per packet: avg %.2f, p99 %u, max %u\n", stats.cache_lines, stats.cache_lines_p99, stats.cache_lines_max);
+    
+    //lookups and hits are shares of all packets, the hit rate is the share of the packets looked up in the country
+    printf("%-4s %-8s %8s %-7s %8s %8s %8s\n", "rule", "match", "matched%", "country", "lookup%", "hit%", "hit_rate");
+    for (i = 0; i < arguments->num_sim_rules; i++) {
+        rule = &arguments->sim_rules[i];
         
-        if (country_code_lookup[country_pos]->forbidden != forbid) {
-            //country_positions may contain duplicates
-            country_code_lookup[country_pos]->forbidden = forbid;
-            processed++;
+        for (j = 0; j < rule->num_countries; j++) {
+            printf("%-4u %-8s %8.2f %-7s %8.2f %8.2f %8.2f\n", i + 1, rule->inverted ? "! src-cc" : "src-cc", 100 * rule->matches / stats.packets,
+                   rule->country_codes[j], 100 * rule->lookups[j] / stats.packets, 100 * rule->hits[j] / stats.packets,
+                   rule->lookups[j] > 0 ? 100 * rule->hits[j] / rule->lookups[j] : 0);
         }
     }
     
-    return processed;
+    geoip_free_context(ctx);
+    
+    return EXIT_SUCCESS;
 }
 
-//parses a comma-separated list of country codes into a 0-terminated array of country positions
-unsigned parse_country_code_list(char *country_codes, uint16_t *country_positions) {
-    char *parsed_country_codes[MAX_COUNTRIES];
-    unsigned num_countries;
-    unsigned i;
+//adds an inotify watch on the directory containing file_name
+//directories are watched rather than files so that atomically replaced files are noticed
+bool add_input_watch(int inotify_fd, char *file_name, WatchedFile *watched_file, unsigned flag) {
+    char *dir_copy;
+    char *base_copy;
+    
+    dir_copy = strdup(file_name);
+    base_copy = strdup(file_name);
+    if (dir_copy == NULL || base_copy == NULL) {
+        free(dir_copy);
+        free(base_copy);
+        return false;
+    }
     
-    num_countries = tokenize_csv(country_codes, parsed_country_codes, MAX_COUNTRIES);
+    watched_file->wd = inotify_add_watch(inotify_fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO);
+    free(dir_copy);
     
-    for (i = 0; i < num_countries; i++) {
-        *country_positions = country_code_pos(parsed_country_codes[i]);
-        
-        //ensure only valid country codes are left in the array
-        if (*country_positions) {
-            country_positions++;
-        }
+    if (watched_file->wd < 0) {
+        free(base_copy);
+        return false;
     }
-    *country_positions = 0;
     
-    return num_countries;
+    //basename may return a pointer into base_copy, so keep base_copy around
+    watched_file->base_name = basename(base_copy);
+    watched_file->name_buf = base_copy;
+    watched_file->flag = flag;
+    
+    return true;
 }
 
-//writes ranges from a range file to multiple binary files
-unsigned process_range_file(char *range_file_name, int addr_family, unsigned num_countries, Country *countries, char *output_directory, char **err_msg) {
-    const unsigned MIN_COLS = 5;
-    const unsigned CIDR_COL_IDX = 0;
-    const unsigned GEONAME_ID_COL_IDX = 1;
-    const unsigned REGISTERED_GEONAME_ID_COL_IDX = 2;
-    const unsigned PROXY_COL_IDX = 3;
-    const unsigned SAT_COL_IDX = 4;
-    const char* REQUIRED_COLS[] = {
-        "network",
-        "geoname_id",
-        "registered_country_geoname_id",
-        "is_anonymous_proxy",
-        "is_satellite_provider"
-    };
-    
-    FILE *range_file;
-    FILE *out_files[MAX_COUNTRIES];
-    static char err_msg_buf[MAX_LINE];
-    char line[MAX_LINE];
-    char *line_data[MAX_COLS];
-    char *geoname_id_str;
-    char *country_code;
-    char *file_name_suffix;
-    char *output_file_name = NULL;
-    unsigned output_file_name_len;
-    unsigned i;
-    unsigned num_cols;
-    unsigned highest_col;
-    unsigned cidr_col;
-    unsigned geoname_id_col;
-    unsigned registered_geoname_id_col;
-    unsigned proxy_col;
-    unsigned sat_col;
-    unsigned line_num = 0;
-    unsigned num_ranges = 0;
-    unsigned column_positions[MIN_COLS];
-    unsigned long geoname_id;
-    uint16_t country_pos;
-    uint16_t last_country_pos = 0;
-    Country *country;
-    AddressRange range;
-    AddressRange last_range;
-    bool proxy;
-    bool sat;
-    bool write_start;
-    
-    //default error message
-    *err_msg = "No usable data in file.";
+//reads the overlays, delegated files and unroutable list again, dropping what was read from them before
+bool reload_source_files(Arguments *arguments, GeoipContext *ctx) {
+    geoip_clear_overlays(ctx);
+    geoip_clear_sources(ctx);
     
-    if (!num_countries) {
-        //nothing to do
-        *err_msg = "No countries to process.";
-        return 0;
+    return load_overlays(arguments, ctx) && load_sources(arguments, ctx) && load_compaction(arguments, ctx);
+}
+
+//waits for the input files to be replaced and converts them again
+//the country table stays in memory and is only reread if the country file itself changes,
+//a country file that can't be used leaving the last good table to convert with
+//the overlays, delegated files and unroutable list are read again together when one of them or the country table changes,
+//and while they can't all be read, nothing is converted
+//changes are debounced so that an update touching several files triggers a single conversion
+//failed_families tells which families failed to convert last time, and which inputs failed to load, for keeping the manifest accurate
+//only returns on error
+int watch_input_files(Arguments *arguments, GeoipContext *ctx, uint16_t *filtered_country_pos, unsigned failed_families) {
+    char event_buf[WATCH_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    struct pollfd poll_fd;
+    WatchedFile watched_files[WATCH_MAX_FILES];
+    unsigned num_watched_files = 0;
+    unsigned pending = 0;
+    unsigned i;
+    ssize_t len;
+    char *pos;
+    int inotify_fd;
+    int ret;
+    
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        fprintf(stderr, "Unable to watch input files: %s\n", strerror(errno));
+        return 3;
     }
     
-    if (addr_family == AF_INET) {
-        file_name_suffix = IPV4_SUFFIX;
-    }
-    else if (addr_family == AF_INET6) {
-        file_name_suffix = IPV6_SUFFIX;
-    }
-    else {
-        *err_msg = "Invalid address family.";
-        return 0;
+    if (!add_input_watch(inotify_fd, arguments->country_file, &watched_files[num_watched_files++], WATCH_COUNTRY_FILE)) {
+        fprintf(stderr, "Unable to watch country file: %s\n", strerror(errno));
+        return 3;
     }
     
-    range_file = fopen(range_file_name, "r");
-    if (range_file == NULL) {
-        *err_msg = "Error opening file.";
-        return 0;
+    if (arguments->ipv4_file != NULL) {
+        if (!add_input_watch(inotify_fd, arguments->ipv4_file, &watched_files[num_watched_files++], WATCH_IPV4_FILE)) {
+            fprintf(stderr, "Unable to watch IPv4 range file: %s\n", strerror(errno));
+            return 3;
+        }
     }
     
-    for (i = 0; i < MAX_COUNTRIES; i++) {
-        out_files[i] = NULL;
+    if (arguments->ipv6_file != NULL) {
+        if (!add_input_watch(inotify_fd, arguments->ipv6_file, &watched_files[num_watched_files++], WATCH_IPV6_FILE)) {
+            fprintf(stderr, "Unable to watch IPv6 range file: %s\n", strerror(errno));
+            return 3;
+        }
     }
     
-    //allocate buffer for output file name
-    output_file_name_len = strlen(output_directory) + 1;
-    output_file_name_len += COUNTRY_CODE_SIZE + strlen(file_name_suffix) + 1;
-    output_file_name = malloc(output_file_name_len);
-    if (output_file_name == NULL) {
-        *err_msg = "Error allocating buffer for output file name.";
-        goto end;
+    for (i = 0; i < arguments->num_exclude_files; i++) {
+        if (!add_input_watch(inotify_fd, arguments->exclude_files[i], &watched_files[num_watched_files++], WATCH_SOURCE_FILES)) {
+            fprintf(stderr, "Unable to watch CIDRs to exclude (%s): %s\n", arguments->exclude_files[i], strerror(errno));
+            return 3;
+        }
     }
     
-    //open output files
-    for (i = 0; i < num_countries; i++) {
-        if (countries[i].forbidden) {
-            //don't open files for forbidden countries
-            continue;
+    for (i = 0; i < arguments->num_include_files; i++) {
+        if (!add_input_watch(inotify_fd, arguments->include_files[i], &watched_files[num_watched_files++], WATCH_SOURCE_FILES)) {
+            fprintf(stderr, "Unable to watch CIDRs to include (%s): %s\n", arguments->include_files[i], strerror(errno));
+            return 3;
         }
-        
-        //get array position for ith country
-        country_code = countries[i].country_code;
-        country_pos = country_code_pos(country_code);
-        
-        //generate file name
-        strcpy(output_file_name, output_directory);
-        strcat(output_file_name, "/");
-        strcat(output_file_name, country_code);
-        strcat(output_file_name, file_name_suffix);
-        
-        //open file for writing
-        out_files[country_pos] = fopen(output_file_name, "w");
-        
-        if (out_files[country_pos] == NULL) {
-            *err_msg = "Error opening an output file.";
-            goto end;
+    }
+    
+    for (i = 0; i < arguments->num_delegated_files; i++) {
+        if (!add_input_watch(inotify_fd, arguments->delegated_files[i], &watched_files[num_watched_files++], WATCH_SOURCE_FILES)) {
+            fprintf(stderr, "Unable to watch delegated file (%s): %s\n", arguments->delegated_files[i], strerror(errno));
+            return 3;
         }
     }
     
-    for (line_num = 1; ; line_num++) {
-        //read line
-        if (fgets(line, MAX_LINE, range_file) == NULL) {
-            if (ferror(range_file)) {
-                *err_msg = "Read error.";
-                num_ranges =  0;
-                goto end;
-            }
-            else {
-                break;
-            }
+    if (arguments->unroutable_file != NULL) {
+        if (!add_input_watch(inotify_fd, arguments->unroutable_file, &watched_files[num_watched_files++], WATCH_SOURCE_FILES)) {
+            fprintf(stderr, "Unable to watch unroutable CIDRs (%s): %s\n", arguments->unroutable_file, strerror(errno));
+            return 3;
         }
-        
-        switch (strlen(line)) {
-            case 0:
-                //skip empty lines
+    }
+    
+    poll_fd.fd = inotify_fd;
+    poll_fd.events = POLLIN;
+    
+    if (arguments->verbose) {
+        printf("Watching input files for changes...\n");
+    }
+    
+    for (;;) {
+        //block until something happens
+        //once a change is pending, wait for things to settle down instead
+        ret = poll(&poll_fd, 1, pending ? WATCH_DEBOUNCE_MS : -1);
+        if (ret < 0) {
+            if (errno == EINTR) {
                 continue;
+            }
             
-            case MAX_LINE - 1:
-                *err_msg = "Line too long.";
-                num_ranges = 0;
-                goto end;
+            fprintf(stderr, "Unable to watch input files: %s\n", strerror(errno));
+            return 3;
         }
         
-        num_cols = tokenize_csv(line, line_data, MAX_COLS);
-        
-        if (line_num == 1) {
-            //this is the header, find the position of the required columns
-            if (detect_columns(line_data, num_cols, REQUIRED_COLS, column_positions, MIN_COLS, &highest_col) != MIN_COLS) {
-                *err_msg = "Required columns not found in header.";
-                num_ranges = 0;
-                goto end;
+        if (ret == 0) {
+            //no events during the debounce interval, convert whatever changed
+            if (pending & WATCH_COUNTRY_FILE) {
+                if (load_countries(arguments, ctx, filtered_country_pos)) {
+                    failed_families &= ~WATCH_COUNTRY_FILE;
+                    
+                    //overlays and delegated records are resolved against the countries, so they're read again too
+                    pending |= WATCH_SOURCE_FILES;
+                }
+                else {
+                    //the library kept the last good table, but the output no longer matches the country file
+                    failed_families |= WATCH_COUNTRY_FILE;
+                }
             }
             
-            cidr_col = column_positions[CIDR_COL_IDX];
-            geoname_id_col = column_positions[GEONAME_ID_COL_IDX];
-            registered_geoname_id_col = column_positions[REGISTERED_GEONAME_ID_COL_IDX];
-            proxy_col = column_positions[PROXY_COL_IDX];
-            sat_col = column_positions[SAT_COL_IDX];
+            if ((pending | failed_families) & WATCH_SOURCE_FILES) {
+                if (reload_source_files(arguments, ctx)) {
+                    failed_families &= ~WATCH_SOURCE_FILES;
+                    
+                    //the ranges of both families may have changed
+                    pending |= WATCH_IPV4_FILE | WATCH_IPV6_FILE;
+                }
+                else {
+                    failed_families |= WATCH_SOURCE_FILES;
+                }
+            }
             
-            //nothing else to do with the header, move on to the next line
-            continue;
-        }
-        
-        if (num_cols < highest_col + 1) {
-            *err_msg = "Insufficient columns.";
-            num_ranges = 0;
-            goto end;
-        }
-        
-        //geoname_id may be empty
-        //if so, use registered_geoname_id
-        if (isdigit(line_data[geoname_id_col][0])) {
-            geoname_id_str = line_data[geoname_id_col];
-        }
-        else {
-            geoname_id_str = line_data[registered_geoname_id_col];
-        }
-        
-        geoname_id = strtoul(geoname_id_str, NULL, 10);
-        if (geoname_id_reserved(geoname_id)) {
-            *err_msg = "Reserved geoname_id.";
-            num_ranges = 0;
-            goto end;
-        }
-        
-        proxy = str2bool(line_data[proxy_col]);
-        sat = str2bool(line_data[sat_col]);
-        
-        country = get_country(geoname_id, proxy, sat, num_countries, countries);
-        if (country == NULL) {
-            //country not found, use O1
-            country = get_country(OTHER_GEONAME_ID, false, false, num_countries, countries);
-        }
-        if (country == NULL) {
-            //country not found, skip line
-            continue;
-        }
-        
-        if (country->forbidden) {
-            //ignore ranges belonging to forbidden countries
+            //without all overlays and sources, leave the previous output in place
+            if (!(failed_families & WATCH_SOURCE_FILES)) {
+                if ((pending & WATCH_IPV4_FILE) && arguments->ipv4_file != NULL) {
+                    if (convert_range_file(arguments, AF_INET, ctx)) {
+                        failed_families &= ~WATCH_IPV4_FILE;
+                    }
+                    else {
+                        failed_families |= WATCH_IPV4_FILE;
+                    }
+                }
+                
+                if ((pending & WATCH_IPV6_FILE) && arguments->ipv6_file != NULL) {
+                    if (convert_range_file(arguments, AF_INET6, ctx)) {
+                        failed_families &= ~WATCH_IPV6_FILE;
+                    }
+                    else {
+                        failed_families |= WATCH_IPV6_FILE;
+                    }
+                }
+            }
+            
+            update_manifest(arguments, filtered_country_pos, !failed_families);
+            pending = 0;
             continue;
         }
         
-        country_pos = country_code_pos(country->country_code);
-        
-        //country code was looked up from previously gathered info,
-        //so it must be valid
-        assert(country_pos);
-        
-        //there must be a valid open file for the country
-        assert(out_files[country_pos] != NULL);
-        
-        //parse cidr to get start and end addresses
-        if (!parse_cidr(line_data[cidr_col], &range)) {
-            *err_msg = "Invalid CIDR.";
-            num_ranges = 0;
-            goto end;
-        }
-        
-        if (range.addr_family != addr_family) {
-            *err_msg = "Wrong address family.";
-            num_ranges = 0;
-            goto end;
+        len = read(inotify_fd, event_buf, sizeof(event_buf));
+        if (len < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            
+            fprintf(stderr, "Unable to watch input files: %s\n", strerror(errno));
+            return 3;
         }
         
-        write_start = true;
-        
-        //merge with last range?
-        //this relies on the range file being sorted
-        if (country_pos == last_country_pos && ranges_contiguous(&range, &last_range)) {
-            //to merge, overwrite previous end address with current end address
-            if (fseek(out_files[country_pos], range.addr_bytes * -1, SEEK_CUR) == 0) {
-                write_start = false;
+        //mark the files affected by these events
+        for (pos = event_buf; pos < event_buf + len; pos += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)pos;
+            
+            if (!event->len) {
+                continue;
             }
-            else {
-                *err_msg = "Seek error.";
-                num_ranges = 0;
-                goto end;
+            
+            for (i = 0; i < num_watched_files; i++) {
+                if (event->wd == watched_files[i].wd && strcmp(event->name, watched_files[i].base_name) == 0) {
+                    pending |= watched_files[i].flag;
+                }
             }
         }
-        
-        //write start and end addresses
-        if (write_start && !fwrite(range.start, range.addr_bytes, 1, out_files[country_pos])) {
-            *err_msg = "Error writing start address.";
-            num_ranges = 0;
-            goto end;
-        }
-        
-        if (!fwrite(range.end, range.addr_bytes, 1, out_files[country_pos])) {
-            *err_msg = "Error writing end address.";
-            num_ranges = 0;
-            goto end;
-        }
-        
-        num_ranges++;
-        last_country_pos = country_pos;
-        last_range = range;
-    }
-    
-    end:
-    
-    fclose(range_file);
-    
-    if (output_file_name != NULL) {
-        free(output_file_name);
-    }
-    
-    //close all output files
-    for (i = 0; i < MAX_COUNTRIES; i++) {
-        if (out_files[i] == NULL) {
-            continue;
-        }
-        
-        fclose(out_files[i]);
-    }
-    
-    if (num_ranges) {
-        //clear default error message
-        *err_msg = NULL;
     }
-    else if (line_num) {
-        //add line number to error message
-        snprintf(err_msg_buf, MAX_LINE, "%s (Line %u)", *err_msg, line_num);
-        *err_msg = err_msg_buf;
-    }
-    
-    return num_ranges;
 }
 
 int main(int argc, char **argv) {
     Arguments arguments;
-    Country countries[MAX_COUNTRIES];
-    Country *country_code_lookup[MAX_COUNTRIES];
-    uint16_t filtered_country_pos[MAX_COUNTRIES];
-    char *err_msg;
-    unsigned num_countries;
-    unsigned num_virtual_countries;
-    unsigned num_filtered_countries;
-    unsigned num_ipv4_ranges;
-    unsigned num_ipv6_ranges;
+    GeoipContext *ctx;
+    PoliteIo polite_io;
+    uint16_t filtered_country_pos[GEOIP_MAX_COUNTRIES];
+    uint16_t *filter = NULL;
+    char *manifest = NULL;
+    bool unchanged = false;
+    unsigned num_countries = 0;
+    unsigned num_cities;
+    unsigned failed_families = 0;
+    int ret;
+    unsigned num_ipv4_ranges = 0;
+    unsigned num_ipv6_ranges = 0;
+    char *DEFAULT_IPV4_FILE_NAMES[] = {DEFAULT_IPV4_RANGE_FILE_NAME, DEFAULT_ASN_IPV4_RANGE_FILE_NAME,
+                                       DEFAULT_CITY_IPV4_RANGE_FILE_NAME, DEFAULT_BUNDLE_IPV4_FILE_NAME};
+    char *DEFAULT_IPV6_FILE_NAMES[] = {DEFAULT_IPV6_RANGE_FILE_NAME, DEFAULT_ASN_IPV6_RANGE_FILE_NAME,
+                                       DEFAULT_CITY_IPV6_RANGE_FILE_NAME, DEFAULT_BUNDLE_IPV6_FILE_NAME};
     
     
     //set default arguments
@@ -768,97 +1566,177 @@ int main(int argc, char **argv) {
     arguments.ipv4_file = DEFAULT_IPV4_RANGE_FILE_NAME;
     arguments.ipv6_file = DEFAULT_IPV6_RANGE_FILE_NAME;
     arguments.target_dir = DEFAULT_OUTPUT_DIRECTORY;
+    arguments.mode = MODE_COUNTRY;
+    arguments.output_format = GEOIP_FORMAT_XTGEOIP;
+    arguments.single_output = false;
+    arguments.num_outputs = 0;
+    arguments.old_dir = NULL;
+    arguments.patch_file = NULL;
+    arguments.sample_file = NULL;
+    arguments.num_sim_rules = 0;
+    arguments.num_exclude_files = 0;
+    arguments.num_include_files = 0;
+    arguments.num_delegated_files = 0;
+    arguments.compact = false;
+    arguments.unroutable_file = NULL;
+    arguments.max_ranges = 0;
+    arguments.polite = false;
+    arguments.polite_rate = DEFAULT_POLITE_RATE;
+    arguments.polite_cpus = NULL;
+    arguments.polite_io = &polite_io;
+    arguments.force = false;
+    arguments.report = false;
+    arguments.watch = false;
     arguments.verbose = false;
     
     //parse arguments from command line
     argp_parse(&argp_parser, argc, argv, 0, 0, &arguments);
     
-    
-    init_country_code_lookup(country_code_lookup);
-    
-    
-    //get countries from country file
-    if (arguments.verbose) {
-        printf("Processing country file (%s)...\n", arguments.country_file);
+    //the manifest is written in polite mode too, the library has its own settings for the rest
+    init_polite_io(&polite_io);
+    if (arguments.polite) {
+        set_polite_io(&polite_io, true, arguments.polite_rate * 1024 * 1024);
     }
     
-    num_countries = read_country_file(arguments.country_file, countries, country_code_lookup, &err_msg);
-    if (!num_countries) {
-        fprintf(stderr, "Unable to process country file: %s\n", err_msg);
-        return 1;
+    //diff, apply and simulate modes work on output files only
+    if (arguments.mode == MODE_DIFF || arguments.mode == MODE_APPLY) {
+        return convert_patch(&arguments);
     }
     
-    if (arguments.verbose) {
-        printf("Read %u countries.\n", num_countries);
+    if (arguments.mode == MODE_SIMULATE) {
+        return simulate_rule_set(&arguments);
     }
     
-    
-    //add virtual countries (A1, A2, O1)
-    if (!arguments.no_virtual_countries) {
-        if (arguments.verbose) {
-            printf("Adding virtual countries...\n");
+    //ASN, City and unpack modes have their own default files
+    //ASN and unpack modes have no country file, City mode uses a city locations file instead
+    if (arguments.mode != MODE_COUNTRY) {
+        if (arguments.ipv4_file != NULL && strcmp(arguments.ipv4_file, DEFAULT_IPV4_RANGE_FILE_NAME) == 0) {
+            arguments.ipv4_file = DEFAULT_IPV4_FILE_NAMES[arguments.mode];
         }
         
-        num_virtual_countries = add_virtual_countries(num_countries, countries, country_code_lookup);
-        assert(num_virtual_countries);
-        num_countries += num_virtual_countries;
+        if (arguments.ipv6_file != NULL && strcmp(arguments.ipv6_file, DEFAULT_IPV6_RANGE_FILE_NAME) == 0) {
+            arguments.ipv6_file = DEFAULT_IPV6_FILE_NAMES[arguments.mode];
+        }
         
-        if (arguments.verbose) {
-            printf("Added %u virtual countries.\n", num_virtual_countries);
+        if (arguments.mode == MODE_ASN || arguments.mode == MODE_UNPACK) {
+            arguments.country_file = NULL;
+        }
+        else if (strcmp(arguments.country_file, DEFAULT_COUNTRY_FILE_NAME) == 0) {
+            arguments.country_file = DEFAULT_CITY_FILE_NAME;
         }
     }
     
     
-    //setup country filtering
+    //parse the country filter once
+    //tokenizing modifies the list, and watch mode may need the filter again
     if (arguments.filtered_countries != NULL) {
-        if (arguments.verbose) {
-            printf("Setting up country filtering...\n");
+        geoip_parse_country_code_list(arguments.filtered_countries, filtered_country_pos);
+        filter = filtered_country_pos;
+    }
+    
+    
+    ctx = geoip_new_context();
+    if (ctx == NULL) {
+        fputs("Unable to allocate conversion context.\n", stderr);
+        return 1;
+    }
+    
+    //before any threads are started or input files hashed, so they inherit the CPUs and I/O priority
+    if (arguments.polite) {
+        if (!geoip_set_polite(ctx, true, arguments.polite_rate * 1024 * 1024, arguments.polite_cpus)) {
+            fprintf(stderr, "Unable to set up polite mode: %s\n", geoip_error(ctx));
+            geoip_free_context(ctx);
+            return 6;
         }
         
-        num_filtered_countries = parse_country_code_list(arguments.filtered_countries, filtered_country_pos);
-        num_filtered_countries = set_filtered_countries(num_countries, countries, country_code_lookup, filtered_country_pos, arguments.forbid_filtered_countries);
-        
         if (arguments.verbose) {
-            printf("Filtered by %u countries.\n", num_filtered_countries);
+            printf("Polite mode: %g MiB/s, CPUs %s.\n", arguments.polite_rate, arguments.polite_cpus != NULL ? arguments.polite_cpus : "unchanged");
         }
     }
     
+    //addresses and prefix lengths are only counted for the report
+    geoip_set_report(ctx, arguments.report);
     
-    //process IPv4 range file
-    if (arguments.ipv4_file != NULL) {
-        if (arguments.verbose) {
-            printf("Processing IPv4 range file (%s)...\n", arguments.ipv4_file);
-        }
+    
+    //skip everything if the inputs and settings match those of the last conversion
+    //a report needs a conversion to gather its data
+    if (!arguments.force && !arguments.report) {
+        manifest = build_manifest(&arguments, filter);
+        unchanged = manifest != NULL && manifest_matches(&arguments, manifest);
+        free(manifest);
         
-        num_ipv4_ranges = process_range_file(arguments.ipv4_file, AF_INET, num_countries, countries, arguments.target_dir, &err_msg);
-        if (num_ipv4_ranges) {
+        if (unchanged) {
             if (arguments.verbose) {
-                printf("Processed %u IPv4 ranges.\n", num_ipv4_ranges);
+                printf("Input files, settings and output files unchanged since the last conversion.\n");
+            }
+            
+            if (!arguments.watch) {
+                geoip_free_context(ctx);
+                return EXIT_SUCCESS;
             }
-        }
-        else {
-            fprintf(stderr, "Unable to process IPv4 range file: %s\n", err_msg);
         }
     }
     
-    
-    //process IPv6 range file
-    if (arguments.ipv6_file != NULL) {
+    if (arguments.mode == MODE_COUNTRY) {
+        num_countries = load_countries(&arguments, ctx, filter);
+        if (!num_countries) {
+            geoip_free_context(ctx);
+            return 1;
+        }
+        
+        if (!load_overlays(&arguments, ctx) || !load_sources(&arguments, ctx) || !load_compaction(&arguments, ctx)) {
+            geoip_free_context(ctx);
+            return 4;
+        }
+    }
+    else if (arguments.mode == MODE_CITY) {
         if (arguments.verbose) {
-            printf("Processing IPv6 range file (%s)...\n", arguments.ipv6_file);
+            printf("Processing city file (%s)...\n", arguments.country_file);
         }
         
-        num_ipv6_ranges = process_range_file(arguments.ipv6_file, AF_INET6, num_countries, countries, arguments.target_dir, &err_msg);
-        if (num_ipv6_ranges) {
-            if (arguments.verbose) {
-                printf("Processed %u IPv6 ranges.\n", num_ipv6_ranges);
+        num_cities = geoip_read_city_file(ctx, arguments.country_file);
+        if (!num_cities) {
+            fprintf(stderr, "Unable to process city file: %s\n", geoip_error(ctx));
+            geoip_free_context(ctx);
+            return 1;
+        }
+        
+        if (arguments.verbose) {
+            printf("Read %u cities in %u subdivisions.\n", num_cities, geoip_num_subdivisions(ctx));
+        }
+    }
+    
+    
+    if (!unchanged) {
+        //process IPv4 range file
+        if (arguments.ipv4_file != NULL) {
+            num_ipv4_ranges = convert_range_file(&arguments, AF_INET, ctx);
+            if (!num_ipv4_ranges) {
+                failed_families |= WATCH_IPV4_FILE;
             }
         }
-        else {
-            fprintf(stderr, "Unable to process IPv6 range file: %s\n", err_msg);
+        
+        
+        //process IPv6 range file
+        if (arguments.ipv6_file != NULL) {
+            num_ipv6_ranges = convert_range_file(&arguments, AF_INET6, ctx);
+            if (!num_ipv6_ranges) {
+                failed_families |= WATCH_IPV6_FILE;
+            }
         }
+        
+        
+        update_manifest(&arguments, filter, !failed_families);
+    }
+    
+    if (arguments.watch) {
+        ret = watch_input_files(&arguments, ctx, filter, failed_families);
+        geoip_free_context(ctx);
+        return ret;
     }
     
+    geoip_free_context(ctx);
+    
     
     //return success if at least one of the range files had usable info
     if (num_ipv4_ranges || num_ipv6_ranges) {
@@ -1,22 +1,49 @@
 #ifndef MM2XTGEOIP_H
 #define MM2XTGEOIP_H
 
-#define MAX_LINE 256
-#define MAX_COLS 16
-#define COUNTRY_CODE_SIZE 2
-#define MAX_COUNTRIES UINT16_MAX
-#define PROXY_GEONAME_ID (ULONG_MAX - 3)
-#define SAT_GEONAME_ID (ULONG_MAX - 2)
-#define OTHER_GEONAME_ID (ULONG_MAX - 1)
-#define PROXY_COUNTRY_CODE "A1"
-#define SAT_COUNTRY_CODE "A2"
-#define OTHER_COUNTRY_CODE "O1"
 #define DEFAULT_COUNTRY_FILE_NAME "GeoLite2-Country-Locations-en.csv"
 #define DEFAULT_IPV4_RANGE_FILE_NAME "GeoLite2-Country-Blocks-IPv4.csv"
 #define DEFAULT_IPV6_RANGE_FILE_NAME "GeoLite2-Country-Blocks-IPv6.csv"
+#define DEFAULT_ASN_IPV4_RANGE_FILE_NAME "GeoLite2-ASN-Blocks-IPv4.csv"
+#define DEFAULT_ASN_IPV6_RANGE_FILE_NAME "GeoLite2-ASN-Blocks-IPv6.csv"
+#define DEFAULT_CITY_FILE_NAME "GeoLite2-City-Locations-en.csv"
+#define DEFAULT_CITY_IPV4_RANGE_FILE_NAME "GeoLite2-City-Blocks-IPv4.csv"
+#define DEFAULT_CITY_IPV6_RANGE_FILE_NAME "GeoLite2-City-Blocks-IPv6.csv"
+#define DEFAULT_BUNDLE_IPV4_FILE_NAME GEOIP_BUNDLE_FILE_NAME GEOIP_BUNDLE_IPV4_SUFFIX
+#define DEFAULT_BUNDLE_IPV6_FILE_NAME GEOIP_BUNDLE_FILE_NAME GEOIP_BUNDLE_IPV6_SUFFIX
 #define DEFAULT_OUTPUT_DIRECTORY "/usr/share/xt_geoip"
-#define IPV4_SUFFIX ".iv4"
-#define IPV6_SUFFIX ".iv6"
+#define MODE_COUNTRY 0
+#define MODE_ASN 1
+#define MODE_CITY 2
+#define MODE_UNPACK 3
+#define MODE_DIFF 4
+#define MODE_APPLY 5
+#define MODE_SIMULATE 6
+#define MAX_OUTPUTS GEOIP_NUM_FORMATS
+#define MANIFEST_FILE_NAME ".mm2xtgeoip_manifest"
+#define MANIFEST_TMP_SUFFIX ".tmp"
+#define MANIFEST_FIXED_SIZE 320
+#define MANIFEST_OVERLAY_SIZE 32
+#define MANIFEST_SOURCE_SIZE 48
+#define MANIFEST_OUTPUT_SIZE 16
+#define MANIFEST_FILE_LINE_SIZE 320
+#define MAX_OVERLAY_FILES 16
+#define MAX_SIM_RULES 64
+#define OUTPUT_FORMAT_VERSION 1
+#define DEFAULT_POLITE_RATE 32
+#define MAX_POLITE_RATE 1048576
+#define WATCH_DEBOUNCE_MS 2000
+#define WATCH_MAX_FILES (4 + 3 * MAX_OVERLAY_FILES)
+#define WATCH_EVENT_BUF_SIZE 4096
+#define WATCH_COUNTRY_FILE 1
+#define WATCH_IPV4_FILE 2
+#define WATCH_IPV6_FILE 4
+#define WATCH_SOURCE_FILES 8
+#define REPORT_U128_DIGITS 39
+#define REPORT_KERNEL_PAGE_SIZE 4096
+#define REPORT_KERNEL_COUNTRY_SIZE 64
+#define REPORT_KERNEL_SUBNET4_SIZE 8
+#define REPORT_KERNEL_SUBNET6_SIZE 32
 
 
 typedef struct Arguments {
@@ -27,27 +54,69 @@ typedef struct Arguments {
     char *ipv4_file;
     char *ipv6_file;
     char *target_dir;
+    int mode;
+    int output_format;
+    bool single_output;
+    GeoipOutput outputs[MAX_OUTPUTS];
+    unsigned num_outputs;
+    char *old_dir;
+    char *patch_file;
+    char *sample_file;
+    GeoipSimRule sim_rules[MAX_SIM_RULES];
+    unsigned num_sim_rules;
+    char *exclude_files[MAX_OVERLAY_FILES];
+    unsigned num_exclude_files;
+    char *include_files[MAX_OVERLAY_FILES];
+    char *include_codes[MAX_OVERLAY_FILES];
+    unsigned num_include_files;
+    char *delegated_files[MAX_OVERLAY_FILES];
+    int delegated_priorities[MAX_OVERLAY_FILES];
+    unsigned num_delegated_files;
+    bool compact;
+    char *unroutable_file;
+    unsigned max_ranges;
+    bool polite;
+    double polite_rate;
+    char *polite_cpus;
+    PoliteIo *polite_io;
+    bool force;
+    bool report;
+    bool watch;
     bool verbose;
 } Arguments;
 
-typedef struct Country {
-    unsigned long geoname_id;
-    char country_code[COUNTRY_CODE_SIZE + 1];
-    bool forbidden;
-} Country;
+typedef struct WatchedFile {
+    int wd;
+    char *base_name;
+    char *name_buf;
+    unsigned flag;
+} WatchedFile;
 
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
-inline bool str2bool(char *s);
-inline bool geoname_id_reserved(unsigned long geoname_id);
-inline Country *get_country(unsigned long geoname_id, bool proxy, bool sat, unsigned num_countries, Country *countries);
-inline uint16_t country_code_pos(char *country_code);
-void init_country_code_lookup(Country **country_code_lookup);
-unsigned read_country_file(char *country_file_name, Country *countries, Country **country_code_lookup, char **err_msg);
-unsigned add_virtual_countries(unsigned num_countries, Country *countries, Country **country_code_lookup);
-unsigned set_filtered_countries(unsigned num_countries, Country *countries, Country **country_code_lookup, uint16_t *country_positions, bool forbid);
-unsigned parse_country_code_list(char *country_codes, uint16_t *country_positions);
-unsigned process_range_file(char *range_file_name, int addr_family, unsigned num_countries, Country *countries, char *output_directory, char **err_msg);
+bool writes_format(Arguments *arguments, int format);
+int compare_country_codes(const void *code1, const void *code2);
+char *build_manifest(Arguments *arguments, uint16_t *filtered_country_pos);
+char *manifest_file_name(char *target_dir);
+bool write_output_files(Arguments *arguments, FILE *manifest_file);
+bool output_files_match(Arguments *arguments, FILE *manifest_file);
+bool manifest_matches(Arguments *arguments, char *manifest);
+bool update_manifest(Arguments *arguments, uint16_t *filtered_country_pos, bool output_complete);
+unsigned load_countries(Arguments *arguments, GeoipContext *ctx, uint16_t *filtered_country_pos);
+char *format_u128(uint64_t high, uint64_t low, char *buf);
+char *country_file_suffix(int format, int addr_family);
+void print_range_report(Arguments *arguments, GeoipContext *ctx, int addr_family);
+void print_compaction_report(GeoipContext *ctx, int addr_family);
+void print_route_report(GeoipContext *ctx, int addr_family);
+bool load_overlays(Arguments *arguments, GeoipContext *ctx);
+bool load_sources(Arguments *arguments, GeoipContext *ctx);
+bool load_compaction(Arguments *arguments, GeoipContext *ctx);
+unsigned convert_range_file(Arguments *arguments, int addr_family, GeoipContext *ctx);
+int convert_patch(Arguments *arguments);
+int simulate_rule_set(Arguments *arguments);
+bool add_input_watch(int inotify_fd, char *file_name, WatchedFile *watched_file, unsigned flag);
+bool reload_source_files(Arguments *arguments, GeoipContext *ctx);
+int watch_input_files(Arguments *arguments, GeoipContext *ctx, uint16_t *filtered_country_pos, unsigned failed_families);
 int main(int argc, char **argv);
 
 #endif
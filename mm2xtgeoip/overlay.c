@@ -0,0 +1,165 @@
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#include "cidr.h"
+#include "overlay.h"
+
+void init_overlay_set(OverlaySet *set, size_t addr_bytes) {
+    set->ranges = NULL;
+    set->num_ranges = 0;
+    set->capacity = 0;
+    set->addr_bytes = addr_bytes;
+    set->prepared = true;
+}
+
+bool add_overlay_range(OverlaySet *set, uint16_t country_pos, uint8_t *start, uint8_t *end) {
+    OverlayRange *ranges;
+    OverlayRange *range;
+    size_t capacity;
+    
+    if (set->num_ranges == set->capacity) {
+        capacity = set->capacity ? set->capacity * 2 : OVERLAY_MIN_CAPACITY;
+        ranges = realloc(set->ranges, capacity * sizeof(OverlayRange));
+        if (ranges == NULL) {
+            return false;
+        }
+        
+        set->ranges = ranges;
+        set->capacity = capacity;
+    }
+    
+    range = &set->ranges[set->num_ranges++];
+    memset(range, 0, sizeof(OverlayRange));
+    range->country_pos = country_pos;
+    memcpy(range->start, start, set->addr_bytes);
+    memcpy(range->end, end, set->addr_bytes);
+    
+    set->prepared = false;
+    
+    return true;
+}
+
+//unused address bytes are zeroed, so whole arrays can be compared regardless of family
+static int compare_overlay_ranges(const void *range1, const void *range2) {
+    const OverlayRange *r1 = range1;
+    const OverlayRange *r2 = range2;
+    
+    if (r1->country_pos != r2->country_pos) {
+        return r1->country_pos < r2->country_pos ? -1 : 1;
+    }
+    
+    return memcmp(r1->start, r2->start, IPV6_BYTES);
+}
+
+//gets the address after addr, returns false if addr is the last one
+bool next_addr(uint8_t *addr, uint8_t *next, size_t addr_bytes) {
+    size_t i = addr_bytes;
+    
+    memcpy(next, addr, addr_bytes);
+    
+    while (i--) {
+        if (++next[i]) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+//gets the address before addr, returns false if addr is the first one
+bool prev_addr(uint8_t *addr, uint8_t *prev, size_t addr_bytes) {
+    size_t i = addr_bytes;
+    
+    memcpy(prev, addr, addr_bytes);
+    
+    while (i--) {
+        if (prev[i]--) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+//sorts the ranges and merges those of the same country_pos that overlap or are contiguous
+void prepare_overlay_set(OverlaySet *set) {
+    OverlayRange *last = NULL;
+    OverlayRange *range;
+    uint8_t after_last[IPV6_BYTES];
+    size_t num_merged = 0;
+    size_t i;
+    
+    if (set->prepared) {
+        return;
+    }
+    
+    qsort(set->ranges, set->num_ranges, sizeof(OverlayRange), compare_overlay_ranges);
+    
+    for (i = 0; i < set->num_ranges; i++) {
+        range = &set->ranges[i];
+        
+        //a range ending at the last address swallows everything after it
+        if (last != NULL && range->country_pos == last->country_pos &&
+            (!next_addr(last->end, after_last, set->addr_bytes) ||
+             memcmp(range->start, after_last, set->addr_bytes) <= 0)) {
+            if (memcmp(range->end, last->end, set->addr_bytes) > 0) {
+                memcpy(last->end, range->end, set->addr_bytes);
+            }
+            continue;
+        }
+        
+        last = &set->ranges[num_merged++];
+        if (last != range) {
+            *last = *range;
+        }
+    }
+    
+    set->num_ranges = num_merged;
+    set->prepared = true;
+}
+
+//returns the position of the first range of country_pos, or num_ranges if there are none
+//the set must be prepared
+size_t find_overlay_ranges(OverlaySet *set, uint16_t country_pos) {
+    size_t start = 0;
+    size_t end = set->num_ranges;
+    size_t mid;
+    
+    while (start < end) {
+        mid = start + (end - start) / 2;
+        
+        if (set->ranges[mid].country_pos < country_pos) {
+            start = mid + 1;
+        }
+        else {
+            end = mid;
+        }
+    }
+    
+    if (start < set->num_ranges && set->ranges[start].country_pos == country_pos) {
+        return start;
+    }
+    
+    return set->num_ranges;
+}
+
+void free_overlay_set(OverlaySet *set) {
+    free(set->ranges);
+    set->ranges = NULL;
+    set->num_ranges = 0;
+    set->capacity = 0;
+    set->prepared = true;
+}
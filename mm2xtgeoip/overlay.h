@@ -0,0 +1,32 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#define OVERLAY_MIN_CAPACITY 256
+
+//an address range to be punched out of (country_pos 0) or added to (other country_pos) the output
+//addresses are big-endian, IPv4 addresses only use the first 4 bytes and leave the rest zeroed
+typedef struct OverlayRange {
+    uint16_t country_pos;
+    uint8_t start[IPV6_BYTES];
+    uint8_t end[IPV6_BYTES];
+} OverlayRange;
+
+//overlay ranges of one address family
+//once prepared, ranges are sorted by country_pos and start, and ranges of the same country_pos don't touch
+typedef struct OverlaySet {
+    OverlayRange *ranges;
+    size_t num_ranges;
+    size_t capacity;
+    size_t addr_bytes;
+    bool prepared;
+} OverlaySet;
+
+void init_overlay_set(OverlaySet *set, size_t addr_bytes);
+bool add_overlay_range(OverlaySet *set, uint16_t country_pos, uint8_t *start, uint8_t *end);
+void prepare_overlay_set(OverlaySet *set);
+size_t find_overlay_ranges(OverlaySet *set, uint16_t country_pos);
+bool next_addr(uint8_t *addr, uint8_t *next, size_t addr_bytes);
+bool prev_addr(uint8_t *addr, uint8_t *prev, size_t addr_bytes);
+void free_overlay_set(OverlaySet *set);
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef _STDIO_H
+#include <stdio.h>
+#endif
+
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#include "cidr.h"
+#include "hash.h"
+#include "bundle.h"
+#include "libmm2xtgeoip.h"
+#include "patch.h"
+
+void patch_put(PatchStream *stream, const void *data, size_t len) {
+    if (len && !fwrite(data, len, 1, stream->file)) {
+        stream->failed = true;
+    }
+    
+    hash_update(&stream->hash, data, len);
+}
+
+bool patch_get(PatchStream *stream, void *data, size_t len) {
+    if (len && !fread(data, len, 1, stream->file)) {
+        return false;
+    }
+    
+    hash_update(&stream->hash, data, len);
+    
+    return true;
+}
+
+void patch_put_varint(PatchStream *stream, unsigned __int128 value) {
+    uint8_t buf[BUNDLE_MAX_VARINT_SIZE];
+    
+    patch_put(stream, buf, encode_varint(value, buf));
+}
+
+//reads a varint a byte at a time, so that nothing after it is consumed
+bool patch_get_varint(PatchStream *stream, unsigned __int128 *value) {
+    uint8_t buf[BUNDLE_MAX_VARINT_SIZE];
+    size_t len = 0;
+    int c;
+    
+    do {
+        c = getc(stream->file);
+        if (c == EOF || len == BUNDLE_MAX_VARINT_SIZE) {
+            return false;
+        }
+        
+        buf[len++] = c;
+    } while (c & 0x80);
+    
+    hash_update(&stream->hash, buf, len);
+    
+    return decode_varint(buf, len, value) == len;
+}
+
+//loads a big-endian address
+static unsigned __int128 load_addr(const uint8_t *addr, size_t addr_bytes) {
+    unsigned __int128 value = 0;
+    size_t i;
+    
+    for (i = 0; i < addr_bytes; i++) {
+        value = (value << 8) | addr[i];
+    }
+    
+    return value;
+}
+
+//stores an address as big-endian bytes
+static void store_addr(uint8_t *out, unsigned __int128 value, size_t addr_bytes) {
+    size_t i;
+    
+    for (i = addr_bytes; i > 0; i--) {
+        out[i - 1] = value;
+        value >>= 8;
+    }
+}
+
+//writes an operation: ranges to copy from the old file, ranges to skip in it, then ranges to insert
+//inserted ranges are encoded like in bundles, against the end of the range written before them
+static void put_operation(PatchStream *stream, size_t num_kept, size_t num_deleted, uint8_t *inserted, size_t num_inserted,
+                          size_t addr_bytes, unsigned __int128 *next_start) {
+    unsigned __int128 start;
+    unsigned __int128 end;
+    size_t i;
+    
+    patch_put_varint(stream, num_kept);
+    patch_put_varint(stream, num_deleted);
+    patch_put_varint(stream, num_inserted);
+    
+    for (i = 0; i < num_inserted; i++) {
+        start = load_addr(inserted + i * 2 * addr_bytes, addr_bytes);
+        end = load_addr(inserted + i * 2 * addr_bytes + addr_bytes, addr_bytes);
+        
+        patch_put_varint(stream, start - *next_start);
+        patch_put_varint(stream, end - start);
+        *next_start = end + 1;
+    }
+}
+
+//merge-walks the ranges of 2 generations of a file, writing the operations that turn the old one into the new one
+//ranges equal in both are kept, all others are deleted from the old file or inserted from the new one
+//the result is always the new file, but the new ranges must be ascending and not overlap for the encoding to work
+bool diff_ranges(PatchStream *stream, uint8_t *old_ranges, size_t num_old, uint8_t *new_ranges, size_t num_new,
+                 size_t addr_bytes, GeoipPatchStats *stats) {
+    size_t range_size = 2 * addr_bytes;
+    size_t i = 0;
+    size_t j;
+    size_t num_kept = 0;
+    size_t num_deleted = 0;
+    size_t num_inserted = 0;
+    size_t first_inserted = 0;
+    unsigned __int128 next_start = 0;
+    int cmp;
+    
+    for (j = 0; j < num_new; j++) {
+        if (load_addr(new_ranges + j * range_size, addr_bytes) > load_addr(new_ranges + j * range_size + addr_bytes, addr_bytes) ||
+            (j && load_addr(new_ranges + j * range_size, addr_bytes) <= load_addr(new_ranges + j * range_size - addr_bytes, addr_bytes))) {
+            return false;
+        }
+    }
+    
+    j = 0;
+    while (i < num_old || j < num_new) {
+        if (i == num_old) {
+            cmp = 1;
+        }
+        else if (j == num_new) {
+            cmp = -1;
+        }
+        else {
+            //big-endian start and end, so comparing bytes orders by start, then end
+            cmp = memcmp(old_ranges + i * range_size, new_ranges + j * range_size, range_size);
+        }
+        
+        if (cmp < 0) {
+            num_deleted++;
+            i++;
+        }
+        else if (cmp > 0) {
+            if (!num_inserted) {
+                first_inserted = j;
+            }
+            
+            num_inserted++;
+            j++;
+        }
+        else {
+            if (num_deleted || num_inserted) {
+                put_operation(stream, num_kept, num_deleted, new_ranges + first_inserted * range_size, num_inserted, addr_bytes, &next_start);
+                stats->deleted_ranges += num_deleted;
+                stats->inserted_ranges += num_inserted;
+                num_kept = num_deleted = num_inserted = 0;
+            }
+            
+            num_kept++;
+            next_start = load_addr(new_ranges + j * range_size + addr_bytes, addr_bytes) + 1;
+            i++;
+            j++;
+        }
+    }
+    
+    if (num_deleted || num_inserted) {
+        put_operation(stream, num_kept, num_deleted, new_ranges + first_inserted * range_size, num_inserted, addr_bytes, &next_start);
+        stats->deleted_ranges += num_deleted;
+        stats->inserted_ranges += num_inserted;
+    }
+    
+    //an empty operation ends the list, and the rest of the old file is kept
+    put_operation(stream, 0, 0, NULL, 0, addr_bytes, &next_start);
+    
+    return !stream->failed;
+}
+
+//copies ranges from the old file to the new one, or skips them if new_file is NULL
+//count may be SIZE_MAX to go on until the end of the old file
+//last_end keeps the end address of the last range copied
+static bool copy_ranges(FILE *old_file, FILE *new_file, size_t count, size_t addr_bytes, uint8_t *buf,
+                        HashState *old_hash, HashState *new_hash, uint8_t *last_end) {
+    size_t range_size = 2 * addr_bytes;
+    size_t chunk;
+    size_t len;
+    
+    while (count) {
+        chunk = count < PATCH_COPY_RANGES ? count : PATCH_COPY_RANGES;
+        len = old_file != NULL ? fread(buf, range_size, chunk, old_file) : 0;
+        
+        if (len < chunk && count != SIZE_MAX) {
+            return false;
+        }
+        
+        if (!len) {
+            break;
+        }
+        
+        hash_update(old_hash, buf, len * range_size);
+        
+        if (new_file != NULL) {
+            if (fwrite(buf, range_size, len, new_file) != len) {
+                return false;
+            }
+            
+            hash_update(new_hash, buf, len * range_size);
+            memcpy(last_end, buf + len * range_size - addr_bytes, addr_bytes);
+        }
+        
+        if (count != SIZE_MAX) {
+            count -= len;
+        }
+    }
+    
+    return old_file == NULL || !ferror(old_file);
+}
+
+//writes the new generation of a file from the old one and the operations read from the patch
+//old_file is NULL for files the patch creates
+//old_hash and new_hash get every byte read and written, for the caller to check
+//returns NULL on success, or an error message
+char *apply_ranges(PatchStream *stream, FILE *old_file, FILE *new_file, size_t addr_bytes,
+                   HashState *old_hash, HashState *new_hash, GeoipPatchStats *stats) {
+    uint8_t buf[PATCH_COPY_RANGES * 2 * IPV6_BYTES];
+    uint8_t range[2 * IPV6_BYTES];
+    uint8_t last_end[IPV6_BYTES];
+    unsigned __int128 max_addr = addr_bytes == IPV6_BYTES ? ~(unsigned __int128)0 : UINT32_MAX;
+    unsigned __int128 num_kept;
+    unsigned __int128 num_deleted;
+    unsigned __int128 num_inserted;
+    unsigned __int128 next_start;
+    unsigned __int128 start;
+    unsigned __int128 size;
+    bool written = false;
+    bool full;
+    
+    while (true) {
+        if (!patch_get_varint(stream, &num_kept) || !patch_get_varint(stream, &num_deleted) ||
+            !patch_get_varint(stream, &num_inserted)) {
+            return "Patch is truncated or invalid.";
+        }
+        
+        if (!num_kept && !num_deleted && !num_inserted) {
+            break;
+        }
+        
+        //SIZE_MAX means the rest of the file to copy_ranges
+        if (num_kept >= SIZE_MAX || num_deleted >= SIZE_MAX) {
+            return "Patch is truncated or invalid.";
+        }
+        
+        if (!copy_ranges(old_file, new_file, num_kept, addr_bytes, buf, old_hash, new_hash, last_end) ||
+            !copy_ranges(old_file, NULL, num_deleted, addr_bytes, buf, old_hash, new_hash, last_end)) {
+            return "Patch doesn't match the files in the directory.";
+        }
+        written = written || num_kept;
+        
+        //no range can follow one that ends at the last address
+        next_start = written ? load_addr(last_end, addr_bytes) : 0;
+        full = written && next_start == max_addr;
+        next_start += written && !full;
+        
+        for (; num_inserted; num_inserted--) {
+            if (full) {
+                return "Patch is truncated or invalid.";
+            }
+            
+            if (!patch_get_varint(stream, &start) || !patch_get_varint(stream, &size) ||
+                start > max_addr - next_start || size > max_addr - (start + next_start)) {
+                return "Patch is truncated or invalid.";
+            }
+            start += next_start;
+            
+            store_addr(range, start, addr_bytes);
+            store_addr(range + addr_bytes, start + size, addr_bytes);
+            if (!fwrite(range, 2 * addr_bytes, 1, new_file)) {
+                return "Error writing ranges.";
+            }
+            
+            hash_update(new_hash, range, 2 * addr_bytes);
+            memcpy(last_end, range + addr_bytes, addr_bytes);
+            written = true;
+            full = start + size == max_addr;
+            next_start = start + size + 1;
+            stats->inserted_ranges++;
+        }
+        
+        stats->deleted_ranges += (unsigned)num_deleted;
+    }
+    
+    if (!copy_ranges(old_file, new_file, SIZE_MAX, addr_bytes, buf, old_hash, new_hash, last_end)) {
+        return "Patch doesn't match the files in the directory.";
+    }
+    
+    return NULL;
+}
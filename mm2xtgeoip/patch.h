@@ -0,0 +1,38 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+#define PATCH_HEADER_SIZE 16
+#define PATCH_MAX_NAME_SIZE 255
+#define PATCH_COPY_RANGES 4096
+#define PATCH_TMP_SUFFIX ".tmp"
+#define PATCH_MIN_FILES 64
+#define PATCH_END 0
+#define PATCH_MODIFY 1
+#define PATCH_CREATE 2
+#define PATCH_DELETE 3
+
+//a patch being written or read, with the hash of every byte so far
+//failed is set on the first write error, so writers only need to check it at the end
+typedef struct PatchStream {
+    FILE *file;
+    HashState hash;
+    bool failed;
+} PatchStream;
+
+//a file being patched, and where its new generation is written until the patch is verified
+//tmp_file_name is NULL for files the patch deletes
+typedef struct PatchedFile {
+    char *file_name;
+    char *tmp_file_name;
+} PatchedFile;
+
+void patch_put(PatchStream *stream, const void *data, size_t len);
+bool patch_get(PatchStream *stream, void *data, size_t len);
+void patch_put_varint(PatchStream *stream, unsigned __int128 value);
+bool patch_get_varint(PatchStream *stream, unsigned __int128 *value);
+bool diff_ranges(PatchStream *stream, uint8_t *old_ranges, size_t num_old, uint8_t *new_ranges, size_t num_new,
+                 size_t addr_bytes, GeoipPatchStats *stats);
+char *apply_ranges(PatchStream *stream, FILE *old_file, FILE *new_file, size_t addr_bytes,
+                   HashState *old_hash, HashState *new_hash, GeoipPatchStats *stats);
+
+#endif
@@ -0,0 +1,422 @@
+//fopencookie, sync_file_range and the CPU set macros are GNU extensions
+#define _GNU_SOURCE
+
+#ifndef _STDIO_H
+#include <stdio.h>
+#endif
+
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#ifndef _ERRNO_H
+#include <errno.h>
+#endif
+
+#ifndef _TIME_H
+#include <time.h>
+#endif
+
+#ifndef _PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifndef _SCHED_H
+#include <sched.h>
+#endif
+
+#ifndef _FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifndef _UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <sys/syscall.h>
+
+#include "polite.h"
+
+static void set_token_bucket(TokenBucket *bucket, double rate) {
+    pthread_mutex_lock(&bucket->lock);
+    bucket->rate = rate;
+    bucket->tokens = 0;
+    clock_gettime(CLOCK_MONOTONIC, &bucket->last);
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+//waits until count bytes may be read or written
+//at most POLITE_BURST_MS worth of unused tokens are kept, so idle time doesn't turn into a burst
+static void take_tokens(TokenBucket *bucket, size_t count) {
+    struct timespec now;
+    struct timespec wait;
+    double elapsed;
+    double max_tokens;
+    double debt;
+    
+    if (!bucket->rate) {
+        return;
+    }
+    
+    pthread_mutex_lock(&bucket->lock);
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - bucket->last.tv_sec) + (now.tv_nsec - bucket->last.tv_nsec) / 1e9;
+    bucket->last = now;
+    
+    max_tokens = bucket->rate * POLITE_BURST_MS / 1000;
+    bucket->tokens += elapsed * bucket->rate;
+    if (bucket->tokens > max_tokens) {
+        bucket->tokens = max_tokens;
+    }
+    
+    bucket->tokens -= count;
+    debt = bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+    
+    pthread_mutex_unlock(&bucket->lock);
+    
+    if (debt > 0) {
+        wait.tv_sec = debt;
+        wait.tv_nsec = (debt - wait.tv_sec) * 1e9;
+        while (nanosleep(&wait, &wait) != 0 && errno == EINTR);
+    }
+}
+
+//starts with no limits and no dropping
+void init_polite_io(PoliteIo *io) {
+    pthread_mutex_init(&io->reads.lock, NULL);
+    pthread_mutex_init(&io->writes.lock, NULL);
+    set_polite_io(io, false, 0);
+}
+
+//max_rate is in bytes per second for reads and for writes, 0 for no limit
+void set_polite_io(PoliteIo *io, bool drop_cache, double max_rate) {
+    io->drop_cache = drop_cache;
+    set_token_bucket(&io->reads, max_rate);
+    set_token_bucket(&io->writes, max_rate);
+}
+
+//polite_fopen only wraps files when this is true
+bool polite_io_active(PoliteIo *io) {
+    return io->drop_cache || io->reads.rate || io->writes.rate;
+}
+
+//drops the pages of a part of the file from the page cache
+//written pages are dirty and stay cached until written back, so wait for that first
+static void drop_pages(PoliteFile *file, off_t start, off_t len) {
+    if (file->writable) {
+        sync_file_range(file->fd, start, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    
+    posix_fadvise(file->fd, start, len, POSIX_FADV_DONTNEED);
+}
+
+//drops what was read or written since the last drop once it's POLITE_DROP_SIZE bytes or more
+static void drop_consumed(PoliteFile *file) {
+    if (file->io->drop_cache && file->pos - file->clean_pos >= POLITE_DROP_SIZE) {
+        drop_pages(file, file->clean_pos, file->pos - file->clean_pos);
+        file->clean_pos = file->pos;
+    }
+}
+
+static ssize_t polite_read(void *cookie, char *buf, size_t size) {
+    PoliteFile *file = cookie;
+    ssize_t len;
+    
+    take_tokens(&file->io->reads, size);
+    
+    do {
+        len = read(file->fd, buf, size);
+    } while (len < 0 && errno == EINTR);
+    
+    if (len > 0) {
+        file->pos += len;
+        drop_consumed(file);
+    }
+    
+    return len;
+}
+
+static ssize_t polite_write(void *cookie, const char *buf, size_t size) {
+    PoliteFile *file = cookie;
+    ssize_t len;
+    size_t written = 0;
+    
+    take_tokens(&file->io->writes, size);
+    
+    while (written < size) {
+        len = write(file->fd, buf + written, size - written);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            
+            return written ? (ssize_t)written : -1;
+        }
+        
+        written += len;
+    }
+    
+    file->pos += written;
+    drop_consumed(file);
+    
+    return written;
+}
+
+static int polite_seek(void *cookie, off64_t *offset, int whence) {
+    PoliteFile *file = cookie;
+    off_t pos;
+    
+    pos = lseek(file->fd, *offset, whence);
+    if (pos < 0) {
+        return -1;
+    }
+    
+    //pages rewritten after seeking back are dropped again on close
+    file->pos = pos;
+    if (file->clean_pos > pos) {
+        file->clean_pos = pos;
+    }
+    
+    *offset = pos;
+    
+    return 0;
+}
+
+static int polite_close(void *cookie) {
+    PoliteFile *file = cookie;
+    int ret;
+    
+    if (file->io->drop_cache) {
+        drop_pages(file, 0, 0);
+    }
+    
+    ret = close(file->fd);
+    free(file);
+    
+    return ret;
+}
+
+//opens a file like fopen, reading or writing it at the rate of io and dropping its pages from the page cache as it goes
+//mode is "r", "w" or "a", optionally followed by "b"; without limits or dropping, this is just fopen
+FILE *polite_fopen(PoliteIo *io, char *file_name, char *mode) {
+    cookie_io_functions_t functions = {polite_read, polite_write, polite_seek, polite_close};
+    PoliteFile *file;
+    FILE *stream;
+    int flags;
+    
+    if (!polite_io_active(io)) {
+        return fopen(file_name, mode);
+    }
+    
+    switch (mode[0]) {
+        case 'r':
+            flags = O_RDONLY;
+            break;
+        
+        case 'w':
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        
+        case 'a':
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        
+        default:
+            errno = EINVAL;
+            return NULL;
+    }
+    
+    file = malloc(sizeof(PoliteFile));
+    if (file == NULL) {
+        return NULL;
+    }
+    
+    file->fd = open(file_name, flags | O_CLOEXEC, 0666);
+    if (file->fd < 0) {
+        free(file);
+        return NULL;
+    }
+    
+    file->writable = mode[0] != 'r';
+    file->pos = mode[0] == 'a' ? lseek(file->fd, 0, SEEK_END) : 0;
+    file->clean_pos = file->pos;
+    file->io = io;
+    
+    if (!file->writable) {
+        posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    
+    stream = fopencookie(file, mode, functions);
+    if (stream == NULL) {
+        close(file->fd);
+        free(file);
+    }
+    
+    return stream;
+}
+
+void free_polite_io(PoliteIo *io) {
+    pthread_mutex_destroy(&io->reads.lock);
+    pthread_mutex_destroy(&io->writes.lock);
+}
+
+struct PoliteCpus {
+    cpu_set_t set;
+};
+
+//parses a comma-separated list of CPUs and CPU ranges, like 0,2-3
+static bool parse_cpu_list(char *cpu_list, cpu_set_t *cpus) {
+    char *pos = cpu_list;
+    char *end;
+    unsigned long first;
+    unsigned long last;
+    
+    CPU_ZERO(cpus);
+    
+    do {
+        first = strtoul(pos, &end, 10);
+        if (end == pos) {
+            return false;
+        }
+        
+        last = first;
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (end == pos || last < first) {
+                return false;
+            }
+        }
+        
+        if (last >= CPU_SETSIZE) {
+            return false;
+        }
+        
+        for (; first <= last; first++) {
+            CPU_SET(first, cpus);
+        }
+        
+        pos = end + 1;
+    } while (*end == ',');
+    
+    return *end == '\0';
+}
+
+//glibc has no wrappers for ioprio_get and ioprio_set, and who 0 is the calling thread
+static int get_io_priority(void) {
+    return syscall(SYS_ioprio_get, POLITE_IOPRIO_WHO_PROCESS, 0);
+}
+
+static bool set_io_priority(int io_priority) {
+    return syscall(SYS_ioprio_set, POLITE_IOPRIO_WHO_PROCESS, 0, io_priority) == 0;
+}
+
+//schedules the calling thread as sched says, saving what it had
+//returns an error message, or NULL if the thread took it all, otherwise it's left as it was
+static char *apply_polite_sched(PoliteSched *sched) {
+    if (sched->cpus != NULL) {
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &sched->saved_cpus->set) != 0 || sched_setaffinity(0, sizeof(cpu_set_t), &sched->cpus->set) != 0) {
+            return "Unable to pin to the CPUs.";
+        }
+    }
+    
+    if (sched->lower_io_priority) {
+        sched->saved_io_priority = get_io_priority();
+        if (sched->saved_io_priority < 0 || !set_io_priority((POLITE_IOPRIO_CLASS_BE << POLITE_IOPRIO_CLASS_SHIFT) | POLITE_IOPRIO_LOWEST)) {
+            if (sched->cpus != NULL) {
+                sched_setaffinity(0, sizeof(cpu_set_t), &sched->saved_cpus->set);
+            }
+            return "Unable to lower I/O priority.";
+        }
+    }
+    
+    return NULL;
+}
+
+static void restore_polite_sched(PoliteSched *sched) {
+    if (sched->cpus != NULL) {
+        sched_setaffinity(0, sizeof(cpu_set_t), &sched->saved_cpus->set);
+    }
+    
+    if (sched->lower_io_priority) {
+        set_io_priority(sched->saved_io_priority);
+    }
+}
+
+//starts with the threads left as they are
+void init_polite_sched(PoliteSched *sched) {
+    memset(sched, 0, sizeof(PoliteSched));
+}
+
+//sets how the threads are scheduled from the next enter_polite_sched on, cpu_list being NULL to leave the CPUs alone
+//the calling thread tries it once, so a CPU list or priority the system refuses is reported here
+//returns an error message, or NULL on success
+char *set_polite_sched(PoliteSched *sched, bool lower_io_priority, char *cpu_list) {
+    char *err_msg;
+    
+    free_polite_sched(sched);
+    
+    if (cpu_list != NULL) {
+        sched->cpus = malloc(sizeof(PoliteCpus));
+        sched->saved_cpus = malloc(sizeof(PoliteCpus));
+        if (sched->cpus == NULL || sched->saved_cpus == NULL) {
+            free_polite_sched(sched);
+            return "Error allocating buffers.";
+        }
+        
+        if (!parse_cpu_list(cpu_list, &sched->cpus->set)) {
+            free_polite_sched(sched);
+            return "Invalid CPU list.";
+        }
+    }
+    
+    sched->lower_io_priority = lower_io_priority;
+    
+    err_msg = apply_polite_sched(sched);
+    if (err_msg != NULL) {
+        free_polite_sched(sched);
+        return err_msg;
+    }
+    
+    restore_polite_sched(sched);
+    
+    return NULL;
+}
+
+//schedules the calling thread, and the threads it starts until leave_polite_sched, as set
+//it was checked by set_polite_sched, so if the system refuses it now, the thread just goes on as it was
+void enter_polite_sched(PoliteSched *sched) {
+    if (sched->depth++) {
+        return;
+    }
+    
+    sched->applied = (sched->cpus != NULL || sched->lower_io_priority) && apply_polite_sched(sched) == NULL;
+}
+
+//gives the calling thread back its own scheduling when the outermost enter_polite_sched is left
+void leave_polite_sched(PoliteSched *sched) {
+    if (--sched->depth) {
+        return;
+    }
+    
+    if (sched->applied) {
+        restore_polite_sched(sched);
+        sched->applied = false;
+    }
+}
+
+//leaves the threads as they are again
+void free_polite_sched(PoliteSched *sched) {
+    free(sched->cpus);
+    free(sched->saved_cpus);
+    init_polite_sched(sched);
+}
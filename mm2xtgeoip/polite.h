@@ -0,0 +1,64 @@
+#ifndef POLITE_H
+#define POLITE_H
+
+#define POLITE_DROP_SIZE (1024 * 1024)
+#define POLITE_BURST_MS 100
+#define POLITE_IOPRIO_WHO_PROCESS 1
+#define POLITE_IOPRIO_CLASS_BE 2
+#define POLITE_IOPRIO_LOWEST 7
+#define POLITE_IOPRIO_CLASS_SHIFT 13
+
+//bytes that may be read or written now, refilled at rate bytes per second
+//tokens go negative when a caller takes more than there are, and the next callers wait for the debt to be paid
+typedef struct TokenBucket {
+    pthread_mutex_t lock;
+    double rate;
+    double tokens;
+    struct timespec last;
+} TokenBucket;
+
+//how files are opened with polite_fopen
+//reads and writes have their own buckets, shared by every file and thread
+typedef struct PoliteIo {
+    bool drop_cache;
+    TokenBucket reads;
+    TokenBucket writes;
+} PoliteIo;
+
+//a cpu_set_t, which callers can't see without _GNU_SOURCE
+typedef struct PoliteCpus PoliteCpus;
+
+//how the threads doing a context's work are scheduled: pinned to cpus unless it's NULL, and at the lowest I/O priority if lower_io_priority
+//it only applies between enter_polite_sched and leave_polite_sched, to the calling thread and the threads it starts meanwhile,
+//the calling thread getting back saved_cpus and saved_io_priority when the outermost of nested calls leaves
+typedef struct PoliteSched {
+    PoliteCpus *cpus;
+    bool lower_io_priority;
+    unsigned depth;
+    bool applied;
+    PoliteCpus *saved_cpus;
+    int saved_io_priority;
+} PoliteSched;
+
+//a file opened with polite_fopen
+//pages before clean_pos have already been dropped from the page cache
+typedef struct PoliteFile {
+    int fd;
+    bool writable;
+    off_t pos;
+    off_t clean_pos;
+    PoliteIo *io;
+} PoliteFile;
+
+void init_polite_io(PoliteIo *io);
+void set_polite_io(PoliteIo *io, bool drop_cache, double max_rate);
+bool polite_io_active(PoliteIo *io);
+FILE *polite_fopen(PoliteIo *io, char *file_name, char *mode);
+void free_polite_io(PoliteIo *io);
+void init_polite_sched(PoliteSched *sched);
+char *set_polite_sched(PoliteSched *sched, bool lower_io_priority, char *cpu_list);
+void enter_polite_sched(PoliteSched *sched);
+void leave_polite_sched(PoliteSched *sched);
+void free_polite_sched(PoliteSched *sched);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+//USDT probes for tracing conversions live, e.g. with bpftrace -e 'usdt:./mm2xtgeoip:mm2xtgeoip:range_file_open { ... }'
+//they're only compiled in with USDT_PROBES defined (make USDT=1), which needs sys/sdt.h from systemtap-sdt-dev
+//compiled-in probes are a single nop until attached; otherwise they expand to nothing and their arguments aren't evaluated
+#define PROBE_ROWS_INTERVAL 65536
+
+#ifdef USDT_PROBES
+#include <sys/sdt.h>
+
+#define PROBE1(name, arg1) DTRACE_PROBE1(mm2xtgeoip, name, arg1)
+#define PROBE2(name, arg1, arg2) DTRACE_PROBE2(mm2xtgeoip, name, arg1, arg2)
+#define PROBE3(name, arg1, arg2, arg3) DTRACE_PROBE3(mm2xtgeoip, name, arg1, arg2, arg3)
+
+//fires every PROBE_ROWS_INTERVAL rows rather than on every row
+#define PROBE_ROWS(num_rows, num_ranges, addr_family) do { \
+    if ((num_rows) % PROBE_ROWS_INTERVAL == 0) { \
+        DTRACE_PROBE3(mm2xtgeoip, rows, num_rows, num_ranges, addr_family); \
+    } \
+} while (0)
+#else
+#define PROBE1(name, arg1) do {} while (0)
+#define PROBE2(name, arg1, arg2) do {} while (0)
+#define PROBE3(name, arg1, arg2, arg3) do {} while (0)
+#define PROBE_ROWS(num_rows, num_ranges, addr_family) do {} while (0)
+#endif
+
+#endif
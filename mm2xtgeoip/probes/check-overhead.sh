@@ -0,0 +1,81 @@
+#!/bin/sh
+
+# Checks that the USDT probes cost nothing while no tracer is attached.
+# Builds mm2xtgeoip with and without probes from a copy of the sources,
+# checks that every probe made it into the probe build, then times both
+# builds converting the GeoLite2 files in DATA_DIR, alternating between
+# them, and compares the fastest run of each.
+#
+# Without sys/sdt.h, the check is skipped.
+#
+# Usage: check-overhead.sh [DATA_DIR [RUNS [MAX_OVERHEAD_PERCENT]]]
+#     Default: tests/fixtures
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to build or convert
+#     2 - Probes missing from the probe build
+#     3 - Overhead above MAX_OVERHEAD_PERCENT (default 2)
+
+PROBES="country_file_open country_header country_file_close range_file_open range_header rows
+        unknown_country range_merge output_flush_start output_flush_done range_file_close"
+
+SRC_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+DATA_DIR="${1:-$SRC_DIR/tests/fixtures}"
+RUNS="${2:-10}"
+MAX_OVERHEAD="${3:-2}"
+
+DATA_DIR="$(cd "$DATA_DIR" && pwd)" || exit 1
+
+if ! echo '#include <sys/sdt.h>' | cc -E - > /dev/null 2>&1; then
+    echo "Probe overhead check skipped: sys/sdt.h not found."
+    exit 0
+fi
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+for build in plain usdt; do
+    mkdir "$WORK_DIR/$build" "$WORK_DIR/$build-out" || exit 1
+    cp "$SRC_DIR"/*.c "$SRC_DIR"/*.h "$SRC_DIR"/Makefile "$WORK_DIR/$build" || exit 1
+done
+
+make -s -C "$WORK_DIR/plain" mm2xtgeoip || exit 1
+make -s -C "$WORK_DIR/usdt" USDT=1 mm2xtgeoip || exit 1
+
+# every probe leaves a note in the binary, with the provider and probe names
+notes="$(readelf -n "$WORK_DIR/usdt/mm2xtgeoip")" || exit 1
+for probe in $PROBES; do
+    if ! echo "$notes" | grep -q "Name: $probe\$"; then
+        echo "Probe $probe is missing from the probe build." >&2
+        exit 2
+    fi
+done
+
+# prints the elapsed time of one conversion in microseconds
+time_run() {
+    start=$(date +%s%N)
+    (cd "$DATA_DIR" && "$WORK_DIR/$1/mm2xtgeoip" -F -d "$WORK_DIR/$1-out") || return 1
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000 ))
+}
+
+best_plain=""
+best_usdt=""
+i=0
+while [ $i -lt "$RUNS" ]; do
+    for build in plain usdt; do
+        elapsed=$(time_run $build) || exit 1
+        eval "best=\$best_$build"
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            eval "best_$build=$elapsed"
+        fi
+    done
+    i=$((i + 1))
+done
+
+overhead=$(awk "BEGIN { printf \"%.2f\", ($best_usdt - $best_plain) * 100 / $best_plain }")
+echo "without probes: ${best_plain}us, with probes: ${best_usdt}us, overhead: ${overhead}%"
+
+awk "BEGIN { exit !($overhead > $MAX_OVERHEAD) }" && exit 3
+exit 0
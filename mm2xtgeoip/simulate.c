@@ -0,0 +1,142 @@
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#include "simulate.h"
+
+//copies the contents of an xt_geoip file into a page-aligned array, as the kernel module loads it
+bool load_sim_subnets(SimSubnets *subnets, const uint8_t *data, size_t size, size_t addr_bytes) {
+    void *copy;
+    
+    if (size % (2 * addr_bytes) != 0) {
+        return false;
+    }
+    
+    //an empty country still gets an allocation, which also marks it as loaded
+    if (posix_memalign(&copy, SIM_PAGE_SIZE, size ? size : 1) != 0) {
+        return false;
+    }
+    
+    memcpy(copy, data, size);
+    subnets->data = copy;
+    subnets->num_subnets = size / (2 * addr_bytes);
+    subnets->addr_bytes = addr_bytes;
+    
+    return true;
+}
+
+//resets the cost counters for the next packet
+void begin_sim_packet(SimCost *cost) {
+    cost->comparisons = 0;
+    cost->probes = 0;
+    cost->cache_lines = 0;
+    cost->num_slots_used = 0;
+    
+    //generation 0 marks slots that were never used, so the set is really emptied when it wraps
+    if (++cost->generation == 0) {
+        memset(cost->generations, 0, sizeof(cost->generations));
+        cost->generation = 1;
+    }
+}
+
+//counts the cache line holding a subnet, unless the packet already touched it
+static void touch_line(SimCost *cost, const uint8_t *subnet) {
+    uintptr_t line = (uintptr_t)subnet / SIM_CACHE_LINE_SIZE;
+    size_t slot;
+    
+    if (cost->num_slots_used >= SIM_LINE_SLOTS / 2) {
+        cost->cache_lines++;
+        return;
+    }
+    
+    for (slot = (line * 0x9E3779B97F4A7C15ULL) % SIM_LINE_SLOTS; cost->generations[slot] == cost->generation;
+         slot = (slot + 1) % SIM_LINE_SLOTS) {
+        if (cost->lines[slot] == line) {
+            return;
+        }
+    }
+    
+    cost->generations[slot] = cost->generation;
+    cost->lines[slot] = line;
+    cost->num_slots_used++;
+    cost->cache_lines++;
+}
+
+//looks an address up the way xt_geoip does: a binary search over the subnets,
+//checking the start of the middle one, then its end only if the address isn't below the start
+//subnets are aligned to their size, so each one sits in a single cache line
+bool sim_lookup(SimSubnets *subnets, const uint8_t *addr, SimCost *cost) {
+    size_t addr_bytes = subnets->addr_bytes;
+    size_t lo = 0;
+    size_t hi = subnets->num_subnets;
+    size_t mid;
+    const uint8_t *subnet;
+    
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        subnet = subnets->data + mid * 2 * addr_bytes;
+        
+        cost->probes++;
+        touch_line(cost, subnet);
+        
+        cost->comparisons++;
+        if (memcmp(addr, subnet, addr_bytes) < 0) {
+            hi = mid;
+            continue;
+        }
+        
+        cost->comparisons++;
+        if (memcmp(addr, subnet + addr_bytes, addr_bytes) <= 0) {
+            return true;
+        }
+        
+        lo = mid + 1;
+    }
+    
+    return false;
+}
+
+static int compare_sim_points(const void *point1, const void *point2) {
+    unsigned value1 = ((const SimPoint *)point1)->value;
+    unsigned value2 = ((const SimPoint *)point2)->value;
+    
+    return (value1 > value2) - (value1 < value2);
+}
+
+void sort_sim_points(SimPoint *points, size_t num_points) {
+    qsort(points, num_points, sizeof(SimPoint), compare_sim_points);
+}
+
+//returns the smallest value that at least fraction of the total weight doesn't exceed
+//points must be sorted
+unsigned sim_percentile(SimPoint *points, size_t num_points, double total_weight, double fraction) {
+    double weight = 0;
+    size_t i;
+    
+    for (i = 0; i < num_points; i++) {
+        weight += points[i].weight;
+        if (weight >= fraction * total_weight) {
+            return points[i].value;
+        }
+    }
+    
+    return num_points ? points[num_points - 1].value : 0;
+}
+
+void free_sim_subnets(SimSubnets *subnets) {
+    free(subnets->data);
+    subnets->data = NULL;
+    subnets->num_subnets = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#define SIM_CACHE_LINE_SIZE 64
+#define SIM_PAGE_SIZE 4096
+#define SIM_LINE_SLOTS 4096
+#define SIM_MIN_POINTS 65536
+
+//a country's ranges of one address family, laid out as xt_geoip holds them in the kernel:
+//start and end address pairs sorted by start, in a page-aligned allocation
+typedef struct SimSubnets {
+    uint8_t *data;
+    size_t num_subnets;
+    size_t addr_bytes;
+} SimSubnets;
+
+//what the lookups for one packet cost
+//cache lines are counted once per packet, using a hash set of the lines touched that's emptied by bumping generation
+//once the set is half full, further lines are counted without being remembered
+typedef struct SimCost {
+    unsigned comparisons;
+    unsigned probes;
+    unsigned cache_lines;
+    unsigned generation;
+    unsigned num_slots_used;
+    uintptr_t lines[SIM_LINE_SLOTS];
+    unsigned generations[SIM_LINE_SLOTS];
+} SimCost;
+
+//a packet's cost and weight, for weighted percentiles
+typedef struct SimPoint {
+    unsigned value;
+    double weight;
+} SimPoint;
+
+bool load_sim_subnets(SimSubnets *subnets, const uint8_t *data, size_t size, size_t addr_bytes);
+void begin_sim_packet(SimCost *cost);
+bool sim_lookup(SimSubnets *subnets, const uint8_t *addr, SimCost *cost);
+void sort_sim_points(SimPoint *points, size_t num_points);
+unsigned sim_percentile(SimPoint *points, size_t num_points, double total_weight, double fraction);
+void free_sim_subnets(SimSubnets *subnets);
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef _STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef __bool_true_false_are_defined
+#include <stdbool.h>
+#endif
+
+#ifndef _STRING_H
+#include <string.h>
+#endif
+
+#include "cidr.h"
+#include "sweep.h"
+
+void init_sweep_set(SweepSet *set, size_t addr_bytes) {
+    set->intervals = NULL;
+    set->num_intervals = 0;
+    set->capacity = 0;
+    set->addr_bytes = addr_bytes;
+}
+
+//makes room for num_intervals more intervals
+static bool reserve_sweep_intervals(SweepSet *set, size_t num_intervals) {
+    SweepInterval *intervals;
+    size_t capacity = set->capacity ? set->capacity : SWEEP_MIN_CAPACITY;
+    
+    if (set->num_intervals + num_intervals <= set->capacity) {
+        return true;
+    }
+    
+    while (capacity < set->num_intervals + num_intervals) {
+        capacity *= 2;
+    }
+    
+    intervals = realloc(set->intervals, capacity * sizeof(SweepInterval));
+    if (intervals == NULL) {
+        return false;
+    }
+    
+    set->intervals = intervals;
+    set->capacity = capacity;
+    
+    return true;
+}
+
+static unsigned __int128 addr_to_int(uint8_t *addr, size_t addr_bytes) {
+    unsigned __int128 value = 0;
+    size_t i;
+    
+    for (i = 0; i < addr_bytes; i++) {
+        value = value << 8 | addr[i];
+    }
+    
+    return value;
+}
+
+static void int_to_addr(unsigned __int128 value, uint8_t *addr, size_t addr_bytes) {
+    size_t i;
+    
+    for (i = addr_bytes; i--; value >>= 8) {
+        addr[i] = (uint8_t)value;
+    }
+}
+
+//adds the interval from start to end, which must not be before start
+bool add_sweep_interval(SweepSet *set, uint16_t source, int priority, uint16_t country_pos, uint8_t *start, uint8_t *end) {
+    SweepInterval *interval;
+    
+    if (!reserve_sweep_intervals(set, 1)) {
+        return false;
+    }
+    
+    interval = &set->intervals[set->num_intervals++];
+    interval->start = addr_to_int(start, set->addr_bytes);
+    interval->end = addr_to_int(end, set->addr_bytes);
+    interval->priority = priority;
+    interval->source = source;
+    interval->country_pos = country_pos;
+    
+    return true;
+}
+
+//adds all intervals of another set of the same address family
+bool add_sweep_set(SweepSet *set, SweepSet *other) {
+    if (!reserve_sweep_intervals(set, other->num_intervals)) {
+        return false;
+    }
+    
+    if (other->num_intervals) {
+        memcpy(set->intervals + set->num_intervals, other->intervals, other->num_intervals * sizeof(SweepInterval));
+        set->num_intervals += other->num_intervals;
+    }
+    
+    return true;
+}
+
+static int compare_sweep_starts(const void *interval1, const void *interval2) {
+    const SweepInterval *i1 = interval1;
+    const SweepInterval *i2 = interval2;
+    
+    return (i1->start > i2->start) - (i1->start < i2->start);
+}
+
+//tells whether interval1 wins the addresses it shares with interval2
+static inline bool outranks(SweepInterval *interval1, SweepInterval *interval2) {
+    if (interval1->priority != interval2->priority) {
+        return interval1->priority > interval2->priority;
+    }
+    
+    if (interval1->source != interval2->source) {
+        return interval1->source < interval2->source;
+    }
+    
+    if (interval1->start != interval2->start) {
+        return interval1->start > interval2->start;
+    }
+    
+    if (interval1->end != interval2->end) {
+        return interval1->end < interval2->end;
+    }
+    
+    return interval1->country_pos < interval2->country_pos;
+}
+
+//the heap holds the positions of the intervals covering the sweep's position, with the winner on top
+static void push_interval(SweepInterval *intervals, size_t *heap, size_t *heap_size, size_t pos) {
+    size_t child = (*heap_size)++;
+    size_t parent;
+    
+    while (child) {
+        parent = (child - 1) / 2;
+        if (!outranks(&intervals[pos], &intervals[heap[parent]])) {
+            break;
+        }
+        
+        heap[child] = heap[parent];
+        child = parent;
+    }
+    
+    heap[child] = pos;
+}
+
+static void pop_interval(SweepInterval *intervals, size_t *heap, size_t *heap_size) {
+    size_t last = heap[--(*heap_size)];
+    size_t parent = 0;
+    size_t child;
+    
+    for (child = 1; child < *heap_size; child = 2 * parent + 1) {
+        if (child + 1 < *heap_size && outranks(&intervals[heap[child + 1]], &intervals[heap[child]])) {
+            child++;
+        }
+        
+        if (!outranks(&intervals[heap[child]], &intervals[last])) {
+            break;
+        }
+        
+        heap[parent] = heap[child];
+        parent = child;
+    }
+    
+    heap[parent] = last;
+}
+
+//sweeps over the intervals in order of their start, keeping those covering the current position in a heap
+//the position only stops where an interval starts or the winning one ends, so each interval is pushed and popped once
+//and the set is resolved in O(n log n), handing each piece of the address space claimed by any source to callback
+//the intervals are left sorted by start
+//returns false if out of memory or if callback fails
+bool sweep_intervals(SweepSet *set, SweepCallback callback, void *user_data) {
+    SweepInterval *intervals = set->intervals;
+    SweepInterval *winner;
+    size_t num_intervals = set->num_intervals;
+    size_t *heap;
+    size_t heap_size = 0;
+    size_t next = 0;
+    unsigned __int128 last_addr = set->addr_bytes == IPV6_BYTES ? ~(unsigned __int128)0 : UINT32_MAX;
+    unsigned __int128 pos = 0;
+    unsigned __int128 end;
+    uint8_t start_addr[IPV6_BYTES];
+    uint8_t end_addr[IPV6_BYTES];
+    bool ok = true;
+    
+    if (!num_intervals) {
+        return true;
+    }
+    
+    heap = malloc(num_intervals * sizeof(size_t));
+    if (heap == NULL) {
+        return false;
+    }
+    
+    qsort(intervals, num_intervals, sizeof(SweepInterval), compare_sweep_starts);
+    
+    while (next < num_intervals || heap_size) {
+        if (!heap_size) {
+            //nothing claims the addresses before the next interval
+            pos = intervals[next].start;
+        }
+        
+        for (; next < num_intervals && intervals[next].start <= pos; next++) {
+            push_interval(intervals, heap, &heap_size, next);
+        }
+        
+        //intervals that have ended are only dropped once they come out on top
+        while (heap_size && intervals[heap[0]].end < pos) {
+            pop_interval(intervals, heap, &heap_size);
+        }
+        
+        if (!heap_size) {
+            continue;
+        }
+        
+        //the winner keeps the addresses until it ends or the next interval starts, which may outrank it
+        winner = &intervals[heap[0]];
+        end = winner->end;
+        if (next < num_intervals && intervals[next].start <= end) {
+            end = intervals[next].start - 1;
+        }
+        
+        int_to_addr(pos, start_addr, set->addr_bytes);
+        int_to_addr(end, end_addr, set->addr_bytes);
+        if (!callback(user_data, winner->country_pos, start_addr, end_addr)) {
+            ok = false;
+            break;
+        }
+        
+        if (end == last_addr) {
+            break;
+        }
+        
+        pos = end + 1;
+    }
+    
+    free(heap);
+    
+    return ok;
+}
+
+void free_sweep_set(SweepSet *set) {
+    free(set->intervals);
+    set->intervals = NULL;
+    set->num_intervals = 0;
+    set->capacity = 0;
+}
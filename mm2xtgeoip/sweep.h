@@ -0,0 +1,34 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#define SWEEP_MIN_CAPACITY 4096
+
+//an address range claimed for a country by one of several sources, as integers
+//where intervals overlap, the one with the highest priority wins, then the one of the lowest source,
+//then the one starting last, so ranges nested in a source win over those around them
+typedef struct SweepInterval {
+    unsigned __int128 start;
+    unsigned __int128 end;
+    int priority;
+    uint16_t source;
+    uint16_t country_pos;
+} SweepInterval;
+
+//the intervals of all sources for one address family
+typedef struct SweepSet {
+    SweepInterval *intervals;
+    size_t num_intervals;
+    size_t capacity;
+    size_t addr_bytes;
+} SweepSet;
+
+//receives the resolved address space in order, as disjoint ranges, each with the country that won it
+typedef bool (*SweepCallback)(void *user_data, uint16_t country_pos, uint8_t *start, uint8_t *end);
+
+void init_sweep_set(SweepSet *set, size_t addr_bytes);
+bool add_sweep_interval(SweepSet *set, uint16_t source, int priority, uint16_t country_pos, uint8_t *start, uint8_t *end);
+bool add_sweep_set(SweepSet *set, SweepSet *other);
+bool sweep_intervals(SweepSet *set, SweepCallback callback, void *user_data);
+void free_sweep_set(SweepSet *set);
+
+#endif
@@ -0,0 +1,79 @@
+#!/bin/sh
+
+# Checks that -a and -f write the same files for the countries they keep
+# as a conversion without them. Rows of forbidden countries are skipped
+# before they're fully decoded, so the lists cover the countries reached
+# through fallbacks in the fixtures: BB through an empty geoname_id, A1
+# and A2 through the proxy and satellite flags and O1 through an unknown
+# geoname_id.
+#
+# Usage: check-allowed.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The files written don't match those of the full conversion
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/full" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -d "$WORK_DIR/full") || exit 1
+
+# converts with a filter option and its countries, and compares the files with those of the full conversion
+# the files of the countries expected to be kept are listed on stdin
+check_filter() {
+    name="$(echo "$1$2" | tr -d ',-')"
+    
+    mkdir "$WORK_DIR/$name" || exit 1
+    (cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F "$1" "$2" -d "$WORK_DIR/$name") || exit 1
+    
+    cat > "$WORK_DIR/$name.expected"
+    (cd "$WORK_DIR/$name" && ls [A-Z]*) > "$WORK_DIR/$name.files"
+    if ! diff -u "$WORK_DIR/$name.expected" "$WORK_DIR/$name.files"; then
+        echo "$1 $2 didn't write the files of the countries it keeps." >&2
+        exit 2
+    fi
+    
+    for file in $(cat "$WORK_DIR/$name.files"); do
+        if ! cmp "$WORK_DIR/full/$file" "$WORK_DIR/$name/$file"; then
+            echo "$file differs from the full conversion with $1 $2." >&2
+            exit 2
+        fi
+    done
+}
+
+check_filter -a AA,O1 <<'FILES_EOF'
+AA.iv4
+AA.iv6
+O1.iv4
+O1.iv6
+FILES_EOF
+
+check_filter -a BB,A1,A2 <<'FILES_EOF'
+A1.iv4
+A1.iv6
+A2.iv4
+A2.iv6
+BB.iv4
+BB.iv6
+FILES_EOF
+
+check_filter -f AA,O1 <<'FILES_EOF'
+A1.iv4
+A1.iv6
+A2.iv4
+A2.iv6
+AF.iv4
+AF.iv6
+BB.iv4
+BB.iv6
+CC.iv4
+CC.iv6
+FILES_EOF
+
+echo "Country filtering OK: kept countries match the full conversion."
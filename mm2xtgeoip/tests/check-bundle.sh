@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Checks that bundles round-trip. The fixtures are converted to xt_geoip
+# and to bundle output, and unpacking the bundles with -U must write the
+# same xt_geoip files. Unpacking bundles with a corrupted byte, or ones
+# that are cut short, must fail and leave the xt_geoip files of the
+# directory they would have been unpacked to as they were.
+#
+# Usage: check-bundle.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or unpack
+#     2 - The unpacked files differ, or a bad bundle was unpacked
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/xt" "$WORK_DIR/bundle" "$WORK_DIR/unpack" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -d "$WORK_DIR/xt" && "$MM2XTGEOIP" -F -o bundle -d "$WORK_DIR/bundle") > /dev/null || exit 1
+(cd "$WORK_DIR/bundle" && "$MM2XTGEOIP" -F -U -d "$WORK_DIR/unpack") || exit 1
+
+# compares the country files of two directories, leaving out the manifest,
+# which records how they were written and is removed when a conversion fails
+same_files() {
+    (cd "$1" && ls [A-Z]*) > "$WORK_DIR/files1"
+    (cd "$2" && ls [A-Z]*) > "$WORK_DIR/files2"
+    cmp -s "$WORK_DIR/files1" "$WORK_DIR/files2" || return 1
+    
+    for file in $(cat "$WORK_DIR/files1"); do
+        cmp -s "$1/$file" "$2/$file" || return 1
+    done
+}
+
+if ! same_files "$WORK_DIR/xt" "$WORK_DIR/unpack"; then
+    echo "The bundles didn't unpack into the files of the conversion." >&2
+    exit 2
+fi
+
+cp -rp "$WORK_DIR/unpack" "$WORK_DIR/unpack.before" || exit 1
+
+# checks that bad bundles of both families are rejected without touching the unpacked files
+# a good bundle of either family would be unpacked, since a conversion succeeds if either family does
+check_rejected() {
+    if "$MM2XTGEOIP" -F -U -4"$WORK_DIR/bad.bundle4" -6"$WORK_DIR/bad.bundle6" -d "$WORK_DIR/unpack" > /dev/null 2>&1; then
+        echo "A bundle $1 was unpacked." >&2
+        exit 2
+    fi
+    
+    if ! same_files "$WORK_DIR/unpack.before" "$WORK_DIR/unpack"; then
+        echo "A bundle $1 changed the directory it was unpacked to." >&2
+        exit 2
+    fi
+}
+
+# the last byte is in the ranges of the last country, so only its checksum catches it
+for family in 4 6; do
+    size="$(wc -c < "$WORK_DIR/bundle/geoip.bundle$family")"
+    cp "$WORK_DIR/bundle/geoip.bundle$family" "$WORK_DIR/bad.bundle$family" || exit 1
+    last_byte="$(od -An -tu1 -j $((size - 1)) "$WORK_DIR/bad.bundle$family" | tr -d ' ')"
+    printf "\\$(printf '%03o' $(((last_byte + 1) % 256)))" | dd of="$WORK_DIR/bad.bundle$family" bs=1 seek=$((size - 1)) conv=notrunc 2> /dev/null || exit 1
+    cmp -s "$WORK_DIR/bundle/geoip.bundle$family" "$WORK_DIR/bad.bundle$family" && exit 1
+done
+check_rejected "with a corrupted byte"
+
+for family in 4 6; do
+    size="$(wc -c < "$WORK_DIR/bundle/geoip.bundle$family")"
+    head -c $((size / 2)) "$WORK_DIR/bundle/geoip.bundle$family" > "$WORK_DIR/bad.bundle$family" || exit 1
+done
+check_rejected "cut short"
+
+echo "Bundle OK: unpacked into the files of the conversion, bad bundles rejected."
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+# Checks -C against the City fixtures in tests/fixtures/city: rows of
+# cities in the same subdivision merge, and rows of locations without a
+# subdivision, with an empty or unknown geoname_id, or with codes that
+# would make file names outside the output directory, like ".." and "/..",
+# are skipped. Then files of their own, with more subdivisions than file
+# descriptors, are converted under a low ulimit -n and must give the same
+# files as without it.
+#
+# Usage: check-city.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The ranges written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures/city"
+
+NUM_SUBDIVISIONS=600
+MAX_OPEN_FILES=16
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the ranges of every non-empty xt_geoip file in a directory, one line per file
+dump_ranges() {
+    for file in "$1"/*.iv4; do
+        [ -s "$file" ] || continue
+        od -An -tu1 -w8 -v "$file" | awk -v name="${file##*/}" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print name ranges }'
+    done
+    
+    for file in "$1"/*.iv6; do
+        [ -s "$file" ] || continue
+        od -An -tx1 -w32 -v "$file" | tr -d ' ' | awk -v name="${file##*/}" '
+            { ranges = ranges " " substr($0, 1, 32) "-" substr($0, 33, 32) }
+            END { print name ranges }'
+    done
+}
+
+mkdir "$WORK_DIR/out" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -C -d "$WORK_DIR/out") || exit 1
+
+dump_ranges "$WORK_DIR/out" > "$WORK_DIR/ranges"
+cat > "$WORK_DIR/expected" <<'RANGES_EOF'
+GB-ENG.iv4 1.0.9.0-1.0.9.255
+PT-11.iv4 1.0.0.0-1.0.1.255 1.0.3.0-1.0.3.255
+PT-13.iv4 1.0.2.0-1.0.2.255
+US-CA.iv4 1.0.4.0-1.0.4.255
+PT-13.iv6 20010db8000000000000000000000000-20010db8ffffffffffffffffffffffff
+US-CA.iv6 20010db9000000000000000000000000-20010db9ffffffffffffffffffffffff
+RANGES_EOF
+
+if ! diff -u "$WORK_DIR/expected" "$WORK_DIR/ranges"; then
+    echo "Ranges don't match the City fixture rows." >&2
+    exit 2
+fi
+
+# the manifest and the 6 files above, and nothing in subdirectories made of bad codes
+if [ "$(find "$WORK_DIR/out" -type f | wc -l)" -ne 7 ]; then
+    find "$WORK_DIR/out" >&2
+    echo "Files were written for skipped locations." >&2
+    exit 2
+fi
+
+# each subdivision has a city with two /24s, the second one after the /24s of all the others
+mkdir "$WORK_DIR/data" "$WORK_DIR/unlimited" "$WORK_DIR/limited" || exit 1
+head -n 1 "$FIXTURES_DIR/GeoLite2-City-Locations-en.csv" > "$WORK_DIR/data/GeoLite2-City-Locations-en.csv" || exit 1
+head -n 1 "$FIXTURES_DIR/GeoLite2-City-Blocks-IPv4.csv" > "$WORK_DIR/data/GeoLite2-City-Blocks-IPv4.csv" || exit 1
+awk -v num_subdivisions=$NUM_SUBDIVISIONS 'BEGIN {
+    for (i = 0; i < num_subdivisions; i++) {
+        printf "%d,en,EU,Europe,AA,Country AA,%d,Subdivision %d,,,City %d,,,0\n", 2000 + i, i, i, i
+    }
+}' >> "$WORK_DIR/data/GeoLite2-City-Locations-en.csv"
+awk -v num_subdivisions=$NUM_SUBDIVISIONS 'BEGIN {
+    for (i = 0; i < 2 * num_subdivisions; i++) {
+        printf "10.%d.%d.0/24,%d,100,,0,0,,,,\n", i / 256, i % 256, 2000 + i % num_subdivisions
+    }
+}' >> "$WORK_DIR/data/GeoLite2-City-Blocks-IPv4.csv"
+
+(cd "$WORK_DIR/data" && "$MM2XTGEOIP" -F -C -6 -d "$WORK_DIR/unlimited") || exit 1
+(ulimit -n $MAX_OPEN_FILES && cd "$WORK_DIR/data" && "$MM2XTGEOIP" -F -C -6 -d "$WORK_DIR/limited") || exit 1
+
+if [ "$(ls "$WORK_DIR/limited" | grep -c '^AA-.*\.iv4$')" -ne $NUM_SUBDIVISIONS ]; then
+    echo "Not every subdivision got a file under ulimit -n $MAX_OPEN_FILES." >&2
+    exit 2
+fi
+
+dump_ranges "$WORK_DIR/unlimited" > "$WORK_DIR/unlimited.ranges"
+dump_ranges "$WORK_DIR/limited" > "$WORK_DIR/limited.ranges"
+if ! cmp -s "$WORK_DIR/unlimited.ranges" "$WORK_DIR/limited.ranges"; then
+    echo "Ranges written under ulimit -n $MAX_OPEN_FILES differ." >&2
+    exit 2
+fi
+
+echo "City OK: $NUM_SUBDIVISIONS subdivisions written under ulimit -n $MAX_OPEN_FILES, bad codes skipped."
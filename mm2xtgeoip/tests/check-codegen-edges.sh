@@ -0,0 +1,64 @@
+#!/bin/sh
+
+# Checks the codegen output in the cases check-codegen.sh doesn't cover.
+# When every range of the fixtures is excluded, the tables are empty and
+# must still compile, with -pedantic, into lookups that find nothing. When
+# the IPv6 range file is broken, no geoip6 files may be left behind, while
+# the IPv4 ones are still written.
+#
+# Usage: check-codegen-edges.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or compile
+#     2 - The output doesn't match what's expected
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+CC="${CC:-cc}"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+printf '0.0.0.0/0\n::/0\n' > "$WORK_DIR/everything" || exit 1
+mkdir "$WORK_DIR/empty" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -o codegen -x "$WORK_DIR/everything" -d "$WORK_DIR/empty") || exit 1
+
+cat > "$WORK_DIR/empty.c" <<'CHECK_EOF'
+#include <stdio.h>
+#include "geoip4.h"
+#include "geoip6.h"
+
+int main(void) {
+    static const uint8_t addr6[16] = {0x20, 0x01, 0x0d, 0xb8};
+    
+    if (GEOIP4_NUM_RANGES != 0 || GEOIP6_NUM_RANGES != 0 || geoip4_lookup(0x01000000) != NULL || geoip6_lookup(addr6) != NULL) {
+        fputs("An empty table found an address.\n", stderr);
+        return 2;
+    }
+    
+    return 0;
+}
+CHECK_EOF
+
+"$CC" -std=c99 -pedantic -Wall -Werror -I"$WORK_DIR/empty" -o "$WORK_DIR/check" "$WORK_DIR/empty.c" \
+    "$WORK_DIR/empty/geoip4.c" "$WORK_DIR/empty/geoip6.c" || exit 1
+"$WORK_DIR/check" || exit 2
+
+mkdir "$WORK_DIR/broken" "$WORK_DIR/out" || exit 1
+cp "$FIXTURES_DIR"/*.csv "$WORK_DIR/broken" || exit 1
+echo "2001:dbc::/32" >> "$WORK_DIR/broken/GeoLite2-Country-Blocks-IPv6.csv"
+(cd "$WORK_DIR/broken" && "$MM2XTGEOIP" -F -o codegen -d "$WORK_DIR/out" 2> /dev/null)
+
+if [ -e "$WORK_DIR/out/geoip6.c" ] || [ -e "$WORK_DIR/out/geoip6.h" ]; then
+    echo "The files of a failed family were left behind." >&2
+    exit 2
+fi
+
+if [ ! -s "$WORK_DIR/out/geoip4.c" ] || [ ! -s "$WORK_DIR/out/geoip4.h" ]; then
+    echo "The files of the family that converted are missing." >&2
+    exit 2
+fi
+
+echo "Codegen edge cases OK."
@@ -0,0 +1,99 @@
+#!/bin/sh
+
+# Checks the lookup tables written by -o codegen against the xt_geoip
+# output of the same conversion. The GeoLite2 files in DATA_DIR are
+# converted to both formats at once, then the generated sources are
+# compiled into a program that looks up the first and last address of
+# every range in every CC.iv4 and CC.iv6 file and expects CC back.
+# The headers are also compiled as C++ when a C++ compiler is found.
+# Extra arguments are passed on to mm2xtgeoip.
+#
+# Usage: check-codegen.sh [DATA_DIR [MM2XTGEOIP_ARGUMENTS...]]
+#     Default: tests/fixtures
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or compile
+#     2 - A lookup returned the wrong country
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+
+DATA_DIR="${1:-$TESTS_DIR/fixtures}"
+[ $# -gt 0 ] && shift
+DATA_DIR="$(cd "$DATA_DIR" && pwd)" || exit 1
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/xt_geoip" "$WORK_DIR/codegen" || exit 1
+(cd "$DATA_DIR" && "$MM2XTGEOIP" -F -O xt_geoip:"$WORK_DIR/xt_geoip" -O codegen:"$WORK_DIR/codegen" "$@") || exit 1
+
+cat > "$WORK_DIR/check.c" <<'CHECK_EOF'
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "geoip4.h"
+#include "geoip6.h"
+
+//looks up an address read from an xt_geoip file, where addresses are in network byte order
+static const char *lookup(const uint8_t *addr, size_t addr_bytes) {
+    if (addr_bytes == 16) {
+        return geoip6_lookup(addr);
+    }
+    
+    return geoip4_lookup((uint32_t)addr[0] << 24 | (uint32_t)addr[1] << 16 | (uint32_t)addr[2] << 8 | addr[3]);
+}
+
+int main(int argc, char **argv) {
+    uint8_t range[32];
+    const char *base_name;
+    const char *found;
+    size_t addr_bytes;
+    unsigned long num_lookups = 0;
+    unsigned long num_wrong = 0;
+    FILE *in_file;
+    int i;
+    int j;
+    
+    for (i = 1; i < argc; i++) {
+        base_name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        addr_bytes = strstr(base_name, ".iv6") ? 16 : 4;
+        in_file = fopen(argv[i], "rb");
+        if (in_file == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        
+        while (fread(range, addr_bytes * 2, 1, in_file)) {
+            for (j = 0; j < 2; j++) {
+                found = lookup(range + j * addr_bytes, addr_bytes);
+                num_lookups++;
+                if (found == NULL || strncmp(found, base_name, 2) != 0) {
+                    if (num_wrong++ < 10) {
+                        fprintf(stderr, "%s: range %s found %s\n", base_name, j ? "end" : "start", found ? found : "nothing");
+                    }
+                }
+            }
+        }
+        
+        fclose(in_file);
+    }
+    
+    printf("%lu lookups, %lu wrong, %u IPv4 and %u IPv6 ranges in the tables\n", num_lookups, num_wrong,
+           (unsigned)GEOIP4_NUM_RANGES, (unsigned)GEOIP6_NUM_RANGES);
+    
+    return num_wrong ? 2 : 0;
+}
+CHECK_EOF
+
+"$CC" -O2 -Wall -Werror -I"$WORK_DIR/codegen" -o "$WORK_DIR/check" "$WORK_DIR/check.c" \
+    "$WORK_DIR/codegen/geoip4.c" "$WORK_DIR/codegen/geoip6.c" || exit 1
+
+if command -v "$CXX" > /dev/null; then
+    printf '#include "geoip4.h"\n#include "geoip6.h"\n' | "$CXX" -fsyntax-only -Wall -Werror -I"$WORK_DIR/codegen" -x c++ - || exit 1
+fi
+
+"$WORK_DIR/check" "$WORK_DIR"/xt_geoip/*.iv4 "$WORK_DIR"/xt_geoip/*.iv6
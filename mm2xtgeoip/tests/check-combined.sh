@@ -0,0 +1,83 @@
+#!/bin/sh
+
+# Checks which set -o combined writes and how it's matched. Allowing AA in
+# the fixtures takes fewer ranges than their complement, so the ranges are
+# written and matched as they are. In range files of its own, where most
+# of the address space is covered, forbidding AA takes fewer ranges as the
+# complement, which must be matched negated. IPv6 covering the whole space
+# there must give an empty set matched negated, and excluding all of AA's
+# addresses an empty set matched as it is.
+#
+# Usage: check-combined.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The sets or matches written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the match and the ranges of the combined set of each family written to a directory, one line per family
+dump_combined() {
+    if [ -e "$1/ZZ.match4" ]; then
+        od -An -tu1 -w8 -v "$1/ZZ.iv4" | awk -v match_line="$(cat "$1/ZZ.match4")" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print "ZZ.iv4 (" match_line ")" ranges }'
+    fi
+    
+    if [ -e "$1/ZZ.match6" ]; then
+        od -An -tx1 -w32 -v "$1/ZZ.iv6" | tr -d ' ' | awk -v match_line="$(cat "$1/ZZ.match6")" '
+            { ranges = ranges " " substr($0, 1, 32) "-" substr($0, 33, 32) }
+            END { print "ZZ.iv6 (" match_line ")" ranges }'
+    fi
+}
+
+# converts the files in a directory with the given options and compares the combined sets with the expected ones on stdin
+check_combined() {
+    data_dir="$1"
+    name="$2"
+    shift 2
+    
+    mkdir "$WORK_DIR/$name" || exit 1
+    (cd "$data_dir" && "$MM2XTGEOIP" -F -o combined "$@" -d "$WORK_DIR/$name") || exit 1
+    
+    cat > "$WORK_DIR/$name.expected"
+    dump_combined "$WORK_DIR/$name" > "$WORK_DIR/$name.sets"
+    if ! diff -u "$WORK_DIR/$name.expected" "$WORK_DIR/$name.sets"; then
+        echo "The combined sets of $* don't match the expected ones." >&2
+        exit 2
+    fi
+}
+
+check_combined "$FIXTURES_DIR" allowed -a AA <<'SETS_EOF'
+ZZ.iv4 (--src-cc ZZ) 1.0.0.0-1.0.1.255 1.0.8.0-1.0.8.255
+ZZ.iv6 (--src-cc ZZ) 20010db8000000000000000000000000-20010db9ffffffffffffffffffffffff
+SETS_EOF
+
+# BB and CC cover all of IPv4 but AA's 10.0.0.0/8 and 20.0.0.0/8, and CC all of IPv6
+mkdir "$WORK_DIR/data" || exit 1
+cp "$FIXTURES_DIR/GeoLite2-Country-Locations-en.csv" "$WORK_DIR/data/" || exit 1
+head -n 1 "$FIXTURES_DIR/GeoLite2-Country-Blocks-IPv4.csv" > "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv4.csv" || exit 1
+for row in 0.0.0.0/5,200 8.0.0.0/7,200 10.0.0.0/8,100 11.0.0.0/8,300 12.0.0.0/6,300 16.0.0.0/6,300 20.0.0.0/8,100 \
+           21.0.0.0/8,200 22.0.0.0/7,200 24.0.0.0/5,200 32.0.0.0/3,200 64.0.0.0/2,200 128.0.0.0/1,200; do
+    echo "$row,${row#*,},,0,0"
+done >> "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv4.csv"
+head -n 1 "$FIXTURES_DIR/GeoLite2-Country-Blocks-IPv6.csv" > "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv6.csv" || exit 1
+printf '::/1,300,300,,0,0\n8000::/1,300,300,,0,0\n' >> "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv6.csv"
+
+check_combined "$WORK_DIR/data" forbidden -f AA <<'SETS_EOF'
+ZZ.iv4 (! --src-cc ZZ) 10.0.0.0-10.255.255.255 20.0.0.0-20.255.255.255
+ZZ.iv6 (! --src-cc ZZ)
+SETS_EOF
+
+printf '10.0.0.0/8\n20.0.0.0/8\n' > "$WORK_DIR/excluded"
+check_combined "$WORK_DIR/data" empty -a AA -x "$WORK_DIR/excluded" -6 <<'SETS_EOF'
+ZZ.iv4 (--src-cc ZZ)
+SETS_EOF
+
+echo "Combined sets OK: ranges, complements, the empty set and the whole space matched."
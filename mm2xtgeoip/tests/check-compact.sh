@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Checks -k, -u and -m on an IPv4 range file of its own. With the built-in
+# list, AA's ranges on both sides of 198.18.0.0/15 merge. With a list of
+# its own, AA merges across one of its blocks, but not across a gap BB
+# holds part of, and the built-in list no longer applies. With -m 2, the
+# smallest gaps of each country are closed until it has 2 ranges, which
+# closes the gap BB holds part of too.
+#
+# Usage: check-compact.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The ranges written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the ranges of every non-empty IPv4 xt_geoip file in a directory, one line per file
+dump_ranges() {
+    for file in "$1"/*.iv4; do
+        [ -s "$file" ] || continue
+        od -An -tu1 -w8 -v "$file" | awk -v name="${file##*/}" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print name ranges }'
+    done
+}
+
+# converts the range file with the given options and compares the ranges with the expected ones on stdin
+check_compaction() {
+    name="$1"
+    shift
+    
+    mkdir "$WORK_DIR/$name" || exit 1
+    (cd "$WORK_DIR/data" && "$MM2XTGEOIP" -F -6 "$@" -d "$WORK_DIR/$name") || exit 1
+    
+    cat > "$WORK_DIR/$name.expected"
+    dump_ranges "$WORK_DIR/$name" > "$WORK_DIR/$name.ranges"
+    if ! diff -u "$WORK_DIR/$name.expected" "$WORK_DIR/$name.ranges"; then
+        echo "Ranges don't match the expected ones with $*." >&2
+        exit 2
+    fi
+}
+
+# AA's gaps: 5.0.1.0/24 (unroutable in the list below), 5.0.3.0-5.0.4.255 (BB, then unroutable),
+# 5.0.6.0-5.0.8.255 and 198.18.0.0/15 (unroutable in the built-in list)
+mkdir "$WORK_DIR/data" || exit 1
+cp "$FIXTURES_DIR/GeoLite2-Country-Locations-en.csv" "$WORK_DIR/data/" || exit 1
+head -n 1 "$FIXTURES_DIR/GeoLite2-Country-Blocks-IPv4.csv" > "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv4.csv" || exit 1
+for row in 5.0.0.0/24,100 5.0.2.0/24,100 5.0.3.0/24,200 5.0.5.0/24,100 5.0.9.0/24,100 \
+           20.0.0.0/24,200 20.0.4.0/24,200 198.17.255.0/24,100 198.20.0.0/24,100; do
+    echo "$row,${row#*,},,0,0"
+done >> "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv4.csv"
+printf '5.0.1.0/24\n5.0.4.0/24\n' > "$WORK_DIR/unroutable"
+
+check_compaction builtin -k <<'RANGES_EOF'
+AA.iv4 5.0.0.0-5.0.0.255 5.0.2.0-5.0.2.255 5.0.5.0-5.0.5.255 5.0.9.0-5.0.9.255 198.17.255.0-198.20.0.255
+BB.iv4 5.0.3.0-5.0.3.255 20.0.0.0-20.0.0.255 20.0.4.0-20.0.4.255
+RANGES_EOF
+
+check_compaction listed -u "$WORK_DIR/unroutable" <<'RANGES_EOF'
+AA.iv4 5.0.0.0-5.0.2.255 5.0.5.0-5.0.5.255 5.0.9.0-5.0.9.255 198.17.255.0-198.17.255.255 198.20.0.0-198.20.0.255
+BB.iv4 5.0.3.0-5.0.3.255 20.0.0.0-20.0.0.255 20.0.4.0-20.0.4.255
+RANGES_EOF
+
+check_compaction budget -u "$WORK_DIR/unroutable" -m 2 <<'RANGES_EOF'
+AA.iv4 5.0.0.0-5.0.9.255 198.17.255.0-198.20.0.255
+BB.iv4 5.0.3.0-5.0.3.255 20.0.0.0-20.0.4.255
+RANGES_EOF
+
+echo "Compaction OK: unroutable gaps merged, smallest gaps closed within the budget."
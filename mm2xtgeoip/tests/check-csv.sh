@@ -0,0 +1,77 @@
+#!/bin/sh
+
+# Converts the range files in tests/fixtures and checks which country each
+# row ends up in. The fixture rows cover geoname_id fallbacks, ids with
+# leading zeros and ids too large for an unsigned long, quoted fields and
+# quoted "0" and "1" flags in the proxy and satellite columns. A row with a
+# geoname_id reserved for the virtual countries must fail the conversion.
+#
+# Usage: check-csv.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The ranges written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the ranges of every non-empty xt_geoip file in a directory, one line per file
+dump_ranges() {
+    for file in "$1"/*.iv4; do
+        [ -s "$file" ] || continue
+        od -An -tu1 -w8 -v "$file" | awk -v name="${file##*/}" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print name ranges }'
+    done
+    
+    for file in "$1"/*.iv6; do
+        [ -s "$file" ] || continue
+        od -An -tx1 -w32 -v "$file" | tr -d ' ' | awk -v name="${file##*/}" '
+            { ranges = ranges " " substr($0, 1, 32) "-" substr($0, 33, 32) }
+            END { print name ranges }'
+    done
+}
+
+mkdir "$WORK_DIR/out" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -d "$WORK_DIR/out") || exit 1
+
+dump_ranges "$WORK_DIR/out" > "$WORK_DIR/ranges"
+cat > "$WORK_DIR/expected" <<'RANGES_EOF'
+A1.iv4 1.0.5.0-1.0.5.255
+A2.iv4 1.0.6.0-1.0.6.255
+AA.iv4 1.0.0.0-1.0.1.255 1.0.8.0-1.0.8.255
+AF.iv4 1.0.9.0-1.0.9.255
+BB.iv4 1.0.2.0-1.0.3.255
+CC.iv4 1.0.4.0-1.0.4.255
+O1.iv4 1.0.7.0-1.0.7.255 2.0.0.0-2.0.255.255
+A1.iv6 20010dbb000000000000000000000000-20010dbbffffffffffffffffffffffff
+AA.iv6 20010db8000000000000000000000000-20010db9ffffffffffffffffffffffff
+BB.iv6 20010dba000000000000000000000000-20010dbaffffffffffffffffffffffff
+RANGES_EOF
+
+if ! diff -u "$WORK_DIR/expected" "$WORK_DIR/ranges"; then
+    echo "Ranges don't match the fixture rows." >&2
+    exit 2
+fi
+
+# geoname_ids from ULONG_MAX - 3 up are taken by A1, A2 and O1
+cp "$FIXTURES_DIR"/*.csv "$WORK_DIR" || exit 1
+echo "3.0.0.0/24,18446744073709551612,100,,0,0" >> "$WORK_DIR/GeoLite2-Country-Blocks-IPv4.csv"
+mkdir "$WORK_DIR/reserved" || exit 1
+if (cd "$WORK_DIR" && "$MM2XTGEOIP" -F -6 -d "$WORK_DIR/reserved" 2> "$WORK_DIR/reserved.err"); then
+    echo "A reserved geoname_id was accepted." >&2
+    exit 2
+fi
+
+if ! grep -q "Reserved geoname_id" "$WORK_DIR/reserved.err"; then
+    cat "$WORK_DIR/reserved.err" >&2
+    echo "A reserved geoname_id failed for another reason." >&2
+    exit 2
+fi
+
+echo "CSV decoding OK."
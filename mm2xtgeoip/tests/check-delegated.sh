@@ -0,0 +1,96 @@
+#!/bin/sh
+
+# Checks how -g merges an RIR delegated file with the range files in
+# tests/fixtures. At priority 0 the range files win where both cover an
+# address, so the delegated file only fills in addresses they're missing.
+# At priority 1 it overrides them. Its records include an IPv4 count that
+# isn't a CIDR, straddling a range of the range files and a gap, a country
+# code missing from the country file, which goes to O1, and records that
+# must be skipped: an available block and an ASN.
+#
+# Usage: check-delegated.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The ranges written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the ranges of every non-empty xt_geoip file in a directory, one line per file
+dump_ranges() {
+    for file in "$1"/*.iv4; do
+        [ -s "$file" ] || continue
+        od -An -tu1 -w8 -v "$file" | awk -v name="${file##*/}" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print name ranges }'
+    done
+    
+    for file in "$1"/*.iv6; do
+        [ -s "$file" ] || continue
+        od -An -tx1 -w32 -v "$file" | tr -d ' ' | awk -v name="${file##*/}" '
+            { ranges = ranges " " substr($0, 1, 32) "-" substr($0, 33, 32) }
+            END { print name ranges }'
+    done
+}
+
+# converts the fixtures with the delegated file at a priority and compares the ranges with the expected ones on stdin
+check_priority() {
+    mkdir "$WORK_DIR/out$1" || exit 1
+    (cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -g "$WORK_DIR/delegated:$1" -d "$WORK_DIR/out$1") || exit 1
+    
+    cat > "$WORK_DIR/expected$1"
+    dump_ranges "$WORK_DIR/out$1" > "$WORK_DIR/ranges$1"
+    if ! diff -u "$WORK_DIR/expected$1" "$WORK_DIR/ranges$1"; then
+        echo "Ranges don't match the delegated file at priority $1." >&2
+        exit 2
+    fi
+}
+
+# 1.0.9.128 + 384 addresses ends at 1.0.10.255, and ZZ isn't in the country file
+cat > "$WORK_DIR/delegated" <<'DELEGATED_EOF'
+2|test|20260101|6|19700101|20260101|+0000
+test|*|ipv4|*|4|summary
+test|*|ipv6|*|1|summary
+test|CC|ipv4|1.0.0.0|256|20200101|allocated
+test|BB|ipv4|1.0.9.128|384|20200101|assigned
+test|ZZ|ipv4|1.0.11.0|256|20200101|allocated
+test||ipv4|1.0.12.0|256||available
+test|AA|asn|64512|1|20200101|assigned
+test|CC|ipv6|2001:dbc::|32|20200101|assigned
+DELEGATED_EOF
+
+check_priority 0 <<'RANGES_EOF'
+A1.iv4 1.0.5.0-1.0.5.255
+A2.iv4 1.0.6.0-1.0.6.255
+AA.iv4 1.0.0.0-1.0.1.255 1.0.8.0-1.0.8.255
+AF.iv4 1.0.9.0-1.0.9.255
+BB.iv4 1.0.2.0-1.0.3.255 1.0.10.0-1.0.10.255
+CC.iv4 1.0.4.0-1.0.4.255
+O1.iv4 1.0.7.0-1.0.7.255 1.0.11.0-1.0.11.255 2.0.0.0-2.0.255.255
+A1.iv6 20010dbb000000000000000000000000-20010dbbffffffffffffffffffffffff
+AA.iv6 20010db8000000000000000000000000-20010db9ffffffffffffffffffffffff
+BB.iv6 20010dba000000000000000000000000-20010dbaffffffffffffffffffffffff
+CC.iv6 20010dbc000000000000000000000000-20010dbcffffffffffffffffffffffff
+RANGES_EOF
+
+check_priority 1 <<'RANGES_EOF'
+A1.iv4 1.0.5.0-1.0.5.255
+A2.iv4 1.0.6.0-1.0.6.255
+AA.iv4 1.0.1.0-1.0.1.255 1.0.8.0-1.0.8.255
+AF.iv4 1.0.9.0-1.0.9.127
+BB.iv4 1.0.2.0-1.0.3.255 1.0.9.128-1.0.10.255
+CC.iv4 1.0.0.0-1.0.0.255 1.0.4.0-1.0.4.255
+O1.iv4 1.0.7.0-1.0.7.255 1.0.11.0-1.0.11.255 2.0.0.0-2.0.255.255
+A1.iv6 20010dbb000000000000000000000000-20010dbbffffffffffffffffffffffff
+AA.iv6 20010db8000000000000000000000000-20010db9ffffffffffffffffffffffff
+BB.iv6 20010dba000000000000000000000000-20010dbaffffffffffffffffffffffff
+CC.iv6 20010dbc000000000000000000000000-20010dbcffffffffffffffffffffffff
+RANGES_EOF
+
+echo "Delegated files OK: gaps filled at priority 0, ranges overridden at priority 1."
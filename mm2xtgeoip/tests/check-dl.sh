@@ -0,0 +1,121 @@
+#!/bin/sh
+
+# Checks mm2xtgeoip_dl against a local HTTP server standing in for MaxMind,
+# serving an archive of the fixtures and its checksum. The first run must
+# download and convert the archive, the second must get a 304 and leave the
+# state and the output alone, and a new archive whose checksum doesn't match
+# must be rejected without replacing the kept archive. Once the checksum is
+# fixed, the new archive must be converted.
+#
+# Usage: check-dl.sh
+#
+# Return values:
+#     0 - Success, or python3, curl, zip, unzip or sha256sum is missing
+#     1 - Unable to set up the server or the archive
+#     2 - mm2xtgeoip_dl didn't behave as expected
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+MM2XTGEOIP_DL="${MM2XTGEOIP_DL:-$TESTS_DIR/../mm2xtgeoip_dl}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+ARCHIVE_NAME="GeoLite2-Country-CSV.zip"
+
+for tool in python3 curl zip unzip sha256sum; do
+    if ! command -v "$tool" > /dev/null 2>&1; then
+        echo "Skipping the download checks: $tool not found."
+        exit 0
+    fi
+done
+
+MM2XTGEOIP="$(cd "$(dirname "$MM2XTGEOIP")" && pwd)/$(basename "$MM2XTGEOIP")"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+server_pid=""
+trap '[ -n "$server_pid" ] && kill "$server_pid"; rm -rf "$WORK_DIR"' EXIT
+
+# mm2xtgeoip_dl runs the mm2xtgeoip found in PATH
+mkdir "$WORK_DIR/bin" "$WORK_DIR/site" "$WORK_DIR/out" || exit 1
+ln -s "$MM2XTGEOIP" "$WORK_DIR/bin/mm2xtgeoip" || exit 1
+PATH="$WORK_DIR/bin:$PATH"
+export PATH
+
+# publishes an archive of the fixtures, with extra files if given, and its checksum,
+# dated a minute after the previous one so the server reports it as modified
+publish() {
+    mkdir "$WORK_DIR/archive" || return 1
+    cp "$FIXTURES_DIR"/*.csv "$@" "$WORK_DIR/archive/" || return 1
+    rm -f "$WORK_DIR/site/$ARCHIVE_NAME"
+    (cd "$WORK_DIR/archive" && zip -qr "$WORK_DIR/site/$ARCHIVE_NAME" .) || return 1
+    rm -rf "$WORK_DIR/archive"
+    
+    published=$(( ${published:-$(date +%s)} + 60 ))
+    touch -d "@$published" "$WORK_DIR/site/$ARCHIVE_NAME" || return 1
+    (cd "$WORK_DIR/site" && sha256sum "$ARCHIVE_NAME" > "$ARCHIVE_NAME.sha256") || return 1
+}
+
+# runs mm2xtgeoip_dl against the server, its return value in dl_status
+run_dl() {
+    MM2XTGEOIP_DL_URL="http://127.0.0.1:$port/$ARCHIVE_NAME" MM2XTGEOIP_DL_STATE_DIR="$WORK_DIR/state" \
+        sh "$MM2XTGEOIP_DL" -F -d "$WORK_DIR/out" 2> "$WORK_DIR/dl.err"
+    dl_status=$?
+}
+
+fail() {
+    echo "$1" >&2
+    cat "$WORK_DIR/dl.err" >&2
+    exit 2
+}
+
+publish || exit 1
+
+# python3 -m http.server can't bind to a free port and tell which one it got
+python3 -c '
+import functools, http.server, os, sys
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), functools.partial(http.server.SimpleHTTPRequestHandler, directory=sys.argv[1]))
+with open(sys.argv[2] + ".tmp", "w") as port_file:
+    port_file.write(str(server.server_address[1]))
+os.rename(sys.argv[2] + ".tmp", sys.argv[2])
+server.serve_forever()
+' "$WORK_DIR/site" "$WORK_DIR/port" 2> "$WORK_DIR/server.log" &
+server_pid=$!
+
+for i in $(seq 50); do
+    [ -f "$WORK_DIR/port" ] && break
+    sleep 0.1
+done
+port=$(cat "$WORK_DIR/port" 2> /dev/null) || { echo "The HTTP server didn't start." >&2; exit 1; }
+
+# 200: the archive is downloaded, checked and converted
+run_dl
+[ "$dl_status" -eq 0 ] || fail "The first download failed with $dl_status."
+[ -f "$WORK_DIR/out/AA.iv4" ] || fail "The first download wasn't converted."
+cmp -s "$WORK_DIR/state/archive.zip" "$WORK_DIR/site/$ARCHIVE_NAME" || fail "The downloaded archive wasn't kept."
+
+# 304: nothing is downloaded or converted
+cp "$WORK_DIR/state/archive.zip" "$WORK_DIR/kept.zip" || exit 1
+cp "$WORK_DIR/state/converted.sha256" "$WORK_DIR/kept.sha256" || exit 1
+rm -f "$WORK_DIR"/out/*
+run_dl
+[ "$dl_status" -eq 0 ] || fail "The unchanged download failed with $dl_status."
+tail -n 1 "$WORK_DIR/server.log" | grep -q '" 304 ' || fail "The server didn't answer the second request with a 304."
+[ -z "$(ls "$WORK_DIR/out")" ] || fail "An unchanged archive was converted again."
+cmp -s "$WORK_DIR/state/archive.zip" "$WORK_DIR/kept.zip" || fail "An unchanged archive replaced the kept one."
+
+# checksum mismatch: the new archive is rejected and the kept one stays
+echo "new" > "$WORK_DIR/README.txt"
+publish "$WORK_DIR/README.txt" || exit 1
+echo "0000000000000000000000000000000000000000000000000000000000000000  $ARCHIVE_NAME" > "$WORK_DIR/site/$ARCHIVE_NAME.sha256"
+run_dl
+[ "$dl_status" -eq 4 ] || fail "An archive with a wrong checksum returned $dl_status instead of 4."
+[ -z "$(ls "$WORK_DIR/out")" ] || fail "An archive with a wrong checksum was converted."
+cmp -s "$WORK_DIR/state/archive.zip" "$WORK_DIR/kept.zip" || fail "An archive with a wrong checksum replaced the kept one."
+cmp -s "$WORK_DIR/state/converted.sha256" "$WORK_DIR/kept.sha256" || fail "An archive with a wrong checksum was recorded as converted."
+
+# once the checksum is right, the same archive goes through
+(cd "$WORK_DIR/site" && sha256sum "$ARCHIVE_NAME" > "$ARCHIVE_NAME.sha256") || exit 1
+run_dl
+[ "$dl_status" -eq 0 ] || fail "The corrected download failed with $dl_status."
+[ -f "$WORK_DIR/out/AA.iv4" ] || fail "The corrected download wasn't converted."
+cmp -s "$WORK_DIR/state/archive.zip" "$WORK_DIR/site/$ARCHIVE_NAME" || fail "The corrected archive wasn't kept."
+
+echo "Download OK: 200, 304 and checksum mismatch handled."
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+# Checks lpm output against cidr output of the fixtures. Both are converted
+# from the same range files, and the entries mm2xtgeoip_lpmload prints from
+# each batch file must be the prefixes of the cidr files of that family,
+# each with the code of its country.
+#
+# Usage: check-lpm.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or load
+#     2 - The entries don't match the cidr output
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+LPMLOAD="${LPMLOAD:-$TESTS_DIR/../mm2xtgeoip_lpmload}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/lpm" "$WORK_DIR/cidr" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -o lpm -d "$WORK_DIR/lpm" && "$MM2XTGEOIP" -F -o cidr -d "$WORK_DIR/cidr") > /dev/null || exit 1
+
+for family in 4 6; do
+    "$LPMLOAD" -p "$WORK_DIR/lpm/geoip.lpm$family" > "$WORK_DIR/entries" || exit 1
+    
+    for cidr_file in "$WORK_DIR/cidr"/*.cidr$family; do
+        country_code="$(basename "$cidr_file" .cidr$family)"
+        sed "s/\$/ $country_code/" "$cidr_file"
+    done > "$WORK_DIR/expected"
+    
+    sort "$WORK_DIR/entries" > "$WORK_DIR/entries.sorted"
+    sort "$WORK_DIR/expected" > "$WORK_DIR/expected.sorted"
+    
+    if [ ! -s "$WORK_DIR/expected.sorted" ]; then
+        echo "The cidr output of IPv$family is empty." >&2
+        exit 1
+    fi
+    
+    if ! diff -u "$WORK_DIR/expected.sorted" "$WORK_DIR/entries.sorted"; then
+        echo "The IPv$family batch doesn't hold the prefixes of the cidr output." >&2
+        exit 2
+    fi
+done
+
+echo "LPM OK: both batches hold the prefixes of the cidr output."
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+# Checks that a conversion is only skipped while its output is intact. The
+# fixtures are converted to xt_geoip and cidr output at once, and a second
+# run with the same inputs and settings must do nothing. A file of the
+# first output that's removed, a file of the second output that's changed
+# and a changed input file must each make the next run convert again and
+# write the same files as the first time.
+#
+# Usage: check-manifest.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - A conversion was skipped or done when it shouldn't have been
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/data" "$WORK_DIR/xt" "$WORK_DIR/cidr" || exit 1
+cp "$FIXTURES_DIR"/*.csv "$WORK_DIR/data/" || exit 1
+
+# converts without -F, failing the check if it wasn't done or skipped as expected
+convert() {
+    (cd "$WORK_DIR/data" && "$MM2XTGEOIP" -v -O "xt_geoip:$WORK_DIR/xt" -O "cidr:$WORK_DIR/cidr") > "$WORK_DIR/convert.log" 2>&1 || exit 1
+    
+    if grep -q "unchanged since the last conversion" "$WORK_DIR/convert.log"; then
+        skipped=yes
+    else
+        skipped=no
+    fi
+    
+    if [ "$skipped" != "$1" ]; then
+        cat "$WORK_DIR/convert.log" >&2
+        echo "$2" >&2
+        exit 2
+    fi
+}
+
+convert no "The first conversion was skipped."
+cp -r "$WORK_DIR/xt" "$WORK_DIR/xt.first" && cp -r "$WORK_DIR/cidr" "$WORK_DIR/cidr.first" || exit 1
+convert yes "An unchanged conversion was done again."
+
+rm "$WORK_DIR/xt/AA.iv4" || exit 1
+convert no "A removed output file didn't make the next run convert again."
+cmp -s "$WORK_DIR/xt/AA.iv4" "$WORK_DIR/xt.first/AA.iv4" || { echo "A removed output file wasn't written again." >&2; exit 2; }
+convert yes "A restored output wasn't recognized."
+
+sed 's/1\.0\.8\.0/1.0.9.0/' "$WORK_DIR/cidr.first/AA.cidr4" > "$WORK_DIR/cidr/AA.cidr4" || exit 1
+convert no "A changed file of the second output didn't make the next run convert again."
+cmp -s "$WORK_DIR/cidr/AA.cidr4" "$WORK_DIR/cidr.first/AA.cidr4" || { echo "A changed output file wasn't written again." >&2; exit 2; }
+
+echo "1.0.10.0/24,100,100,,0,0" >> "$WORK_DIR/data/GeoLite2-Country-Blocks-IPv4.csv" || exit 1
+convert no "A changed input file didn't make the next run convert again."
+convert yes "An unchanged conversion was done again after an input changed."
+
+echo "Manifest OK: missing and changed outputs converted again."
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Checks -x and -i against the fixtures. The excluded CIDRs punch a hole
+# in the middle of one of AA's ranges, remove one of AA's IPv6 blocks and
+# all of BB's first block. The included CIDRs add a block to CC that
+# straddles the end of AA's range and the start of that BB block: AA keeps
+# its addresses, since an inclusion only adds to its country, and CC keeps
+# the part BB lost, since inclusions aren't excluded.
+#
+# Usage: check-overlay.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert
+#     2 - The ranges written don't match the expected ones
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the ranges of every non-empty xt_geoip file in a directory, one line per file
+dump_ranges() {
+    for file in "$1"/*.iv4; do
+        [ -s "$file" ] || continue
+        od -An -tu1 -w8 -v "$file" | awk -v name="${file##*/}" '
+            { ranges = ranges sprintf(" %s.%s.%s.%s-%s.%s.%s.%s", $1, $2, $3, $4, $5, $6, $7, $8) }
+            END { print name ranges }'
+    done
+    
+    for file in "$1"/*.iv6; do
+        [ -s "$file" ] || continue
+        od -An -tx1 -w32 -v "$file" | tr -d ' ' | awk -v name="${file##*/}" '
+            { ranges = ranges " " substr($0, 1, 32) "-" substr($0, 33, 32) }
+            END { print name ranges }'
+    done
+}
+
+printf '1.0.0.128/25\n2001:db9::/32\n1.0.2.0/24\n' > "$WORK_DIR/excluded"
+printf '1.0.1.128/25\n1.0.2.0/25\n' > "$WORK_DIR/included"
+
+mkdir "$WORK_DIR/out" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -x "$WORK_DIR/excluded" -i "$WORK_DIR/included:CC" -d "$WORK_DIR/out") || exit 1
+
+dump_ranges "$WORK_DIR/out" > "$WORK_DIR/ranges"
+cat > "$WORK_DIR/expected" <<'RANGES_EOF'
+A1.iv4 1.0.5.0-1.0.5.255
+A2.iv4 1.0.6.0-1.0.6.255
+AA.iv4 1.0.0.0-1.0.0.127 1.0.1.0-1.0.1.255 1.0.8.0-1.0.8.255
+AF.iv4 1.0.9.0-1.0.9.255
+BB.iv4 1.0.3.0-1.0.3.255
+CC.iv4 1.0.1.128-1.0.2.127 1.0.4.0-1.0.4.255
+O1.iv4 1.0.7.0-1.0.7.255 2.0.0.0-2.0.255.255
+A1.iv6 20010dbb000000000000000000000000-20010dbbffffffffffffffffffffffff
+AA.iv6 20010db8000000000000000000000000-20010db8ffffffffffffffffffffffff
+BB.iv6 20010dba000000000000000000000000-20010dbaffffffffffffffffffffffff
+RANGES_EOF
+
+if ! diff -u "$WORK_DIR/expected" "$WORK_DIR/ranges"; then
+    echo "Ranges don't match the overlays." >&2
+    exit 2
+fi
+
+echo "Overlays OK: excluded CIDRs punched out, included CIDRs added across ranges."
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Checks that a patch written by -D turns one generation of xt_geoip files
+# into the next. DATA_DIR is converted twice, allowing OLD_COUNTRIES and
+# then NEW_COUNTRIES, a patch is written between the two outputs and
+# applied to a copy of the old one, which must then match the new output
+# byte for byte. Applying the patch again must fail on the checksums and
+# leave the files alone. The size of the patch against the new output and
+# the time taken to apply it are shown.
+#
+# Usage: check-patch.sh [DATA_DIR OLD_COUNTRIES NEW_COUNTRIES]
+#     e.g. check-patch.sh /srv/geolite2 MV MV,LU
+#     Default: tests/fixtures AA AA,BB
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or write the patch
+#     2 - The patched files don't match, or a stale patch was applied
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+
+DATA_DIR="${1:-$TESTS_DIR/fixtures}"
+OLD_COUNTRIES="${2:-AA}"
+NEW_COUNTRIES="${3:-AA,BB}"
+DATA_DIR="$(cd "$DATA_DIR" && pwd)" || exit 1
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# compares the xt_geoip files of two directories, including which files there are
+same_files() {
+    (cd "$1" && ls -- *.iv4 *.iv6) > "$WORK_DIR/names1" 2> /dev/null
+    (cd "$2" && ls -- *.iv4 *.iv6) > "$WORK_DIR/names2" 2> /dev/null
+    cmp -s "$WORK_DIR/names1" "$WORK_DIR/names2" || return 1
+    
+    while read -r name; do
+        cmp -s "$1/$name" "$2/$name" || return 1
+    done < "$WORK_DIR/names1"
+}
+
+# prints the current time in milliseconds
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+mkdir "$WORK_DIR/old" "$WORK_DIR/new" || exit 1
+(cd "$DATA_DIR" && "$MM2XTGEOIP" -F -a "$OLD_COUNTRIES" -d "$WORK_DIR/old") || exit 1
+(cd "$DATA_DIR" && "$MM2XTGEOIP" -F -a "$NEW_COUNTRIES" -d "$WORK_DIR/new") || exit 1
+
+"$MM2XTGEOIP" -D "$WORK_DIR/old" -d "$WORK_DIR/new" > "$WORK_DIR/patch" || exit 1
+
+cp -R "$WORK_DIR/old" "$WORK_DIR/patched" || exit 1
+start=$(now_ms)
+"$MM2XTGEOIP" -P "$WORK_DIR/patch" -d "$WORK_DIR/patched" || { echo "Unable to apply the patch." >&2; exit 2; }
+end=$(now_ms)
+
+if ! same_files "$WORK_DIR/patched" "$WORK_DIR/new"; then
+    echo "The patched files don't match the new output." >&2
+    exit 2
+fi
+
+# the old checksums no longer match, so nothing may be written
+if "$MM2XTGEOIP" -P "$WORK_DIR/patch" -d "$WORK_DIR/patched" 2> /dev/null; then
+    echo "A patch was applied twice." >&2
+    exit 2
+fi
+
+if ! same_files "$WORK_DIR/patched" "$WORK_DIR/new"; then
+    echo "A rejected patch changed the files." >&2
+    exit 2
+fi
+
+patch_size=$(wc -c < "$WORK_DIR/patch")
+new_size=$(cat "$WORK_DIR"/new/*.iv4 "$WORK_DIR"/new/*.iv6 | wc -c)
+echo "Patch OK: $patch_size bytes for $new_size bytes of new output, applied in $(( end - start )) ms."
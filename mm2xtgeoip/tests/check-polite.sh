@@ -0,0 +1,71 @@
+#!/bin/sh
+
+# Measures how much of the page cache a conversion takes, with and without
+# polite mode. The GeoLite2 files in DATA_DIR are evicted from the page
+# cache before each conversion, then the cached bytes of the input and
+# output files are counted with fincore, along with the growth of Cached
+# in /proc/meminfo, which includes everything else on the system.
+# Extra arguments are passed on to mm2xtgeoip; polite runs use -p -R 0 so
+# that only the page cache handling differs.
+#
+# Without fincore, the check is skipped.
+#
+# Usage: check-polite.sh [DATA_DIR [MM2XTGEOIP_ARGUMENTS...]]
+#     Default: tests/fixtures
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or measure
+#     2 - Polite mode left as much of the files cached as a normal conversion
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+
+DATA_DIR="${1:-$TESTS_DIR/fixtures}"
+[ $# -gt 0 ] && shift
+DATA_DIR="$(cd "$DATA_DIR" && pwd)" || exit 1
+
+if ! command -v fincore > /dev/null; then
+    echo "Polite mode check skipped: fincore not found."
+    exit 0
+fi
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# prints the kilobytes counted as Cached by the kernel
+cached_kb() {
+    awk '$1 == "Cached:" { print $2 }' /proc/meminfo
+}
+
+# prints the bytes of the given files that are in the page cache
+resident_bytes() {
+    fincore --bytes --noheadings --output RES "$@" | awk '{ total += $1 } END { print total + 0 }'
+}
+
+# converts with the given extra arguments, printing cached input and output bytes and the growth of Cached
+measure() {
+    rm -rf "$WORK_DIR/out" && mkdir "$WORK_DIR/out" || return 1
+    
+    for file in "$DATA_DIR"/*.csv; do
+        dd if="$file" iflag=nocache count=0 status=none || return 1
+    done
+    
+    before=$(cached_kb)
+    (cd "$DATA_DIR" && "$MM2XTGEOIP" -F -d "$WORK_DIR/out" "$@") || return 1
+    after=$(cached_kb)
+    
+    echo "$(resident_bytes "$DATA_DIR"/*.csv) $(resident_bytes "$WORK_DIR"/out/*) $(( (after - before) * 1024 ))"
+}
+
+normal=$(measure "$@") || exit 1
+polite=$(measure "$@" -p -R 0) || exit 1
+
+printf "%-8s %14s %14s %14s\n" "mode" "input_cached" "output_cached" "cached_growth"
+echo "normal $normal" | awk '{ printf "%-8s %14d %14d %14d\n", $1, $2, $3, $4 }'
+echo "polite $polite" | awk '{ printf "%-8s %14d %14d %14d\n", $1, $2, $3, $4 }'
+
+normal_files=$(echo "$normal" | awk '{ print $1 + $2 }')
+polite_files=$(echo "$polite" | awk '{ print $1 + $2 }')
+[ "$polite_files" -lt "$normal_files" ] || exit 2
+exit 0
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+# Checks -S against the xt_geoip files of the fixtures. A weighted sample is
+# replayed through a rule matching the virtual country A1 and an inverted
+# rule on O1, given in lowercase, and the share of packets each rule
+# matches must follow from the sample. A rule with a code that isn't two
+# letters or digits must be rejected.
+#
+# Usage: check-simulate.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to convert or simulate
+#     2 - The report doesn't match the sample
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+
+WORK_DIR="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+mkdir "$WORK_DIR/out" || exit 1
+(cd "$FIXTURES_DIR" && "$MM2XTGEOIP" -F -d "$WORK_DIR/out") || exit 1
+
+# 10 packets to AA, 2 to A1, 3 and 1 to O1, 4 to AA over IPv6 and 1 to an address in no file
+cat > "$WORK_DIR/sample" <<'SAMPLE_EOF'
+1.0.0.1 10
+1.0.7.5 3
+2.0.1.1
+1.0.5.1 2
+2001:db8::1 4
+9.9.9.9
+SAMPLE_EOF
+
+"$MM2XTGEOIP" -S "$WORK_DIR/sample" -d "$WORK_DIR/out" -s A1 -s '!o1' > "$WORK_DIR/report" || exit 1
+
+# the first line, and each rule's match and share of packets
+sed -n '1p' "$WORK_DIR/report" > "$WORK_DIR/matches"
+awk '/^rule/ { rules = 1; next } rules && $1 ~ /^[0-9]+$/ { print $1, $2 == "!" ? "! " $3 : $2, $2 == "!" ? $4 : $3 }' "$WORK_DIR/report" >> "$WORK_DIR/matches"
+cat > "$WORK_DIR/expected" <<'MATCHES_EOF'
+6 addresses, 21 packets, 19.05% matched by no rule
+1 src-cc 9.52
+2 ! src-cc 71.43
+MATCHES_EOF
+
+if ! diff -u "$WORK_DIR/expected" "$WORK_DIR/matches"; then
+    cat "$WORK_DIR/report" >&2
+    echo "The rules didn't match the packets of the sample." >&2
+    exit 2
+fi
+
+if "$MM2XTGEOIP" -S "$WORK_DIR/sample" -d "$WORK_DIR/out" -s 'A/' > /dev/null 2>&1; then
+    echo "A rule with an invalid country code was accepted." >&2
+    exit 2
+fi
+
+echo "Simulation OK: virtual countries and inverted rules matched."
@@ -0,0 +1,92 @@
+#!/bin/sh
+
+# Checks that --watch converts again when any input file is replaced, not
+# only the country and range files. The fixtures are converted with a file
+# of CIDRs to exclude, which is then replaced and must change the output.
+# The country file is then replaced by one that can't be read, which must
+# remove the manifest but leave the last good country table in use, so a
+# changed range file is still converted. A good country file brings the
+# manifest back. Each step waits for the debounce interval of --watch.
+#
+# Usage: check-watch.sh
+#
+# Return values:
+#     0 - Success
+#     1 - Unable to set up the files or start mm2xtgeoip
+#     2 - The output didn't follow the input files
+
+TESTS_DIR="$(cd "$(dirname "$0")" && pwd)"
+MM2XTGEOIP="${MM2XTGEOIP:-$TESTS_DIR/../mm2xtgeoip}"
+FIXTURES_DIR="$TESTS_DIR/fixtures"
+TIMEOUT=15
+
+WORK_DIR="$(mktemp -d)" || exit 1
+watch_pid=""
+trap '[ -n "$watch_pid" ] && kill "$watch_pid"; rm -rf "$WORK_DIR"' EXIT
+
+DATA_DIR="$WORK_DIR/data"
+OUT_DIR="$WORK_DIR/out"
+mkdir "$DATA_DIR" "$OUT_DIR" || exit 1
+cp "$FIXTURES_DIR"/*.csv "$DATA_DIR/" || exit 1
+
+# replaces a file atomically, as updates are expected to be made, with the standard input
+replace() {
+    cat > "$1.tmp" && mv -f "$1.tmp" "$1"
+}
+
+# waits for a shell condition to hold, failing with a message if it doesn't in time
+wait_for() {
+    deadline=$(( $(date +%s) + TIMEOUT ))
+    
+    until eval "$1"; do
+        if [ "$(date +%s)" -ge "$deadline" ]; then
+            echo "$2" >&2
+            cat "$WORK_DIR/watch.log" >&2
+            exit 2
+        fi
+        
+        sleep 0.2
+    done
+}
+
+# AA has 1.0.0.0/23 and 1.0.8.0/24, each range taking 8 bytes
+aa_size() {
+    if [ -f "$OUT_DIR/AA.iv4" ]; then
+        wc -c < "$OUT_DIR/AA.iv4"
+    else
+        echo 0
+    fi
+}
+
+echo "1.0.8.0/24" | replace "$DATA_DIR/exclude" || exit 1
+
+(cd "$DATA_DIR" && exec "$MM2XTGEOIP" -F -w -x exclude -d "$OUT_DIR") > "$WORK_DIR/watch.log" 2>&1 &
+watch_pid=$!
+
+wait_for '[ -f "$OUT_DIR/.mm2xtgeoip_manifest" ] && [ "$(aa_size)" -eq 8 ]' "The first conversion didn't exclude 1.0.8.0/24."
+
+# a replaced overlay is read again
+echo "1.0.0.0/24" | replace "$DATA_DIR/exclude" || exit 1
+wait_for '[ "$(aa_size)" -eq 16 ]' "A replaced file of CIDRs to exclude wasn't read again."
+
+# a country file that can't be read removes the manifest
+echo "broken" | replace "$DATA_DIR/GeoLite2-Country-Locations-en.csv" || exit 1
+wait_for '[ ! -f "$OUT_DIR/.mm2xtgeoip_manifest" ]' "A broken country file left the manifest in place."
+
+# the last good countries still convert a changed range file
+(cat "$FIXTURES_DIR/GeoLite2-Country-Blocks-IPv4.csv" && echo "1.0.10.0/24,100,100,,0,0") | replace "$DATA_DIR/GeoLite2-Country-Blocks-IPv4.csv" || exit 1
+wait_for '[ "$(aa_size)" -eq 24 ]' "A changed range file wasn't converted with the last good countries."
+
+if [ -f "$OUT_DIR/.mm2xtgeoip_manifest" ]; then
+    echo "A manifest was written while the country file was broken." >&2
+    exit 2
+fi
+
+# a good country file brings the manifest back
+replace "$DATA_DIR/GeoLite2-Country-Locations-en.csv" < "$FIXTURES_DIR/GeoLite2-Country-Locations-en.csv" || exit 1
+wait_for '[ -f "$OUT_DIR/.mm2xtgeoip_manifest" ] && [ "$(aa_size)" -eq 24 ]' "A fixed country file didn't bring the manifest back."
+
+kill "$watch_pid" 2> /dev/null
+watch_pid=""
+
+echo "Watch OK: overlays and range files followed, last good countries kept."
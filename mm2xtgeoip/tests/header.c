@@ -0,0 +1,10 @@
+//includes nothing but the installed header, so any type it uses without including its header fails to compile
+#include "../libmm2xtgeoip.h"
+
+//takes the address of the functions whose parameters use types from system headers
+void *header_functions[] = {
+    (void *)geoip_diff_directories,
+    (void *)geoip_apply_patch,
+    (void *)geoip_process_range_outputs,
+    (void *)geoip_simulate
+};
@@ -0,0 +1,288 @@
+//converts a database in several threads at once, each with its own context, in every output format,
+//and checks that each thread writes the same files, byte for byte, as a conversion done on its own
+//make check-threads also runs it built with -fsanitize=thread, which reports any data race between the contexts
+//usage: threads [NUM_THREADS [DATA_DIR]], by default 8 threads over tests/fixtures
+//returns 0 on success, 1 if a conversion failed and 2 if a thread's files differ
+//nftw's flags
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "../libmm2xtgeoip.h"
+
+#define DEFAULT_NUM_THREADS 8
+#define MAX_THREADS 256
+#define MAX_PATH 4096
+#define MAX_ERR_MSG 256
+#define COMPARE_BUF_SIZE 65536
+#define DEFAULT_DATA_DIR "tests/fixtures"
+#define COUNTRY_FILE_NAME "GeoLite2-Country-Locations-en.csv"
+#define IPV4_FILE_NAME "GeoLite2-Country-Blocks-IPv4.csv"
+#define IPV6_FILE_NAME "GeoLite2-Country-Blocks-IPv6.csv"
+
+//one conversion, written to one subdirectory of directory per output format
+typedef struct Conversion {
+    pthread_t thread;
+    char *data_dir;
+    char directory[MAX_PATH];
+    char err_msg[MAX_ERR_MSG];
+} Conversion;
+
+//a conversion that failed has its error message set
+static void *convert(void *arg) {
+    Conversion *conversion = arg;
+    GeoipContext *ctx;
+    GeoipOutput outputs[GEOIP_NUM_FORMATS];
+    char directories[GEOIP_NUM_FORMATS][MAX_PATH];
+    char file_name[MAX_PATH];
+    int i;
+    
+    ctx = geoip_new_context();
+    if (ctx == NULL) {
+        snprintf(conversion->err_msg, MAX_ERR_MSG, "Unable to allocate a context.");
+        return NULL;
+    }
+    
+    for (i = 0; i < GEOIP_NUM_FORMATS; i++) {
+        snprintf(directories[i], MAX_PATH, "%s/%s", conversion->directory, geoip_format_name(i));
+        if (mkdir(directories[i], 0755) != 0) {
+            snprintf(conversion->err_msg, MAX_ERR_MSG, "Unable to create %s.", directories[i]);
+            goto end;
+        }
+        
+        outputs[i].format = i;
+        outputs[i].directory = directories[i];
+    }
+    
+    snprintf(file_name, MAX_PATH, "%s/%s", conversion->data_dir, COUNTRY_FILE_NAME);
+    if (!geoip_read_country_file(ctx, file_name)) {
+        snprintf(conversion->err_msg, MAX_ERR_MSG, "Unable to process the country file: %s", geoip_error(ctx));
+        goto end;
+    }
+    
+    geoip_add_virtual_countries(ctx);
+    
+    snprintf(file_name, MAX_PATH, "%s/%s", conversion->data_dir, IPV4_FILE_NAME);
+    if (!geoip_process_range_outputs(ctx, file_name, AF_INET, outputs, GEOIP_NUM_FORMATS)) {
+        snprintf(conversion->err_msg, MAX_ERR_MSG, "Unable to process the IPv4 range file: %s", geoip_error(ctx));
+        goto end;
+    }
+    
+    snprintf(file_name, MAX_PATH, "%s/%s", conversion->data_dir, IPV6_FILE_NAME);
+    if (!geoip_process_range_outputs(ctx, file_name, AF_INET6, outputs, GEOIP_NUM_FORMATS)) {
+        snprintf(conversion->err_msg, MAX_ERR_MSG, "Unable to process the IPv6 range file: %s", geoip_error(ctx));
+        goto end;
+    }
+    
+    end:
+    geoip_free_context(ctx);
+    
+    return NULL;
+}
+
+static bool same_file(char *file_name1, char *file_name2) {
+    static char buf1[COMPARE_BUF_SIZE];
+    static char buf2[COMPARE_BUF_SIZE];
+    FILE *file1;
+    FILE *file2;
+    size_t len1;
+    size_t len2;
+    bool same = false;
+    
+    file1 = fopen(file_name1, "rb");
+    file2 = fopen(file_name2, "rb");
+    if (file1 == NULL || file2 == NULL) {
+        goto end;
+    }
+    
+    do {
+        len1 = fread(buf1, 1, COMPARE_BUF_SIZE, file1);
+        len2 = fread(buf2, 1, COMPARE_BUF_SIZE, file2);
+        if (len1 != len2 || memcmp(buf1, buf2, len1) != 0) {
+            goto end;
+        }
+    } while (len1);
+    
+    same = !ferror(file1) && !ferror(file2);
+    
+    end:
+    if (file1 != NULL) {
+        fclose(file1);
+    }
+    if (file2 != NULL) {
+        fclose(file2);
+    }
+    
+    return same;
+}
+
+static unsigned count_files(char *directory) {
+    DIR *dir;
+    struct dirent *entry;
+    unsigned num_files = 0;
+    
+    dir = opendir(directory);
+    if (dir == NULL) {
+        return 0;
+    }
+    
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            num_files++;
+        }
+    }
+    
+    closedir(dir);
+    
+    return num_files;
+}
+
+//checks that both directories hold the same files with the same contents
+//the name of the first file that differs is written to differing
+static bool same_directory(char *directory1, char *directory2, char *differing) {
+    DIR *dir;
+    struct dirent *entry;
+    char file_name1[MAX_PATH];
+    char file_name2[MAX_PATH];
+    bool same = true;
+    
+    strcpy(differing, directory2);
+    
+    dir = opendir(directory1);
+    if (dir == NULL || count_files(directory1) != count_files(directory2)) {
+        same = false;
+        goto end;
+    }
+    
+    while (same && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        
+        snprintf(file_name1, MAX_PATH, "%s/%s", directory1, entry->d_name);
+        snprintf(file_name2, MAX_PATH, "%s/%s", directory2, entry->d_name);
+        if (!same_file(file_name1, file_name2)) {
+            strcpy(differing, file_name2);
+            same = false;
+        }
+    }
+    
+    end:
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    
+    return same;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    static Conversion conversions[MAX_THREADS];
+    Conversion reference;
+    char work_dir[] = "/tmp/mm2xtgeoip-threads-XXXXXX";
+    char directory1[MAX_PATH];
+    char directory2[MAX_PATH];
+    char differing[MAX_PATH];
+    unsigned num_threads = DEFAULT_NUM_THREADS;
+    char *data_dir = DEFAULT_DATA_DIR;
+    unsigned num_failed = 0;
+    unsigned num_differing = 0;
+    int ret = 0;
+    unsigned i;
+    int format;
+    
+    if (argc > 1) {
+        num_threads = strtoul(argv[1], NULL, 10);
+        if (num_threads < 1 || num_threads > MAX_THREADS) {
+            fprintf(stderr, "The number of threads must be between 1 and %d.\n", MAX_THREADS);
+            return 1;
+        }
+    }
+    
+    if (argc > 2) {
+        data_dir = argv[2];
+    }
+    
+    if (mkdtemp(work_dir) == NULL) {
+        perror("Unable to create the work directory");
+        return 1;
+    }
+    
+    //the reference conversion runs alone
+    memset(&reference, 0, sizeof(Conversion));
+    reference.data_dir = data_dir;
+    snprintf(reference.directory, MAX_PATH, "%s/reference", work_dir);
+    if (mkdir(reference.directory, 0755) != 0) {
+        perror("Unable to create the reference directory");
+        ret = 1;
+        goto end;
+    }
+    
+    convert(&reference);
+    if (reference.err_msg[0]) {
+        fprintf(stderr, "%s\n", reference.err_msg);
+        ret = 1;
+        goto end;
+    }
+    
+    for (i = 0; i < num_threads; i++) {
+        conversions[i].data_dir = data_dir;
+        snprintf(conversions[i].directory, MAX_PATH, "%s/%u", work_dir, i);
+        if (mkdir(conversions[i].directory, 0755) != 0 || pthread_create(&conversions[i].thread, NULL, convert, &conversions[i]) != 0) {
+            fprintf(stderr, "Unable to start thread %u.\n", i);
+            num_threads = i;
+            ret = 1;
+            break;
+        }
+    }
+    
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(conversions[i].thread, NULL);
+    }
+    
+    if (ret) {
+        goto end;
+    }
+    
+    for (i = 0; i < num_threads; i++) {
+        if (conversions[i].err_msg[0]) {
+            fprintf(stderr, "Thread %u: %s\n", i, conversions[i].err_msg);
+            num_failed++;
+            continue;
+        }
+        
+        for (format = 0; format < GEOIP_NUM_FORMATS; format++) {
+            snprintf(directory1, MAX_PATH, "%s/%s", reference.directory, geoip_format_name(format));
+            snprintf(directory2, MAX_PATH, "%s/%s", conversions[i].directory, geoip_format_name(format));
+            if (!same_directory(directory1, directory2, differing)) {
+                fprintf(stderr, "Thread %u: %s differs from the reference.\n", i, differing);
+                num_differing++;
+                break;
+            }
+        }
+    }
+    
+    if (num_failed) {
+        ret = 1;
+    } else if (num_differing) {
+        ret = 2;
+    } else {
+        printf("%u threads wrote the same files as a single conversion in %d formats.\n", num_threads, GEOIP_NUM_FORMATS);
+    }
+    
+    end:
+    nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    
+    return ret;
+}